@@ -11,27 +11,212 @@
 
 #include "BQ27621.h"
 
-BQ27621::BQ27621(I2C_device &i2cDevice) : _i2c_device(i2cDevice), _i2c_address(BQ27621_I2C_ADDRESS), _seal_flag(false), _userConfigControl(false)
+BQ27621::BQ27621(I2C_device &i2cDevice, uint8_t i2cAddress) : BQ27621(i2cDevice, BQ27621BusPath(), i2cAddress)
 {
 }
 
+/**
+ * @brief Gauge behind one or more muxes. The bus must route selectPath() (see BQ27621MuxI2C).
+ *
+ * @param i2cDevice Bus the first mux of busPath sits on
+ * @param busPath Mux channels leading to the gauge
+ * @param i2cAddress Gauge address on its segment
+ */
+BQ27621::BQ27621(I2C_device &i2cDevice, const BQ27621BusPath &busPath, uint8_t i2cAddress) : _i2c_device(i2cDevice), _i2c_address(i2cAddress), _busPath(busPath), _seal_flag(false), _userConfigControl(false), _configMode(false), _itporSeen(false), _blockCacheClock(0), _statusMaxAge(0), _retryPolicy(defaultRetryPolicy()), _retryStats()
+{
+    invalidateBlockCache();
+    invalidateStatus();
+#if BQ27621_INSTRUMENTATION
+    _instrumentControl = 0;
+    _instrumentClass = 0;
+#endif
+}
+
 BQ27621::~BQ27621()
 {
 }
 
 /**
- * @brief
+ * @brief Writes a Control() subcommand and reads back its 2-byte result in one combined transfer.
+ * Blocking wrapper of startReadControlWord().
+ *
+ * @param function Control subcommand (ControlSubCommands)
+ * @param word Pointer to uint16_t that will hold the control word value
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::readControlWord(uint16_t function, uint16_t *word)
+{
+    BQ27621Operation op;
+    startReadControlWord(&op, function, word);
+    return run(&op);
+}
+
+/**
+ * @brief Writes a Control() subcommand that returns no data
+ *
+ * @param function Control subcommand (ControlSubCommands)
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::executeControlWord(uint16_t function)
+{
+    uint8_t subCommand[2] = {(uint8_t)(function & 0xFF), (uint8_t)(function >> 8)};
+    return writeBytes(COMMAND_CONTROL, subCommand, sizeof(subCommand));
+}
+
+/**
+ * @brief Policy used until setRetryPolicy() is called, from the BQ27621_RETRY_* macros
+ *
+ * @return BQ27621RetryPolicy
+ */
+BQ27621RetryPolicy BQ27621::defaultRetryPolicy(void)
+{
+    BQ27621RetryPolicy policy;
+    policy.maxAttempts = BQ27621_RETRY_ATTEMPTS;
+    policy.backoffMicros = BQ27621_RETRY_BACKOFF_US;
+    policy.maxBackoffMicros = BQ27621_RETRY_MAX_BACKOFF_US;
+    policy.operationBudget = BQ27621_OPERATION_BUDGET_US;
+    return policy;
+}
+
+/**
+ * @brief Errors that may go away by themselves: the gauge was busy or the bus was in use
+ *
+ */
+bool BQ27621::retryable(BQ27621_error_code result)
+{
+    return result == NACK_RECEIVED || result == BUS_BUSY;
+}
+
+/**
+ * @brief Whether a transfer may be sent again after a failure. Reads, register writes and block writes
+ * (select, data and checksum together) leave the same state when repeated; the reset and exit subcommands
+ * may already have run.
+ *
+ * @param messages Pointer to message array
+ * @param count Number of messages
+ * @return true if it is safe to repeat
+ */
+bool BQ27621::repeatable(const I2C_message *messages, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const I2C_message &message = messages[i];
+        if ((message.flags & I2C_MSG_READ) || message.len < 3 || message.data[0] != COMMAND_CONTROL)
+            continue;
+        uint16_t function = (uint16_t)(message.data[1] | (message.data[2] << 8));
+        if (function == RESET || function == SOFT_RESET || function == EXIT_CFGUPDATE || function == EXIT_RESIM)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Delay before retry number attempt (1 for the first retry)
+ *
+ */
+uint32_t BQ27621::backoff(uint8_t attempt) const
+{
+    uint32_t delay = _retryPolicy.backoffMicros;
+    for (uint8_t i = 1; i < attempt && delay < _retryPolicy.maxBackoffMicros; i++)
+        delay <<= 1;
+    return (delay < _retryPolicy.maxBackoffMicros) ? delay : _retryPolicy.maxBackoffMicros;
+}
+
+/**
+ * @brief Slow path of transfer(): repeats a failed blocking transfer with exponential backoff while the policy
+ * allows it. A retry that would end its backoff past operationBudget is not made.
+ *
+ * @param messages Pointer to message array
+ * @param count Number of messages
+ * @param result Result of the first attempt
+ * @return BQ27621_error_code TIMEOUT_ERROR once the budget is spent
+ */
+BQ27621_error_code BQ27621::retryTransfer(I2C_message *messages, size_t count, BQ27621_error_code result)
+{
+    if (!retryable(result))
+        return result;
+    if (!repeatable(messages, count))
+    {
+        _retryStats.exhausted++;
+        return result;
+    }
+
+    uint32_t start = _i2c_device.micros();
+    for (uint8_t attempt = 1; attempt < _retryPolicy.maxAttempts; attempt++)
+    {
+        uint32_t delay = backoff(attempt);
+        if (_retryPolicy.operationBudget != 0 && (uint32_t)(_i2c_device.micros() - start) + delay > _retryPolicy.operationBudget)
+        {
+            _retryStats.timeouts++;
+            return TIMEOUT_ERROR;
+        }
+        _i2c_device.delayMicros(delay);
+        _retryStats.retries++;
+        result = transferOnce(messages, count);
+        if (result == OK)
+        {
+            _retryStats.recovered++;
+            return OK;
+        }
+        if (!retryable(result))
+            return result;
+    }
+    _retryStats.exhausted++;
+    return result;
+}
+
+/**
+ * @brief Reads len consecutive bytes starting at subAddress. The gauge auto-increments the
+ * register pointer, so the whole range costs a single I2C transaction. Blocking wrapper of startReadBytes().
+ *
+ * @param subAddress First register to read
+ * @param data Pointer to buffer of at least len bytes
+ * @param len Number of bytes to read
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::readBytes(uint8_t subAddress, uint8_t *data, size_t len)
+{
+    BQ27621Operation op;
+    startReadBytes(&op, subAddress, data, len);
+    return run(&op);
+}
+
+/**
+ * @brief Writes len consecutive bytes starting at subAddress in a single transaction
  *
- * @param word Which control word to read
- * @param function Pointer to uint16_t that will hold the control word value
+ * @param subAddress First register to write
+ * @param data Pointer to bytes to write
+ * @param len Number of bytes (at most BQ27621_MAX_WRITE)
  * @return BQ27621_error_code
  */
-BQ27621_error_code BQ27621::readControlWord(uint16_t word, uint16_t *function)
+BQ27621_error_code BQ27621::writeBytes(uint8_t subAddress, const uint8_t *data, size_t len)
 {
-    uint16_t swapped_function = byte_swap(*function);
+    if (len > BQ27621_MAX_WRITE)
+        return BUS_ERROR;
+
+    uint8_t buffer[BQ27621_MAX_WRITE + 1];
+    buffer[0] = subAddress;
+    for (size_t i = 0; i < len; i++)
+        buffer[i + 1] = data[i];
+    I2C_message message = {_i2c_address, I2C_MSG_WRITE, (uint16_t)(len + 1), buffer};
+    return transfer(&message, 1);
+}
 
-    // TODO I2c write bytes address = CONTROL, data = swapped, len = 2
-    // TODO I2C read bytes address = CONTROL, data = swapped, len = 2
+/**
+ * @brief Reads a 2-byte standard command (little-endian on the bus)
+ *
+ * @param subAdress Command code
+ * @param word Pointer to uint16_t that will hold the register value
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::readWord(uint16_t subAdress, uint16_t *word)
+{
+    uint8_t data[2];
+    BQ27621_error_code retVal = readBytes((uint8_t)subAdress, data, sizeof(data));
+    if (retVal != OK)
+        return retVal;
+    *word = decodeWord(data);
+    return OK;
 }
 
 BQ27621_error_code BQ27621::init()
@@ -39,7 +224,6 @@ BQ27621_error_code BQ27621::init()
     BQ27621_error_code retVal;
     uint16_t deviceId = 0;
 
-    // TODO I2c transaction begin
     retVal = getDeviceType(&deviceId);
 
     if (retVal != OK)
@@ -50,6 +234,214 @@ BQ27621_error_code BQ27621::init()
         return INCORRECT_DEVICE_TYPE;
 }
 
+/**
+ * @brief Enters CONFIG UPDATE mode, unsealing the gauge first if needed. With userControl set, data memory
+ * writes are only coalesced in the block cache until exitConfig(), so each modified block is written once.
+ * On failure the gauge is resealed if this call unsealed it and the session flags are left as they were.
+ *
+ * @param userControl true if the caller will end the session with exitConfig()
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::enterConfig(bool userControl)
+{
+    if (_configMode)
+    {
+        if (userControl)
+            _userConfigControl = true;
+        return OK;
+    }
+
+    bool sealed;
+    BQ27621_error_code retVal = isSealed(&sealed);
+    if (retVal != OK)
+        return retVal;
+    if (sealed)
+    {
+        retVal = unseal();
+        if (retVal != OK)
+        {
+            seal(); // The first key word may have been taken
+            return retVal;
+        }
+    }
+
+    retVal = executeControlWord(SET_CFGUPDATE);
+    if (retVal == OK)
+    {
+        retVal = waitConfigMode(true);
+        // A read error while polling says nothing about the entry: if it still happens, leave CONFIG UPDATE again.
+        // A timeout means the gauge stayed out for BQ27621_CONFIG_TIMEOUT_US and there is nothing to leave.
+        if (retVal != OK && retVal != TIMEOUT_ERROR && waitConfigMode(true) == OK)
+        {
+            _configMode = true;
+            _seal_flag = _seal_flag || sealed;
+            return abortConfig(retVal, false);
+        }
+    }
+    if (retVal != OK)
+    {
+        if (sealed)
+            seal();
+        return retVal;
+    }
+
+    _configMode = true;
+    if (sealed)
+        _seal_flag = true;
+    if (userControl)
+        _userConfigControl = true;
+    return OK;
+}
+
+/**
+ * @brief Writes all dirty cached blocks, leaves CONFIG UPDATE mode and restores the SEALED state. If any step fails
+ * the pending changes are dropped, the gauge is still taken out of CONFIG UPDATE and resealed, and the first error
+ * is returned.
+ *
+ * @param mode Exit subcommand: SOFT_RESET, EXIT_CFGUPDATE or EXIT_RESIM
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::exitConfig(ConfigExitMode mode)
+{
+    _userConfigControl = false;
+    if (!_configMode)
+        return OK;
+
+    BQ27621_error_code retVal = flushBlockCache();
+    if (retVal != OK)
+        return abortConfig(retVal, false);
+
+    switch (mode)
+    {
+    case CONFIG_EXIT_CFGUPDATE:
+        retVal = executeControlWord(EXIT_CFGUPDATE);
+        break;
+    case CONFIG_EXIT_RESIM:
+        retVal = executeControlWord(EXIT_RESIM);
+        break;
+    case CONFIG_EXIT_SOFT_RESET:
+    default:
+        retVal = softReset();
+        break;
+    }
+    if (retVal != OK)
+        return abortConfig(retVal, true);
+    retVal = waitConfigMode(false);
+    if (retVal != OK)
+        return abortConfig(retVal, retVal != TIMEOUT_ERROR); // After a timeout the exit has demonstrably not run
+    _configMode = false;
+
+    if (_seal_flag)
+    {
+        _seal_flag = false;
+        return seal();
+    }
+    return OK;
+}
+
+/**
+ * @brief Ends a failed CONFIG UPDATE session the way finish() does on the step() path: the cached changes are
+ * dropped, the gauge is taken out of CONFIG UPDATE on a best-effort basis and resealed if the session unsealed it.
+ * SOFT_RESET is only sent once the gauge is known not to be leaving, so an exit that did run is never repeated.
+ * Errors of the cleanup itself are not reported.
+ *
+ * @param failure Error that ended the session
+ * @param exitPending true if an exit subcommand may have reached the gauge: wait BQ27621_CONFIG_TIMEOUT_US for it
+ * before sending SOFT_RESET
+ * @return BQ27621_error_code failure
+ */
+BQ27621_error_code BQ27621::abortConfig(BQ27621_error_code failure, bool exitPending)
+{
+    invalidateBlockCache();
+    invalidateStatus();
+
+    BQ27621_error_code retVal = exitPending ? waitConfigMode(false) : TIMEOUT_ERROR;
+    if (retVal == TIMEOUT_ERROR)
+    {
+        retVal = softReset();
+        if (retVal == OK)
+            retVal = waitConfigMode(false);
+    }
+    if (retVal == OK)
+        _configMode = false;
+
+    if (_seal_flag)
+    {
+        _seal_flag = false;
+        seal();
+    }
+    return failure;
+}
+
+/**
+ * @brief Polls Flags() until [CFGUPMODE] matches active or BQ27621_CONFIG_TIMEOUT_US elapses
+ *
+ * @param active Expected [CFGUPMODE] state
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::waitConfigMode(bool active)
+{
+    uint32_t start = _i2c_device.micros();
+    for (;;)
+    {
+        uint16_t flags;
+        BQ27621_error_code retVal = readWord(COMMAND_FLAGS, &flags);
+        if (retVal != OK)
+            return retVal;
+        if (((flags & FLAG_CFGUPMODE) != 0) == active)
+            return OK;
+        if ((uint32_t)(_i2c_device.micros() - start) > BQ27621_CONFIG_TIMEOUT_US)
+            return TIMEOUT_ERROR;
+        _i2c_device.delayMicros(BQ27621_CONFIG_POLL_US);
+    }
+}
+
+/**
+ * @brief Writes every dirty block of the shadow cache. Must be called in CONFIG UPDATE mode.
+ *
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::flushBlockCache(void)
+{
+    for (size_t i = 0; i < BQ27621_BLOCK_CACHE_SIZE; i++)
+    {
+        if (_blockCache[i].valid && _blockCache[i].dirty)
+        {
+            BQ27621_error_code retVal = storeBlock(&_blockCache[i]);
+            if (retVal != OK)
+                return retVal;
+        }
+    }
+    return OK;
+}
+
+/**
+ * @brief Drops every cached block, including unwritten changes
+ *
+ */
+void BQ27621::invalidateBlockCache(void)
+{
+    for (size_t i = 0; i < BQ27621_BLOCK_CACHE_SIZE; i++)
+    {
+        _blockCache[i].valid = false;
+        _blockCache[i].dirty = false;
+    }
+}
+
+/**
+ * @brief Performs a full device reset (RESET subcommand). Data memory returns to defaults, so the block cache
+ * and the status/OpConfig shadows are dropped.
+ *
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::reset(void)
+{
+    invalidateBlockCache();
+    invalidateStatus();
+    _configMode = false;
+    return executeControlWord(RESET);
+}
+
 /**
  * @brief
  *
@@ -58,8 +450,8 @@ BQ27621_error_code BQ27621::init()
  */
 BQ27621_error_code BQ27621::setCapacity(uint16_t capacity)
 {
-    uint16_t *capacity_data = (uint16_t *)(byte_swap(capacity));
-    return writeExtendedData(ID_STATE, STATE_DESIGN_CAPACITY, (uint8_t *)capacity_data, sizeof(uint16_t));
+    uint8_t data[2] = {(uint8_t)(capacity >> 8), (uint8_t)(capacity & 0xFF)}; // Data memory is big-endian
+    return writeExtendedData(ID_STATE, STATE_DESIGN_CAPACITY, data, sizeof(data));
 }
 
 /**
@@ -70,8 +462,8 @@ BQ27621_error_code BQ27621::setCapacity(uint16_t capacity)
  */
 BQ27621_error_code BQ27621::setDesignenergy(uint16_t energy)
 {
-    uint16_t *capacity_data = (uint16_t *)(byte_swap(energy));
-    return writeExtendedData(ID_STATE, STATE_DESIGN_ENERGY, (uint8_t *)capacity_data, sizeof(uint16_t));
+    uint8_t data[2] = {(uint8_t)(energy >> 8), (uint8_t)(energy & 0xFF)}; // Data memory is big-endian
+    return writeExtendedData(ID_STATE, STATE_DESIGN_ENERGY, data, sizeof(data));
 }
 
 /**
@@ -82,8 +474,8 @@ BQ27621_error_code BQ27621::setDesignenergy(uint16_t energy)
  */
 BQ27621_error_code BQ27621::setTerminateVoltage(uint16_t voltage)
 {
-    uint16_t *capacity_data = (uint16_t *)(byte_swap(voltage));
-    return writeExtendedData(ID_STATE, STATE_TERMINATE_VOLTAGE, (uint8_t *)capacity_data, sizeof(uint16_t));
+    uint8_t data[2] = {(uint8_t)(voltage >> 8), (uint8_t)(voltage & 0xFF)}; // Data memory is big-endian
+    return writeExtendedData(ID_STATE, STATE_TERMINATE_VOLTAGE, data, sizeof(data));
 }
 
 /**
@@ -117,38 +509,19 @@ BQ27621_error_code BQ27621::getCurrent(int16_t *current)
  */
 BQ27621_error_code BQ27621::getCapacity(CapacityMeasure type, uint16_t *capacity)
 {
-    uint8_t capacityCmd;
-    switch (type)
-    {
-    case C_MEASURE_FULL:
-        capacityCmd = COMMAND_FULL_CHARGE_CAPACITY;
-        break;
-    case C_MEASURE_AVAIL:
-        capacityCmd = COMMAND_NOMINAL_AVAILABLE_CAPACITY;
-        break;
-    case C_MEASURE_AVAIL_FULL:
-        capacityCmd = COMMAND_FULL_AVAILABLE_CAPACITY;
-        break;
-    case C_MEASURE_REMAIN_F:
-        capacityCmd = COMMAND_REMAINING_CAPACITY_FILTERED;
-        break;
-    case C_MEASURE_REMAIN_UF:
-        capacityCmd = COMMAND_REMAINING_CAPACITY_UNFILTERED;
-        break;
-    case C_MEASURE_FULL_F:
-        capacityCmd = COMMAND_FULL_CHARGE_CAPACITY_FILTERED;
-        break;
-    case C_MEASURE_FULL_UF:
-        capacityCmd = COMMAND_FULL_CHARGE_CAPACITY_UNFILTERED;
-        break;
-    case C_MEASURE_DESIGN:
-        capacityCmd = EXTENDED_DESIGN_CAPACITY;
-        break;
-    case C_MEASURE_REMAIN:
-    default:
-        capacityCmd = COMMAND_REMAINING_CAPACITY;
-        break;
-    }
+    // Indexed by CapacityMeasure
+    static const uint8_t capacityCommands[] = {
+        BQ27621Registers::RemainingCapacity::address,
+        BQ27621Registers::FullChargeCapacity::address,
+        BQ27621Registers::NominalAvailableCapacity::address,
+        BQ27621Registers::FullAvailableCapacity::address,
+        BQ27621Registers::RemainingCapacityFiltered::address,
+        BQ27621Registers::RemainingCapacityUnfiltered::address,
+        BQ27621Registers::FullChargeCapacityFiltered::address,
+        BQ27621Registers::FullChargeCapacityUnfiltered::address,
+        BQ27621Registers::DesignCapacity::address,
+    };
+    uint8_t capacityCmd = (type < sizeof(capacityCommands)) ? capacityCommands[type] : capacityCommands[C_MEASURE_REMAIN];
     return readWord(capacityCmd, capacity);
 };
 
@@ -172,18 +545,7 @@ BQ27621_error_code BQ27621::getPower(int16_t *power)
  */
 BQ27621_error_code BQ27621::getSOC(SocMeasure type, uint16_t *soc)
 {
-    Commands socCmd;
-    switch (type)
-    {
-    case UNFILTERED:
-        socCmd = COMMAND_STATE_OF_CHARGE_UNFILTERED;
-        break;
-
-    case FILTERED:
-    default:
-        socCmd = COMMAND_STATE_OF_CHARGE;
-        break;
-    }
+    uint8_t socCmd = (type == UNFILTERED) ? BQ27621Registers::StateOfChargeUnfiltered::address : BQ27621Registers::StateOfCharge::address;
     return readWord(socCmd, soc);
 };
 
@@ -202,107 +564,1081 @@ BQ27621_error_code BQ27621::getTemperature(TempMeasure type, uint16_t *temperatu
 };
 
 /**
- * @brief  Get GPOUT polarity setting (active-high or active-low)
+ * @brief Reads the standard commands in [first, last] with one auto-incrementing burst and decodes them into snapshot.
+ * Registers outside the range keep their previous value. Blocking wrapper of startReadSnapshot().
  *
- * @param polarity
+ * @param snapshot Pointer to snapshot to fill
+ * @param first First command of the burst (BQ27621_SNAPSHOT_FIRST by default)
+ * @param last Last command of the burst (BQ27621_SNAPSHOT_LAST by default)
  * @return BQ27621_error_code
  */
-BQ27621_error_code BQ27621::getGpoutPolarity(bool *polarity)
+BQ27621_error_code BQ27621::readSnapshot(BQ27621Snapshot *snapshot, Commands first, Commands last)
 {
-    uint16_t opConfig;
-    BQ27621_error_code retVal = getOpConfig(&opConfig);
-    *polarity = opConfig & OPCONFIG_GPIOPOL;
-    return retVal;
-};
+    BQ27621Operation op;
+    BQ27621_error_code retVal = startReadSnapshot(&op, snapshot, first, last);
+    if (retVal != OK)
+        return retVal;
+    return run(&op);
+}
 
 /**
- * @brief Set GPOUT polarity to active-high or active-low
+ * @brief Decodes a raw burst of the standard commands [first, last] into snapshot. Every word is taken at an offset
+ * from the start of data, never through a pointer moved before it.
  *
- * @param polarity
- * @return BQ27621_error_code
+ * @param data Raw bytes, data[0] is the low byte of first, last + 2 - first bytes (range checked by startReadSnapshot())
+ * @param first First command of the burst
+ * @param last Last command of the burst
+ * @param snapshot Pointer to snapshot to fill
  */
-BQ27621_error_code BQ27621::setGpoutPolarity(bool polarity)
+void BQ27621::decodeSnapshot(const uint8_t *data, uint8_t first, uint8_t last, BQ27621Snapshot *snapshot)
 {
-    uint16_t oldOpConfig;
-    BQ27621_error_code retVal = getOpConfig(&oldOpConfig);
-
-    if ((polarity && (oldOpConfig & OPCONFIG_GPIOPOL)) || (!polarity && !(oldOpConfig & OPCONFIG_GPIOPOL)))
-        return OK;
+    if (first <= COMMAND_FLAGS && last >= COMMAND_FLAGS)
+        cacheFlags(decodeWord(&data[COMMAND_FLAGS - first]));
 
-    uint16_t newOpConfig = oldOpConfig;
-    if (polarity)
-    {
-        newOpConfig |= OPCONFIG_GPIOPOL;
-    }
-    else
+    snapshot->first = first;
+    snapshot->last = last;
+    for (uint8_t cmd = first; cmd <= last; cmd += 2)
     {
-        newOpConfig &= ~(OPCONFIG_GPIOPOL);
+        uint16_t word = decodeWord(&data[cmd - first]);
+        switch (cmd)
+        {
+        case COMMAND_TEMPERATURE:
+            snapshot->temperature = word;
+            break;
+        case COMMAND_VOLTAGE:
+            snapshot->voltage = word;
+            break;
+        case COMMAND_FLAGS:
+            snapshot->flags = word;
+            break;
+        case COMMAND_NOMINAL_AVAILABLE_CAPACITY:
+            snapshot->nominalAvailableCapacity = word;
+            break;
+        case COMMAND_FULL_AVAILABLE_CAPACITY:
+            snapshot->fullAvailableCapacity = word;
+            break;
+        case COMMAND_REMAINING_CAPACITY:
+            snapshot->remainingCapacity = word;
+            break;
+        case COMMAND_FULL_CHARGE_CAPACITY:
+            snapshot->fullChargeCapacity = word;
+            break;
+        case COMMAND_EFFECTIVE_CURRENT:
+            snapshot->effectiveCurrent = (int16_t)word;
+            break;
+        case COMMAND_AVERAGE_POWER:
+            snapshot->averagePower = (int16_t)word;
+            break;
+        case COMMAND_STATE_OF_CHARGE:
+            snapshot->stateOfCharge = word;
+            break;
+        case COMMAND_INTERNAL_TEMPERATURE:
+            snapshot->internalTemperature = word;
+            break;
+        case COMMAND_REMAINING_CAPACITY_UNFILTERED:
+            snapshot->remainingCapacityUnfiltered = word;
+            break;
+        case COMMAND_REMAINING_CAPACITY_FILTERED:
+            snapshot->remainingCapacityFiltered = word;
+            break;
+        case COMMAND_FULL_CHARGE_CAPACITY_UNFILTERED:
+            snapshot->fullChargeCapacityUnfiltered = word;
+            break;
+        case COMMAND_FULL_CHARGE_CAPACITY_FILTERED:
+            snapshot->fullChargeCapacityFiltered = word;
+            break;
+        case COMMAND_STATE_OF_CHARGE_UNFILTERED:
+            snapshot->stateOfChargeUnfiltered = word;
+            break;
+        default: // Reserved registers inside the burst
+            break;
+        }
     }
-
-    return setOpConfig(newOpConfig);
-};
+}
 
 /**
- * @brief Get GPOUT function (BAT_LOW or SOC_INT)
- * 
- * @param function 
- * @return BQ27621_error_code 
+ * @brief Reports whether the gauge is in SEALED access mode
+ *
+ * @param isSealed Pointer to bool that will hold the SEALED state
+ * @return BQ27621_error_code
  */
-BQ27621_error_code BQ27621::getGpoutFunction(GpoutFunction *function){
-    uint16_t opConfig;
-    BQ27621_error_code retVal = getOpConfig(&opConfig);
-    *function = GpoutFunction(opConfig & OPCONFIG_BATLOWEN);
+BQ27621_error_code BQ27621::isSealed(bool *isSealed)
+{
+    uint16_t status;
+    BQ27621_error_code retVal = readControlWord(CONTROL_STATUS, &status);
+    *isSealed = (status & STATUS_SS) != 0;
     return retVal;
-};
-
-/**
- * @brief 
- * 
- * @param function 
- * @return BQ27621_error_code 
- */
-BQ27621_error_code BQ27621::setGpoutFunction(GpoutFunction function){
-    uint16_t oldOpConfig;
-    BQ27621_error_code retVal = getOpConfig(&oldOpConfig);
-
-    if ((function && (oldOpConfig & OPCONFIG_GPIOPOL)) || (!function && !(oldOpConfig & OPCONFIG_GPIOPOL)))
-        return OK;
-
-    uint16_t newOpConfig = oldOpConfig;
-    if (function == GPOUT_F_BAT_LOW)
-    {
-        newOpConfig |= OPCONFIG_BATLOWEN;
-    }
-    else
-    {
-        newOpConfig &= ~(OPCONFIG_BATLOWEN);
-    }
-
-    return setOpConfig(newOpConfig);
-};
-
-
+}
 
 /**
- * @brief
+ * @brief Places the gauge in SEALED access mode
  *
- * @param deviceType Pointer to uint16_t that will hold
  * @return BQ27621_error_code
  */
-BQ27621_error_code BQ27621::getDeviceType(uint16_t *deviceType)
+BQ27621_error_code BQ27621::seal(void)
 {
-    return readControlWord(BQ27621_DEVICE_TYPE, deviceType);
+    return executeControlWord(SEALED);
 }
 
 /**
- * @brief
+ * @brief Unseals the gauge by writing the unseal key twice
  *
- * @param word
- * @return uint16_t Swapped word
+ * @return BQ27621_error_code
  */
-uint16_t BQ27621::byte_swap(uint16_t word)
+BQ27621_error_code BQ27621::unseal(void)
 {
-    uint16_t msb = (word & 0xFF00) >> 8;
-    uint16_t lsb = (word & 0x00FF);
-    return (lsb << 8) | msb;
-}
\ No newline at end of file
+    BQ27621_error_code retVal = executeControlWord(BQ27621_UNSEAL_KEY);
+    if (retVal != OK)
+        return retVal;
+    return executeControlWord(BQ27621_UNSEAL_KEY);
+}
+
+/**
+ * @brief Exits CONFIG UPDATE mode through SOFT_RESET
+ *
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::softReset(void)
+{
+    return executeControlWord(SOFT_RESET);
+}
+
+/**
+ * @brief Reads the OpConfig word of the Registers subclass, the word setOpConfig() writes, so a read-modify-write
+ * never mixes data memory with the OpConfig() standard command. Only the first call touches the bus; later calls
+ * return the write-through shadow.
+ *
+ * @param opConfig Pointer to uint16_t that will hold the OpConfig bits
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getOpConfig(uint16_t *opConfig)
+{
+    if (!_opConfigValid)
+    {
+        uint8_t data[2];
+        BQ27621_error_code retVal = readExtendedData(ID_REGISTERS, REGISTERS_OP_CONFIG, data, sizeof(data));
+        if (retVal != OK)
+            return retVal;
+        _opConfig = (uint16_t)((data[0] << 8) | data[1]);
+        _opConfigValid = true;
+    }
+    *opConfig = _opConfig;
+    return OK;
+}
+
+/**
+ * @brief Writes the OpConfig word of the Registers subclass
+ *
+ * @param opConfig OpConfig bits
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::setOpConfig(uint16_t opConfig)
+{
+    uint8_t data[2] = {(uint8_t)(opConfig >> 8), (uint8_t)(opConfig & 0xFF)};
+    BQ27621_error_code retVal = writeExtendedData(ID_REGISTERS, REGISTERS_OP_CONFIG, data, sizeof(data));
+    _opConfig = opConfig;
+    _opConfigValid = (retVal == OK);
+    return retVal;
+}
+
+/**
+ * @brief Enables block data memory access (BlockDataControl() = 0x00)
+ *
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::blockDataControl(void)
+{
+    uint8_t enable = 0x00;
+    return writeBytes(EXTENDED_BLOCK_DATA_CONTROL, &enable, 1);
+}
+
+/**
+ * @brief Selects the data memory class (DataClass())
+ *
+ * @param id Class ID
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::blockDataClass(uint8_t id)
+{
+    return writeBytes(EXTENDED_DATA_CLASS, &id, 1);
+}
+
+/**
+ * @brief Selects the 32-byte block of the current class (DataBlock())
+ *
+ * @param offset Block index
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::blockDataOffset(uint8_t offset)
+{
+    return writeBytes(EXTENDED_DATA_BLOCK, &offset, 1);
+}
+
+/**
+ * @brief Reads BlockDataCheckSum()
+ *
+ * @param checksum Pointer to uint8_t that will hold the checksum
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::blockDataChecksum(uint8_t *checksum)
+{
+    return readBytes(EXTENDED_BLOCK_DATA_CHECKSUM, checksum, 1);
+}
+
+/**
+ * @brief Reads the selected block together with its checksum in one burst and verifies it
+ *
+ * @param data Pointer to BQ27621_BLOCK_SIZE bytes
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::readBlockData(uint8_t *data)
+{
+    uint8_t buffer[BQ27621_BLOCK_SIZE + 1];
+    BQ27621_error_code retVal = readBytes(EXTENDED_BLOCK_DATA, buffer, sizeof(buffer));
+    if (retVal != OK)
+        return retVal;
+    if (computeBlockChecksum(buffer) != buffer[BQ27621_BLOCK_SIZE])
+        return BUS_ERROR;
+    for (size_t i = 0; i < BQ27621_BLOCK_SIZE; i++)
+        data[i] = buffer[i];
+    return OK;
+}
+
+/**
+ * @brief Writes the whole selected block in one burst
+ *
+ * @param data Pointer to BQ27621_BLOCK_SIZE bytes
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::writeBlockData(const uint8_t *data)
+{
+    return writeBytes(EXTENDED_BLOCK_DATA, data, BQ27621_BLOCK_SIZE);
+}
+
+/**
+ * @brief Computes the BlockDataCheckSum() of a block: 255 minus the 8-bit sum of its bytes
+ *
+ * @param data Pointer to BQ27621_BLOCK_SIZE bytes
+ * @return uint8_t Checksum
+ */
+uint8_t BQ27621::computeBlockChecksum(const uint8_t *data)
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < BQ27621_BLOCK_SIZE; i++)
+        sum += data[i];
+    return (uint8_t)(0xFF - sum);
+}
+
+/**
+ * @brief Writes BlockDataCheckSum(), which commits the block buffer to data memory
+ *
+ * @param checksum Checksum of the new block contents
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::writeBlockChecksum(uint8_t checksum)
+{
+    return writeBytes(EXTENDED_BLOCK_DATA_CHECKSUM, &checksum, 1);
+}
+
+/**
+ * @brief Returns the cache entry for (classId, block), reading it from the gauge on a miss.
+ * The least recently used clean entry is replaced; if every entry is dirty they are flushed first.
+ *
+ * @param classId Data memory class
+ * @param block Block index inside the class
+ * @param entry Pointer that will hold the cache entry
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::loadBlock(uint8_t classId, uint8_t block, BQ27621BlockCacheEntry **entry)
+{
+    BQ27621BlockCacheEntry *cached = findBlock(classId, block);
+    if (cached != NULL)
+    {
+        cached->lastUse = ++_blockCacheClock;
+        *entry = cached;
+        return OK;
+    }
+    BQ27621BlockCacheEntry *victim = victimBlock(true);
+
+    BQ27621_error_code retVal;
+    if (victim == NULL)
+    {
+        retVal = flushBlockCache();
+        if (retVal != OK)
+            return retVal;
+        victim = &_blockCache[0];
+    }
+
+    bool sealed = false;
+    if (!_configMode)
+    {
+        retVal = isSealed(&sealed);
+        if (retVal == OK && sealed)
+            retVal = unseal();
+        if (retVal != OK)
+            return retVal;
+    }
+
+    victim->valid = false;
+    retVal = blockDataControl();
+    if (retVal == OK)
+        retVal = blockDataClass(classId);
+    if (retVal == OK)
+        retVal = blockDataOffset(block);
+    if (retVal == OK)
+        retVal = readBlockData(victim->data);
+
+    if (sealed)
+    {
+        BQ27621_error_code sealRetVal = seal();
+        if (retVal == OK)
+            retVal = sealRetVal;
+    }
+    if (retVal != OK)
+        return retVal;
+
+    victim->classId = classId;
+    victim->block = block;
+    victim->valid = true;
+    victim->dirty = false;
+    victim->lastUse = ++_blockCacheClock;
+    *entry = victim;
+    return OK;
+}
+
+/**
+ * @brief Looks up a cached block
+ *
+ * @param classId Data memory class
+ * @param block Block index inside the class
+ * @return BQ27621BlockCacheEntry* Entry, NULL on a miss
+ */
+BQ27621BlockCacheEntry *BQ27621::findBlock(uint8_t classId, uint8_t block)
+{
+    for (size_t i = 0; i < BQ27621_BLOCK_CACHE_SIZE; i++)
+    {
+        if (_blockCache[i].valid && _blockCache[i].classId == classId && _blockCache[i].block == block)
+            return &_blockCache[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Picks the entry to replace: an invalid one, else the least recently used
+ *
+ * @param clean true to only consider entries without unwritten changes
+ * @return BQ27621BlockCacheEntry* Entry, NULL if clean is set and every entry is dirty
+ */
+BQ27621BlockCacheEntry *BQ27621::victimBlock(bool clean)
+{
+    BQ27621BlockCacheEntry *victim = NULL;
+    for (size_t i = 0; i < BQ27621_BLOCK_CACHE_SIZE; i++)
+    {
+        BQ27621BlockCacheEntry *candidate = &_blockCache[i];
+        if (!candidate->valid)
+            return candidate;
+        if (clean && candidate->dirty)
+            continue;
+        if (victim == NULL || (uint16_t)(_blockCacheClock - candidate->lastUse) > (uint16_t)(_blockCacheClock - victim->lastUse))
+            victim = candidate;
+    }
+    return victim;
+}
+
+/**
+ * @brief Writes a cached block back with one burst and one checksum write
+ *
+ * @param entry Cache entry to write
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::storeBlock(BQ27621BlockCacheEntry *entry)
+{
+    BQ27621_error_code retVal = blockDataControl();
+    if (retVal == OK)
+        retVal = blockDataClass(entry->classId);
+    if (retVal == OK)
+        retVal = blockDataOffset(entry->block);
+    if (retVal == OK)
+        retVal = writeBlockData(entry->data);
+    if (retVal == OK)
+        retVal = writeBlockChecksum(computeBlockChecksum(entry->data));
+    if (retVal == OK)
+        entry->dirty = false;
+    return retVal;
+}
+
+/**
+ * @brief Drops the block cache and the OpConfig shadow when [ITPOR] rises, as data memory is back to defaults.
+ * [ITPOR] stays set until the host commits a configuration, so only the edge means a new reset. Ignored inside
+ * CONFIG UPDATE, where [ITPOR] stays set until the new configuration is committed.
+ *
+ * @param flags Flags() value
+ */
+void BQ27621::checkItPor(uint16_t flags)
+{
+    if (_configMode)
+        return;
+    bool itpor = (flags & FLAG_ITPOR) != 0;
+    if (itpor && !_itporSeen)
+    {
+        invalidateBlockCache();
+        _opConfigValid = false;
+    }
+    _itporSeen = itpor;
+}
+
+/**
+ * @brief Stores a fresh Flags() value for getFlags() and checks it for [ITPOR]
+ *
+ * @param flags Flags() value
+ */
+void BQ27621::cacheFlags(uint16_t flags)
+{
+    checkItPor(flags);
+    decodeFlags(flags, &_flags);
+    _flagsValid = true;
+    _flagsTimestamp = _i2c_device.micros();
+}
+
+void BQ27621::decodeFlags(uint16_t raw, BQ27621FlagSet *flags)
+{
+    flags->raw = raw;
+    flags->overTemperature = (raw & FLAG_OT) != 0;
+    flags->underTemperature = (raw & FLAG_UT) != 0;
+    flags->fullCharge = (raw & FLAG_FC) != 0;
+    flags->charging = (raw & FLAG_CHG) != 0;
+    flags->ocvTaken = (raw & FLAG_OCVTAKEN) != 0;
+    flags->itpor = (raw & FLAG_ITPOR) != 0;
+    flags->cfgUpMode = (raw & FLAG_CFGUPMODE) != 0;
+    flags->batteryDetected = (raw & FLAG_BAT_DET) != 0;
+    flags->soc1 = (raw & FLAG_SOC1) != 0;
+    flags->socf = (raw & FLAG_SOCF) != 0;
+    flags->discharging = (raw & FLAG_DSG) != 0;
+}
+
+void BQ27621::decodeStatus(uint16_t raw, BQ27621StatusSet *status)
+{
+    status->raw = raw;
+    status->shutdownEnabled = (raw & STATUS_SHUTDOWNEN) != 0;
+    status->watchdogReset = (raw & STATUS_WDRESET) != 0;
+    status->sealed = (raw & STATUS_SS) != 0;
+    status->calibrationMode = (raw & STATUS_CALMODE) != 0;
+    status->ocvComplete = (raw & STATUS_OCVCMDCOMP) != 0;
+    status->ocvFail = (raw & STATUS_OCVFAIL) != 0;
+    status->initComplete = (raw & STATUS_INITCOMP) != 0;
+    status->powerMin = (raw & STATUS_POWERMIN) != 0;
+    status->sleep = (raw & STATUS_SLEEP) != 0;
+    status->constantPowerModel = (raw & STATUS_LDMD) != 0;
+    status->chemChange = (raw & STATUS_CHEMCHNG) != 0;
+}
+
+/**
+ * @brief Returns the decoded Flags(). A cached value younger than the configured max age is reused without bus traffic.
+ *
+ * @param flags Pointer to flag set to fill
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getFlags(BQ27621FlagSet *flags)
+{
+    if (!_flagsValid || _statusMaxAge == 0 || (uint32_t)(_i2c_device.micros() - _flagsTimestamp) > _statusMaxAge)
+    {
+        uint16_t raw;
+        BQ27621_error_code retVal = readWord(COMMAND_FLAGS, &raw);
+        if (retVal != OK)
+            return retVal;
+        cacheFlags(raw);
+    }
+    *flags = _flags;
+    return OK;
+}
+
+/**
+ * @brief Reads Flags() and CONTROL_STATUS in one combined transfer and decodes both
+ *
+ * @param flags Pointer to flag set to fill
+ * @param status Pointer to status set to fill
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getStatus(BQ27621FlagSet *flags, BQ27621StatusSet *status)
+{
+    uint8_t flagsCommand = COMMAND_FLAGS;
+    uint8_t subCommand[3] = {COMMAND_CONTROL, (uint8_t)(CONTROL_STATUS & 0xFF), (uint8_t)(CONTROL_STATUS >> 8)};
+    uint8_t controlCommand = COMMAND_CONTROL;
+    uint8_t flagsData[2];
+    uint8_t statusData[2];
+    I2C_message messages[5] = {
+        {_i2c_address, I2C_MSG_WRITE, 1, &flagsCommand},
+        {_i2c_address, I2C_MSG_READ, sizeof(flagsData), flagsData},
+        {_i2c_address, I2C_MSG_WRITE, sizeof(subCommand), subCommand},
+        {_i2c_address, I2C_MSG_WRITE, 1, &controlCommand},
+        {_i2c_address, I2C_MSG_READ, sizeof(statusData), statusData},
+    };
+
+    BQ27621_error_code retVal = transfer(messages, 5);
+    if (retVal != OK)
+        return retVal;
+
+    cacheFlags(decodeWord(flagsData));
+    *flags = _flags;
+    decodeStatus(decodeWord(statusData), status);
+    return OK;
+}
+
+/**
+ * @brief Sets how long a Flags() value may be reused by getFlags() and the get*Flag() getters
+ *
+ * @param maxAge Microseconds, 0 to read on every call (DEFAULT)
+ */
+void BQ27621::setStatusMaxAge(uint32_t maxAge)
+{
+    _statusMaxAge = maxAge;
+}
+
+/**
+ * @brief Forgets the cached Flags() and OpConfig() values
+ *
+ */
+void BQ27621::invalidateStatus(void)
+{
+    _flagsValid = false;
+    _opConfigValid = false;
+}
+
+/**
+ * @brief Writes len bytes of data memory. The bytes are merged into the cached block; outside a user
+ * controlled config session the block is written back immediately inside its own CONFIG UPDATE round trip.
+ * Blocking wrapper of startWriteExtendedData().
+ *
+ * @param classId Data memory class
+ * @param offset Byte offset inside the class
+ * @param data Pointer to bytes to write
+ * @param len Number of bytes (must not cross a block boundary)
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::writeExtendedData(uint8_t classId, uint8_t offset, const uint8_t *data, size_t len)
+{
+    BQ27621Operation op;
+    BQ27621_error_code retVal = startWriteExtendedData(&op, classId, offset, data, len);
+    if (retVal != OK)
+        return retVal;
+    return run(&op);
+}
+
+/**
+ * @brief Reads len bytes of data memory, served from the block cache when the block is present
+ *
+ * @param classId Data memory class
+ * @param offset Byte offset inside the class
+ * @param data Pointer to buffer of at least len bytes
+ * @param len Number of bytes (must not cross a block boundary)
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::readExtendedData(uint8_t classId, uint8_t offset, uint8_t *data, size_t len)
+{
+    if (len == 0 || (offset % BQ27621_BLOCK_SIZE) + len > BQ27621_BLOCK_SIZE)
+        return BUS_ERROR;
+
+    BQ27621BlockCacheEntry *entry;
+    BQ27621_error_code retVal = loadBlock(classId, offset / BQ27621_BLOCK_SIZE, &entry);
+    if (retVal != OK)
+        return retVal;
+
+    const uint8_t *source = &entry->data[offset % BQ27621_BLOCK_SIZE];
+    for (size_t i = 0; i < len; i++)
+        data[i] = source[i];
+    return OK;
+}
+
+/**
+ * @brief Read-modify-write of the OpConfig word in data memory. Works on the cached block, so inside a
+ * config session it sees earlier uncommitted changes.
+ *
+ * @param mask OpConfig bits to change
+ * @param value New value of the masked bits
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::updateOpConfig(uint16_t mask, uint16_t value)
+{
+    uint8_t data[2];
+    BQ27621_error_code retVal = readExtendedData(ID_REGISTERS, REGISTERS_OP_CONFIG, data, sizeof(data));
+    if (retVal != OK)
+        return retVal;
+
+    uint16_t opConfig = (uint16_t)((data[0] << 8) | data[1]);
+    opConfig = (uint16_t)((opConfig & ~mask) | (value & mask));
+    return setOpConfig(opConfig);
+}
+
+/**
+ * @brief Reads the SOC_INT delta (State subclass)
+ *
+ * @param sociDelta Pointer to uint8_t that will hold the delta in %
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getSociDelta(uint8_t *sociDelta)
+{
+    return readExtendedData(ID_STATE, STATE_SOCI_DELTA, sociDelta, 1);
+}
+
+/**
+ * @brief Sets the SOC change that pulses GPOUT in SOC_INT mode
+ *
+ * @param sociDelta Delta in %
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::setSociDelta(uint8_t sociDelta)
+{
+    return writeExtendedData(ID_STATE, STATE_SOCI_DELTA, &sociDelta, 1);
+}
+
+/**
+ * @brief Sets the SOC1 set and clear thresholds (Discharge subclass)
+ *
+ * @param set [SOC1] set threshold in %
+ * @param clear [SOC1] clear threshold in %
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::setSOC1Thresholds(uint8_t set, uint8_t clear)
+{
+    uint8_t data[2] = {set, clear};
+    return writeExtendedData(ID_DISCHARGE, DISCHARGE_SOC1_SET_THRESHOLD, data, sizeof(data));
+}
+
+/**
+ * @brief Sets the SOCF set and clear thresholds (Discharge subclass)
+ *
+ * @param set [SOCF] set threshold in %
+ * @param clear [SOCF] clear threshold in %
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::setSOCFThresholds(uint8_t set, uint8_t clear)
+{
+    uint8_t data[2] = {set, clear};
+    return writeExtendedData(ID_DISCHARGE, DISCHARGE_SOCF_SET_THRESHOLD, data, sizeof(data));
+}
+
+/**
+ * @brief Reads several (not necessarily contiguous) standard commands. Each group of up to BQ27621_MAX_BATCH
+ * registers is submitted as one combined transfer, so the bus adapter sees one request per group.
+ *
+ * @param commands Array of command codes
+ * @param words Array that will hold the register values, same order as commands
+ * @param count Number of registers
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::readWords(const uint8_t *commands, uint16_t *words, size_t count)
+{
+    uint8_t addresses[BQ27621_MAX_BATCH];
+    uint8_t data[BQ27621_MAX_BATCH][2];
+    I2C_message messages[2 * BQ27621_MAX_BATCH];
+
+    while (count > 0)
+    {
+        size_t n = (count > BQ27621_MAX_BATCH) ? BQ27621_MAX_BATCH : count;
+        for (size_t i = 0; i < n; i++)
+        {
+            addresses[i] = commands[i];
+            messages[2 * i] = {_i2c_address, I2C_MSG_WRITE, 1, &addresses[i]};
+            messages[2 * i + 1] = {_i2c_address, I2C_MSG_READ, 2, data[i]};
+        }
+
+        BQ27621_error_code retVal = transfer(messages, 2 * n);
+        if (retVal != OK)
+            return retVal;
+
+        for (size_t i = 0; i < n; i++)
+            words[i] = decodeWord(data[i]);
+        commands += n;
+        words += n;
+        count -= n;
+    }
+    return OK;
+}
+
+/**
+ * @brief  Get GPOUT polarity setting (active-high or active-low)
+ *
+ * @param polarity
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getGpoutPolarity(bool *polarity)
+{
+    uint16_t opConfig;
+    BQ27621_error_code retVal = getOpConfig(&opConfig);
+    if (retVal != OK)
+        return retVal;
+    *polarity = opConfig & OPCONFIG_GPIOPOL;
+    return OK;
+};
+
+/**
+ * @brief Set GPOUT polarity to active-high or active-low
+ *
+ * @param polarity
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::setGpoutPolarity(bool polarity)
+{
+    uint16_t oldOpConfig;
+    BQ27621_error_code retVal = getOpConfig(&oldOpConfig);
+    if (retVal != OK)
+        return retVal;
+
+    if ((polarity && (oldOpConfig & OPCONFIG_GPIOPOL)) || (!polarity && !(oldOpConfig & OPCONFIG_GPIOPOL)))
+        return OK;
+
+    uint16_t newOpConfig = oldOpConfig;
+    if (polarity)
+    {
+        newOpConfig |= OPCONFIG_GPIOPOL;
+    }
+    else
+    {
+        newOpConfig &= ~(OPCONFIG_GPIOPOL);
+    }
+
+    return setOpConfig(newOpConfig);
+};
+
+/**
+ * @brief Get GPOUT function (BAT_LOW or SOC_INT)
+ * 
+ * @param function 
+ * @return BQ27621_error_code 
+ */
+BQ27621_error_code BQ27621::getGpoutFunction(GpoutFunction *function){
+    uint16_t opConfig;
+    BQ27621_error_code retVal = getOpConfig(&opConfig);
+    if (retVal != OK)
+        return retVal;
+    *function = (opConfig & OPCONFIG_BATLOWEN) ? GPOUT_F_BAT_LOW : GPOUT_F_SOC_INT;
+    return OK;
+};
+
+/**
+ * @brief Set GPOUT function (BAT_LOW or SOC_INT)
+ * 
+ * @param function 
+ * @return BQ27621_error_code 
+ */
+BQ27621_error_code BQ27621::setGpoutFunction(GpoutFunction function){
+    uint16_t oldOpConfig;
+    BQ27621_error_code retVal = getOpConfig(&oldOpConfig);
+    if (retVal != OK)
+        return retVal;
+
+    bool batLow = (function == GPOUT_F_BAT_LOW);
+    if ((batLow && (oldOpConfig & OPCONFIG_BATLOWEN)) || (!batLow && !(oldOpConfig & OPCONFIG_BATLOWEN)))
+        return OK;
+
+    uint16_t newOpConfig = oldOpConfig;
+    if (batLow)
+    {
+        newOpConfig |= OPCONFIG_BATLOWEN;
+    }
+    else
+    {
+        newOpConfig &= ~(OPCONFIG_BATLOWEN);
+    }
+
+    return setOpConfig(newOpConfig);
+};
+
+/**
+ * @brief Reads [SOC1]: StateOfCharge() at or below the SOC1 set threshold
+ *
+ * @param soc1
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getSoc1Flag(bool *soc1)
+{
+    BQ27621FlagSet flags;
+    BQ27621_error_code retVal = getFlags(&flags);
+    if (retVal != OK)
+        return retVal;
+    *soc1 = flags.soc1;
+    return OK;
+}
+
+/**
+ * @brief Reads [SOCF]: StateOfCharge() at or below the SOCF set threshold
+ *
+ * @param socf
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getSocfFlag(bool *socf)
+{
+    BQ27621FlagSet flags;
+    BQ27621_error_code retVal = getFlags(&flags);
+    if (retVal != OK)
+        return retVal;
+    *socf = flags.socf;
+    return OK;
+}
+
+/**
+ * @brief Reads [ITPOR]: power-on reset or RESET occurred
+ *
+ * @param itpor
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getItPorFlag(bool *itpor)
+{
+    BQ27621FlagSet flags;
+    BQ27621_error_code retVal = getFlags(&flags);
+    if (retVal != OK)
+        return retVal;
+    *itpor = flags.itpor;
+    return OK;
+}
+
+/**
+ * @brief Reads [FC]: full charge detected
+ *
+ * @param fc
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getFcFlag(bool *fc)
+{
+    BQ27621FlagSet flags;
+    BQ27621_error_code retVal = getFlags(&flags);
+    if (retVal != OK)
+        return retVal;
+    *fc = flags.fullCharge;
+    return OK;
+}
+
+/**
+ * @brief Reads [CHG]: fast charging allowed
+ *
+ * @param chg
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getChgFlag(bool *chg)
+{
+    BQ27621FlagSet flags;
+    BQ27621_error_code retVal = getFlags(&flags);
+    if (retVal != OK)
+        return retVal;
+    *chg = flags.charging;
+    return OK;
+}
+
+/**
+ * @brief Reads [DSG]: discharging detected
+ *
+ * @param dsg
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getDsgFlag(bool *dsg)
+{
+    BQ27621FlagSet flags;
+    BQ27621_error_code retVal = getFlags(&flags);
+    if (retVal != OK)
+        return retVal;
+    *dsg = flags.discharging;
+    return OK;
+}
+
+/**
+ * @brief
+ *
+ * @param deviceType Pointer to uint16_t that will hold
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getDeviceType(uint16_t *deviceType)
+{
+    return readControlWord(DEVICE_TYPE, deviceType);
+}
+
+/**
+ * @brief Reads the ADC power/accuracy trade-off from OpConfig() [ADMLP] and [ADOLP]
+ *
+ * @param mode Pointer to AdcMode that will hold the mode
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::getAdcMode(AdcMode *mode)
+{
+    uint16_t opConfig;
+    BQ27621_error_code retVal = getOpConfig(&opConfig);
+    if (retVal != OK)
+        return retVal;
+    if (!(opConfig & OPCONFIG_ADMLP))
+        *mode = ADC_ACCURATE;
+    else
+        *mode = (opConfig & OPCONFIG_ADOLP) ? ADC_LOWEST_POWER : ADC_LOW_POWER;
+    return OK;
+}
+
+/**
+ * @brief Sets OpConfig() [ADMLP] and [ADOLP]. Nothing is written if the mode is already selected, otherwise this
+ * costs a CONFIG UPDATE round trip.
+ *
+ * @param mode ADC mode
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::setAdcMode(AdcMode mode)
+{
+    uint16_t oldOpConfig;
+    BQ27621_error_code retVal = getOpConfig(&oldOpConfig);
+    if (retVal != OK)
+        return retVal;
+
+    uint16_t bits = 0;
+    if (mode == ADC_LOW_POWER)
+        bits = OPCONFIG_ADMLP;
+    else if (mode == ADC_LOWEST_POWER)
+        bits = OPCONFIG_ADMLP | OPCONFIG_ADOLP;
+
+    uint16_t newOpConfig = (uint16_t)((oldOpConfig & ~(OPCONFIG_ADMLP | OPCONFIG_ADOLP)) | bits);
+    if (newOpConfig == oldOpConfig)
+        return OK;
+    return setOpConfig(newOpConfig);
+}
+
+/**
+ * @brief Sets (SET_HIBERNATE) or clears (CLEAR_HIBERNATE) CONTROL_STATUS [HIBERNATE]. With it set the gauge drops
+ * from SLEEP into HIBERNATE once its current is low enough; clearing it lets the gauge wake up again.
+ *
+ * @param hibernate
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::setHibernate(bool hibernate)
+{
+    return executeControlWord(hibernate ? SET_HIBERNATE : CLEAR_HIBERNATE);
+}
+
+/**
+ * @brief Sets CONTROL_STATUS [POWERMIN] (TOGGLE_POWERMIN)
+ *
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::togglePowerMin(void)
+{
+    return executeControlWord(TOGGLE_POWERMIN);
+}
+
+/**
+ * @brief Unseals if needed, then issues SHUTDOWN_ENABLE and SHUTDOWN. The gauge stops answering until its wake-up pin
+ * is asserted and comes back from a full reset, so every cached value is dropped. If either subcommand fails the
+ * gauge is resealed when this call unsealed it; [SHUTDOWNEN] may stay set until the next reset.
+ *
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::shutdown(void)
+{
+    bool sealed;
+    BQ27621_error_code retVal = isSealed(&sealed);
+    if (retVal != OK)
+        return retVal;
+    if (sealed)
+    {
+        retVal = unseal();
+        if (retVal != OK)
+        {
+            seal(); // The first key word may have been taken
+            return retVal;
+        }
+    }
+
+    retVal = executeControlWord(SHUTDOWN_ENABLE);
+    if (retVal == OK)
+    {
+        invalidateBlockCache();
+        invalidateStatus();
+        _configMode = false;
+        retVal = executeControlWord(SHUTDOWN);
+    }
+    if (retVal != OK && sealed)
+        seal(); // Best effort: the original error is the one reported
+    return retVal;
+}
+
+/**
+ * @brief Unseals the gauge and enters CONFIG UPDATE mode for the lifetime of the session
+ *
+ * @param gauge Gauge to configure
+ */
+BQ27621::ConfigSession::ConfigSession(BQ27621 &gauge) : _gauge(gauge), _status(OK), _active(true)
+{
+    apply(_gauge.enterConfig(true));
+}
+
+/**
+ * @brief Commits with SOFT_RESET if commit() was not called
+ *
+ */
+BQ27621::ConfigSession::~ConfigSession()
+{
+    commit();
+}
+
+BQ27621_error_code BQ27621::ConfigSession::apply(BQ27621_error_code retVal)
+{
+    if (_status == OK)
+        _status = retVal;
+    return _status;
+}
+
+BQ27621_error_code BQ27621::ConfigSession::setCapacity(uint16_t capacity)
+{
+    return (_status != OK) ? _status : apply(_gauge.setCapacity(capacity));
+}
+
+BQ27621_error_code BQ27621::ConfigSession::setDesignenergy(uint16_t energy)
+{
+    return (_status != OK) ? _status : apply(_gauge.setDesignenergy(energy));
+}
+
+BQ27621_error_code BQ27621::ConfigSession::setTerminateVoltage(uint16_t voltage)
+{
+    return (_status != OK) ? _status : apply(_gauge.setTerminateVoltage(voltage));
+}
+
+BQ27621_error_code BQ27621::ConfigSession::setSociDelta(uint8_t sociDelta)
+{
+    return (_status != OK) ? _status : apply(_gauge.setSociDelta(sociDelta));
+}
+
+BQ27621_error_code BQ27621::ConfigSession::setSOC1Thresholds(uint8_t set, uint8_t clear)
+{
+    return (_status != OK) ? _status : apply(_gauge.setSOC1Thresholds(set, clear));
+}
+
+BQ27621_error_code BQ27621::ConfigSession::setSOCFThresholds(uint8_t set, uint8_t clear)
+{
+    return (_status != OK) ? _status : apply(_gauge.setSOCFThresholds(set, clear));
+}
+
+/**
+ * @brief Sets or clears OpConfig bits (OpConfig)
+ *
+ * @param mask Bits to change
+ * @param enable true to set, false to clear
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::ConfigSession::setOpConfigBits(uint16_t mask, bool enable)
+{
+    return (_status != OK) ? _status : apply(_gauge.updateOpConfig(mask, enable ? mask : 0));
+}
+
+/**
+ * @brief Writes the modified blocks, leaves CONFIG UPDATE with one exit subcommand and reseals.
+ * If a setter failed, the session still leaves CONFIG UPDATE but the pending changes are discarded.
+ *
+ * @param mode Exit subcommand
+ * @return BQ27621_error_code First error of the session
+ */
+BQ27621_error_code BQ27621::ConfigSession::commit(ConfigExitMode mode)
+{
+    if (!_active)
+        return _status;
+    _active = false;
+
+    if (_status != OK)
+    {
+        _gauge.invalidateBlockCache();
+        _gauge.invalidateStatus();
+    }
+    return apply(_gauge.exitConfig(mode));
+}
@@ -16,12 +16,105 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "BQ27621_defs.h"
+#include "BQ27621_i2c.h"
+#include "BQ27621_registers.h"
 
 /**
- * @brief BQ27621 testing Macro. Not used in production
+ * @brief BQ27621 testing Macro. Not used in production; 1 pulls in <iostream> for debug output
  *
  */
-#define BQ27621_TESTING 1
+#ifndef BQ27621_TESTING
+#define BQ27621_TESTING 0
+#endif
+
+/**
+ * @brief Maximum number of registers readWords() packs into one combined transfer
+ *
+ */
+#ifndef BQ27621_MAX_BATCH
+#define BQ27621_MAX_BATCH 8
+#endif
+
+/**
+ * @brief Largest payload of a single register write (one data memory block)
+ *
+ */
+#define BQ27621_MAX_WRITE BQ27621_BLOCK_SIZE
+
+/**
+ * @brief Set to 1 to count transfers, bytes, errors and latency per command (see BQ27621_instrument.h).
+ * With 0 the hooks compile away.
+ *
+ */
+#ifndef BQ27621_INSTRUMENTATION
+#define BQ27621_INSTRUMENTATION 0
+#endif
+
+#if BQ27621_INSTRUMENTATION
+#include "BQ27621_instrument.h"
+#endif
+
+/**
+ * @brief Number of 32-byte data memory blocks kept in the shadow cache
+ *
+ */
+#ifndef BQ27621_BLOCK_CACHE_SIZE
+#define BQ27621_BLOCK_CACHE_SIZE 4
+#endif
+
+/**
+ * @brief Timeout and poll period while waiting for [CFGUPMODE] to change (microseconds)
+ *
+ */
+#ifndef BQ27621_CONFIG_TIMEOUT_US
+#define BQ27621_CONFIG_TIMEOUT_US 2000000
+#endif
+#ifndef BQ27621_CONFIG_POLL_US
+#define BQ27621_CONFIG_POLL_US 10000
+#endif
+
+/**
+ * @brief Default retry policy (see BQ27621RetryPolicy)
+ *
+ */
+#ifndef BQ27621_RETRY_ATTEMPTS
+#define BQ27621_RETRY_ATTEMPTS 4
+#endif
+#ifndef BQ27621_RETRY_BACKOFF_US
+#define BQ27621_RETRY_BACKOFF_US 500
+#endif
+#ifndef BQ27621_RETRY_MAX_BACKOFF_US
+#define BQ27621_RETRY_MAX_BACKOFF_US 8000
+#endif
+#ifndef BQ27621_OPERATION_BUDGET_US
+#define BQ27621_OPERATION_BUDGET_US (2 * BQ27621_CONFIG_TIMEOUT_US + 1000000) // Enter and leave CONFIG UPDATE
+#endif
+
+/**
+ * @brief How transfers that were not acknowledged (NACK_RECEIVED) or found the bus busy (BUS_BUSY) are retried.
+ * Transfers carrying RESET, SOFT_RESET, EXIT_CFGUPDATE or EXIT_RESIM are never repeated, as the first attempt may
+ * have been executed.
+ */
+struct BQ27621RetryPolicy
+{
+    uint8_t maxAttempts;       // Tries per transfer, 1 disables retries
+    uint32_t backoffMicros;    // Delay before the first retry, doubled for each further one
+    uint32_t maxBackoffMicros; // Upper bound of one delay
+    uint32_t operationBudget;  // Microseconds an operation run through step(), or a blocking transfer and its
+                               // retries, may take, 0 for no limit
+};
+
+/**
+ * @brief Retry counters since the driver was created
+ *
+ */
+struct BQ27621RetryStats
+{
+    uint32_t retries;   // Transfers repeated
+    uint32_t recovered; // Transfers that succeeded after at least one retry
+    uint32_t exhausted; // Transfers that failed after the last allowed attempt or could not be repeated
+    uint32_t timeouts;  // Operations stopped by operationBudget
+};
 
 #if defined(BQ27621_TESTING) && BQ27621_TESTING != 0
 #include <iostream>
@@ -32,16 +125,158 @@ using std::string;
 using std::uppercase;
 #endif
 
+/**
+ * @brief Shadow copy of one data memory block
+ *
+ */
+struct BQ27621BlockCacheEntry
+{
+    uint8_t classId;
+    uint8_t block;
+    bool valid;
+    bool dirty;           // Modified in RAM, not yet written to the gauge
+    uint16_t lastUse;     // LRU stamp
+    uint8_t data[BQ27621_BLOCK_SIZE];
+};
+
+/**
+ * @brief Largest image flashImage() accepts
+ *
+ */
+#ifndef BQ27621_FLASH_MAX_BLOCKS
+#define BQ27621_FLASH_MAX_BLOCKS 32
+#endif
+
+/**
+ * @brief One 32-byte data memory block of a configuration image
+ *
+ */
+struct BQ27621ImageBlock
+{
+    uint8_t classId;
+    uint8_t block;
+    uint32_t mask; // Bit i set if data[i] is part of the image, 0xFFFFFFFF for the whole block
+    uint8_t data[BQ27621_BLOCK_SIZE];
+};
+
+/**
+ * @brief Outcome of flashImage()
+ *
+ */
+struct BQ27621FlashReport
+{
+    uint32_t changed;       // Bit i set if image[i] differed from the gauge and was written
+    uint16_t bytesChanged;
+    uint8_t blocksRead;
+    uint8_t blocksWritten;
+    uint8_t classSwitches;  // DataClass() selections issued
+    uint8_t verifyFailures; // Written blocks that read back different
+};
+
+/**
+ * @brief State of one resumable driver operation. Start it with one of the BQ27621::start*() functions and call
+ * BQ27621::step() until it returns something other than PENDING. Must stay alive until then.
+ */
+struct BQ27621Operation
+{
+    uint8_t kind;
+    uint8_t state;
+    BQ27621_error_code result;
+    bool inFlight;  // A transfer was started and not polled to completion
+    bool entered;   // The operation entered CONFIG UPDATE and must exit it
+    bool sealed;    // The operation unsealed the gauge and must reseal it
+    bool evicting;  // Writing back a dirty block to free a cache entry
+    bool cleanup;   // Leaving CONFIG UPDATE and resealing after a failure
+    bool exitUnconfirmed; // A failed exit subcommand may or may not have run
+    BQ27621_error_code failure; // Result reported once the cleanup is done
+    uint32_t waitStart;
+    uint32_t waitMicros; // Non-zero while waiting between polls
+    uint32_t pollStart;
+
+    uint8_t classId; // Data memory target of a write
+    uint8_t offset;
+    uint8_t len;
+    uint8_t first; // Snapshot range
+    uint8_t last;
+    void *output;  // uint8_t *, uint16_t * or BQ27621Snapshot * depending on kind
+    BQ27621BlockCacheEntry *entry;
+
+    uint8_t command[4];
+    uint8_t data[BQ27621_BLOCK_SIZE];
+    uint8_t buffer[BQ27621_SNAPSHOT_SIZE];
+    uint8_t select[3][2];
+    I2C_message messages[5];
+    uint8_t messageCount;  // Messages of the current transfer
+    uint8_t attempts;      // Retries of the current transfer
+    bool started;          // startMicros is set
+    uint32_t startMicros;  // First step() of the operation
+#if BQ27621_INSTRUMENTATION
+    uint32_t transferStart;
+#endif
+};
+
 class BQ27621
 {
 private:
-    I2C_device &_i2c_device; // Change for I2C class or structure from application MCU
+    I2C_device &_i2c_device; // Transport implemented by the application MCU or host (see BQ27621_i2c.h)
     uint8_t _i2c_address;
+    BQ27621BusPath _busPath; // Mux channels selected before each transfer
     uint16_t _device_type;
     bool _seal_flag;
     bool _userConfigControl;
+    bool _configMode;
+    bool _itporSeen; // [ITPOR] in the last Flags() checked outside CONFIG UPDATE
+
+    BQ27621BlockCacheEntry _blockCache[BQ27621_BLOCK_CACHE_SIZE];
+    uint16_t _blockCacheClock;
 
-    static uint16_t byte_swap(uint16_t word);
+    uint16_t _opConfig; // Write-through shadow of OpConfig()
+    bool _opConfigValid;
+    BQ27621FlagSet _flags; // Last Flags() read
+    bool _flagsValid;
+    uint32_t _flagsTimestamp;
+    uint32_t _statusMaxAge; // Microseconds a cached Flags() value may be reused, 0 to always read
+#if BQ27621_INSTRUMENTATION
+    BQ27621Instrumentation _instrumentation;
+    uint16_t _instrumentControl; // Last Control() subcommand written
+    uint8_t _instrumentClass;    // Last subclass selected
+
+    void instrument(const I2C_message *messages, size_t count, BQ27621_error_code result, uint32_t micros);
+#endif
+
+    BQ27621RetryPolicy _retryPolicy;
+    BQ27621RetryStats _retryStats;
+
+    static bool retryable(BQ27621_error_code result);
+    static bool repeatable(const I2C_message *messages, size_t count);
+    uint32_t backoff(uint8_t attempt) const;
+    BQ27621_error_code retryTransfer(I2C_message *messages, size_t count, BQ27621_error_code result);
+
+    BQ27621_error_code transferOnce(I2C_message *messages, size_t count)
+    {
+        BQ27621_error_code selected = _i2c_device.selectPath(_busPath);
+        if (selected != OK)
+            return selected;
+#if BQ27621_INSTRUMENTATION
+        uint32_t start = _i2c_device.micros();
+        BQ27621_error_code retVal = _i2c_device.transfer(messages, count);
+        instrument(messages, count, retVal, _i2c_device.micros() - start);
+        return retVal;
+#else
+        return _i2c_device.transfer(messages, count);
+#endif
+    }
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count)
+    {
+        BQ27621_error_code retVal = transferOnce(messages, count);
+        return (retVal == OK) ? OK : retryTransfer(messages, count, retVal);
+    }
+
+    static constexpr uint16_t byte_swap(uint16_t word)
+    {
+        return (uint16_t)(((word & 0x00FF) << 8) | ((word & 0xFF00) >> 8));
+    }
 
     BQ27621_error_code isSealed(bool *isSealed);
     BQ27621_error_code seal(void);
@@ -52,33 +287,107 @@ private:
 
     BQ27621_error_code softReset(void);
 
+    // Little-endian register word as it arrives on the bus
+    static constexpr uint16_t decodeWord(const uint8_t *data)
+    {
+        return (uint16_t)(data[0] | (data[1] << 8));
+    }
+    void decodeSnapshot(const uint8_t *data, uint8_t first, uint8_t last, BQ27621Snapshot *snapshot);
+
+    BQ27621_error_code run(BQ27621Operation *op);
+    BQ27621_error_code issue(BQ27621Operation *op);
+    BQ27621_error_code complete(BQ27621Operation *op);
+    BQ27621_error_code finish(BQ27621Operation *op, BQ27621_error_code result);
+    BQ27621_error_code startReadBytes(BQ27621Operation *op, uint8_t subAddress, uint8_t *data, size_t len);
+    BQ27621BlockCacheEntry *findBlock(uint8_t classId, uint8_t block);
+    BQ27621BlockCacheEntry *victimBlock(bool clean);
+
+    template <uint8_t First>
+    static void decodeBurst(const uint8_t *data)
+    {
+        (void)data;
+    }
+
+    template <uint8_t First, class Reg, class... Rest>
+    static void decodeBurst(const uint8_t *data, typename Reg::value_type *value, typename Rest::value_type *...rest)
+    {
+        *value = Reg::decode(&data[Reg::address - First]);
+        decodeBurst<First, Rest...>(data, rest...);
+    }
+
+    BQ27621_error_code readBytes(uint8_t subAddress, uint8_t *data, size_t len);
+    BQ27621_error_code writeBytes(uint8_t subAddress, const uint8_t *data, size_t len);
     BQ27621_error_code readWord(uint16_t subAdress, uint16_t *word);
     BQ27621_error_code readControlWord(uint16_t function, uint16_t *word);
 
     BQ27621_error_code executeControlWord(uint16_t function );
 
+    BQ27621_error_code waitConfigMode(bool active);
+    BQ27621_error_code abortConfig(BQ27621_error_code failure, bool exitPending);
+
     BQ27621_error_code blockDataControl(void);
     BQ27621_error_code blockDataClass(uint8_t id);
     BQ27621_error_code blockDataOffset(uint8_t offset);
     BQ27621_error_code blockDataChecksum(uint8_t *checksum);
 
-    BQ27621_error_code readBlockData(uint8_t offset, uint8_t *data);
-    BQ27621_error_code writeBlockData(uint8_t offset, uint8_t data);
+    BQ27621_error_code readBlockData(uint8_t *data);
+    BQ27621_error_code writeBlockData(const uint8_t *data);
 
-    BQ27621_error_code computeBlockChecksum(uint8_t *checksum);
+    static uint8_t computeBlockChecksum(const uint8_t *data);
     BQ27621_error_code writeBlockChecksum(uint8_t checksum);
 
-    BQ27621_error_code writeExtendedData(uint8_t classId, uint8_t offset, uint8_t *data, size_t len);
-    BQ27621_error_code readExtendedData(uint8_t classId, uint8_t offset, uint8_t *data);
+    BQ27621_error_code loadBlock(uint8_t classId, uint8_t block, BQ27621BlockCacheEntry **entry);
+    BQ27621_error_code storeBlock(BQ27621BlockCacheEntry *entry);
+    void checkItPor(uint16_t flags);
+    void cacheFlags(uint16_t flags);
+    static void decodeFlags(uint16_t raw, BQ27621FlagSet *flags);
+    static void decodeStatus(uint16_t raw, BQ27621StatusSet *status);
+    BQ27621_error_code updateOpConfig(uint16_t mask, uint16_t value);
+
+    size_t imageMessages(uint8_t classId, uint8_t block, int16_t *currentClass, uint8_t select[3][2], I2C_message *messages);
+    BQ27621_error_code readImageBlock(uint8_t classId, uint8_t block, int16_t *currentClass, uint8_t *data);
+    BQ27621_error_code writeImageBlock(uint8_t classId, uint8_t block, int16_t *currentClass, const uint8_t *data, uint8_t checksum);
+    void syncCachedBlock(uint8_t classId, uint8_t block, const uint8_t *data);
+
+    BQ27621_error_code writeExtendedData(uint8_t classId, uint8_t offset, const uint8_t *data, size_t len);
+    BQ27621_error_code readExtendedData(uint8_t classId, uint8_t offset, uint8_t *data, size_t len);
 
 
     //... More to add
 
 public:
-    BQ27621(I2C_device &i2cDevice);
+    BQ27621(I2C_device &i2cDevice, uint8_t i2cAddress = BQ27621_I2C_ADDRESS);
+    BQ27621(I2C_device &i2cDevice, const BQ27621BusPath &busPath, uint8_t i2cAddress = BQ27621_I2C_ADDRESS);
     ~BQ27621();
 
     BQ27621_error_code init();
+
+    const BQ27621BusPath &busPath(void) const { return _busPath; }
+    void setBusPath(const BQ27621BusPath &busPath) { _busPath = busPath; }
+
+    // Data memory access. Between enterConfig(true) and exitConfig() writes are coalesced per block.
+    BQ27621_error_code enterConfig(bool userControl = true);
+    BQ27621_error_code exitConfig(ConfigExitMode mode = CONFIG_EXIT_SOFT_RESET);
+    BQ27621_error_code flushBlockCache(void);
+    void invalidateBlockCache(void);
+    BQ27621_error_code reset(void);
+
+    // Bulk provisioning: only blocks that differ from the image are written
+    BQ27621_error_code readImage(BQ27621ImageBlock *image, size_t count);
+    BQ27621_error_code flashImage(const BQ27621ImageBlock *image, size_t count, bool verify, BQ27621FlashReport *report, ConfigExitMode mode = CONFIG_EXIT_SOFT_RESET);
+
+    // Decoded status. Flags() may be served from cache for up to maxAge microseconds.
+    BQ27621_error_code getFlags(BQ27621FlagSet *flags);
+    BQ27621_error_code getStatus(BQ27621FlagSet *flags, BQ27621StatusSet *status);
+    void setStatusMaxAge(uint32_t maxAge);
+    void invalidateStatus(void);
+
+    // Retries and operation deadlines
+    static BQ27621RetryPolicy defaultRetryPolicy(void);
+    void setRetryPolicy(const BQ27621RetryPolicy &policy) { _retryPolicy = policy; }
+    const BQ27621RetryPolicy &retryPolicy(void) const { return _retryPolicy; }
+    const BQ27621RetryStats &retryStats(void) const { return _retryStats; }
+
     BQ27621_error_code setCapacity(uint16_t capacity);
     BQ27621_error_code setDesignenergy(uint16_t energy);
     BQ27621_error_code setTerminateVoltage(uint16_t voltage);
@@ -86,10 +395,45 @@ public:
     // Battery characteristics
     BQ27621_error_code getVoltage(uint16_t *voltage);
     BQ27621_error_code getCurrent(int16_t *current);
-    BQ27621_error_code getCapacity(CapacityMeasure type = C_MEASURE_REMAIN,uint16_t *capacity);
+    BQ27621_error_code getCapacity(CapacityMeasure type, uint16_t *capacity);
     BQ27621_error_code getPower(int16_t *power);
-    BQ27621_error_code getSOC(SocMeasure type = FILTERED, uint16_t *soc);
-    BQ27621_error_code getTemperature(TempMeasure type = T_MEASURE_BATTERY, uint16_t *temperature);
+    BQ27621_error_code getSOC(SocMeasure type, uint16_t *soc);
+    BQ27621_error_code getTemperature(TempMeasure type, uint16_t *temperature);
+
+    // Burst read of the standard command register file
+    BQ27621_error_code readSnapshot(BQ27621Snapshot *snapshot, Commands first = BQ27621_SNAPSHOT_FIRST, Commands last = BQ27621_SNAPSHOT_LAST);
+    /**
+     * @brief Reads one register described at compile time, e.g. read<BQ27621Registers::Voltage>(&voltage)
+     *
+     */
+    template <class Reg>
+    BQ27621_error_code read(typename Reg::value_type *value)
+    {
+        uint8_t data[Reg::width];
+        BQ27621_error_code retVal = readBytes(Reg::address, data, Reg::width);
+        if (retVal == OK)
+            *value = Reg::decode(data);
+        return retVal;
+    }
+
+    /**
+     * @brief Reads several registers with the smallest burst that covers them; the burst bounds and every
+     * decode offset are compile-time constants
+     *
+     */
+    template <class... Regs>
+    BQ27621_error_code readBurst(typename Regs::value_type *...values)
+    {
+        typedef BQ27621Burst<Regs...> Burst;
+        uint8_t data[Burst::size];
+        BQ27621_error_code retVal = readBytes(Burst::first, data, Burst::size);
+        if (retVal == OK)
+            decodeBurst<Burst::first, Regs...>(data, values...);
+        return retVal;
+    }
+
+    // Several non-contiguous standard commands in one combined transfer
+    BQ27621_error_code readWords(const uint8_t *commands, uint16_t *words, size_t count);
 
     // GPOUT commands
     BQ27621_error_code getGpoutPolarity(bool *polarity);
@@ -119,6 +463,56 @@ public:
 
     BQ27621_error_code getDeviceType(uint16_t *deviceType);
 
+    // Power modes. shutdown() needs a GPOUT/BIN wake-up and the gauge restarts from its ROM defaults.
+    BQ27621_error_code getAdcMode(AdcMode *mode);
+    BQ27621_error_code setAdcMode(AdcMode mode);
+    BQ27621_error_code setHibernate(bool hibernate);
+    BQ27621_error_code togglePowerMin(void);
+    BQ27621_error_code shutdown(void);
+
+#if BQ27621_INSTRUMENTATION
+    BQ27621Instrumentation &instrumentation(void) { return _instrumentation; }
+#endif
+
+    // Non-blocking operations: start*() then step() until it stops returning PENDING
+    BQ27621_error_code startReadWord(BQ27621Operation *op, uint8_t command, uint16_t *word);
+    BQ27621_error_code startReadControlWord(BQ27621Operation *op, uint16_t function, uint16_t *word);
+    BQ27621_error_code startReadSnapshot(BQ27621Operation *op, BQ27621Snapshot *snapshot, Commands first = BQ27621_SNAPSHOT_FIRST, Commands last = BQ27621_SNAPSHOT_LAST);
+    BQ27621_error_code startWriteExtendedData(BQ27621Operation *op, uint8_t classId, uint8_t offset, const uint8_t *data, size_t len);
+    BQ27621_error_code step(BQ27621Operation *op);
+
+    class ConfigSession;
+};
+
+/**
+ * @brief Scoped CONFIG UPDATE session. The constructor unseals and enters CONFIG UPDATE once; every setter only
+ * updates the block cache, and commit() (or the destructor) writes each modified block once, leaves CONFIG UPDATE
+ * with the chosen exit subcommand and reseals. The first error is kept and returned by status() and commit().
+ */
+class BQ27621::ConfigSession
+{
+private:
+    BQ27621 &_gauge;
+    BQ27621_error_code _status;
+    bool _active;
+
+    BQ27621_error_code apply(BQ27621_error_code retVal);
+
+public:
+    explicit ConfigSession(BQ27621 &gauge);
+    ~ConfigSession();
+
+    BQ27621_error_code status(void) const { return _status; }
+
+    BQ27621_error_code setCapacity(uint16_t capacity);
+    BQ27621_error_code setDesignenergy(uint16_t energy);
+    BQ27621_error_code setTerminateVoltage(uint16_t voltage);
+    BQ27621_error_code setSociDelta(uint8_t sociDelta);
+    BQ27621_error_code setSOC1Thresholds(uint8_t set, uint8_t clear);
+    BQ27621_error_code setSOCFThresholds(uint8_t set, uint8_t clear);
+    BQ27621_error_code setOpConfigBits(uint16_t mask, bool enable);
+
+    BQ27621_error_code commit(ConfigExitMode mode = CONFIG_EXIT_SOFT_RESET);
 };
 
 #endif /*BQ27621_h*/
\ No newline at end of file
@@ -0,0 +1,592 @@
+/**
+ * @file BQ27621_async.cpp
+ * @author your name (you@domain.com)
+ * @brief Resumable (non-blocking) BQ27621 operations
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621.h"
+
+enum OperationKind : uint8_t
+{
+    OP_READ_BYTES,
+    OP_READ_WORD,
+    OP_READ_CONTROL,
+    OP_READ_SNAPSHOT,
+    OP_WRITE_EXTENDED,
+};
+
+/**
+ * @brief Steps of an operation. Reads only use OP_STATE_TRANSFER; a data memory write walks
+ * LOOKUP -> (STATUS -> UNSEAL -> CFGUPDATE -> WAIT_ENTER -> LOOKUP) -> READ_BLOCK -> MERGE -> WRITE_BLOCK -> EXIT -> WAIT_EXIT -> SEAL
+ * and skips whatever the cache and the current mode make unnecessary.
+ */
+enum OperationState : uint8_t
+{
+    OP_STATE_TRANSFER,
+    OP_STATE_LOOKUP,
+    OP_STATE_STATUS,
+    OP_STATE_UNSEAL,
+    OP_STATE_CFGUPDATE,
+    OP_STATE_WAIT_ENTER,
+    OP_STATE_READ_BLOCK,
+    OP_STATE_MERGE,
+    OP_STATE_WRITE_BLOCK,
+    OP_STATE_EXIT,
+    OP_STATE_WAIT_EXIT,
+    OP_STATE_SEAL,
+    OP_STATE_DONE,
+};
+
+/**
+ * @brief Fills op->command and op->messages with a Control() subcommand write, optionally followed by
+ * the read back of its 2-byte result into op->buffer
+ *
+ * @return size_t Number of messages
+ */
+static size_t controlMessages(BQ27621Operation *op, uint8_t address, uint16_t function, bool read)
+{
+    op->command[0] = COMMAND_CONTROL;
+    op->command[1] = (uint8_t)(function & 0xFF);
+    op->command[2] = (uint8_t)(function >> 8);
+    op->command[3] = COMMAND_CONTROL;
+    op->messages[0] = {address, I2C_MSG_WRITE, 3, op->command};
+    if (!read)
+        return 1;
+    op->messages[1] = {address, I2C_MSG_WRITE, 1, &op->command[3]};
+    op->messages[2] = {address, I2C_MSG_READ, 2, op->buffer};
+    return 3;
+}
+
+static void initOperation(BQ27621Operation *op, uint8_t kind, uint8_t state)
+{
+    op->kind = kind;
+    op->state = state;
+    op->result = PENDING;
+    op->inFlight = false;
+    op->entered = false;
+    op->sealed = false;
+    op->evicting = false;
+    op->cleanup = false;
+    op->exitUnconfirmed = false;
+    op->failure = OK;
+    op->waitMicros = 0;
+    op->entry = NULL;
+    op->messageCount = 0;
+    op->attempts = 0;
+    op->started = false;
+}
+
+/**
+ * @brief Prepares a read of len consecutive registers
+ *
+ * @param op Operation state
+ * @param subAddress First register
+ * @param data Pointer to buffer of at least len bytes, written when the operation completes
+ * @param len Number of bytes
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::startReadBytes(BQ27621Operation *op, uint8_t subAddress, uint8_t *data, size_t len)
+{
+    initOperation(op, OP_READ_BYTES, OP_STATE_TRANSFER);
+    op->command[0] = subAddress;
+    op->messages[0] = {_i2c_address, I2C_MSG_WRITE, 1, op->command};
+    op->messages[1] = {_i2c_address, I2C_MSG_READ, (uint16_t)len, data};
+    op->len = 2;
+    return OK;
+}
+
+/**
+ * @brief Prepares a read of one standard command
+ *
+ * @param op Operation state
+ * @param command Command code
+ * @param word Pointer to uint16_t written when the operation completes
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::startReadWord(BQ27621Operation *op, uint8_t command, uint16_t *word)
+{
+    startReadBytes(op, command, op->buffer, 2);
+    op->kind = OP_READ_WORD;
+    op->output = word;
+    return OK;
+}
+
+/**
+ * @brief Prepares a Control() subcommand write and read back as one combined transfer
+ *
+ * @param op Operation state
+ * @param function Control subcommand
+ * @param word Pointer to uint16_t written when the operation completes
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::startReadControlWord(BQ27621Operation *op, uint16_t function, uint16_t *word)
+{
+    initOperation(op, OP_READ_CONTROL, OP_STATE_TRANSFER);
+    op->len = (uint8_t)controlMessages(op, _i2c_address, function, true);
+    op->output = word;
+    return OK;
+}
+
+/**
+ * @brief Prepares a snapshot burst of the standard commands [first, last]
+ *
+ * @param op Operation state
+ * @param snapshot Pointer to snapshot filled when the operation completes
+ * @param first First command, even
+ * @param last Last command, even
+ * @return BQ27621_error_code BUS_ERROR for a range outside the snapshot registers or an odd bound, which would
+ * decode no register at all
+ */
+BQ27621_error_code BQ27621::startReadSnapshot(BQ27621Operation *op, BQ27621Snapshot *snapshot, Commands first, Commands last)
+{
+    if (first < BQ27621_SNAPSHOT_FIRST || last > BQ27621_SNAPSHOT_LAST || first > last || ((first | last) & 1))
+        return BUS_ERROR;
+
+    startReadBytes(op, first, op->buffer, last + 2 - first);
+    op->kind = OP_READ_SNAPSHOT;
+    op->first = first;
+    op->last = last;
+    op->output = snapshot;
+    return OK;
+}
+
+/**
+ * @brief Prepares a data memory write. The data is copied, so the caller's buffer may be reused at once.
+ *
+ * @param op Operation state
+ * @param classId Data memory class
+ * @param offset Byte offset inside the class
+ * @param data Pointer to bytes to write
+ * @param len Number of bytes (must not cross a block boundary)
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::startWriteExtendedData(BQ27621Operation *op, uint8_t classId, uint8_t offset, const uint8_t *data, size_t len)
+{
+    if (len == 0 || (offset % BQ27621_BLOCK_SIZE) + len > BQ27621_BLOCK_SIZE)
+        return BUS_ERROR;
+
+    initOperation(op, OP_WRITE_EXTENDED, OP_STATE_LOOKUP);
+    op->classId = classId;
+    op->offset = offset;
+    op->len = (uint8_t)len;
+    for (size_t i = 0; i < len; i++)
+        op->data[i] = data[i];
+    return OK;
+}
+
+/**
+ * @brief Advances an operation as far as possible without waiting for the bus
+ *
+ * @param op Operation state
+ * @return BQ27621_error_code PENDING while the operation is in progress, then its result
+ */
+BQ27621_error_code BQ27621::step(BQ27621Operation *op)
+{
+    if (op->state == OP_STATE_DONE)
+        return op->result;
+
+    if (!op->started)
+    {
+        op->started = true;
+        op->startMicros = _i2c_device.micros();
+    }
+
+    BQ27621_error_code retVal;
+    if (op->inFlight)
+    {
+        retVal = _i2c_device.pollTransfer();
+        if (retVal == PENDING)
+            return PENDING;
+        op->inFlight = false;
+#if BQ27621_INSTRUMENTATION
+        instrument(op->messages, op->messageCount, retVal, _i2c_device.micros() - op->transferStart);
+#endif
+        if (retVal == OK && op->attempts != 0)
+        {
+            _retryStats.recovered++;
+            op->attempts = 0;
+        }
+        if (retryable(retVal))
+        {
+            // Wait, then issue() the same state again
+            if (op->attempts + 1 < _retryPolicy.maxAttempts && repeatable(op->messages, op->messageCount))
+            {
+                op->attempts++;
+                _retryStats.retries++;
+                op->waitStart = _i2c_device.micros();
+                op->waitMicros = backoff(op->attempts);
+                retVal = OK;
+            }
+            else
+            {
+                _retryStats.exhausted++;
+            }
+        }
+        else if (retVal == OK)
+        {
+            retVal = complete(op);
+        }
+        if (retVal != OK)
+            return finish(op, retVal);
+    }
+
+    while (op->state != OP_STATE_DONE)
+    {
+        if (_retryPolicy.operationBudget != 0 && !op->cleanup && (uint32_t)(_i2c_device.micros() - op->startMicros) > _retryPolicy.operationBudget)
+        {
+            _retryStats.timeouts++;
+            return finish(op, TIMEOUT_ERROR);
+        }
+        if (op->waitMicros != 0)
+        {
+            if ((uint32_t)(_i2c_device.micros() - op->waitStart) < op->waitMicros)
+                return PENDING;
+            op->waitMicros = 0;
+        }
+
+        retVal = issue(op);
+        if (retVal == PENDING)
+            return PENDING;
+        if (retVal != OK)
+            return finish(op, retVal);
+    }
+    return finish(op, OK);
+}
+
+/**
+ * @brief Runs an operation to completion (blocking)
+ *
+ * @param op Operation state
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::run(BQ27621Operation *op)
+{
+    BQ27621_error_code retVal;
+    while ((retVal = step(op)) == PENDING)
+    {
+        if (op->waitMicros != 0)
+            _i2c_device.delayMicros(op->waitMicros);
+    }
+    return retVal;
+}
+
+/**
+ * @brief Ends an operation. A data memory write that fails after it unsealed the gauge or got SET_CFGUPDATE
+ * acknowledged is not ended at once: like a failed ConfigSession it drops the block cache, then leaves CONFIG UPDATE
+ * and reseals as a best effort, and reports the original error once that is done. An exit subcommand that failed is
+ * not sent again before the gauge was seen still in CONFIG UPDATE for BQ27621_CONFIG_TIMEOUT_US, as it may have run.
+ *
+ * @param op Operation state
+ * @param result Result of the operation
+ * @return BQ27621_error_code result, or PENDING while the cleanup runs
+ */
+BQ27621_error_code BQ27621::finish(BQ27621Operation *op, BQ27621_error_code result)
+{
+    if (op->cleanup)
+    {
+        if (result == TIMEOUT_ERROR && op->state == OP_STATE_WAIT_EXIT && op->exitUnconfirmed)
+        {
+            // Still in CONFIG UPDATE long after the failed exit: it did not run, sending it now is no repeat
+            op->exitUnconfirmed = false;
+            op->waitMicros = 0;
+            op->state = OP_STATE_EXIT;
+            return PENDING;
+        }
+        // An error of the cleanup does not replace the original one, but resealing is still attempted
+        if (result != OK && op->sealed && op->state != OP_STATE_SEAL)
+        {
+            op->attempts = 0;
+            op->waitMicros = 0;
+            op->state = OP_STATE_SEAL;
+            return PENDING;
+        }
+        result = op->failure;
+    }
+    else if (result != OK && op->kind == OP_WRITE_EXTENDED)
+    {
+        bool unsealing = op->sealed || op->state == OP_STATE_UNSEAL;
+        bool entering = (op->state == OP_STATE_WAIT_ENTER); // SET_CFGUPDATE was acknowledged, entry is under way
+        bool exiting = (op->state == OP_STATE_EXIT || op->state == OP_STATE_WAIT_EXIT); // An exit may have run
+        if (unsealing || entering || exiting || op->entered)
+        {
+            invalidateBlockCache();
+            invalidateStatus();
+            op->cleanup = true;
+            op->failure = result;
+            op->sealed = unsealing;
+            op->attempts = 0;
+            op->waitMicros = 0;
+            if (exiting)
+            {
+                op->exitUnconfirmed = (op->state == OP_STATE_EXIT);
+                op->pollStart = _i2c_device.micros();
+                op->state = OP_STATE_WAIT_EXIT;
+            }
+            else
+            {
+                op->state = entering ? OP_STATE_WAIT_ENTER : (op->entered ? OP_STATE_EXIT : OP_STATE_SEAL);
+            }
+            return PENDING;
+        }
+    }
+
+#if BQ27621_INSTRUMENTATION
+    if (op->started)
+        _instrumentation.recordOperation(_i2c_device.micros() - op->startMicros);
+#endif
+    op->state = OP_STATE_DONE;
+    op->result = result;
+    return result;
+}
+
+/**
+ * @brief Executes the current state: starts its transfer (returns PENDING) or, for states that need no bus
+ * traffic, moves to the next state (returns OK)
+ *
+ * @param op Operation state
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::issue(BQ27621Operation *op)
+{
+    size_t count = 0;
+    uint8_t block = op->offset / BQ27621_BLOCK_SIZE;
+
+    switch (op->state)
+    {
+    case OP_STATE_TRANSFER:
+        count = op->len;
+        break;
+
+    case OP_STATE_LOOKUP:
+        op->entry = findBlock(op->classId, block);
+        if (op->entry != NULL)
+        {
+            op->entry->lastUse = ++_blockCacheClock;
+            op->state = OP_STATE_MERGE;
+        }
+        else if (!_configMode)
+        {
+            op->state = OP_STATE_STATUS;
+        }
+        else
+        {
+            op->entry = victimBlock(true);
+            if (op->entry != NULL)
+            {
+                op->state = OP_STATE_READ_BLOCK;
+            }
+            else
+            {
+                op->entry = victimBlock(false);
+                op->evicting = true;
+                op->state = OP_STATE_WRITE_BLOCK;
+            }
+        }
+        return OK;
+
+    case OP_STATE_STATUS:
+        count = controlMessages(op, _i2c_address, CONTROL_STATUS, true);
+        break;
+
+    case OP_STATE_UNSEAL:
+        controlMessages(op, _i2c_address, BQ27621_UNSEAL_KEY, false);
+        op->messages[1] = op->messages[0]; // The key is written twice
+        count = 2;
+        break;
+
+    case OP_STATE_CFGUPDATE:
+        count = controlMessages(op, _i2c_address, SET_CFGUPDATE, false);
+        break;
+
+    case OP_STATE_EXIT:
+        count = controlMessages(op, _i2c_address, SOFT_RESET, false);
+        break;
+
+    case OP_STATE_SEAL:
+        count = controlMessages(op, _i2c_address, SEALED, false);
+        break;
+
+    case OP_STATE_WAIT_ENTER:
+    case OP_STATE_WAIT_EXIT:
+        op->command[0] = COMMAND_FLAGS;
+        op->messages[0] = {_i2c_address, I2C_MSG_WRITE, 1, op->command};
+        op->messages[1] = {_i2c_address, I2C_MSG_READ, 2, op->buffer};
+        count = 2;
+        break;
+
+    case OP_STATE_READ_BLOCK:
+    case OP_STATE_WRITE_BLOCK:
+    {
+        BQ27621BlockCacheEntry *entry = op->entry;
+        bool write = (op->state == OP_STATE_WRITE_BLOCK);
+        op->select[0][0] = EXTENDED_BLOCK_DATA_CONTROL;
+        op->select[0][1] = 0x00;
+        op->select[1][0] = EXTENDED_DATA_CLASS;
+        op->select[1][1] = write ? entry->classId : op->classId;
+        op->select[2][0] = EXTENDED_DATA_BLOCK;
+        op->select[2][1] = write ? entry->block : block;
+        for (size_t i = 0; i < 3; i++)
+            op->messages[i] = {_i2c_address, I2C_MSG_WRITE, 2, op->select[i]};
+
+        op->buffer[0] = EXTENDED_BLOCK_DATA;
+        if (write)
+        {
+            for (size_t i = 0; i < BQ27621_BLOCK_SIZE; i++)
+                op->buffer[i + 1] = entry->data[i];
+            op->command[0] = EXTENDED_BLOCK_DATA_CHECKSUM;
+            op->command[1] = computeBlockChecksum(entry->data);
+            op->messages[3] = {_i2c_address, I2C_MSG_WRITE, BQ27621_BLOCK_SIZE + 1, op->buffer};
+            op->messages[4] = {_i2c_address, I2C_MSG_WRITE, 2, op->command};
+        }
+        else
+        {
+            op->messages[3] = {_i2c_address, I2C_MSG_WRITE, 1, op->buffer};
+            op->messages[4] = {_i2c_address, I2C_MSG_READ, BQ27621_BLOCK_SIZE + 1, op->buffer};
+        }
+        count = 5;
+        break;
+    }
+
+    case OP_STATE_MERGE:
+    {
+        uint8_t *target = &op->entry->data[op->offset % BQ27621_BLOCK_SIZE];
+        for (size_t i = 0; i < op->len; i++)
+        {
+            if (target[i] != op->data[i])
+            {
+                target[i] = op->data[i];
+                op->entry->dirty = true;
+            }
+        }
+
+        if (!op->entry->dirty)
+            op->state = op->entered ? OP_STATE_EXIT : OP_STATE_DONE;
+        else if (_userConfigControl)
+            op->state = OP_STATE_DONE; // Coalesced, written by exitConfig()
+        else if (!_configMode)
+            op->state = OP_STATE_STATUS;
+        else
+            op->state = OP_STATE_WRITE_BLOCK;
+        return OK;
+    }
+
+    default:
+        return BUS_ERROR;
+    }
+
+    op->messageCount = (uint8_t)count;
+#if BQ27621_INSTRUMENTATION
+    op->transferStart = _i2c_device.micros();
+#endif
+    BQ27621_error_code retVal = _i2c_device.selectPath(_busPath); // Mux writes complete before the transfer starts
+    if (retVal == OK)
+        retVal = _i2c_device.startTransfer(op->messages, count);
+    if (retVal != OK)
+        return retVal;
+    op->inFlight = true;
+    return PENDING;
+}
+
+/**
+ * @brief Consumes the result of the transfer of the current state and selects the next state
+ *
+ * @param op Operation state
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::complete(BQ27621Operation *op)
+{
+    switch (op->state)
+    {
+    case OP_STATE_TRANSFER:
+        if (op->kind == OP_READ_SNAPSHOT)
+            decodeSnapshot(op->buffer, op->first, op->last, (BQ27621Snapshot *)op->output);
+        else if (op->kind == OP_READ_CONTROL || op->kind == OP_READ_WORD)
+            *(uint16_t *)op->output = decodeWord(op->buffer);
+        op->state = OP_STATE_DONE;
+        break;
+
+    case OP_STATE_STATUS:
+        op->state = (decodeWord(op->buffer) & STATUS_SS) ? OP_STATE_UNSEAL : OP_STATE_CFGUPDATE;
+        break;
+
+    case OP_STATE_UNSEAL:
+        op->sealed = true;
+        op->state = OP_STATE_CFGUPDATE;
+        break;
+
+    case OP_STATE_CFGUPDATE:
+        op->pollStart = _i2c_device.micros();
+        op->state = OP_STATE_WAIT_ENTER;
+        break;
+
+    case OP_STATE_WAIT_ENTER:
+    case OP_STATE_WAIT_EXIT:
+    {
+        bool entering = (op->state == OP_STATE_WAIT_ENTER);
+        bool active = (decodeWord(op->buffer) & FLAG_CFGUPMODE) != 0;
+        if (active == entering)
+        {
+            _configMode = entering;
+            if (entering)
+            {
+                op->entered = true;
+                op->state = op->cleanup ? OP_STATE_EXIT : OP_STATE_LOOKUP;
+            }
+            else
+            {
+                op->state = op->sealed ? OP_STATE_SEAL : OP_STATE_DONE;
+            }
+            break;
+        }
+        if ((uint32_t)(_i2c_device.micros() - op->pollStart) > BQ27621_CONFIG_TIMEOUT_US)
+            return TIMEOUT_ERROR;
+        op->waitStart = _i2c_device.micros();
+        op->waitMicros = BQ27621_CONFIG_POLL_US;
+        break;
+    }
+
+    case OP_STATE_READ_BLOCK:
+        if (computeBlockChecksum(op->buffer) != op->buffer[BQ27621_BLOCK_SIZE])
+            return BUS_ERROR;
+        for (size_t i = 0; i < BQ27621_BLOCK_SIZE; i++)
+            op->entry->data[i] = op->buffer[i];
+        op->entry->classId = op->classId;
+        op->entry->block = op->offset / BQ27621_BLOCK_SIZE;
+        op->entry->valid = true;
+        op->entry->dirty = false;
+        op->entry->lastUse = ++_blockCacheClock;
+        op->state = OP_STATE_MERGE;
+        break;
+
+    case OP_STATE_WRITE_BLOCK:
+        op->entry->dirty = false;
+        if (op->evicting)
+        {
+            op->evicting = false;
+            op->state = OP_STATE_LOOKUP;
+        }
+        else
+        {
+            op->state = op->entered ? OP_STATE_EXIT : OP_STATE_DONE;
+        }
+        break;
+
+    case OP_STATE_EXIT:
+        op->pollStart = _i2c_device.micros();
+        op->state = OP_STATE_WAIT_EXIT;
+        break;
+
+    case OP_STATE_SEAL:
+        op->state = OP_STATE_DONE;
+        break;
+
+    default:
+        return BUS_ERROR;
+    }
+    return OK;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file BQ27621_batch.cpp
+ * @author your name (you@domain.com)
+ * @brief Batched decoding and unit conversion of raw BQ27621 register arrays
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_batch.h"
+
+#if BQ27621_BATCH_SIMD && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define BATCH_X86 1
+#include <immintrin.h>
+#else
+#define BATCH_X86 0
+#endif
+
+struct FieldConversion
+{
+    bool isSigned;
+    float scale;
+    float offset;
+};
+
+// Indexed by BQ27621BatchField
+static const FieldConversion conversions[BATCH_FIELD_COUNT] = {
+    {false, 0.1f, -273.15f},
+    {false, 0.001f, 0.0f},
+    {true, 0.001f, 0.0f},
+    {true, 0.001f, 0.0f},
+    {false, 0.001f, 0.0f},
+    {false, 0.001f, 0.0f},
+    {false, 1.0f, 0.0f},
+    {false, 0.1f, -273.15f},
+};
+
+typedef void (*ConvertKernel)(const uint8_t *src, float *dst, size_t count, bool bigEndian, const FieldConversion &conversion);
+
+static void convertScalar(const uint8_t *src, float *dst, size_t count, bool bigEndian, const FieldConversion &conversion)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t word = bigEndian ? (uint16_t)((src[2 * i] << 8) | src[2 * i + 1]) : (uint16_t)(src[2 * i] | (src[2 * i + 1] << 8));
+        int32_t value = conversion.isSigned ? (int32_t)(int16_t)word : (int32_t)word;
+        float scaled = (float)value * conversion.scale;
+        dst[i] = scaled + conversion.offset;
+    }
+}
+
+#if BATCH_X86
+
+static void convertSse2(const uint8_t *src, float *dst, size_t count, bool bigEndian, const FieldConversion &conversion)
+{
+    const __m128 scale = _mm_set1_ps(conversion.scale);
+    const __m128 offset = _mm_set1_ps(conversion.offset);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i words = _mm_loadu_si128((const __m128i *)&src[2 * i]);
+        if (bigEndian)
+            words = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+        __m128i low, high;
+        if (conversion.isSigned)
+        {
+            low = _mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16);
+            high = _mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16);
+        }
+        else
+        {
+            low = _mm_unpacklo_epi16(words, zero);
+            high = _mm_unpackhi_epi16(words, zero);
+        }
+        _mm_storeu_ps(&dst[i], _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(low), scale), offset));
+        _mm_storeu_ps(&dst[i + 4], _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(high), scale), offset));
+    }
+    convertScalar(&src[2 * i], &dst[i], count - i, bigEndian, conversion);
+}
+
+__attribute__((target("avx2"))) static void convertAvx2(const uint8_t *src, float *dst, size_t count, bool bigEndian, const FieldConversion &conversion)
+{
+    const __m256 scale = _mm256_set1_ps(conversion.scale);
+    const __m256 offset = _mm256_set1_ps(conversion.offset);
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i words = _mm256_loadu_si256((const __m256i *)&src[2 * i]);
+        if (bigEndian)
+            words = _mm256_shuffle_epi8(words, swap);
+        __m128i low = _mm256_castsi256_si128(words);
+        __m128i high = _mm256_extracti128_si256(words, 1);
+        __m256i lowValues = conversion.isSigned ? _mm256_cvtepi16_epi32(low) : _mm256_cvtepu16_epi32(low);
+        __m256i highValues = conversion.isSigned ? _mm256_cvtepi16_epi32(high) : _mm256_cvtepu16_epi32(high);
+        _mm256_storeu_ps(&dst[i], _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(lowValues), scale), offset));
+        _mm256_storeu_ps(&dst[i + 8], _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(highValues), scale), offset));
+    }
+    convertSse2(&src[2 * i], &dst[i], count - i, bigEndian, conversion);
+}
+
+#endif /*BATCH_X86*/
+
+/**
+ * @brief Uses the fastest kernel the CPU supports
+ *
+ */
+BQ27621BatchDecoder::BQ27621BatchDecoder() : _kernel(bestKernel())
+{
+}
+
+/**
+ * @brief Uses the given kernel, or the best supported one if the CPU lacks it
+ *
+ * @param kernel
+ */
+BQ27621BatchDecoder::BQ27621BatchDecoder(BQ27621BatchKernel kernel) : _kernel(kernelSupported(kernel) ? kernel : bestKernel())
+{
+}
+
+bool BQ27621BatchDecoder::kernelSupported(BQ27621BatchKernel kernel)
+{
+    switch (kernel)
+    {
+    case BATCH_KERNEL_SCALAR:
+        return true;
+#if BATCH_X86
+    case BATCH_KERNEL_SSE2:
+        return true;
+    case BATCH_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+BQ27621BatchKernel BQ27621BatchDecoder::bestKernel(void)
+{
+    if (kernelSupported(BATCH_KERNEL_AVX2))
+        return BATCH_KERNEL_AVX2;
+    if (kernelSupported(BATCH_KERNEL_SSE2))
+        return BATCH_KERNEL_SSE2;
+    return BATCH_KERNEL_SCALAR;
+}
+
+/**
+ * @brief Converts count samples of every field present in raw into decoded
+ *
+ * @param raw Input arrays, NULL fields are skipped
+ * @param decoded Output arrays, required for every field present in raw
+ * @param count Samples per field
+ */
+void BQ27621BatchDecoder::decode(const BQ27621RawBatch &raw, const BQ27621DecodedBatch &decoded, size_t count) const
+{
+    ConvertKernel convert = convertScalar;
+#if BATCH_X86
+    if (_kernel == BATCH_KERNEL_AVX2)
+        convert = convertAvx2;
+    else if (_kernel == BATCH_KERNEL_SSE2)
+        convert = convertSse2;
+#endif
+
+    for (size_t field = 0; field < BATCH_FIELD_COUNT; field++)
+    {
+        if (raw.field[field] != NULL && decoded.field[field] != NULL)
+            convert(raw.field[field], decoded.field[field], count, raw.bigEndian, conversions[field]);
+    }
+}
@@ -0,0 +1,89 @@
+/**
+ * @file BQ27621_batch.h
+ * @author your name (you@domain.com)
+ * @brief Batched decoding and unit conversion of raw BQ27621 register arrays
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_BATCH_H
+#define BQ27621_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Set to 0 to build the scalar kernel only
+ *
+ */
+#ifndef BQ27621_BATCH_SIMD
+#define BQ27621_BATCH_SIMD 1
+#endif
+
+/**
+ * @brief Registers a batch can carry, with the unit they are converted to
+ *
+ */
+enum BQ27621BatchField : uint8_t
+{
+    BATCH_TEMPERATURE,          // 0.1 K -> °C
+    BATCH_VOLTAGE,              // mV -> V
+    BATCH_CURRENT,              // mA -> A, signed
+    BATCH_POWER,                // mW -> W, signed
+    BATCH_REMAINING_CAPACITY,   // mAh -> Ah
+    BATCH_FULL_CHARGE_CAPACITY, // mAh -> Ah
+    BATCH_STATE_OF_CHARGE,      // %
+    BATCH_INTERNAL_TEMPERATURE, // 0.1 K -> °C
+    BATCH_FIELD_COUNT
+};
+
+enum BQ27621BatchKernel : uint8_t
+{
+    BATCH_KERNEL_SCALAR,
+    BATCH_KERNEL_SSE2,
+    BATCH_KERNEL_AVX2,
+};
+
+/**
+ * @brief Structure-of-arrays input: per field, count 2-byte register values exactly as read from the bus
+ * (little-endian, or big-endian when bigEndian is set, e.g. words copied out of data memory). NULL skips a field.
+ */
+struct BQ27621RawBatch
+{
+    const uint8_t *field[BATCH_FIELD_COUNT];
+    bool bigEndian;
+};
+
+/**
+ * @brief Structure-of-arrays output, one float per sample for every field present in the input
+ *
+ */
+struct BQ27621DecodedBatch
+{
+    float *field[BATCH_FIELD_COUNT];
+};
+
+/**
+ * @brief Byte-swaps, sign-extends and scales register arrays. Every kernel computes raw * scale + offset in single
+ * precision with separate multiply and add, so all kernels give bit-identical results.
+ */
+class BQ27621BatchDecoder
+{
+private:
+    BQ27621BatchKernel _kernel;
+
+public:
+    BQ27621BatchDecoder();
+    explicit BQ27621BatchDecoder(BQ27621BatchKernel kernel);
+
+    static BQ27621BatchKernel bestKernel(void);
+    static bool kernelSupported(BQ27621BatchKernel kernel);
+
+    BQ27621BatchKernel kernel(void) const { return _kernel; }
+    void decode(const BQ27621RawBatch &raw, const BQ27621DecodedBatch &decoded, size_t count) const;
+};
+
+#endif /*BQ27621_BATCH_H*/
@@ -21,21 +21,19 @@
 enum BQ27621_error_code : uint8_t
 {
     OK = 0,
-    BUS_ERROR, // Generic I2C bus error
-    // NACK_RECEIVED,
-    // BUS_BUSY,
-    // TIMEOUT_ERROR,
-    //...
+    BUS_ERROR,     // Generic I2C bus error
+    NACK_RECEIVED, // The gauge did not acknowledge, e.g. while it restarts after a reset
+    BUS_BUSY,      // The adapter or bus is in use by another master
+    TIMEOUT_ERROR, // A transfer, a mode change or an operation budget ran out of time
     INCORRECT_DEVICE_TYPE,
+    PENDING, // Asynchronous operation or transfer still in progress
 
 };
 
-typedef uint8_t I2C_device; // TODO change I2C_Device in application
-// TODO
-
 #define BQ27621_DEVICE_TYPE 0x0621
 #define BQ27621_I2C_ADDRESS 0x55
 #define BQ27621_UNSEAL_KEY 0x8000
+#define BQ27621_BLOCK_SIZE 32 // Bytes per data memory block (BlockData() window)
 
 /**
  * @brief The fuel gauge uses a series of 2-byte standard commands to enable system reading and writing of battery information.
@@ -63,6 +61,36 @@ enum Commands : uint8_t
     COMMAND_OPERATION_CONFIGURATION = 0x3A          // NA
 };
 
+#define BQ27621_SNAPSHOT_FIRST COMMAND_TEMPERATURE                // First register covered by a snapshot burst
+#define BQ27621_SNAPSHOT_LAST COMMAND_STATE_OF_CHARGE_UNFILTERED  // Last register covered by a snapshot burst
+#define BQ27621_SNAPSHOT_SIZE (BQ27621_SNAPSHOT_LAST + 2 - BQ27621_SNAPSHOT_FIRST)
+
+/**
+ * @brief Decoded copy of the standard command register file (Temperature() to StateOfChargeUnfiltered()).
+ * Only the registers inside [first, last] of the burst that filled it are updated.
+ */
+struct BQ27621Snapshot
+{
+    uint8_t first;                          // First command code of the burst that filled this snapshot
+    uint8_t last;                           // Last command code of the burst that filled this snapshot
+    uint16_t temperature;                   // 0.1 K
+    uint16_t voltage;                       // mV
+    uint16_t flags;                         // FlagBits
+    uint16_t nominalAvailableCapacity;      // mAh
+    uint16_t fullAvailableCapacity;         // mAh
+    uint16_t remainingCapacity;             // mAh
+    uint16_t fullChargeCapacity;            // mAh
+    int16_t effectiveCurrent;               // mA
+    int16_t averagePower;                   // mW
+    uint16_t stateOfCharge;                 // %
+    uint16_t internalTemperature;           // 0.1 K
+    uint16_t remainingCapacityUnfiltered;   // mAh
+    uint16_t remainingCapacityFiltered;     // mAh
+    uint16_t fullChargeCapacityUnfiltered;  // mAh
+    uint16_t fullChargeCapacityFiltered;    // mAh
+    uint16_t stateOfChargeUnfiltered;       // %
+};
+
 /**
  * @brief Issuing a Control() command requires a subsequent 2-byte subcommand. These additional bytes specify
  * the particular control function desired. The Control() command allows the system to control specific features
@@ -152,6 +180,46 @@ enum FlagBits : uint16_t
     FLAG_DSG = (1 << 0),       // Discharging detected. True when set.
 };
 
+/**
+ * @brief Decoded Flags() word
+ *
+ */
+struct BQ27621FlagSet
+{
+    uint16_t raw;
+    bool overTemperature;  // [OT]
+    bool underTemperature; // [UT]
+    bool fullCharge;       // [FC]
+    bool charging;         // [CHG]
+    bool ocvTaken;         // [OCVTAKEN]
+    bool itpor;            // [ITPOR]
+    bool cfgUpMode;        // [CFGUPMODE]
+    bool batteryDetected;  // [BAT_DET]
+    bool soc1;             // [SOC1]
+    bool socf;             // [SOCF]
+    bool discharging;      // [DSG]
+};
+
+/**
+ * @brief Decoded CONTROL_STATUS word
+ *
+ */
+struct BQ27621StatusSet
+{
+    uint16_t raw;
+    bool shutdownEnabled;    // [SHUTDOWNEN]
+    bool watchdogReset;      // [WDRESET]
+    bool sealed;             // [SS]
+    bool calibrationMode;    // [CALMODE]
+    bool ocvComplete;        // [OCVCMDCOMP]
+    bool ocvFail;            // [OCVFAIL]
+    bool initComplete;       // [INITCOMP]
+    bool powerMin;           // [POWERMIN]
+    bool sleep;              // [SLEEP]
+    bool constantPowerModel; // [LDMD]
+    bool chemChange;         // [CHEMCHNG]
+};
+
 enum OpConfig : uint16_t
 {
     OPCONFIG_RSVD5 = (1 << 15),   // Reserved
@@ -225,6 +293,26 @@ enum StateSubClass : uint8_t
 
 };
 
+enum DischargeSubClass : uint8_t
+{
+    DISCHARGE_SOC1_SET_THRESHOLD = 0,
+    DISCHARGE_SOC1_CLEAR_THRESHOLD = 1,
+    DISCHARGE_SOCF_SET_THRESHOLD = 2,
+    DISCHARGE_SOCF_CLEAR_THRESHOLD = 3,
+};
+
+enum RegistersSubClass : uint8_t
+{
+    REGISTERS_OP_CONFIG = 0,
+};
+
+enum ConfigExitMode : uint8_t
+{
+    CONFIG_EXIT_SOFT_RESET, // SOFT_RESET: OCV measurement and resimulation (DEFAULT)
+    CONFIG_EXIT_CFGUPDATE,  // EXIT_CFGUPDATE: no OCV measurement, no resimulation
+    CONFIG_EXIT_RESIM       // EXIT_RESIM: no OCV measurement, resimulate with the new data
+};
+
 enum CapacityMeasure : uint8_t
 {
     C_MEASURE_REMAIN,     // Remaining Capacity (DEFAULT)
@@ -250,6 +338,13 @@ enum TempMeasure : uint8_t
     T_MEASURE_INTERNAL_TEMP // Internal IC Temperature
 };
 
+enum AdcMode : uint8_t
+{
+    ADC_ACCURATE,     // [ADMLP] and [ADOLP] cleared: longest conversions, full power
+    ADC_LOW_POWER,    // [ADMLP] set (DEFAULT): low-power conversions
+    ADC_LOWEST_POWER  // [ADMLP] and [ADOLP] set: low-power and shortest conversions, least accurate
+};
+
 enum GpoutFunction : uint8_t
 {
     GPOUT_F_SOC_INT, // Set GPOUT to SOC_INT functionality
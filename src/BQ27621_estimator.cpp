@@ -0,0 +1,137 @@
+/**
+ * @file BQ27621_estimator.cpp
+ * @author your name (you@domain.com)
+ * @brief Host-side time-to-empty/time-to-full and health estimator for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_estimator.h"
+
+#define MICROS_PER_HOUR 3600000000ULL
+
+/**
+ * @brief Construct a new BQ27621Estimator object
+ *
+ * @param designCapacity DesignCapacity() in mAh, 0 if not known yet
+ * @param timeConstant Smoothing time constant of current and power, microseconds
+ * @param idleCurrent Current magnitude below which no time estimate is given, mA
+ */
+BQ27621Estimator::BQ27621Estimator(uint16_t designCapacity, uint32_t timeConstant, int16_t idleCurrent) : _timeConstant(timeConstant), _idleCurrent(idleCurrent), _designCapacity(designCapacity)
+{
+    reset();
+}
+
+/**
+ * @brief Reads DesignCapacity() once, so the fade indicator needs no further bus access
+ *
+ * @param gauge
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Estimator::readDesignCapacity(BQ27621 &gauge)
+{
+    return gauge.getCapacity(C_MEASURE_DESIGN, &_designCapacity);
+}
+
+/**
+ * @brief Clears the averages and the throughput counters
+ *
+ */
+void BQ27621Estimator::reset(void)
+{
+    _started = false;
+    _lastSample = 0;
+    _lastCurrent = 0;
+    _lastPower = 0;
+    _averageCurrent = 0;
+    _averagePower = 0;
+    _remainingCapacity = 0;
+    _fullChargeCapacity = 0;
+    _energyIn = 0;
+    _energyOut = 0;
+    _chargeOut = 0;
+}
+
+/**
+ * @brief Adds one sample. Uses EffectiveCurrent(), AveragePower(),
+ * RemainingCapacity() and FullChargeCapacity(). A sample taken at the same time as the previous one only replaces its
+ * values, as no time has passed to integrate or smooth over.
+ *
+ * @param snapshot Sample
+ * @param now Time the sample was read, microseconds
+ */
+void BQ27621Estimator::update(const BQ27621Snapshot &snapshot, uint32_t now)
+{
+    _remainingCapacity = snapshot.remainingCapacity;
+    _fullChargeCapacity = snapshot.fullChargeCapacity;
+
+    if (!_started)
+    {
+        _started = true;
+        _averageCurrent = snapshot.effectiveCurrent;
+        _averagePower = snapshot.averagePower;
+    }
+    else
+    {
+        uint32_t dt = now - _lastSample;
+        if (dt == 0)
+        {
+            _lastCurrent = snapshot.effectiveCurrent;
+            _lastPower = snapshot.averagePower;
+            return;
+        }
+
+        // Throughput integrates the previous sample over the elapsed interval
+        uint64_t power = (uint64_t)(_lastPower < 0 ? -_lastPower : _lastPower) * dt;
+        if (_lastPower < 0)
+            _energyOut += power;
+        else
+            _energyIn += power;
+        if (_lastCurrent < 0)
+            _chargeOut += (uint64_t)(-_lastCurrent) * dt;
+
+        float alpha = (float)dt / ((float)_timeConstant + (float)dt);
+        _averageCurrent += alpha * (snapshot.effectiveCurrent - _averageCurrent);
+        _averagePower += alpha * (snapshot.averagePower - _averagePower);
+    }
+    _lastSample = now;
+    _lastCurrent = snapshot.effectiveCurrent;
+    _lastPower = snapshot.averagePower;
+}
+
+/**
+ * @brief Current estimate, computed from stored state only
+ *
+ * @return BQ27621Estimate
+ */
+BQ27621Estimate BQ27621Estimator::estimate(void) const
+{
+    BQ27621Estimate estimate;
+    estimate.timeToEmpty = BQ27621_TIME_UNAVAILABLE;
+    estimate.timeToFull = BQ27621_TIME_UNAVAILABLE;
+    estimate.averageCurrent = (int16_t)_averageCurrent;
+    estimate.averagePower = (int16_t)_averagePower;
+
+    if (_started && _averageCurrent <= -_idleCurrent)
+    {
+        float minutes = _remainingCapacity * 60.0f / -_averageCurrent;
+        estimate.timeToEmpty = (minutes < BQ27621_TIME_UNAVAILABLE) ? (uint16_t)minutes : BQ27621_TIME_UNAVAILABLE - 1;
+    }
+    else if (_started && _averageCurrent >= _idleCurrent)
+    {
+        uint16_t missing = (_fullChargeCapacity > _remainingCapacity) ? _fullChargeCapacity - _remainingCapacity : 0;
+        float minutes = missing * 60.0f / _averageCurrent;
+        estimate.timeToFull = (minutes < BQ27621_TIME_UNAVAILABLE) ? (uint16_t)minutes : BQ27621_TIME_UNAVAILABLE - 1;
+    }
+
+    estimate.energyIn = (uint32_t)(_energyIn / MICROS_PER_HOUR);
+    estimate.energyOut = (uint32_t)(_energyOut / MICROS_PER_HOUR);
+    estimate.chargeOut = (uint32_t)(_chargeOut / MICROS_PER_HOUR);
+    estimate.cycles = (_designCapacity != 0) ? (uint16_t)(_chargeOut * 100 / MICROS_PER_HOUR / _designCapacity) : 0;
+    uint32_t health = (_designCapacity != 0) ? (uint32_t)((_fullChargeCapacity * 100UL + _designCapacity / 2) / _designCapacity) : 0;
+    estimate.stateOfHealth = (health < UINT8_MAX) ? (uint8_t)health : UINT8_MAX; // Saturates on a bad DesignCapacity()
+    return estimate;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file BQ27621_estimator.h
+ * @author your name (you@domain.com)
+ * @brief Host-side time-to-empty/time-to-full and health estimator for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_ESTIMATOR_H
+#define BQ27621_ESTIMATOR_H
+
+#include "BQ27621.h"
+
+#define BQ27621_TIME_UNAVAILABLE 0xFFFF // As the gauges that report TimeToEmpty() do
+
+/**
+ * @brief Derived values, all computed from samples already read
+ *
+ */
+struct BQ27621Estimate
+{
+    uint16_t timeToEmpty;    // Minutes at the smoothed discharge current, BQ27621_TIME_UNAVAILABLE unless discharging
+    uint16_t timeToFull;     // Minutes at the smoothed charge current, BQ27621_TIME_UNAVAILABLE unless charging
+    int16_t averageCurrent;  // mA, exponentially smoothed EffectiveCurrent()
+    int16_t averagePower;    // mW, exponentially smoothed AveragePower()
+    uint32_t energyIn;       // mWh charged since reset()
+    uint32_t energyOut;      // mWh discharged since reset()
+    uint32_t chargeOut;      // mAh discharged since reset()
+    uint16_t cycles;         // Equivalent full cycles x100 (chargeOut / DesignCapacity)
+    uint8_t stateOfHealth;   // FullChargeCapacity() as % of DesignCapacity(), 0 if unknown, at most 255
+};
+
+/**
+ * @brief O(1) per sample estimator fed with the snapshots the application already reads (readSnapshot(),
+ * BQ27621Scheduler::values(), ...). Queries never touch the bus.
+ */
+class BQ27621Estimator
+{
+private:
+    uint32_t _timeConstant; // Microseconds
+    int16_t _idleCurrent;   // |current| below this counts as rest, mA
+    uint16_t _designCapacity;
+    bool _started;
+    uint32_t _lastSample;
+    int16_t _lastCurrent;
+    int16_t _lastPower;
+    float _averageCurrent;
+    float _averagePower;
+    uint16_t _remainingCapacity;
+    uint16_t _fullChargeCapacity;
+    uint64_t _energyIn;  // mW x us
+    uint64_t _energyOut; // mW x us
+    uint64_t _chargeOut; // mA x us
+
+public:
+    BQ27621Estimator(uint16_t designCapacity = 0, uint32_t timeConstant = 60000000, int16_t idleCurrent = 10);
+
+    void setDesignCapacity(uint16_t designCapacity) { _designCapacity = designCapacity; }
+    BQ27621_error_code readDesignCapacity(BQ27621 &gauge);
+    void reset(void);
+
+    void update(const BQ27621Snapshot &snapshot, uint32_t now);
+    BQ27621Estimate estimate(void) const;
+};
+
+#endif /*BQ27621_ESTIMATOR_H*/
@@ -0,0 +1,125 @@
+/**
+ * @file BQ27621_events.cpp
+ * @author your name (you@domain.com)
+ * @brief GPOUT driven event mode for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_events.h"
+
+BQ27621EventMonitor::BQ27621EventMonitor(BQ27621 &gauge, GPOUT_line &line) : _gauge(gauge), _line(line), _callback(NULL), _context(NULL), _deltaReference(0), _sociDelta(1), _started(false), _edges(0), _reads(0)
+{
+}
+
+/**
+ * @brief Sets the function that receives events
+ *
+ * @param callback Event sink, NULL to disable
+ * @param context Opaque pointer passed back to callback
+ */
+void BQ27621EventMonitor::setCallback(BQ27621EventCallback callback, void *context)
+{
+    _callback = callback;
+    _context = context;
+}
+
+/**
+ * @brief Selects the GPOUT function, loads the SOCI delta and takes the reference snapshot. Edges latched until then
+ * (the CONFIG UPDATE of the function change can pulse GPOUT) are dropped, the snapshot already covers them.
+ *
+ * @param function GPOUT_F_SOC_INT for delta and threshold pulses, GPOUT_F_BAT_LOW for [SOC1] level
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621EventMonitor::begin(GpoutFunction function)
+{
+    BQ27621_error_code retVal = _gauge.setGpoutFunction(function);
+    if (retVal != OK)
+        return retVal;
+    retVal = _gauge.getSociDelta(&_sociDelta);
+    if (retVal != OK)
+        return retVal;
+    if (_sociDelta == 0)
+        _sociDelta = 1;
+
+    bool edge = true;
+    while (edge)
+    {
+        retVal = _line.waitEdge(0, &edge);
+        if (retVal != OK)
+            return retVal;
+    }
+
+    retVal = _gauge.readSnapshot(&_snapshot);
+    if (retVal != OK)
+        return retVal;
+    _reads++;
+    _deltaReference = _snapshot.stateOfCharge;
+    _started = true;
+    return OK;
+}
+
+/**
+ * @brief Waits up to timeoutMicros for GPOUT and handles the edge if one arrived
+ *
+ * @param timeoutMicros Maximum wait
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621EventMonitor::poll(uint32_t timeoutMicros)
+{
+    bool edge;
+    BQ27621_error_code retVal = _line.waitEdge(timeoutMicros, &edge);
+    if (retVal != OK || !edge)
+        return retVal;
+    return handleEdge();
+}
+
+/**
+ * @brief Reads one snapshot and dispatches every event it implies. Call it from the application's own
+ * GPOUT interrupt handling when poll() is not used. begin() must have succeeded first: configuring GPOUT takes a
+ * CONFIG UPDATE round trip, which has no place on an edge path.
+ *
+ * @return BQ27621_error_code BUS_ERROR if the monitor was never started
+ */
+BQ27621_error_code BQ27621EventMonitor::handleEdge(void)
+{
+    if (!_started)
+        return BUS_ERROR;
+
+    _edges++;
+    uint16_t previousSoc = _snapshot.stateOfCharge;
+    uint16_t previousFlags = _snapshot.flags;
+    BQ27621_error_code retVal = _gauge.readSnapshot(&_snapshot);
+    if (retVal != OK)
+        return retVal;
+    _reads++;
+
+    uint16_t soc = _snapshot.stateOfCharge;
+    uint16_t distance = (soc > _deltaReference) ? soc - _deltaReference : _deltaReference - soc;
+    if (distance >= _sociDelta)
+    {
+        dispatch(EVENT_SOC_DELTA, previousSoc);
+        _deltaReference = soc;
+    }
+
+    uint16_t changed = previousFlags ^ _snapshot.flags;
+    if (changed & FLAG_SOC1)
+        dispatch((_snapshot.flags & FLAG_SOC1) ? EVENT_SOC1_SET : EVENT_SOC1_CLEAR, previousSoc);
+    if (changed & FLAG_SOCF)
+        dispatch((_snapshot.flags & FLAG_SOCF) ? EVENT_SOCF_SET : EVENT_SOCF_CLEAR, previousSoc);
+    return OK;
+}
+
+void BQ27621EventMonitor::dispatch(BQ27621EventType type, uint16_t previousSoc)
+{
+    if (_callback == NULL)
+        return;
+    BQ27621Event event;
+    event.type = type;
+    event.previousStateOfCharge = previousSoc;
+    event.snapshot = &_snapshot;
+    _callback(event, _context);
+}
@@ -0,0 +1,73 @@
+/**
+ * @file BQ27621_events.h
+ * @author your name (you@domain.com)
+ * @brief GPOUT driven event mode for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_EVENTS_H
+#define BQ27621_EVENTS_H
+
+#include "BQ27621.h"
+#include "BQ27621_gpout.h"
+
+enum BQ27621EventType : uint8_t
+{
+    EVENT_SOC_DELTA,  // StateOfCharge() moved by at least the SOCI delta since the last such event
+    EVENT_SOC1_SET,   // [SOC1] set
+    EVENT_SOC1_CLEAR, // [SOC1] cleared
+    EVENT_SOCF_SET,   // [SOCF] set
+    EVENT_SOCF_CLEAR, // [SOCF] cleared
+};
+
+/**
+ * @brief One typed event and the snapshot it was derived from
+ *
+ */
+struct BQ27621Event
+{
+    BQ27621EventType type;
+    uint16_t previousStateOfCharge;
+    const BQ27621Snapshot *snapshot;
+};
+
+typedef void (*BQ27621EventCallback)(const BQ27621Event &event, void *context);
+
+/**
+ * @brief Reads the gauge only when GPOUT signals a change (SOC_INT pulse or BAT_LOW edge) and turns the
+ * difference with the previous reading into typed events. An idle pack causes no bus traffic.
+ */
+class BQ27621EventMonitor
+{
+private:
+    BQ27621 &_gauge;
+    GPOUT_line &_line;
+    BQ27621EventCallback _callback;
+    void *_context;
+    BQ27621Snapshot _snapshot;
+    uint16_t _deltaReference; // StateOfCharge() at the last EVENT_SOC_DELTA
+    uint8_t _sociDelta;
+    bool _started;
+    uint32_t _edges;
+    uint32_t _reads;
+
+    void dispatch(BQ27621EventType type, uint16_t previousSoc);
+
+public:
+    BQ27621EventMonitor(BQ27621 &gauge, GPOUT_line &line);
+
+    void setCallback(BQ27621EventCallback callback, void *context);
+    BQ27621_error_code begin(GpoutFunction function = GPOUT_F_SOC_INT);
+    BQ27621_error_code poll(uint32_t timeoutMicros);
+    BQ27621_error_code handleEdge(void);
+
+    const BQ27621Snapshot &snapshot(void) const { return _snapshot; }
+    uint32_t edges(void) const { return _edges; }
+    uint32_t reads(void) const { return _reads; }
+};
+
+#endif /*BQ27621_EVENTS_H*/
@@ -0,0 +1,300 @@
+/**
+ * @file BQ27621_flash.cpp
+ * @author your name (you@domain.com)
+ * @brief Diff-based data memory image flashing for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621.h"
+
+static_assert(BQ27621_FLASH_MAX_BLOCKS <= 32, "BQ27621FlashReport::changed holds 32 blocks");
+
+/**
+ * @brief Builds the block selection messages. BlockDataControl() and DataClass() are only written when the
+ * class changes; consecutive blocks of one class just move DataBlock().
+ *
+ * @param classId Data memory class
+ * @param block Block index inside the class
+ * @param currentClass Class selected by the previous access, -1 if none; updated
+ * @param select Storage for the message payloads
+ * @param messages Receives the messages
+ * @return Number of messages
+ */
+size_t BQ27621::imageMessages(uint8_t classId, uint8_t block, int16_t *currentClass, uint8_t select[3][2], I2C_message *messages)
+{
+    size_t count = 0;
+    if (*currentClass != classId)
+    {
+        select[0][0] = EXTENDED_BLOCK_DATA_CONTROL;
+        select[0][1] = 0x00;
+        select[1][0] = EXTENDED_DATA_CLASS;
+        select[1][1] = classId;
+        messages[count++] = {_i2c_address, I2C_MSG_WRITE, 2, select[0]};
+        messages[count++] = {_i2c_address, I2C_MSG_WRITE, 2, select[1]};
+        *currentClass = classId;
+    }
+    select[2][0] = EXTENDED_DATA_BLOCK;
+    select[2][1] = block;
+    messages[count++] = {_i2c_address, I2C_MSG_WRITE, 2, select[2]};
+    return count;
+}
+
+/**
+ * @brief Selects a block and reads it with its checksum in one combined transfer
+ *
+ * @param classId Data memory class
+ * @param block Block index inside the class
+ * @param currentClass See imageMessages()
+ * @param data Receives BQ27621_BLOCK_SIZE bytes followed by the checksum
+ * @return BQ27621_error_code BUS_ERROR also when the checksum does not match
+ */
+BQ27621_error_code BQ27621::readImageBlock(uint8_t classId, uint8_t block, int16_t *currentClass, uint8_t *data)
+{
+    uint8_t select[3][2];
+    uint8_t command = EXTENDED_BLOCK_DATA;
+    I2C_message messages[5];
+    size_t count = imageMessages(classId, block, currentClass, select, messages);
+    messages[count++] = {_i2c_address, I2C_MSG_WRITE, 1, &command};
+    messages[count++] = {_i2c_address, I2C_MSG_READ, BQ27621_BLOCK_SIZE + 1, data};
+
+    BQ27621_error_code retVal = transfer(messages, count);
+    if (retVal != OK)
+    {
+        *currentClass = -1;
+        return retVal;
+    }
+    return (computeBlockChecksum(data) == data[BQ27621_BLOCK_SIZE]) ? OK : BUS_ERROR;
+}
+
+/**
+ * @brief Selects a block, writes it and commits it with its checksum in one combined transfer
+ *
+ * @param classId Data memory class
+ * @param block Block index inside the class
+ * @param currentClass See imageMessages()
+ * @param data BQ27621_BLOCK_SIZE bytes
+ * @param checksum BlockDataCheckSum() of data
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::writeImageBlock(uint8_t classId, uint8_t block, int16_t *currentClass, const uint8_t *data, uint8_t checksum)
+{
+    uint8_t select[3][2];
+    uint8_t buffer[BQ27621_BLOCK_SIZE + 1];
+    uint8_t commit[2] = {EXTENDED_BLOCK_DATA_CHECKSUM, checksum};
+    I2C_message messages[5];
+    size_t count = imageMessages(classId, block, currentClass, select, messages);
+
+    buffer[0] = EXTENDED_BLOCK_DATA;
+    for (size_t i = 0; i < BQ27621_BLOCK_SIZE; i++)
+        buffer[i + 1] = data[i];
+    messages[count++] = {_i2c_address, I2C_MSG_WRITE, sizeof(buffer), buffer};
+    messages[count++] = {_i2c_address, I2C_MSG_WRITE, sizeof(commit), commit};
+
+    BQ27621_error_code retVal = transfer(messages, count);
+    if (retVal != OK)
+        *currentClass = -1;
+    return retVal;
+}
+
+/**
+ * @brief Keeps the block cache and the OpConfig shadow coherent with a block written behind their back
+ *
+ */
+void BQ27621::syncCachedBlock(uint8_t classId, uint8_t block, const uint8_t *data)
+{
+    BQ27621BlockCacheEntry *entry = findBlock(classId, block);
+    if (entry != NULL)
+    {
+        for (size_t i = 0; i < BQ27621_BLOCK_SIZE; i++)
+            entry->data[i] = data[i];
+        entry->dirty = false;
+    }
+    if (classId == ID_REGISTERS && block == REGISTERS_OP_CONFIG / BQ27621_BLOCK_SIZE)
+        _opConfigValid = false;
+}
+
+/**
+ * @brief Reads the current contents of the blocks listed in image (classId and block must be set), e.g. to
+ * capture a golden image from a configured gauge. The mask of every block is set to the whole block.
+ *
+ * @param image Blocks to read
+ * @param count Number of blocks
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621::readImage(BQ27621ImageBlock *image, size_t count)
+{
+    bool sealed = false;
+    BQ27621_error_code retVal = OK;
+    if (!_configMode)
+    {
+        retVal = isSealed(&sealed);
+        if (retVal == OK && sealed)
+            retVal = unseal();
+        if (retVal != OK)
+            return retVal;
+    }
+
+    int16_t currentClass = -1;
+    uint8_t data[BQ27621_BLOCK_SIZE + 1];
+    for (size_t i = 0; i < count && retVal == OK; i++)
+    {
+        retVal = readImageBlock(image[i].classId, image[i].block, &currentClass, data);
+        if (retVal != OK)
+            break;
+        for (size_t j = 0; j < BQ27621_BLOCK_SIZE; j++)
+            image[i].data[j] = data[j];
+        image[i].mask = 0xFFFFFFFF;
+    }
+
+    if (sealed)
+    {
+        BQ27621_error_code sealRetVal = seal();
+        if (retVal == OK)
+            retVal = sealRetVal;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Brings data memory in line with a configuration image. Blocks are visited in class/block order and
+ * each is read with one combined transfer; only blocks whose masked bytes differ are written, with a checksum
+ * updated from the one read back instead of summing the block again. CONFIG UPDATE is entered on the first
+ * difference, so flashing an already-provisioned gauge costs reads only. Inside a user session
+ * (enterConfig(true)) the session is left open.
+ *
+ * @param image Image blocks, any order, at most BQ27621_FLASH_MAX_BLOCKS
+ * @param count Number of blocks
+ * @param verify true to read every written block back before leaving CONFIG UPDATE
+ * @param report Filled with what was read, written and verified, may be NULL
+ * @param mode How to leave CONFIG UPDATE if it was entered
+ * @return BQ27621_error_code BUS_ERROR also on a failed verification
+ */
+BQ27621_error_code BQ27621::flashImage(const BQ27621ImageBlock *image, size_t count, bool verify, BQ27621FlashReport *report, ConfigExitMode mode)
+{
+    BQ27621FlashReport local;
+    if (report == NULL)
+        report = &local;
+    *report = BQ27621FlashReport();
+    if (count > BQ27621_FLASH_MAX_BLOCKS)
+        return BUS_ERROR;
+
+    // Visit blocks in (class, block) order so each class is selected once
+    uint8_t order[BQ27621_FLASH_MAX_BLOCKS];
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t j = i;
+        for (; j > 0; j--)
+        {
+            const BQ27621ImageBlock &previous = image[order[j - 1]];
+            if (previous.classId < image[i].classId || (previous.classId == image[i].classId && previous.block <= image[i].block))
+                break;
+            order[j] = order[j - 1];
+        }
+        order[j] = (uint8_t)i;
+    }
+
+    bool session = _configMode;
+    BQ27621_error_code retVal = OK;
+    if (session)
+    {
+        retVal = flushBlockCache();
+    }
+    else
+    {
+        bool sealed;
+        retVal = isSealed(&sealed);
+        if (retVal == OK && sealed)
+        {
+            _seal_flag = true;
+            retVal = unseal();
+        }
+    }
+
+    int16_t currentClass = -1;
+    uint8_t data[BQ27621_BLOCK_SIZE + 1];
+    for (size_t n = 0; n < count && retVal == OK; n++)
+    {
+        const BQ27621ImageBlock &target = image[order[n]];
+        int16_t previousClass = currentClass;
+        retVal = readImageBlock(target.classId, target.block, &currentClass, data);
+        if (retVal != OK)
+            break;
+        report->blocksRead++;
+        if (currentClass != previousClass)
+            report->classSwitches++;
+
+        uint8_t sum = (uint8_t)(0xFF - data[BQ27621_BLOCK_SIZE]);
+        uint8_t changed = 0;
+        for (size_t i = 0; i < BQ27621_BLOCK_SIZE; i++)
+        {
+            if ((target.mask & (1UL << i)) && data[i] != target.data[i])
+            {
+                sum = (uint8_t)(sum - data[i] + target.data[i]);
+                data[i] = target.data[i];
+                changed++;
+            }
+        }
+        if (changed == 0)
+            continue;
+
+        if (!_configMode)
+        {
+            retVal = enterConfig(false);
+            currentClass = -1; // Be conservative about the selection after the mode change
+            if (retVal != OK)
+                break;
+        }
+        previousClass = currentClass;
+        retVal = writeImageBlock(target.classId, target.block, &currentClass, data, (uint8_t)(0xFF - sum));
+        if (retVal != OK)
+            break;
+        if (currentClass != previousClass)
+            report->classSwitches++;
+        syncCachedBlock(target.classId, target.block, data);
+        report->changed |= 1UL << order[n];
+        report->bytesChanged += changed;
+        report->blocksWritten++;
+    }
+
+    for (size_t n = 0; n < count && retVal == OK && verify; n++)
+    {
+        const BQ27621ImageBlock &target = image[order[n]];
+        if (!(report->changed & (1UL << order[n])))
+            continue;
+        int16_t previousClass = currentClass;
+        retVal = readImageBlock(target.classId, target.block, &currentClass, data);
+        if (currentClass != previousClass)
+            report->classSwitches++;
+        for (size_t i = 0; retVal == OK && i < BQ27621_BLOCK_SIZE; i++)
+        {
+            if ((target.mask & (1UL << i)) && data[i] != target.data[i])
+            {
+                report->verifyFailures++;
+                break;
+            }
+        }
+    }
+    if (retVal == OK && report->verifyFailures != 0)
+        retVal = BUS_ERROR;
+
+    if (session)
+        return retVal;
+
+    BQ27621_error_code exitRetVal = OK;
+    if (_configMode)
+    {
+        exitRetVal = exitConfig(mode);
+    }
+    else if (_seal_flag)
+    {
+        _seal_flag = false;
+        exitRetVal = seal();
+    }
+    if (retVal != OK)
+        invalidateBlockCache();
+    return (retVal != OK) ? retVal : exitRetVal;
+}
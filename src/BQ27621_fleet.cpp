@@ -0,0 +1,286 @@
+/**
+ * @file BQ27621_fleet.cpp
+ * @author your name (you@domain.com)
+ * @brief Host-side poller for many BQ27621 gauges spread over several I2C buses
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_fleet.h"
+#include <math.h>
+
+GaugeFleet::GaugeFleet() : _running(false), _period(0), _samples(0), _errors(0), _callback(NULL), _callbackContext(NULL)
+{
+}
+
+GaugeFleet::~GaugeFleet()
+{
+    stop();
+}
+
+/**
+ * @brief Registers a bus. Must be called before start().
+ *
+ * @param device Transport of the bus
+ * @param muxGroup Buses with the same non-negative group are channels of one physical bus behind a mux
+ * @return size_t Bus index
+ */
+size_t GaugeFleet::addBus(I2C_device &device, int muxGroup)
+{
+    size_t worker = _busLocks.size();
+    if (muxGroup >= 0)
+    {
+        for (size_t i = 0; i < _buses.size(); i++)
+        {
+            if (_buses[i].muxGroup == muxGroup)
+                worker = _buses[i].worker;
+        }
+    }
+    if (worker == _busLocks.size())
+        _busLocks.emplace_back(new std::mutex());
+
+    Bus bus;
+    bus.device = &device;
+    bus.muxGroup = muxGroup;
+    bus.worker = worker;
+    _buses.push_back(bus);
+    return _buses.size() - 1;
+}
+
+/**
+ * @brief Creates a gauge on a bus. Must be called before start().
+ *
+ * @param bus Bus index
+ * @param i2cAddress Gauge address
+ * @return size_t Gauge index
+ */
+size_t GaugeFleet::addGauge(size_t bus, uint8_t i2cAddress)
+{
+    Gauge gauge;
+    gauge.bus = bus;
+    gauge.driver.reset(new BQ27621(*_buses[bus].device, i2cAddress));
+    gauge.busy = false;
+    gauge.samples = 0;
+    gauge.errors = 0;
+    gauge.jitterMean = 0;
+    gauge.jitterM2 = 0;
+    gauge.jitterMax = 0;
+    _gauges.push_back(std::move(gauge));
+    _buses[bus].gauges.push_back(_gauges.size() - 1);
+    return _gauges.size() - 1;
+}
+
+/**
+ * @brief Sets the function that receives every sample. It runs on the worker threads.
+ *
+ * @param callback Sample sink, NULL to disable
+ * @param context Opaque pointer passed back to callback
+ */
+void GaugeFleet::setCallback(BQ27621FleetCallback callback, void *context)
+{
+    _callback = callback;
+    _callbackContext = context;
+}
+
+/**
+ * @brief Starts one worker per physical bus, sampling every gauge at rateHz. The gauges of a physical bus are
+ * staggered across the period.
+ *
+ * @param rateHz Target samples per second per gauge
+ * @return true if started
+ */
+bool GaugeFleet::start(double rateHz)
+{
+    if (_running || rateHz <= 0)
+        return false;
+
+    _period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / rateHz));
+    _start = std::chrono::steady_clock::now();
+    _samples = 0;
+    _errors = 0;
+
+    std::vector<size_t> perWorker(_busLocks.size(), 0);
+    for (size_t i = 0; i < _gauges.size(); i++)
+        perWorker[_buses[_gauges[i].bus].worker]++;
+    std::vector<size_t> slot(_busLocks.size(), 0);
+    for (size_t i = 0; i < _gauges.size(); i++)
+    {
+        Gauge &gauge = _gauges[i];
+        size_t worker = _buses[gauge.bus].worker;
+        gauge.due = _start + _period * slot[worker]++ / perWorker[worker];
+        gauge.busy = false;
+        gauge.samples = 0;
+        gauge.errors = 0;
+        gauge.jitterMean = 0;
+        gauge.jitterM2 = 0;
+        gauge.jitterMax = 0;
+    }
+
+    _running = true;
+    for (size_t w = 0; w < _busLocks.size(); w++)
+        _workers.emplace_back(&GaugeFleet::worker, this, w);
+    return true;
+}
+
+/**
+ * @brief Stops and joins the workers
+ *
+ */
+void GaugeFleet::stop(void)
+{
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (!_running)
+            return;
+        _running = false;
+        _stop = std::chrono::steady_clock::now();
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _workers.size(); i++)
+        _workers[i].join();
+    _workers.clear();
+}
+
+/**
+ * @brief Chooses the most overdue gauge of a physical bus. Called with _mutex held.
+ *
+ * @param worker Physical bus
+ * @param now Current time
+ * @param gauge Pointer that will hold the chosen gauge
+ * @param nextDue Pointer that will hold the earliest due time of the bus's gauges when nothing is due
+ * @return true if a gauge is due
+ */
+bool GaugeFleet::pick(size_t worker, std::chrono::steady_clock::time_point now, size_t *gauge, std::chrono::steady_clock::time_point *nextDue)
+{
+    bool found = false;
+    *nextDue = std::chrono::steady_clock::time_point::max();
+    for (size_t b = 0; b < _buses.size(); b++)
+    {
+        if (_buses[b].worker != worker)
+            continue;
+        const std::vector<size_t> &gauges = _buses[b].gauges;
+        for (size_t i = 0; i < gauges.size(); i++)
+        {
+            Gauge &candidate = _gauges[gauges[i]];
+            if (candidate.busy)
+                continue;
+            if (candidate.due <= now && (!found || candidate.due < _gauges[*gauge].due))
+            {
+                *gauge = gauges[i];
+                found = true;
+            }
+            if (candidate.due < *nextDue)
+                *nextDue = candidate.due;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Reads one snapshot under the physical bus lock, updates statistics and reschedules the gauge
+ *
+ * @param index Gauge index
+ */
+void GaugeFleet::sample(size_t index)
+{
+    Gauge &gauge = _gauges[index];
+    BQ27621FleetSample sample;
+    std::chrono::steady_clock::time_point begin;
+
+    {
+        std::lock_guard<std::mutex> busGuard(*_busLocks[_buses[gauge.bus].worker]);
+        begin = std::chrono::steady_clock::now();
+        sample.result = gauge.driver->readSnapshot(&sample.snapshot);
+    }
+    sample.gauge = index;
+    sample.timestampNanos = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(begin.time_since_epoch()).count();
+
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        double late = std::chrono::duration<double, std::micro>(begin - gauge.due).count();
+        gauge.samples++;
+        double delta = late - gauge.jitterMean;
+        gauge.jitterMean += delta / gauge.samples;
+        gauge.jitterM2 += delta * (late - gauge.jitterMean);
+        if (late > gauge.jitterMax)
+            gauge.jitterMax = late;
+        if (sample.result != OK)
+        {
+            gauge.errors++;
+            _errors++;
+        }
+        _samples++;
+
+        gauge.due += _period;
+        if (gauge.due < begin) // Fell behind by more than a period: skip the missed slots instead of bursting
+            gauge.due = begin + _period;
+        gauge.busy = false;
+    }
+
+    if (_callback != NULL)
+        _callback(sample, _callbackContext);
+}
+
+void GaugeFleet::worker(size_t worker)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_running)
+    {
+        size_t index = 0;
+        std::chrono::steady_clock::time_point nextDue;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        if (!pick(worker, now, &index, &nextDue))
+        {
+            if (nextDue == std::chrono::steady_clock::time_point::max())
+                _wake.wait(lock); // No gauge on this bus, until stop()
+            else
+                _wake.wait_until(lock, nextDue);
+            continue;
+        }
+
+        _gauges[index].busy = true;
+        lock.unlock();
+        sample(index);
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Returns fleet-wide counters and the achieved sample rate
+ *
+ * @return BQ27621FleetStats
+ */
+BQ27621FleetStats GaugeFleet::stats(void) const
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+    BQ27621FleetStats stats;
+    std::chrono::steady_clock::time_point end = _running ? std::chrono::steady_clock::now() : _stop;
+    stats.samples = _samples;
+    stats.errors = _errors;
+    stats.elapsedSeconds = std::chrono::duration<double>(end - _start).count();
+    stats.samplesPerSecond = (stats.elapsedSeconds > 0) ? _samples / stats.elapsedSeconds : 0;
+    return stats;
+}
+
+/**
+ * @brief Returns the counters and start-time jitter of one gauge
+ *
+ * @param index Gauge index
+ * @return BQ27621GaugeStats
+ */
+BQ27621GaugeStats GaugeFleet::gaugeStats(size_t index) const
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+    const Gauge &gauge = _gauges[index];
+    BQ27621GaugeStats stats;
+    stats.samples = gauge.samples;
+    stats.errors = gauge.errors;
+    stats.jitterMeanMicros = gauge.jitterMean;
+    stats.jitterStdMicros = (gauge.samples > 1) ? sqrt(gauge.jitterM2 / (gauge.samples - 1)) : 0;
+    stats.jitterMaxMicros = gauge.jitterMax;
+    return stats;
+}
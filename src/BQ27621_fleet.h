@@ -0,0 +1,132 @@
+/**
+ * @file BQ27621_fleet.h
+ * @author your name (you@domain.com)
+ * @brief Host-side poller for many BQ27621 gauges spread over several I2C buses
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_FLEET_H
+#define BQ27621_FLEET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "BQ27621.h"
+
+/**
+ * @brief One published reading of one gauge
+ *
+ */
+struct BQ27621FleetSample
+{
+    size_t gauge;            // Index returned by GaugeFleet::addGauge()
+    uint64_t timestampNanos; // Steady clock time the read started
+    BQ27621_error_code result;
+    BQ27621Snapshot snapshot;
+};
+
+typedef void (*BQ27621FleetCallback)(const BQ27621FleetSample &sample, void *context);
+
+/**
+ * @brief Fleet-wide throughput counters
+ *
+ */
+struct BQ27621FleetStats
+{
+    uint64_t samples;
+    uint64_t errors;
+    double elapsedSeconds;
+    double samplesPerSecond; // Achieved rate since start()
+};
+
+/**
+ * @brief Scheduling jitter of one gauge: how late each read started against its slot
+ *
+ */
+struct BQ27621GaugeStats
+{
+    uint64_t samples;
+    uint64_t errors;
+    double jitterMeanMicros;
+    double jitterStdMicros;
+    double jitterMaxMicros;
+};
+
+/**
+ * @brief Owns BQ27621 instances on several buses and samples each one at a target rate with one worker thread per
+ * physical bus. Gauges on one bus are read one at a time. Buses added with the same mux group are channels of one
+ * physical bus: a single worker serves all of them, since their transactions cannot overlap anyway.
+ */
+class GaugeFleet
+{
+private:
+    struct Bus
+    {
+        I2C_device *device;
+        int muxGroup;
+        size_t worker; // Index of the physical bus, one worker and lock each
+        std::vector<size_t> gauges;
+    };
+
+    struct Gauge
+    {
+        size_t bus;
+        std::unique_ptr<BQ27621> driver;
+        std::chrono::steady_clock::time_point due;
+        bool busy;
+        uint64_t samples;
+        uint64_t errors;
+        double jitterMean; // Welford running mean and M2 of lateness in microseconds
+        double jitterM2;
+        double jitterMax;
+    };
+
+    std::vector<Bus> _buses;
+    std::vector<std::unique_ptr<std::mutex>> _busLocks; // Held for every transaction on the physical bus
+    std::vector<Gauge> _gauges;
+    std::vector<std::thread> _workers;
+
+    mutable std::mutex _mutex; // Protects scheduling state and statistics
+    std::condition_variable _wake;
+    std::atomic<bool> _running;
+    std::chrono::steady_clock::duration _period;
+    std::chrono::steady_clock::time_point _start;
+    std::chrono::steady_clock::time_point _stop;
+    uint64_t _samples;
+    uint64_t _errors;
+
+    BQ27621FleetCallback _callback;
+    void *_callbackContext;
+
+    void worker(size_t worker);
+    bool pick(size_t worker, std::chrono::steady_clock::time_point now, size_t *gauge, std::chrono::steady_clock::time_point *nextDue);
+    void sample(size_t gauge);
+
+public:
+    GaugeFleet();
+    ~GaugeFleet();
+
+    size_t addBus(I2C_device &device, int muxGroup = -1);
+    size_t addGauge(size_t bus, uint8_t i2cAddress = BQ27621_I2C_ADDRESS);
+    BQ27621 &gauge(size_t index) { return *_gauges[index].driver; }
+    size_t gaugeCount(void) const { return _gauges.size(); }
+
+    void setCallback(BQ27621FleetCallback callback, void *context);
+    bool start(double rateHz);
+    void stop(void);
+
+    BQ27621FleetStats stats(void) const;
+    BQ27621GaugeStats gaugeStats(size_t index) const;
+};
+
+#endif /*BQ27621_FLEET_H*/
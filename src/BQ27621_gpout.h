@@ -0,0 +1,37 @@
+/**
+ * @file BQ27621_gpout.h
+ * @author your name (you@domain.com)
+ * @brief GPOUT input line interface used by the BQ27621 event monitor
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_GPOUT_H
+#define BQ27621_GPOUT_H
+
+#include <stdint.h>
+#include "BQ27621_defs.h"
+
+/**
+ * @brief Host input wired to the gauge GPOUT pin. Implement waitEdge() for the application MCU or host
+ * (interrupt flag, GPIO character device, simulation...).
+ */
+class GPOUT_line
+{
+public:
+    virtual ~GPOUT_line() {}
+
+    /**
+     * @brief Waits for the next GPOUT edge selected when the line was configured
+     *
+     * @param timeoutMicros Maximum wait, 0 to only check for an already latched edge
+     * @param edge Pointer to bool set to true if an edge occurred
+     * @return BQ27621_error_code
+     */
+    virtual BQ27621_error_code waitEdge(uint32_t timeoutMicros, bool *edge) = 0;
+};
+
+#endif /*BQ27621_GPOUT_H*/
@@ -0,0 +1,429 @@
+/**
+ * @file BQ27621_history.cpp
+ * @author your name (you@domain.com)
+ * @brief Snapshot ring and compressed telemetry history for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <string.h>
+#include "BQ27621_history.h"
+
+static_assert((BQ27621_RING_SIZE & (BQ27621_RING_SIZE - 1)) == 0, "BQ27621_RING_SIZE must be a power of two");
+
+// Chunk layout: header, one raw sample, then delta records
+struct ChunkHeader
+{
+    uint32_t firstTimestamp;
+    uint32_t lastTimestamp;
+    uint16_t count;
+    uint16_t used; // Bytes of the chunk in use, header included
+};
+
+#define KEYFRAME_SIZE 12
+#define MAX_RECORD_SIZE (1 + 5 * 5) // Mask and five 32-bit varints
+
+static_assert(BQ27621_HISTORY_CHUNK_SIZE >= sizeof(ChunkHeader) + KEYFRAME_SIZE + MAX_RECORD_SIZE, "BQ27621_HISTORY_CHUNK_SIZE too small");
+static_assert(BQ27621_HISTORY_CHUNK_SIZE <= 0xFFFF, "BQ27621_HISTORY_CHUNK_SIZE too large");
+
+enum ChangeMask : uint8_t
+{
+    CHANGE_INTERVAL = 0x01,
+    CHANGE_VOLTAGE = 0x02,
+    CHANGE_CURRENT = 0x04,
+    CHANGE_SOC = 0x08,
+    CHANGE_TEMPERATURE = 0x10,
+};
+
+BQ27621SnapshotRing::BQ27621SnapshotRing() : _head(0)
+{
+    for (uint32_t i = 0; i < BQ27621_RING_SIZE; i++)
+        _slots[i].sequence.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Publishes one entry. Only one thread may publish.
+ *
+ * @param value
+ */
+void BQ27621SnapshotRing::publish(const BQ27621TimedSnapshot &value)
+{
+    uint32_t index = _head.load(std::memory_order_relaxed);
+    Slot &slot = _slots[index & (BQ27621_RING_SIZE - 1)];
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.value = value;
+    slot.sequence.store(index + 1, std::memory_order_release);
+    _head.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Reads the entry at *cursor and advances it. A cursor that fell behind the ring is moved to the oldest
+ * entry still held and the number of skipped entries is added to *lost.
+ *
+ * @param cursor Consumer's cursor, start at 0 or at head()
+ * @param value Entry read
+ * @param lost Incremented by the entries overwritten before they were read, may be NULL
+ * @return true if an entry was read, false if the consumer is caught up
+ */
+bool BQ27621SnapshotRing::read(uint32_t *cursor, BQ27621TimedSnapshot *value, uint32_t *lost)
+{
+    for (;;)
+    {
+        uint32_t head = _head.load(std::memory_order_acquire);
+        if (*cursor == head)
+            return false;
+
+        // Keep one slot of slack: the slot after the newest may already be under rewrite
+        if (head - *cursor > BQ27621_RING_SIZE - 1)
+        {
+            uint32_t oldest = head - (BQ27621_RING_SIZE - 1);
+            if (lost != NULL)
+                *lost += oldest - *cursor;
+            *cursor = oldest;
+        }
+
+        const Slot &slot = _slots[*cursor & (BQ27621_RING_SIZE - 1)];
+        uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence == *cursor + 1)
+        {
+            *value = slot.value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+            {
+                (*cursor)++;
+                return true;
+            }
+        }
+        // Overwritten while reading: retry against the new head
+    }
+}
+
+/**
+ * @brief Reads the newest entry
+ *
+ * @param value
+ * @return false if nothing was published yet
+ */
+bool BQ27621SnapshotRing::latest(BQ27621TimedSnapshot *value)
+{
+    for (;;)
+    {
+        uint32_t head = _head.load(std::memory_order_acquire);
+        if (head == 0)
+            return false;
+        uint32_t cursor = head - 1;
+        if (read(&cursor, value, NULL))
+            return true;
+    }
+}
+
+static inline uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static size_t putVarint(uint8_t *data, uint32_t value)
+{
+    size_t len = 0;
+    while (value >= 0x80)
+    {
+        data[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    data[len++] = (uint8_t)value;
+    return len;
+}
+
+static uint32_t getVarint(const uint8_t *data, size_t *pos)
+{
+    uint32_t value = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+    do
+    {
+        byte = data[(*pos)++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+static void putKeyframe(uint8_t *data, const BQ27621HistorySample &sample)
+{
+    memcpy(&data[0], &sample.timestamp, 4);
+    memcpy(&data[4], &sample.voltage, 2);
+    memcpy(&data[6], &sample.current, 2);
+    memcpy(&data[8], &sample.stateOfCharge, 2);
+    memcpy(&data[10], &sample.temperature, 2);
+}
+
+static void getKeyframe(const uint8_t *data, BQ27621HistorySample *sample)
+{
+    memcpy(&sample->timestamp, &data[0], 4);
+    memcpy(&sample->voltage, &data[4], 2);
+    memcpy(&sample->current, &data[6], 2);
+    memcpy(&sample->stateOfCharge, &data[8], 2);
+    memcpy(&sample->temperature, &data[10], 2);
+}
+
+/**
+ * @brief Encodes sample as a change of previous
+ *
+ * @return Bytes written to data
+ */
+static size_t encodeRecord(uint8_t *data, const BQ27621HistorySample &previous, int32_t previousInterval, const BQ27621HistorySample &sample)
+{
+    int32_t deltas[5] = {
+        (int32_t)(sample.timestamp - previous.timestamp) - previousInterval,
+        (int32_t)sample.voltage - (int32_t)previous.voltage,
+        (int32_t)sample.current - (int32_t)previous.current,
+        (int32_t)sample.stateOfCharge - (int32_t)previous.stateOfCharge,
+        (int32_t)sample.temperature - (int32_t)previous.temperature,
+    };
+    uint8_t mask = 0;
+    size_t len = 1;
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        if (deltas[i] != 0)
+        {
+            mask |= (uint8_t)(1 << i);
+            len += putVarint(&data[len], zigzag(deltas[i]));
+        }
+    }
+    data[0] = mask;
+    return len;
+}
+
+/**
+ * @brief Decodes the record at *pos into *sample, which holds the previous sample on entry
+ *
+ */
+static void decodeRecord(const uint8_t *data, size_t *pos, BQ27621HistorySample *sample, int32_t *interval)
+{
+    uint8_t mask = data[(*pos)++];
+    if (mask & CHANGE_INTERVAL)
+        *interval += unzigzag(getVarint(data, pos));
+    sample->timestamp += (uint32_t)*interval;
+    if (mask & CHANGE_VOLTAGE)
+        sample->voltage = (uint16_t)(sample->voltage + unzigzag(getVarint(data, pos)));
+    if (mask & CHANGE_CURRENT)
+        sample->current = (int16_t)(sample->current + unzigzag(getVarint(data, pos)));
+    if (mask & CHANGE_SOC)
+        sample->stateOfCharge = (uint16_t)(sample->stateOfCharge + unzigzag(getVarint(data, pos)));
+    if (mask & CHANGE_TEMPERATURE)
+        sample->temperature = (uint16_t)(sample->temperature + unzigzag(getVarint(data, pos)));
+}
+
+static ChunkHeader readHeader(const uint8_t *chunk)
+{
+    ChunkHeader header;
+    memcpy(&header, chunk, sizeof(header));
+    return header;
+}
+
+/**
+ * @brief Construct a new BQ27621History object
+ *
+ * @param storage Buffer holding the chunks, it must outlive the history
+ * @param size Size of storage; whole chunks of BQ27621_HISTORY_CHUNK_SIZE bytes are used
+ */
+BQ27621History::BQ27621History(uint8_t *storage, size_t size) : _storage(storage), _chunks(size / BQ27621_HISTORY_CHUNK_SIZE)
+{
+    clear();
+}
+
+void BQ27621History::clear(void)
+{
+    _oldest = 0;
+    _live = 0;
+    _samples = 0;
+    _lastInterval = 0;
+    memset(&_last, 0, sizeof(_last));
+}
+
+/**
+ * @brief Address of the logical-th live chunk, 0 being the oldest
+ *
+ */
+uint8_t *BQ27621History::chunk(size_t logical) const
+{
+    return &_storage[((_oldest + logical) % _chunks) * BQ27621_HISTORY_CHUNK_SIZE];
+}
+
+/**
+ * @brief Opens a new chunk with sample as its raw first sample, recycling the oldest chunk when full
+ *
+ */
+bool BQ27621History::startChunk(const BQ27621HistorySample &sample)
+{
+    if (_chunks == 0)
+        return false;
+    if (_live == _chunks)
+    {
+        _samples -= readHeader(chunk(0)).count;
+        _oldest = (_oldest + 1) % _chunks;
+        _live--;
+    }
+    uint8_t *data = chunk(_live++);
+    ChunkHeader header = {sample.timestamp, sample.timestamp, 1, (uint16_t)(sizeof(ChunkHeader) + KEYFRAME_SIZE)};
+    memcpy(data, &header, sizeof(header));
+    putKeyframe(&data[sizeof(ChunkHeader)], sample);
+    _lastInterval = 0;
+    return true;
+}
+
+/**
+ * @brief Appends one sample
+ *
+ * @param sample Timestamps must not decrease
+ * @return false if the timestamp went backwards or there is no storage
+ */
+bool BQ27621History::append(const BQ27621HistorySample &sample)
+{
+    if (_live != 0 && (int32_t)(sample.timestamp - _last.timestamp) < 0)
+        return false;
+
+    bool stored = false;
+    if (_live != 0)
+    {
+        uint8_t *data = chunk(_live - 1);
+        ChunkHeader header = readHeader(data);
+        if (header.used + MAX_RECORD_SIZE <= BQ27621_HISTORY_CHUNK_SIZE)
+        {
+            header.used += encodeRecord(&data[header.used], _last, _lastInterval, sample);
+            header.count++;
+            header.lastTimestamp = sample.timestamp;
+            memcpy(data, &header, sizeof(header));
+            _lastInterval = (int32_t)(sample.timestamp - _last.timestamp);
+            stored = true;
+        }
+    }
+    if (!stored && !startChunk(sample))
+        return false;
+
+    _last = sample;
+    _samples++;
+    return true;
+}
+
+/**
+ * @brief Logical index of the last chunk starting at or before timestamp (binary search on the chunk headers)
+ *
+ * @return _live if timestamp is older than the history
+ */
+size_t BQ27621History::findChunk(uint32_t timestamp) const
+{
+    size_t low = 0;
+    size_t high = _live;
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if ((int32_t)(readHeader(chunk(middle)).firstTimestamp - timestamp) <= 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return (low == 0) ? _live : low - 1;
+}
+
+/**
+ * @brief Finds the newest sample taken at or before timestamp
+ *
+ * @param timestamp
+ * @param sample
+ * @return false if timestamp is older than the history
+ */
+bool BQ27621History::find(uint32_t timestamp, BQ27621HistorySample *sample) const
+{
+    size_t logical = findChunk(timestamp);
+    if (logical == _live)
+        return false;
+
+    const uint8_t *data = chunk(logical);
+    ChunkHeader header = readHeader(data);
+    BQ27621HistorySample current;
+    getKeyframe(&data[sizeof(ChunkHeader)], &current);
+    size_t pos = sizeof(ChunkHeader) + KEYFRAME_SIZE;
+    int32_t interval = 0;
+    for (uint16_t i = 1; i < header.count; i++)
+    {
+        BQ27621HistorySample next = current;
+        int32_t nextInterval = interval;
+        size_t nextPos = pos;
+        decodeRecord(data, &nextPos, &next, &nextInterval);
+        if ((int32_t)(next.timestamp - timestamp) > 0)
+            break;
+        current = next;
+        interval = nextInterval;
+        pos = nextPos;
+    }
+    *sample = current;
+    return true;
+}
+
+/**
+ * @brief Copies samples taken at or after from, oldest first
+ *
+ * @param from
+ * @param samples Destination
+ * @param max Capacity of samples
+ * @return Samples copied
+ */
+size_t BQ27621History::copy(uint32_t from, BQ27621HistorySample *samples, size_t max) const
+{
+    size_t logical = findChunk(from);
+    if (logical == _live)
+        logical = 0;
+
+    size_t copied = 0;
+    for (; logical < _live && copied < max; logical++)
+    {
+        const uint8_t *data = chunk(logical);
+        ChunkHeader header = readHeader(data);
+        BQ27621HistorySample current;
+        getKeyframe(&data[sizeof(ChunkHeader)], &current);
+        size_t pos = sizeof(ChunkHeader) + KEYFRAME_SIZE;
+        int32_t interval = 0;
+        for (uint16_t i = 0; i < header.count && copied < max; i++)
+        {
+            if (i != 0)
+                decodeRecord(data, &pos, &current, &interval);
+            if ((int32_t)(current.timestamp - from) >= 0)
+                samples[copied++] = current;
+        }
+    }
+    return copied;
+}
+
+/**
+ * @brief Bytes of storage holding samples, chunk headers included
+ *
+ */
+size_t BQ27621History::bytesUsed(void) const
+{
+    size_t used = 0;
+    for (size_t i = 0; i < _live; i++)
+        used += readHeader(chunk(i)).used;
+    return used;
+}
+
+BQ27621HistorySample BQ27621History::fromSnapshot(const BQ27621TimedSnapshot &value)
+{
+    BQ27621HistorySample sample;
+    sample.timestamp = value.timestamp;
+    sample.voltage = value.snapshot.voltage;
+    sample.current = value.snapshot.effectiveCurrent;
+    sample.stateOfCharge = value.snapshot.stateOfCharge;
+    sample.temperature = value.snapshot.temperature;
+    return sample;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file BQ27621_history.h
+ * @author your name (you@domain.com)
+ * @brief Snapshot ring and compressed telemetry history for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_HISTORY_H
+#define BQ27621_HISTORY_H
+
+#include <atomic>
+#include <stddef.h>
+#include "BQ27621.h"
+
+#ifndef BQ27621_RING_SIZE
+#define BQ27621_RING_SIZE 64 // Power of two
+#endif
+
+#ifndef BQ27621_HISTORY_CHUNK_SIZE
+#define BQ27621_HISTORY_CHUNK_SIZE 256
+#endif
+
+/**
+ * @brief Snapshot and the time it was read
+ *
+ */
+struct BQ27621TimedSnapshot
+{
+    uint32_t timestamp;
+    BQ27621Snapshot snapshot;
+};
+
+/**
+ * @brief Lock-free single-producer/multi-consumer ring of snapshots. The producer never waits: when a consumer falls
+ * more than BQ27621_RING_SIZE entries behind, the oldest entries are overwritten and reported as lost. Each consumer
+ * keeps its own cursor, so every consumer sees every entry it keeps up with.
+ */
+class BQ27621SnapshotRing
+{
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence; // Index + 1 of the entry held, 0 while it is being written
+        BQ27621TimedSnapshot value;
+    };
+
+    Slot _slots[BQ27621_RING_SIZE];
+    std::atomic<uint32_t> _head; // Entries published so far
+
+public:
+    BQ27621SnapshotRing();
+
+    void publish(const BQ27621TimedSnapshot &value);
+    uint32_t head(void) const { return _head.load(std::memory_order_acquire); }
+    bool read(uint32_t *cursor, BQ27621TimedSnapshot *value, uint32_t *lost);
+    bool latest(BQ27621TimedSnapshot *value);
+};
+
+/**
+ * @brief The slowly changing part of a snapshot kept in the history
+ *
+ */
+struct BQ27621HistorySample
+{
+    uint32_t timestamp; // Any monotonic unit, e.g. milliseconds
+    uint16_t voltage;
+    int16_t current;
+    uint16_t stateOfCharge;
+    uint16_t temperature;
+};
+
+/**
+ * @brief Compressed history in fixed-size chunks over caller-provided storage. Each chunk starts with one raw sample,
+ * the following samples store only a change mask and zigzag varints of the fields that moved (the timestamp as the
+ * change of the sampling interval), so a steady pack costs one byte per sample. Chunks decode independently; once
+ * the storage is full the oldest chunk is recycled.
+ */
+class BQ27621History
+{
+private:
+    uint8_t *_storage;
+    size_t _chunks;       // Chunks available in _storage
+    size_t _oldest;       // Chunk index of the oldest live chunk
+    size_t _live;         // Live chunks
+    uint32_t _samples;    // Live samples
+    BQ27621HistorySample _last;
+    int32_t _lastInterval;
+
+    uint8_t *chunk(size_t logical) const;
+    size_t findChunk(uint32_t timestamp) const;
+    bool startChunk(const BQ27621HistorySample &sample);
+
+public:
+    BQ27621History(uint8_t *storage, size_t size);
+
+    void clear(void);
+    bool append(const BQ27621HistorySample &sample);
+    bool find(uint32_t timestamp, BQ27621HistorySample *sample) const;
+    size_t copy(uint32_t from, BQ27621HistorySample *samples, size_t max) const;
+
+    uint32_t samples(void) const { return _samples; }
+    size_t bytesUsed(void) const;
+    size_t capacity(void) const { return _chunks * BQ27621_HISTORY_CHUNK_SIZE; }
+
+    static BQ27621HistorySample fromSnapshot(const BQ27621TimedSnapshot &value);
+};
+
+#endif /*BQ27621_HISTORY_H*/
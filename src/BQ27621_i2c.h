@@ -0,0 +1,155 @@
+/**
+ * @file BQ27621_i2c.h
+ * @author your name (you@domain.com)
+ * @brief I2C transport interface used by the BQ27621 driver
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_I2C_H
+#define BQ27621_I2C_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "BQ27621_defs.h"
+
+/**
+ * @brief Direction of a single I2C message
+ *
+ */
+enum I2C_message_flags : uint8_t
+{
+    I2C_MSG_WRITE = 0,
+    I2C_MSG_READ = 1,
+};
+
+/**
+ * @brief One segment of a combined transfer. Consecutive messages of one transfer are separated
+ * by repeated starts; a single stop ends the transfer.
+ */
+struct I2C_message
+{
+    uint8_t address; // 7-bit slave address
+    uint8_t flags;   // I2C_message_flags
+    uint16_t len;    // Number of bytes in data
+    uint8_t *data;   // Bytes to write or buffer to read into
+};
+
+#ifndef BQ27621_MAX_MUX_DEPTH
+#define BQ27621_MAX_MUX_DEPTH 2 // Muxes chained between the host and a gauge
+#endif
+
+/**
+ * @brief Route from the host bus to a device through TCA9548-style muxes: hop[0] is the mux on the host bus, each
+ * following mux sits on the previous hop's channel. An empty path (depth 0) is the host bus itself.
+ */
+struct BQ27621BusPath
+{
+    uint8_t depth;
+    struct
+    {
+        uint8_t muxAddress; // 7-bit address of the mux
+        uint8_t channel;    // Channel 0..7 enabled on it
+    } hop[BQ27621_MAX_MUX_DEPTH];
+};
+
+/**
+ * @brief I2C bus the driver talks through. Implement transfer(), micros() and delayMicros() for the
+ * application MCU or host; the single-message helpers are built on transfer(). DMA or interrupt driven
+ * buses also override startTransfer()/pollTransfer() so the driver's step() API never blocks.
+ */
+class I2C_device
+{
+protected:
+    BQ27621_error_code _pendingResult;
+
+public:
+    I2C_device() : _pendingResult(OK) {}
+    virtual ~I2C_device() {}
+
+    /**
+     * @brief Executes count messages as one combined transfer (start, msg, repeated start, msg, ..., stop)
+     *
+     * @param messages Pointer to message array
+     * @param count Number of messages
+     * @return BQ27621_error_code
+     */
+    virtual BQ27621_error_code transfer(I2C_message *messages, size_t count) = 0;
+
+    /**
+     * @brief Free-running microsecond time base
+     *
+     * @return uint32_t Microseconds
+     */
+    virtual uint32_t micros(void) = 0;
+
+    /**
+     * @brief Blocks for at least us microseconds
+     *
+     * @param us Microseconds
+     */
+    virtual void delayMicros(uint32_t us) = 0;
+
+    /**
+     * @brief Starts a combined transfer. messages and their buffers must stay valid until pollTransfer()
+     * stops returning PENDING. The default runs transfer() to completion.
+     *
+     * @param messages Pointer to message array
+     * @param count Number of messages
+     * @return BQ27621_error_code OK if the transfer was started
+     */
+    virtual BQ27621_error_code startTransfer(I2C_message *messages, size_t count)
+    {
+        _pendingResult = transfer(messages, count);
+        return OK;
+    }
+
+    /**
+     * @brief Reports the state of the transfer started by startTransfer()
+     *
+     * @return BQ27621_error_code PENDING while the bus is busy, then the transfer result
+     */
+    virtual BQ27621_error_code pollTransfer(void)
+    {
+        return _pendingResult;
+    }
+
+    /**
+     * @brief Routes the following transfers to path. Called by the driver before each transfer; buses with muxes
+     * override it, a plain bus has nothing to select.
+     *
+     * @param path Route to the device
+     * @return BQ27621_error_code
+     */
+    virtual BQ27621_error_code selectPath(const BQ27621BusPath &path)
+    {
+        (void)path;
+        return OK;
+    }
+
+    BQ27621_error_code write(uint8_t address, uint8_t *data, uint16_t len)
+    {
+        I2C_message message = {address, I2C_MSG_WRITE, len, data};
+        return transfer(&message, 1);
+    }
+
+    BQ27621_error_code read(uint8_t address, uint8_t *data, uint16_t len)
+    {
+        I2C_message message = {address, I2C_MSG_READ, len, data};
+        return transfer(&message, 1);
+    }
+
+    BQ27621_error_code writeRead(uint8_t address, uint8_t *wdata, uint16_t wlen, uint8_t *rdata, uint16_t rlen)
+    {
+        I2C_message messages[2] = {
+            {address, I2C_MSG_WRITE, wlen, wdata},
+            {address, I2C_MSG_READ, rlen, rdata},
+        };
+        return transfer(messages, 2);
+    }
+};
+
+#endif /*BQ27621_I2C_H*/
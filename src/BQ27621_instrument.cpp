@@ -0,0 +1,291 @@
+/**
+ * @file BQ27621_instrument.cpp
+ * @author your name (you@domain.com)
+ * @brief Per-command bus instrumentation for the BQ27621 driver (BQ27621_INSTRUMENTATION)
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621.h"
+
+#if BQ27621_INSTRUMENTATION
+
+#include <stdio.h>
+
+#define KEY(kind, id) (((uint32_t)(kind) << 16) | (id))
+
+BQ27621Instrumentation::BQ27621Instrumentation()
+{
+    reset();
+}
+
+/**
+ * @brief Clears every counter. Call from the driver's thread.
+ *
+ */
+void BQ27621Instrumentation::reset(void)
+{
+    _used.store(0, std::memory_order_relaxed);
+    for (Slot &s : _slots)
+    {
+        s.key.store(0, std::memory_order_relaxed);
+        s.count.store(0, std::memory_order_relaxed);
+        s.bytes.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint32_t> &e : s.errors)
+            e.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint32_t> &l : s.latency)
+            l.store(0, std::memory_order_relaxed);
+        s.maxMicros.store(0, std::memory_order_relaxed);
+    }
+    for (std::atomic<uint32_t> &o : _operations)
+        o.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+BQ27621Instrumentation::Slot &BQ27621Instrumentation::slot(uint32_t key)
+{
+    uint32_t used = _used.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < used; i++)
+    {
+        if (_slots[i].key.load(std::memory_order_relaxed) == key)
+            return _slots[i];
+    }
+    if (used == BQ27621_INSTRUMENT_SLOTS - 1)
+        key = KEY(INSTRUMENT_OTHER, 0);
+    if (used == BQ27621_INSTRUMENT_SLOTS)
+        return _slots[BQ27621_INSTRUMENT_SLOTS - 1];
+
+    // Single writer: fill the key, then publish the slot
+    _slots[used].key.store(key, std::memory_order_relaxed);
+    _used.store(used + 1, std::memory_order_release);
+    return _slots[used];
+}
+
+static inline void add(std::atomic<uint32_t> &counter, uint32_t value)
+{
+    // Only the driver's thread writes, a plain load/store pair is enough and avoids a locked RMW
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Accounts one transfer against a key
+ *
+ * @param kind
+ * @param id Command code, subcommand or subclass ID
+ * @param bytes Bytes on the wire
+ * @param result Transfer result
+ * @param micros Transfer latency
+ */
+void BQ27621Instrumentation::record(BQ27621InstrumentKind kind, uint16_t id, uint32_t bytes, BQ27621_error_code result, uint32_t micros)
+{
+    Slot &s = slot(KEY(kind, id));
+    uint8_t bucket = 0;
+    for (uint32_t us = micros; us != 0 && bucket < BQ27621_LATENCY_BUCKETS - 1; us >>= 1)
+        bucket++;
+
+    add(s.count, 1);
+    add(s.bytes, bytes);
+    add(s.errors[(result < BQ27621_ERROR_CODE_COUNT) ? result : BUS_ERROR], 1);
+    add(s.latency[bucket], 1);
+    if (micros > s.maxMicros.load(std::memory_order_relaxed))
+        s.maxMicros.store(micros, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Accounts the latency of one operation run through step(), from its first step() to its result
+ *
+ * @param micros
+ */
+void BQ27621Instrumentation::recordOperation(uint32_t micros)
+{
+    size_t bucket = micros;
+    if (micros >= 8)
+    {
+        uint8_t exponent = 0;
+        while ((micros >> exponent) >= 16)
+            exponent++;
+        bucket = 8 + exponent * 8 + ((micros >> exponent) - 8);
+    }
+    add(_operations[bucket], 1);
+}
+
+/**
+ * @brief Operations recorded
+ *
+ */
+uint32_t BQ27621Instrumentation::operations(void) const
+{
+    uint32_t total = 0;
+    for (const std::atomic<uint32_t> &o : _operations)
+        total += o.load(std::memory_order_relaxed);
+    return total;
+}
+
+/**
+ * @brief Operation latency at a quantile, e.g. 0.99 or 0.999
+ *
+ * @param quantile 0 to 1
+ * @return Upper bound of the bucket holding the quantile in microseconds, 0 if nothing was recorded
+ */
+uint32_t BQ27621Instrumentation::operationLatency(float quantile) const
+{
+    uint32_t counts[BQ27621_OPERATION_BUCKETS];
+    uint64_t total = 0;
+    for (size_t i = 0; i < BQ27621_OPERATION_BUCKETS; i++)
+    {
+        counts[i] = _operations[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(quantile * total + 0.5f);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BQ27621_OPERATION_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen < rank)
+            continue;
+        if (i < 8)
+            return (uint32_t)i;
+        uint8_t exponent = (uint8_t)((i - 8) / 8);
+        uint64_t lower = (uint64_t)(8 + (i - 8) % 8) << exponent;
+        uint64_t upper = lower + ((uint64_t)1 << exponent) - 1;
+        return (upper > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)upper;
+    }
+    return 0xFFFFFFFF;
+}
+
+/**
+ * @brief Copies the counters of every key seen so far. Safe to call from any thread.
+ *
+ * @param stats Destination
+ * @param max Capacity of stats
+ * @return Keys copied
+ */
+size_t BQ27621Instrumentation::snapshot(BQ27621CommandStats *stats, size_t max) const
+{
+    size_t used = _used.load(std::memory_order_acquire);
+    if (used > max)
+        used = max;
+    for (size_t i = 0; i < used; i++)
+    {
+        const Slot &s = _slots[i];
+        uint32_t key = s.key.load(std::memory_order_relaxed);
+        stats[i].kind = (BQ27621InstrumentKind)(key >> 16);
+        stats[i].id = (uint16_t)key;
+        stats[i].count = s.count.load(std::memory_order_relaxed);
+        stats[i].bytes = s.bytes.load(std::memory_order_relaxed);
+        for (size_t e = 0; e < BQ27621_ERROR_CODE_COUNT; e++)
+            stats[i].errors[e] = s.errors[e].load(std::memory_order_relaxed);
+        for (size_t b = 0; b < BQ27621_LATENCY_BUCKETS; b++)
+            stats[i].latency[b] = s.latency[b].load(std::memory_order_relaxed);
+        stats[i].maxMicros = s.maxMicros.load(std::memory_order_relaxed);
+    }
+    return used;
+}
+
+/**
+ * @brief Writes one CSV line per key: kind,id,count,bytes,errors (all codes but OK),max_us,histogram buckets
+ *
+ * @param buffer Destination, always NUL terminated when size > 0
+ * @param size Size of buffer
+ * @return Characters written, excluding the terminator
+ */
+size_t BQ27621Instrumentation::exportCsv(char *buffer, size_t size) const
+{
+    static const char *const kinds[] = {"command", "control", "class", "other"};
+    BQ27621CommandStats stats[BQ27621_INSTRUMENT_SLOTS];
+    size_t count = snapshot(stats, BQ27621_INSTRUMENT_SLOTS);
+    size_t pos = 0;
+
+    if (size == 0)
+        return 0;
+    buffer[0] = '\0';
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t errors = 0;
+        for (size_t e = OK + 1; e < BQ27621_ERROR_CODE_COUNT; e++)
+            errors += stats[i].errors[e];
+
+        int n = snprintf(&buffer[pos], size - pos, "%s,0x%04X,%lu,%lu,%lu,%lu", kinds[stats[i].kind], stats[i].id,
+                         (unsigned long)stats[i].count, (unsigned long)stats[i].bytes, (unsigned long)errors, (unsigned long)stats[i].maxMicros);
+        for (size_t b = 0; n > 0 && (size_t)n < size - pos && b < BQ27621_LATENCY_BUCKETS; b++)
+            n += snprintf(&buffer[pos + n], size - pos - n, ",%lu", (unsigned long)stats[i].latency[b]);
+        if (n < 0 || (size_t)n + 1 >= size - pos)
+        {
+            buffer[pos] = '\0';
+            break;
+        }
+        buffer[pos + n] = '\n';
+        buffer[pos + n + 1] = '\0';
+        pos += n + 1;
+    }
+    return pos;
+}
+
+/**
+ * @brief Splits a combined transfer into the keys it carries and records each once. A Control() write and its
+ * read-back count as one access to the subcommand; block data commands count against the selected subclass.
+ * The transfer latency is split across the keys in proportion to their bytes on the wire, so the latencies recorded
+ * for one transfer add up to it instead of charging every key the whole of it.
+ *
+ */
+void BQ27621::instrument(const I2C_message *messages, size_t count, BQ27621_error_code result, uint32_t micros)
+{
+    BQ27621InstrumentKind kind = INSTRUMENT_COMMAND;
+    uint16_t id = 0;
+    uint32_t bytes = 0;
+    uint32_t totalBytes = 0;
+    uint32_t charged = 0;
+    bool open = false;
+
+    for (size_t i = 0; i < count; i++)
+        totalBytes += messages[i].len + 1;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const I2C_message &message = messages[i];
+        if (!(message.flags & I2C_MSG_READ) && message.len > 0)
+        {
+            uint8_t command = message.data[0];
+            BQ27621InstrumentKind nextKind = INSTRUMENT_COMMAND;
+            uint16_t nextId = command;
+            if (command == COMMAND_CONTROL)
+            {
+                if (message.len >= 3)
+                    _instrumentControl = (uint16_t)(message.data[1] | (message.data[2] << 8));
+                nextKind = INSTRUMENT_CONTROL;
+                nextId = _instrumentControl;
+            }
+            else if (command >= EXTENDED_DATA_CLASS && command <= EXTENDED_BLOCK_DATA_CHECKSUM)
+            {
+                if (command == EXTENDED_DATA_CLASS && message.len >= 2)
+                    _instrumentClass = message.data[1];
+                nextKind = INSTRUMENT_DATA_CLASS;
+                nextId = _instrumentClass;
+            }
+
+            if (open && (nextKind != kind || nextId != id))
+            {
+                uint32_t share = (uint32_t)((uint64_t)micros * bytes / totalBytes);
+                _instrumentation.record(kind, id, bytes, result, share);
+                charged += share;
+                bytes = 0;
+            }
+            kind = nextKind;
+            id = nextId;
+            open = true;
+        }
+        bytes += message.len + 1;
+    }
+    if (open)
+        _instrumentation.record(kind, id, bytes, result, micros - charged); // The rounding remainder goes to the last key
+}
+
+#endif /*BQ27621_INSTRUMENTATION*/
@@ -0,0 +1,102 @@
+/**
+ * @file BQ27621_instrument.h
+ * @author your name (you@domain.com)
+ * @brief Per-command bus instrumentation for the BQ27621 driver (BQ27621_INSTRUMENTATION)
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_INSTRUMENT_H
+#define BQ27621_INSTRUMENT_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+#include "BQ27621_defs.h"
+
+/**
+ * @brief Distinct commands, subcommands and data classes tracked; further keys share the last slot
+ *
+ */
+#ifndef BQ27621_INSTRUMENT_SLOTS
+#define BQ27621_INSTRUMENT_SLOTS 32
+#endif
+
+/**
+ * @brief Latency histogram buckets: bucket 0 holds 0 us, bucket i holds [2^(i-1), 2^i) us, the last one the rest
+ *
+ */
+#define BQ27621_LATENCY_BUCKETS 16
+
+#define BQ27621_ERROR_CODE_COUNT (PENDING + 1)
+
+/**
+ * @brief Operation latency histogram: exact below 8 us, then 8 buckets per power of two (at most 12.5 % wide)
+ *
+ */
+#define BQ27621_OPERATION_BUCKETS (8 + 29 * 8)
+
+enum BQ27621InstrumentKind : uint8_t
+{
+    INSTRUMENT_COMMAND,    // Standard or extended command, id is the command code
+    INSTRUMENT_CONTROL,    // Control() subcommand, id is the subcommand
+    INSTRUMENT_DATA_CLASS, // Data memory block access, id is the subclass ID
+    INSTRUMENT_OTHER,      // Slots exhausted
+};
+
+/**
+ * @brief Counters of one key as returned by BQ27621Instrumentation::snapshot()
+ *
+ */
+struct BQ27621CommandStats
+{
+    BQ27621InstrumentKind kind;
+    uint16_t id;
+    uint32_t count;  // Transfers carrying the key
+    uint32_t bytes;  // Address and data bytes on the wire
+    uint32_t errors[BQ27621_ERROR_CODE_COUNT]; // Indexed by BQ27621_error_code, errors[OK] counts successes
+    uint32_t latency[BQ27621_LATENCY_BUCKETS]; // Share of each transfer's latency, split across its keys by bytes
+    uint32_t maxMicros;
+};
+
+/**
+ * @brief Counters keyed by command, written by the driver's thread and readable from any thread without locks.
+ * Each counter is read atomically; a snapshot taken while the driver runs may mix counters a few transfers apart.
+ */
+class BQ27621Instrumentation
+{
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> key;
+        std::atomic<uint32_t> count;
+        std::atomic<uint32_t> bytes;
+        std::atomic<uint32_t> errors[BQ27621_ERROR_CODE_COUNT];
+        std::atomic<uint32_t> latency[BQ27621_LATENCY_BUCKETS];
+        std::atomic<uint32_t> maxMicros;
+    };
+
+    Slot _slots[BQ27621_INSTRUMENT_SLOTS];
+    std::atomic<uint32_t> _used;
+    std::atomic<uint32_t> _operations[BQ27621_OPERATION_BUCKETS];
+
+    Slot &slot(uint32_t key);
+
+public:
+    BQ27621Instrumentation();
+
+    void record(BQ27621InstrumentKind kind, uint16_t id, uint32_t bytes, BQ27621_error_code result, uint32_t micros);
+    void recordOperation(uint32_t micros);
+    void reset(void);
+
+    size_t snapshot(BQ27621CommandStats *stats, size_t max) const;
+    size_t exportCsv(char *buffer, size_t size) const;
+
+    uint32_t operations(void) const;
+    uint32_t operationLatency(float quantile) const;
+};
+
+#endif /*BQ27621_INSTRUMENT_H*/
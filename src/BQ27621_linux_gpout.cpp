@@ -0,0 +1,104 @@
+/**
+ * @file BQ27621_linux_gpout.cpp
+ * @author your name (you@domain.com)
+ * @brief Linux GPIO character device backend for the GPOUT line
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_linux_gpout.h"
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+LinuxGpoutLine::LinuxGpoutLine() : _fd(-1)
+{
+}
+
+LinuxGpoutLine::~LinuxGpoutLine()
+{
+    close();
+}
+
+/**
+ * @brief Requests edge events on one GPIO line
+ *
+ * @param chipPath GPIO chip node, e.g. "/dev/gpiochip0"
+ * @param lineOffset Line number on the chip
+ * @param edge Edges to report
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code LinuxGpoutLine::open(const char *chipPath, uint32_t lineOffset, GpoutEdge edge)
+{
+    close();
+    int chip = ::open(chipPath, O_RDONLY);
+    if (chip < 0)
+        return BUS_ERROR;
+
+    struct gpioevent_request request;
+    memset(&request, 0, sizeof(request));
+    request.lineoffset = lineOffset;
+    request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    request.eventflags = (edge == GPOUT_EDGE_RISING) ? GPIOEVENT_REQUEST_RISING_EDGE : (edge == GPOUT_EDGE_FALLING) ? GPIOEVENT_REQUEST_FALLING_EDGE : GPIOEVENT_REQUEST_BOTH_EDGES;
+    strncpy(request.consumer_label, "bq27621-gpout", sizeof(request.consumer_label) - 1);
+
+    int retVal = ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &request);
+    ::close(chip);
+    if (retVal < 0)
+        return BUS_ERROR;
+    _fd = request.fd;
+    return OK;
+}
+
+/**
+ * @brief Releases the line if requested
+ *
+ */
+void LinuxGpoutLine::close(void)
+{
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+}
+
+/**
+ * @brief Sleeps in poll() until an edge event is queued or the timeout expires
+ *
+ * @param timeoutMicros Maximum wait
+ * @param edge Pointer to bool set to true if an edge occurred
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code LinuxGpoutLine::waitEdge(uint32_t timeoutMicros, bool *edge)
+{
+    *edge = false;
+    if (_fd < 0)
+        return BUS_ERROR;
+
+    struct pollfd pfd;
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    uint32_t millis = timeoutMicros / 1000 + ((timeoutMicros % 1000) != 0); // Rounded up without overflowing
+    int ready = poll(&pfd, 1, (millis > (uint32_t)INT_MAX) ? INT_MAX : (int)millis);
+    if (ready < 0)
+        return BUS_ERROR;
+    if (ready == 0)
+        return OK;
+
+    struct gpioevent_data event;
+    if (read(_fd, &event, sizeof(event)) != (ssize_t)sizeof(event))
+        return BUS_ERROR;
+    *edge = true;
+    return OK;
+}
+
+#endif /*__linux__*/
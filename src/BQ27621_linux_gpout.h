@@ -0,0 +1,47 @@
+/**
+ * @file BQ27621_linux_gpout.h
+ * @author your name (you@domain.com)
+ * @brief Linux GPIO character device backend for the GPOUT line
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_LINUX_GPOUT_H
+#define BQ27621_LINUX_GPOUT_H
+
+#if defined(__linux__)
+
+#include "BQ27621_gpout.h"
+
+enum GpoutEdge : uint8_t
+{
+    GPOUT_EDGE_RISING,  // SOC_INT pulses with GPOUT active-high
+    GPOUT_EDGE_FALLING, // SOC_INT pulses with GPOUT active-low (DEFAULT polarity)
+    GPOUT_EDGE_BOTH     // BAT_LOW level changes
+};
+
+/**
+ * @brief GPOUT_line on a /dev/gpiochipN line event. The kernel latches edges, so none are lost between waits.
+ *
+ */
+class LinuxGpoutLine : public GPOUT_line
+{
+private:
+    int _fd;
+
+public:
+    LinuxGpoutLine();
+    ~LinuxGpoutLine();
+
+    BQ27621_error_code open(const char *chipPath, uint32_t lineOffset, GpoutEdge edge);
+    void close(void);
+
+    BQ27621_error_code waitEdge(uint32_t timeoutMicros, bool *edge) override;
+};
+
+#endif /*__linux__*/
+
+#endif /*BQ27621_LINUX_GPOUT_H*/
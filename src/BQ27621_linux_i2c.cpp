@@ -0,0 +1,138 @@
+/**
+ * @file BQ27621_linux_i2c.cpp
+ * @author your name (you@domain.com)
+ * @brief Linux i2c-dev transport for the BQ27621 driver
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_linux_i2c.h"
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <errno.h>
+
+/**
+ * @brief Maps the errno of a failed I2C_RDWR to a driver error code (see the kernel's i2c fault-codes)
+ *
+ */
+static BQ27621_error_code errnoError(void)
+{
+    switch (errno)
+    {
+    case ENXIO:
+    case EREMOTEIO:
+        return NACK_RECEIVED;
+    case EBUSY:
+    case EAGAIN:
+        return BUS_BUSY;
+    case ETIMEDOUT:
+        return TIMEOUT_ERROR;
+    default:
+        return BUS_ERROR;
+    }
+}
+
+LinuxI2C::LinuxI2C() : _fd(-1)
+{
+}
+
+LinuxI2C::~LinuxI2C()
+{
+    close();
+}
+
+/**
+ * @brief Opens an i2c-dev adapter
+ *
+ * @param path Adapter node, e.g. "/dev/i2c-1"
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code LinuxI2C::open(const char *path)
+{
+    close();
+    _fd = ::open(path, O_RDWR);
+    return (_fd < 0) ? BUS_ERROR : OK;
+}
+
+/**
+ * @brief Closes the adapter if open
+ *
+ */
+void LinuxI2C::close(void)
+{
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+}
+
+/**
+ * @brief Issues the messages as one I2C_RDWR combined transfer. A batch larger than the kernel limit is rejected
+ * rather than split, as a split would put a stop between messages the caller expects under one start.
+ *
+ * @param messages Pointer to message array
+ * @param count Number of messages, at most I2C_RDWR_IOCTL_MAX_MSGS
+ * @return BQ27621_error_code BUS_ERROR for an oversized batch or a transfer the adapter cut short
+ */
+BQ27621_error_code LinuxI2C::transfer(I2C_message *messages, size_t count)
+{
+    if (_fd < 0 || count > I2C_RDWR_IOCTL_MAX_MSGS)
+        return BUS_ERROR;
+
+    struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+    for (size_t i = 0; i < count; i++)
+    {
+        msgs[i].addr = messages[i].address;
+        msgs[i].flags = (messages[i].flags & I2C_MSG_READ) ? I2C_M_RD : 0;
+        msgs[i].len = messages[i].len;
+        msgs[i].buf = messages[i].data;
+    }
+
+    struct i2c_rdwr_ioctl_data rdwr;
+    rdwr.msgs = msgs;
+    rdwr.nmsgs = count;
+    int done = ioctl(_fd, I2C_RDWR, &rdwr);
+    if (done < 0)
+        return errnoError();
+    if (done != (int)count)
+        return BUS_ERROR; // Not every message went out, errno is not set
+    return OK;
+}
+
+/**
+ * @brief Monotonic microsecond time base
+ *
+ * @return uint32_t Microseconds
+ */
+uint32_t LinuxI2C::micros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+/**
+ * @brief Sleeps for at least us microseconds
+ *
+ * @param us Microseconds
+ */
+void LinuxI2C::delayMicros(uint32_t us)
+{
+    struct timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (long)(us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) // ts holds the time left after a signal
+    {
+    }
+}
+
+#endif /*__linux__*/
@@ -0,0 +1,44 @@
+/**
+ * @file BQ27621_linux_i2c.h
+ * @author your name (you@domain.com)
+ * @brief Linux i2c-dev transport for the BQ27621 driver
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_LINUX_I2C_H
+#define BQ27621_LINUX_I2C_H
+
+#if defined(__linux__)
+
+#include "BQ27621_i2c.h"
+
+/**
+ * @brief I2C_device backed by /dev/i2c-N. Every transfer() is a single I2C_RDWR ioctl of at most
+ * I2C_RDWR_IOCTL_MAX_MSGS messages, so a register write + read back is one syscall with a repeated start instead of
+ * two transactions.
+ */
+class LinuxI2C : public I2C_device
+{
+private:
+    int _fd;
+
+public:
+    LinuxI2C();
+    ~LinuxI2C();
+
+    BQ27621_error_code open(const char *path);
+    void close(void);
+    bool isOpen(void) const { return _fd >= 0; }
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override;
+    uint32_t micros(void) override;
+    void delayMicros(uint32_t us) override;
+};
+
+#endif /*__linux__*/
+
+#endif /*BQ27621_LINUX_I2C_H*/
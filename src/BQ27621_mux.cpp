@@ -0,0 +1,260 @@
+/**
+ * @file BQ27621_mux.cpp
+ * @author your name (you@domain.com)
+ * @brief TCA9548-style I2C mux routing and channel-grouped polling for gauges sharing address 0x55
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_mux.h"
+
+int bq27621BusPathCompare(const BQ27621BusPath &a, const BQ27621BusPath &b)
+{
+    uint8_t depth = (a.depth < b.depth) ? a.depth : b.depth;
+    for (uint8_t i = 0; i < depth; i++)
+    {
+        if (a.hop[i].muxAddress != b.hop[i].muxAddress)
+            return (a.hop[i].muxAddress < b.hop[i].muxAddress) ? -1 : 1;
+        if (a.hop[i].channel != b.hop[i].channel)
+            return (a.hop[i].channel < b.hop[i].channel) ? -1 : 1;
+    }
+    return (int)a.depth - (int)b.depth;
+}
+
+BQ27621MuxI2C::BQ27621MuxI2C(I2C_device &bus) : _bus(bus), _muxCount(0), _switches(0)
+{
+}
+
+/**
+ * @brief Registers a mux up front. Muxes are also registered the first time a path goes through them, but one that
+ * is never on a path must be known to be switched off when a sibling is used.
+ *
+ * @param upstream Path to the segment the mux sits on, empty for the host bus
+ * @param address 7-bit mux address
+ * @return false if BQ27621_MAX_MUXES are already tracked
+ */
+bool BQ27621MuxI2C::addMux(const BQ27621BusPath &upstream, uint8_t address)
+{
+    for (size_t i = 0; i < _muxCount; i++)
+    {
+        if (_muxes[i].address == address && onSegment(_muxes[i].upstream, upstream, upstream.depth))
+            return true;
+    }
+    if (_muxCount == BQ27621_MAX_MUXES)
+        return false;
+    Mux &mux = _muxes[_muxCount++];
+    mux.upstream = upstream;
+    mux.address = address;
+    mux.control = 0;
+    mux.known = false;
+    return true;
+}
+
+/**
+ * @brief Forgets every control register, e.g. after the muxes were reset. The next selection rewrites them.
+ *
+ */
+void BQ27621MuxI2C::invalidate(void)
+{
+    for (size_t i = 0; i < _muxCount; i++)
+        _muxes[i].known = false;
+}
+
+/**
+ * @brief Enables the channels of path and disables every other channel that would put a second device on its
+ * segments. Only registers that differ from the last written value are written.
+ *
+ * @param path Route to the device
+ * @return BQ27621_error_code Error of a failed control write, BUS_ERROR if the path needs more than
+ * BQ27621_MAX_MUXES muxes
+ */
+BQ27621_error_code BQ27621MuxI2C::selectPath(const BQ27621BusPath &path)
+{
+    if (_muxCount == 0 && path.depth == 0)
+        return OK;
+    return route(_muxes, &_muxCount, path, true, &_switches);
+}
+
+/**
+ * @brief Counts the control writes selecting paths one after the other would take from the current state, without
+ * touching the bus
+ *
+ * @param paths Paths in the order they would be selected
+ * @param count Number of paths
+ * @return uint32_t Control writes
+ */
+uint32_t BQ27621MuxI2C::switchesFor(const BQ27621BusPath *const *paths, size_t count)
+{
+    Mux muxes[BQ27621_MAX_MUXES];
+    size_t muxCount = _muxCount;
+    for (size_t i = 0; i < muxCount; i++)
+        muxes[i] = _muxes[i];
+
+    uint32_t switches = 0;
+    for (size_t i = 0; i < count; i++)
+        route(muxes, &muxCount, *paths[i], false, &switches);
+    return switches;
+}
+
+bool BQ27621MuxI2C::onSegment(const BQ27621BusPath &upstream, const BQ27621BusPath &path, uint8_t depth)
+{
+    if (upstream.depth != depth)
+        return false;
+    for (uint8_t i = 0; i < depth; i++)
+    {
+        if (upstream.hop[i].muxAddress != path.hop[i].muxAddress || upstream.hop[i].channel != path.hop[i].channel)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Walks path from the host bus down. On each segment the muxes off the path are disabled first, then the
+ * path's mux gets its channel; a segment is only written once the hops above it are routed. The segment of the
+ * device itself is cleared too, so a mux next to the gauge cannot expose another 0x55.
+ *
+ * @param muxes Register cache to use and update
+ * @param muxCount Entries in muxes, grows when the path names a new mux
+ * @param path Route to the device
+ * @param apply Write the bus, or only count
+ * @param switches Incremented per control write
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621MuxI2C::route(Mux *muxes, size_t *muxCount, const BQ27621BusPath &path, bool apply, uint32_t *switches)
+{
+    for (uint8_t depth = 0; depth <= path.depth; depth++)
+    {
+        bool last = (depth == path.depth);
+        Mux *target = NULL;
+        for (size_t i = 0; i < *muxCount; i++)
+        {
+            Mux &mux = muxes[i];
+            if (!onSegment(mux.upstream, path, depth))
+                continue;
+            if (!last && mux.address == path.hop[depth].muxAddress)
+            {
+                target = &mux;
+                continue;
+            }
+            BQ27621_error_code retVal = writeControl(mux, 0, apply, switches);
+            if (retVal != OK)
+                return retVal;
+        }
+        if (last)
+            break;
+
+        if (target == NULL)
+        {
+            if (*muxCount == BQ27621_MAX_MUXES)
+                return BUS_ERROR;
+            target = &muxes[(*muxCount)++];
+            target->upstream = path;
+            target->upstream.depth = depth;
+            target->address = path.hop[depth].muxAddress;
+            target->control = 0;
+            target->known = false;
+        }
+        BQ27621_error_code retVal = writeControl(*target, (uint8_t)(1u << (path.hop[depth].channel & 7)), apply, switches);
+        if (retVal != OK)
+            return retVal;
+    }
+    return OK;
+}
+
+/**
+ * @brief Writes a mux control register as its own transfer: the TCA9548 switches channels on the STOP
+ *
+ */
+BQ27621_error_code BQ27621MuxI2C::writeControl(Mux &mux, uint8_t control, bool apply, uint32_t *switches)
+{
+    if (mux.known && mux.control == control)
+        return OK;
+    if (apply)
+    {
+        BQ27621_error_code retVal = _bus.write(mux.address, &control, 1);
+        if (retVal != OK)
+        {
+            mux.known = false; // The register may or may not have changed
+            return retVal;
+        }
+    }
+    mux.control = control;
+    mux.known = true;
+    (*switches)++;
+    return OK;
+}
+
+BQ27621MuxScheduler::BQ27621MuxScheduler(BQ27621MuxI2C &bus) : _bus(bus), _count(0), _last(), _totalSaved(0)
+{
+}
+
+/**
+ * @brief Queues an operation for the next round
+ *
+ * @param gauge Gauge the operation runs on, its bus path decides the group
+ * @param task Operation
+ * @param context Passed to task
+ * @return false if BQ27621_MAX_MUX_TASKS operations are already queued
+ */
+bool BQ27621MuxScheduler::enqueue(BQ27621 &gauge, BQ27621MuxTask task, void *context)
+{
+    if (_count == BQ27621_MAX_MUX_TASKS)
+        return false;
+    Task &entry = _tasks[_count++];
+    entry.gauge = &gauge;
+    entry.run = task;
+    entry.context = context;
+    return true;
+}
+
+/**
+ * @brief Runs every queued operation grouped by bus path and empties the queue. A failed operation does not stop the
+ * round.
+ *
+ * @param stats Receives the mux cost of the round, may be NULL
+ * @return BQ27621_error_code First error of the round
+ */
+BQ27621_error_code BQ27621MuxScheduler::round(BQ27621MuxRoundStats *stats)
+{
+    const BQ27621BusPath *paths[BQ27621_MAX_MUX_TASKS];
+    for (size_t i = 0; i < _count; i++)
+        paths[i] = &_tasks[i].gauge->busPath();
+    uint32_t unsorted = _bus.switchesFor(paths, _count);
+
+    // Insertion sort: stable, and the queue is short
+    for (size_t i = 1; i < _count; i++)
+    {
+        Task task = _tasks[i];
+        size_t j = i;
+        for (; j > 0 && bq27621BusPathCompare(_tasks[j - 1].gauge->busPath(), task.gauge->busPath()) > 0; j--)
+            _tasks[j] = _tasks[j - 1];
+        _tasks[j] = task;
+    }
+
+    BQ27621_error_code retVal = OK;
+    uint32_t before = _bus.switches();
+    _last = BQ27621MuxRoundStats();
+    for (size_t i = 0; i < _count; i++)
+    {
+        BQ27621_error_code result = _tasks[i].run(*_tasks[i].gauge, _tasks[i].context);
+        if (result != OK)
+        {
+            _last.errors++;
+            if (retVal == OK)
+                retVal = result;
+        }
+    }
+    _last.operations = (uint16_t)_count;
+    _last.switches = _bus.switches() - before;
+    _last.switchesUnsorted = unsorted;
+    _last.saved = (unsorted > _last.switches) ? unsorted - _last.switches : 0;
+    _totalSaved += _last.saved;
+    _count = 0;
+
+    if (stats != NULL)
+        *stats = _last;
+    return retVal;
+}
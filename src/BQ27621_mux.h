@@ -0,0 +1,150 @@
+/**
+ * @file BQ27621_mux.h
+ * @author your name (you@domain.com)
+ * @brief TCA9548-style I2C mux routing and channel-grouped polling for gauges sharing address 0x55
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_MUX_H
+#define BQ27621_MUX_H
+
+#include "BQ27621.h"
+
+#ifndef BQ27621_MAX_MUXES
+#define BQ27621_MAX_MUXES 8 // Muxes whose channel register is tracked
+#endif
+
+#ifndef BQ27621_MAX_MUX_TASKS
+#define BQ27621_MAX_MUX_TASKS 32 // Operations queued for one round
+#endif
+
+/**
+ * @brief Builds a path from hops of (mux address, channel)
+ *
+ */
+static inline BQ27621BusPath bq27621BusPath(uint8_t muxAddress, uint8_t channel)
+{
+    BQ27621BusPath path = BQ27621BusPath();
+    path.depth = 1;
+    path.hop[0].muxAddress = muxAddress;
+    path.hop[0].channel = channel;
+    return path;
+}
+
+static inline BQ27621BusPath bq27621BusPath(const BQ27621BusPath &upstream, uint8_t muxAddress, uint8_t channel)
+{
+    BQ27621BusPath path = upstream;
+    if (path.depth < BQ27621_MAX_MUX_DEPTH)
+    {
+        path.hop[path.depth].muxAddress = muxAddress;
+        path.hop[path.depth].channel = channel;
+        path.depth++;
+    }
+    return path;
+}
+
+/**
+ * @brief Orders paths hop by hop so that paths sharing a prefix are adjacent; 0 if equal
+ *
+ */
+int bq27621BusPathCompare(const BQ27621BusPath &a, const BQ27621BusPath &b);
+
+/**
+ * @brief Bus with TCA9548-style muxes. Remembers the control register of every mux it wrote and only writes the ones
+ * a path needs changed, so consecutive transfers on one channel cost no mux traffic. Exactly one channel is enabled on
+ * a mux in use and sibling muxes on the same segment are switched off, so only one 0x55 is ever visible.
+ */
+class BQ27621MuxI2C : public I2C_device
+{
+private:
+    struct Mux
+    {
+        BQ27621BusPath upstream; // Segment the mux sits on
+        uint8_t address;
+        uint8_t control; // Last value written
+        bool known;      // false until written, and after a failed write
+    };
+
+    I2C_device &_bus;
+    Mux _muxes[BQ27621_MAX_MUXES];
+    size_t _muxCount;
+    uint32_t _switches;
+
+    static bool onSegment(const BQ27621BusPath &upstream, const BQ27621BusPath &path, uint8_t depth);
+    BQ27621_error_code route(Mux *muxes, size_t *muxCount, const BQ27621BusPath &path, bool apply, uint32_t *switches);
+    BQ27621_error_code writeControl(Mux &mux, uint8_t control, bool apply, uint32_t *switches);
+
+public:
+    BQ27621MuxI2C(I2C_device &bus);
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override { return _bus.transfer(messages, count); }
+    BQ27621_error_code startTransfer(I2C_message *messages, size_t count) override { return _bus.startTransfer(messages, count); }
+    BQ27621_error_code pollTransfer(void) override { return _bus.pollTransfer(); }
+    BQ27621_error_code selectPath(const BQ27621BusPath &path) override;
+    uint32_t micros(void) override { return _bus.micros(); }
+    void delayMicros(uint32_t us) override { _bus.delayMicros(us); }
+
+    bool addMux(const BQ27621BusPath &upstream, uint8_t address);
+    void invalidate(void);
+    uint32_t switchesFor(const BQ27621BusPath *const *paths, size_t count);
+
+    uint32_t switches(void) const { return _switches; }
+    void resetStats(void) { _switches = 0; }
+};
+
+/**
+ * @brief Operation run on one gauge during a round
+ *
+ */
+typedef BQ27621_error_code (*BQ27621MuxTask)(BQ27621 &gauge, void *context);
+
+/**
+ * @brief Mux cost of one round
+ *
+ */
+struct BQ27621MuxRoundStats
+{
+    uint16_t operations;
+    uint16_t errors;
+    uint32_t switches;         // Mux control writes the grouped round took
+    uint32_t switchesUnsorted; // Mux control writes in submission order, from the same starting state
+    uint32_t saved;            // switchesUnsorted - switches
+};
+
+/**
+ * @brief Queues operations on gauges behind one BQ27621MuxI2C and runs them once per round grouped by bus path, so
+ * each mux channel is selected once per round however the operations were submitted. Submission order is kept
+ * within a channel.
+ */
+class BQ27621MuxScheduler
+{
+private:
+    struct Task
+    {
+        BQ27621 *gauge;
+        BQ27621MuxTask run;
+        void *context;
+    };
+
+    BQ27621MuxI2C &_bus;
+    Task _tasks[BQ27621_MAX_MUX_TASKS];
+    size_t _count;
+    BQ27621MuxRoundStats _last;
+    uint64_t _totalSaved;
+
+public:
+    BQ27621MuxScheduler(BQ27621MuxI2C &bus);
+
+    bool enqueue(BQ27621 &gauge, BQ27621MuxTask task, void *context);
+    size_t pending(void) const { return _count; }
+    BQ27621_error_code round(BQ27621MuxRoundStats *stats = NULL);
+
+    const BQ27621MuxRoundStats &lastRound(void) const { return _last; }
+    uint64_t totalSaved(void) const { return _totalSaved; }
+};
+
+#endif /*BQ27621_MUX_H*/
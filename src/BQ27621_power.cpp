@@ -0,0 +1,272 @@
+/**
+ * @file BQ27621_power.cpp
+ * @author your name (you@domain.com)
+ * @brief Power-state manager trading BQ27621 supply current against sample latency
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_power.h"
+#include <string.h>
+
+#define MICROAMP_MICROS_PER_MICROAH 3600000000.0
+
+BQ27621PowerManager::BQ27621PowerManager(BQ27621 &gauge) : _gauge(gauge), _policy(defaultPolicy()), _wakeCallback(NULL), _wakeContext(NULL), _state(POWER_LOW_POWER), _awakeState(POWER_LOW_POWER), _waking(false), _configLost(false), _since(0), _wakeStart(0)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+/**
+ * @brief Accurate ADC below 1 s sampling, HIBERNATE for gaps of 10 s or more and SHUTDOWN from 10 min, each only if
+ * waking up takes at most 10 % of the gap. Currents are typical datasheet figures; measure the board to refine them.
+ *
+ * @return BQ27621PowerPolicy
+ */
+BQ27621PowerPolicy BQ27621PowerManager::defaultPolicy(void)
+{
+    BQ27621PowerPolicy policy;
+    const uint32_t minInterval[POWER_STATE_COUNT] = {0, 1000000, 10000000, 600000000};
+    const uint32_t supply[POWER_STATE_COUNT] = {65, 50, 9, 1};
+    const uint32_t wake[POWER_STATE_COUNT] = {0, 0, 20000, 2000000};
+    for (size_t i = 0; i < POWER_STATE_COUNT; i++)
+    {
+        policy.minInterval[i] = minInterval[i];
+        policy.supplyMicroAmps[i] = supply[i];
+        policy.wakeMicros[i] = wake[i];
+    }
+    policy.latencyPercent = 10;
+    policy.activeAdc = ADC_ACCURATE;
+    policy.lowPowerAdc = ADC_LOWEST_POWER;
+    policy.settleTimeout = 5000000;
+    return policy;
+}
+
+/**
+ * @brief Registers the function asserting the wake-up pin. Without one POWER_SHUTDOWN is never selected.
+ *
+ * @param callback
+ * @param context Passed to callback
+ */
+void BQ27621PowerManager::setWakeCallback(BQ27621WakeCallback callback, void *context)
+{
+    _wakeCallback = callback;
+    _wakeContext = context;
+}
+
+void BQ27621PowerManager::account(uint32_t now)
+{
+    uint32_t elapsed = now - _since;
+    _stats.residencyMicros[_state] += elapsed;
+    _stats.chargeMicroAh += (double)elapsed * _policy.supplyMicroAmps[_state] / MICROAMP_MICROS_PER_MICROAH;
+    _since = now;
+}
+
+void BQ27621PowerManager::setState(BQ27621PowerState state, uint32_t now)
+{
+    account(now);
+    if (state != _state)
+        _stats.entries[state]++;
+    _state = state;
+}
+
+/**
+ * @brief Mean measured wake-up latency of a state, or the policy's guess before the first wake-up
+ *
+ */
+uint32_t BQ27621PowerManager::expectedWake(BQ27621PowerState state) const
+{
+    if (_stats.wakeups[state] == 0)
+        return _policy.wakeMicros[state];
+    return (uint32_t)(_stats.totalWakeMicros[state] / _stats.wakeups[state]);
+}
+
+/**
+ * @brief Takes the awake state from the gauge's current ADC mode and starts the statistics
+ *
+ * @param now Current time in microseconds
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621PowerManager::begin(uint32_t now)
+{
+    AdcMode mode;
+    BQ27621_error_code retVal = _gauge.getAdcMode(&mode);
+    if (retVal != OK)
+        return retVal;
+
+    memset(&_stats, 0, sizeof(_stats));
+    _awakeState = (mode == _policy.activeAdc) ? POWER_ACTIVE : POWER_LOW_POWER;
+    _state = _awakeState;
+    _stats.entries[_state] = 1;
+    _waking = false;
+    _configLost = false;
+    _since = now;
+    return OK;
+}
+
+/**
+ * @brief Chooses the awake state for a sampling interval: the low-power ADC from minInterval[POWER_LOW_POWER] on.
+ * Changing the ADC mode writes OpConfig(), so it only happens when the plan crosses that threshold. While the gauge
+ * sleeps the change is deferred to the next wake-up.
+ *
+ * @param sampleInterval Time between samples in microseconds
+ * @param now Current time in microseconds
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621PowerManager::plan(uint32_t sampleInterval, uint32_t now)
+{
+    BQ27621PowerState target = (sampleInterval >= _policy.minInterval[POWER_LOW_POWER]) ? POWER_LOW_POWER : POWER_ACTIVE;
+    if (!isAwake())
+    {
+        _awakeState = target;
+        return OK;
+    }
+    if (target == _awakeState)
+        return OK;
+
+    BQ27621_error_code retVal = _gauge.setAdcMode((target == POWER_ACTIVE) ? _policy.activeAdc : _policy.lowPowerAdc);
+    if (retVal != OK)
+        return retVal;
+    _awakeState = target;
+    setState(target, now);
+    return OK;
+}
+
+/**
+ * @brief Deepest state allowed for a gap: its minimum interval is reached and its expected wake-up latency fits in
+ * latencyPercent of the gap
+ *
+ * @param gap Time until the next sample in microseconds
+ * @return BQ27621PowerState
+ */
+BQ27621PowerState BQ27621PowerManager::select(uint32_t gap) const
+{
+    for (int state = POWER_SHUTDOWN; state >= POWER_HIBERNATE; state--)
+    {
+        if (state == POWER_SHUTDOWN && _wakeCallback == NULL)
+            continue;
+        if (gap < _policy.minInterval[state])
+            continue;
+        if ((uint64_t)expectedWake((BQ27621PowerState)state) * 100 <= (uint64_t)gap * _policy.latencyPercent)
+            return (BQ27621PowerState)state;
+    }
+    return _awakeState;
+}
+
+/**
+ * @brief Puts the gauge into the state select() picks for the gap before the next sample
+ *
+ * @param gap Time until the next sample in microseconds
+ * @param now Current time in microseconds
+ * @return BQ27621_error_code PENDING while a wake-up is still settling
+ */
+BQ27621_error_code BQ27621PowerManager::idle(uint32_t gap, uint32_t now)
+{
+    if (_waking)
+        return PENDING;
+    if (!isAwake())
+        return OK;
+
+    BQ27621PowerState target = select(gap);
+    BQ27621_error_code retVal = OK;
+    if (target == POWER_HIBERNATE)
+        retVal = _gauge.setHibernate(true);
+    else if (target == POWER_SHUTDOWN)
+        retVal = _gauge.shutdown();
+    if (retVal != OK)
+        return retVal;
+    setState(target, now);
+    return OK;
+}
+
+/**
+ * @brief Starts a wake-up: clears [HIBERNATE] or asserts the wake-up pin. Call poll() until it returns OK before
+ * reading the gauge.
+ *
+ * @param now Current time in microseconds
+ * @return BQ27621_error_code OK if the gauge is already awake, PENDING once the wake-up is under way
+ */
+BQ27621_error_code BQ27621PowerManager::wake(uint32_t now)
+{
+    if (_waking)
+        return PENDING;
+    if (isAwake())
+        return OK;
+
+    BQ27621_error_code retVal;
+    if (_state == POWER_HIBERNATE)
+        retVal = _gauge.setHibernate(false);
+    else
+        retVal = _wakeCallback(_wakeContext);
+    if (retVal != OK)
+        return retVal;
+    _waking = true;
+    _wakeStart = now;
+    return PENDING;
+}
+
+/**
+ * @brief Completes a wake-up once CONTROL_STATUS shows [SLEEP] clear and [INITCOMP] set. The gauge may not answer
+ * right after SHUTDOWN; NACKs and a busy bus count as not settled yet. After SHUTDOWN the awake ADC mode is written
+ * again and configLost() is raised, since the gauge restarted from its defaults.
+ *
+ * @param now Current time in microseconds
+ * @return BQ27621_error_code OK when awake, PENDING while settling, TIMEOUT_ERROR after settleTimeout (wake() may then
+ * be called again)
+ */
+BQ27621_error_code BQ27621PowerManager::poll(uint32_t now)
+{
+    if (!_waking)
+        return OK;
+
+    BQ27621FlagSet flags;
+    BQ27621StatusSet status;
+    BQ27621_error_code retVal = _gauge.getStatus(&flags, &status);
+    if (retVal != OK && retVal != NACK_RECEIVED && retVal != BUS_BUSY)
+        return retVal;
+
+    uint32_t latency = now - _wakeStart;
+    if (retVal != OK || status.sleep || !status.initComplete)
+    {
+        if (latency <= _policy.settleTimeout)
+            return PENDING;
+        _stats.settleTimeouts++;
+        _waking = false;
+        return TIMEOUT_ERROR;
+    }
+
+    _stats.wakeups[_state]++;
+    _stats.lastWakeMicros[_state] = latency;
+    _stats.totalWakeMicros[_state] += latency;
+    if (latency > _stats.maxWakeMicros[_state])
+        _stats.maxWakeMicros[_state] = latency;
+    _waking = false;
+
+    if (_state == POWER_SHUTDOWN)
+    {
+        _stats.reinitializations++;
+        _configLost = true;
+        setState(_awakeState, now);
+        return _gauge.setAdcMode((_awakeState == POWER_ACTIVE) ? _policy.activeAdc : _policy.lowPowerAdc);
+    }
+    setState(_awakeState, now);
+    return OK;
+}
+
+/**
+ * @brief Statistics up to now, with the charge estimate brought up to date
+ *
+ * @param now Current time in microseconds
+ * @return BQ27621PowerStats
+ */
+BQ27621PowerStats BQ27621PowerManager::stats(uint32_t now)
+{
+    account(now);
+    uint64_t elapsed = 0; // Sum of the residencies rather than now - _start, which wraps after 71 minutes
+    for (size_t i = 0; i < POWER_STATE_COUNT; i++)
+        elapsed += _stats.residencyMicros[i];
+    _stats.averageMicroAmps = (elapsed != 0) ? _stats.chargeMicroAh * MICROAMP_MICROS_PER_MICROAH / elapsed : 0;
+    return _stats;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file BQ27621_power.h
+ * @author your name (you@domain.com)
+ * @brief Power-state manager trading BQ27621 supply current against sample latency
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_POWER_H
+#define BQ27621_POWER_H
+
+#include "BQ27621.h"
+
+/**
+ * @brief Gauge power states, from the most to the least power hungry
+ *
+ */
+enum BQ27621PowerState : uint8_t
+{
+    POWER_ACTIVE,    // NORMAL mode, accurate ADC
+    POWER_LOW_POWER, // NORMAL mode, low-power ADC
+    POWER_HIBERNATE, // [HIBERNATE] set, the gauge sleeps until it is cleared
+    POWER_SHUTDOWN,  // SHUTDOWN, needs the wake-up pin and restarts from ROM defaults
+    POWER_STATE_COUNT
+};
+
+/**
+ * @brief Asserts the GPOUT/BIN wake-up of a gauge in SHUTDOWN
+ *
+ */
+typedef BQ27621_error_code (*BQ27621WakeCallback)(void *context);
+
+/**
+ * @brief When each state may be used and what it is assumed to cost
+ *
+ */
+struct BQ27621PowerPolicy
+{
+    uint32_t minInterval[POWER_STATE_COUNT];     // Shortest sampling gap (microseconds) that may use the state
+    uint32_t supplyMicroAmps[POWER_STATE_COUNT]; // Gauge current in the state, used for the charge estimate
+    uint32_t wakeMicros[POWER_STATE_COUNT];      // Expected wake-up and settle latency until one has been measured
+    uint8_t latencyPercent;                      // A gap may spend at most this share waking up
+    AdcMode activeAdc;                           // ADC mode of POWER_ACTIVE
+    AdcMode lowPowerAdc;                         // ADC mode of POWER_LOW_POWER
+    uint32_t settleTimeout;                      // Longest wait for [SLEEP] clear and [INITCOMP] set
+};
+
+/**
+ * @brief Residency and wake-up latency per state since begin()
+ *
+ */
+struct BQ27621PowerStats
+{
+    uint32_t entries[POWER_STATE_COUNT];
+    uint64_t residencyMicros[POWER_STATE_COUNT];
+    uint32_t wakeups[POWER_STATE_COUNT];        // Completed wake-ups out of the state
+    uint32_t lastWakeMicros[POWER_STATE_COUNT]; // From the wake-up command until the gauge settled
+    uint32_t maxWakeMicros[POWER_STATE_COUNT];
+    uint64_t totalWakeMicros[POWER_STATE_COUNT];
+    uint32_t settleTimeouts;
+    uint32_t reinitializations; // Wake-ups from SHUTDOWN, after which the RAM configuration is back to defaults
+    double chargeMicroAh;       // Estimated gauge consumption
+    double averageMicroAmps;
+};
+
+/**
+ * @brief Moves one gauge between the power states following the host's sampling plan. plan() picks the awake state
+ * (ADC mode) for the sampling interval, idle() drops to the deepest state whose wake-up latency fits in the gap before
+ * the next sample, and wake() followed by poll() until OK brings the gauge back and measures how long [SLEEP] and
+ * [INITCOMP] took to settle. The manager owns the power commands: the gauge must not be read while asleep.
+ */
+class BQ27621PowerManager
+{
+private:
+    BQ27621 &_gauge;
+    BQ27621PowerPolicy _policy;
+    BQ27621PowerStats _stats;
+    BQ27621WakeCallback _wakeCallback;
+    void *_wakeContext;
+    BQ27621PowerState _state;
+    BQ27621PowerState _awakeState; // State returned to by wake()
+    bool _waking;
+    bool _configLost;
+    uint32_t _since;     // Time of the last residency update
+    uint32_t _wakeStart; // Time the pending wake-up was issued
+
+    void account(uint32_t now);
+    void setState(BQ27621PowerState state, uint32_t now);
+    uint32_t expectedWake(BQ27621PowerState state) const;
+
+public:
+    BQ27621PowerManager(BQ27621 &gauge);
+
+    static BQ27621PowerPolicy defaultPolicy(void);
+    void setPolicy(const BQ27621PowerPolicy &policy) { _policy = policy; }
+    void setWakeCallback(BQ27621WakeCallback callback, void *context);
+
+    BQ27621_error_code begin(uint32_t now);
+    BQ27621_error_code plan(uint32_t sampleInterval, uint32_t now);
+    BQ27621PowerState select(uint32_t gap) const;
+    BQ27621_error_code idle(uint32_t gap, uint32_t now);
+    BQ27621_error_code wake(uint32_t now);
+    BQ27621_error_code poll(uint32_t now);
+
+    BQ27621PowerState state(void) const { return _state; }
+    bool isAwake(void) const { return !_waking && _state <= POWER_LOW_POWER; }
+    bool configLost(void) const { return _configLost; }
+    void clearConfigLost(void) { _configLost = false; }
+    BQ27621PowerStats stats(uint32_t now);
+};
+
+#endif /*BQ27621_POWER_H*/
@@ -0,0 +1,134 @@
+/**
+ * @file BQ27621_registers.h
+ * @author your name (you@domain.com)
+ * @brief Compile-time descriptors of the BQ27621 standard commands
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_REGISTERS_H
+#define BQ27621_REGISTERS_H
+
+#include <stdint.h>
+#include "BQ27621_defs.h"
+
+enum BQ27621Unit : uint8_t
+{
+    UNIT_NONE,
+    UNIT_DECIKELVIN, // 0.1 K
+    UNIT_MILLIVOLT,
+    UNIT_MILLIAMP,
+    UNIT_MILLIWATT,
+    UNIT_MILLIAMP_HOUR,
+    UNIT_PERCENT,
+};
+
+/**
+ * @brief Raw register value tagged with its unit, so a current cannot be passed where a voltage is expected
+ *
+ * @tparam Unit Unit of one LSB
+ * @tparam Raw uint16_t or int16_t
+ */
+template <BQ27621Unit Unit, typename Raw>
+struct BQ27621Quantity
+{
+    static constexpr BQ27621Unit unit = Unit;
+    Raw raw;
+
+    /**
+     * @brief Value in the base unit of the quantity (K, V, A, W, Ah or %)
+     *
+     */
+    float value() const
+    {
+        return (Unit == UNIT_DECIKELVIN) ? raw * 0.1f : (Unit == UNIT_PERCENT || Unit == UNIT_NONE) ? (float)raw : raw * 0.001f;
+    }
+};
+
+template <bool Signed>
+struct BQ27621RawType
+{
+    typedef uint16_t type;
+};
+
+template <>
+struct BQ27621RawType<true>
+{
+    typedef int16_t type;
+};
+
+/**
+ * @brief Descriptor of one 2-byte standard command: address, signedness and unit, all resolved at compile time
+ *
+ * @tparam Address Command code (Commands)
+ * @tparam Signed true for two's complement registers
+ * @tparam Unit Unit of one LSB
+ */
+template <uint8_t Address, bool Signed, BQ27621Unit Unit>
+struct BQ27621Register
+{
+    static constexpr uint8_t address = Address;
+    static constexpr uint8_t width = 2;
+    static constexpr bool isSigned = Signed;
+    static constexpr BQ27621Unit unit = Unit;
+    typedef typename BQ27621RawType<Signed>::type raw_type;
+    typedef BQ27621Quantity<Unit, raw_type> value_type;
+
+    static value_type decode(const uint8_t *data)
+    {
+        value_type value;
+        value.raw = (raw_type)(uint16_t)(data[0] | (data[1] << 8));
+        return value;
+    }
+};
+
+namespace BQ27621Registers
+{
+    typedef BQ27621Register<COMMAND_TEMPERATURE, false, UNIT_DECIKELVIN> Temperature;
+    typedef BQ27621Register<COMMAND_VOLTAGE, false, UNIT_MILLIVOLT> Voltage;
+    typedef BQ27621Register<COMMAND_FLAGS, false, UNIT_NONE> Flags;
+    typedef BQ27621Register<COMMAND_NOMINAL_AVAILABLE_CAPACITY, false, UNIT_MILLIAMP_HOUR> NominalAvailableCapacity;
+    typedef BQ27621Register<COMMAND_FULL_AVAILABLE_CAPACITY, false, UNIT_MILLIAMP_HOUR> FullAvailableCapacity;
+    typedef BQ27621Register<COMMAND_REMAINING_CAPACITY, false, UNIT_MILLIAMP_HOUR> RemainingCapacity;
+    typedef BQ27621Register<COMMAND_FULL_CHARGE_CAPACITY, false, UNIT_MILLIAMP_HOUR> FullChargeCapacity;
+    typedef BQ27621Register<COMMAND_EFFECTIVE_CURRENT, true, UNIT_MILLIAMP> EffectiveCurrent;
+    typedef BQ27621Register<COMMAND_AVERAGE_POWER, true, UNIT_MILLIWATT> AveragePower;
+    typedef BQ27621Register<COMMAND_STATE_OF_CHARGE, false, UNIT_PERCENT> StateOfCharge;
+    typedef BQ27621Register<COMMAND_INTERNAL_TEMPERATURE, false, UNIT_DECIKELVIN> InternalTemperature;
+    typedef BQ27621Register<COMMAND_REMAINING_CAPACITY_UNFILTERED, false, UNIT_MILLIAMP_HOUR> RemainingCapacityUnfiltered;
+    typedef BQ27621Register<COMMAND_REMAINING_CAPACITY_FILTERED, false, UNIT_MILLIAMP_HOUR> RemainingCapacityFiltered;
+    typedef BQ27621Register<COMMAND_FULL_CHARGE_CAPACITY_UNFILTERED, false, UNIT_MILLIAMP_HOUR> FullChargeCapacityUnfiltered;
+    typedef BQ27621Register<COMMAND_FULL_CHARGE_CAPACITY_FILTERED, false, UNIT_MILLIAMP_HOUR> FullChargeCapacityFiltered;
+    typedef BQ27621Register<COMMAND_STATE_OF_CHARGE_UNFILTERED, false, UNIT_PERCENT> StateOfChargeUnfiltered;
+    typedef BQ27621Register<COMMAND_OPERATION_CONFIGURATION, false, UNIT_NONE> OpConfig;
+    typedef BQ27621Register<EXTENDED_DESIGN_CAPACITY, false, UNIT_MILLIAMP_HOUR> DesignCapacity;
+}
+
+/**
+ * @brief Smallest contiguous burst covering a set of registers, computed at compile time
+ *
+ * @tparam Regs Register descriptors, in any order
+ */
+template <class... Regs>
+struct BQ27621Burst;
+
+template <class Reg>
+struct BQ27621Burst<Reg>
+{
+    static constexpr uint8_t first = Reg::address;
+    static constexpr uint8_t end = Reg::address + Reg::width; // One past the last byte
+    static constexpr uint8_t size = end - first;
+};
+
+template <class Reg, class... Rest>
+struct BQ27621Burst<Reg, Rest...>
+{
+    static constexpr uint8_t first = (Reg::address < BQ27621Burst<Rest...>::first) ? Reg::address : BQ27621Burst<Rest...>::first;
+    static constexpr uint8_t end = (Reg::address + Reg::width > BQ27621Burst<Rest...>::end) ? Reg::address + Reg::width : BQ27621Burst<Rest...>::end;
+    static constexpr uint8_t size = end - first;
+};
+
+#endif /*BQ27621_REGISTERS_H*/
@@ -0,0 +1,294 @@
+/**
+ * @file BQ27621_scheduler.cpp
+ * @author your name (you@domain.com)
+ * @brief Adaptive per-field polling scheduler for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_scheduler.h"
+#include <string.h>
+
+#define SCHEDULER_MAX_REGISTERS (FIELD_COUNT + 1)
+
+/**
+ * @brief Registers behind each field
+ *
+ */
+static const uint8_t fieldRegisters[FIELD_COUNT][2] = {
+    {COMMAND_FLAGS, 0},
+    {COMMAND_EFFECTIVE_CURRENT, 0},
+    {COMMAND_VOLTAGE, 0},
+    {COMMAND_STATE_OF_CHARGE, 0},
+    {COMMAND_AVERAGE_POWER, 0},
+    {COMMAND_TEMPERATURE, 0},
+    {COMMAND_REMAINING_CAPACITY, COMMAND_FULL_CHARGE_CAPACITY},
+};
+
+BQ27621Scheduler::BQ27621Scheduler(BQ27621 &gauge) : _gauge(gauge), _config(defaultConfig()), _capacitySoc(0), _sociDelta(1), _active(false), _start(0), _windowStart(0), _windowMicros(0)
+{
+    memset(&_stats, 0, sizeof(_stats));
+    memset(&_values, 0, sizeof(_values));
+    for (size_t i = 0; i < FIELD_COUNT; i++)
+    {
+        _lastRead[i] = 0;
+        _valid[i] = false;
+    }
+}
+
+/**
+ * @brief Intervals suited to a single-cell pack: 1 s electrical fields while active, 30 s in relax,
+ * temperature at a quarter of the voltage rate
+ *
+ * @return BQ27621SchedulerConfig
+ */
+BQ27621SchedulerConfig BQ27621Scheduler::defaultConfig(void)
+{
+    BQ27621SchedulerConfig config;
+    const uint32_t active[FIELD_COUNT] = {1000000, 1000000, 1000000, 1000000, 1000000, 4000000, 60000000};
+    const uint32_t relax[FIELD_COUNT] = {5000000, 30000000, 30000000, 30000000, 30000000, 120000000, 600000000};
+    for (size_t i = 0; i < FIELD_COUNT; i++)
+    {
+        config.activeInterval[i] = active[i];
+        config.relaxInterval[i] = relax[i];
+    }
+    config.activeCurrent = 50;
+    config.coalesceMicros = 100000;
+    config.busClockHz = 100000;
+    config.budgetPeriod = 1000000;
+    config.budgetMicros = 0;
+    return config;
+}
+
+/**
+ * @brief Loads the SOCI delta and reads every field once
+ *
+ * @param now Current time in microseconds
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Scheduler::begin(uint32_t now)
+{
+    BQ27621_error_code retVal = _gauge.getSociDelta(&_sociDelta);
+    if (retVal != OK)
+        return retVal;
+    if (_sociDelta == 0)
+        _sociDelta = 1;
+
+    for (size_t i = 0; i < FIELD_COUNT; i++)
+        _valid[i] = false;
+    memset(&_stats, 0, sizeof(_stats));
+    _start = now;
+    _windowStart = now;
+    _windowMicros = 0;
+
+    uint32_t nextPoll;
+    return poll(now, &nextPoll);
+}
+
+uint32_t BQ27621Scheduler::interval(BQ27621Field field) const
+{
+    return _active ? _config.activeInterval[field] : _config.relaxInterval[field];
+}
+
+bool BQ27621Scheduler::due(BQ27621Field field, uint32_t now) const
+{
+    if (!_valid[field])
+        return true;
+    if (field == FIELD_CAPACITY && _valid[FIELD_SOC])
+    {
+        uint16_t soc = _values.stateOfCharge;
+        uint16_t distance = (soc > _capacitySoc) ? soc - _capacitySoc : _capacitySoc - soc;
+        if (distance >= _sociDelta)
+            return true;
+        return (uint32_t)(now + _config.coalesceMicros - _lastRead[field]) >= _config.relaxInterval[field];
+    }
+    return (uint32_t)(now + _config.coalesceMicros - _lastRead[field]) >= interval(field);
+}
+
+/**
+ * @brief Estimated bus time of a transfer: 9 clocks per byte, start/stop and one repeated start per extra message
+ *
+ */
+uint32_t BQ27621Scheduler::busTime(uint32_t bytes, uint32_t messages) const
+{
+    uint64_t bits = 9ULL * bytes + 2 + (messages - 1);
+    return (uint32_t)(bits * 1000000ULL / _config.busClockHz);
+}
+
+void BQ27621Scheduler::storeWord(uint8_t command, uint16_t word)
+{
+    switch (command)
+    {
+    case COMMAND_FLAGS:
+        _values.flags = word;
+        break;
+    case COMMAND_EFFECTIVE_CURRENT:
+        _values.effectiveCurrent = (int16_t)word;
+        break;
+    case COMMAND_VOLTAGE:
+        _values.voltage = word;
+        break;
+    case COMMAND_STATE_OF_CHARGE:
+        _values.stateOfCharge = word;
+        break;
+    case COMMAND_AVERAGE_POWER:
+        _values.averagePower = (int16_t)word;
+        break;
+    case COMMAND_TEMPERATURE:
+        _values.temperature = word;
+        break;
+    case COMMAND_REMAINING_CAPACITY:
+        _values.remainingCapacity = word;
+        break;
+    case COMMAND_FULL_CHARGE_CAPACITY:
+        _values.fullChargeCapacity = word;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Marks every field whose registers lie in [command, command + 1] as read at now
+ *
+ * @param socRead true if StateOfCharge() came with the same transfer, so FIELD_CAPACITY can be tagged with it
+ */
+void BQ27621Scheduler::markRead(uint8_t command, uint32_t now, bool socRead)
+{
+    for (size_t f = 0; f < FIELD_COUNT; f++)
+    {
+        if (fieldRegisters[f][0] == command || (fieldRegisters[f][1] == command && command != 0))
+        {
+            _lastRead[f] = now;
+            _valid[f] = true;
+            if (f == FIELD_CAPACITY && socRead)
+                _capacitySoc = _values.stateOfCharge;
+        }
+    }
+}
+
+/**
+ * @brief Reads the fields that are due, within the bus budget of the current window
+ *
+ * @param now Current time in microseconds
+ * @param nextPoll Pointer that will hold the time the next field becomes due
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Scheduler::poll(uint32_t now, uint32_t *nextPoll)
+{
+    if ((uint32_t)(now - _windowStart) >= _config.budgetPeriod)
+    {
+        _windowStart = now;
+        _windowMicros = 0;
+    }
+
+    uint8_t commands[SCHEDULER_MAX_REGISTERS];
+    size_t count = 0;
+    uint8_t first = 0xFF;
+    uint8_t last = 0;
+    uint32_t planned = 0;
+    bool socPlanned = false;
+
+    for (size_t f = 0; f < FIELD_COUNT; f++)
+    {
+        if (!due((BQ27621Field)f, now))
+            continue;
+
+        // Cost of adding this field as separate reads: pointer write + 2-byte read per register. FIELD_CAPACITY
+        // brings StateOfCharge() along, as the SOC it was read at decides when it is due again.
+        size_t registers = (fieldRegisters[f][1] != 0) ? 2 : 1;
+        bool withSoc = (f == FIELD_CAPACITY && !socPlanned);
+        uint32_t reads = (uint32_t)registers + (withSoc ? 1 : 0);
+        uint32_t cost = busTime(5 * reads, 2 * reads);
+        if (_config.budgetMicros != 0 && _valid[f] && _windowMicros + planned + cost > _config.budgetMicros)
+        {
+            _stats.deferred++;
+            continue;
+        }
+        planned += cost;
+        if (f == FIELD_SOC || withSoc)
+            socPlanned = true;
+
+        for (size_t r = 0; r < reads; r++)
+        {
+            uint8_t command = (r < registers) ? fieldRegisters[f][r] : (uint8_t)COMMAND_STATE_OF_CHARGE;
+            commands[count++] = command;
+            if (command < first)
+                first = command;
+            if (command > last)
+                last = command;
+        }
+    }
+
+    BQ27621_error_code retVal = OK;
+    if (count > 0)
+    {
+        uint32_t burstBytes = 3 + (last + 2 - first);
+        uint32_t separateBytes = 5 * (uint32_t)count;
+        uint32_t spent;
+        if (burstBytes <= separateBytes)
+        {
+            retVal = _gauge.readSnapshot(&_values, (Commands)first, (Commands)last);
+            spent = busTime(burstBytes, 2);
+            if (retVal == OK)
+            {
+                bool socRead = first <= COMMAND_STATE_OF_CHARGE && COMMAND_STATE_OF_CHARGE <= last;
+                for (uint8_t command = first; command <= last; command += 2)
+                    markRead(command, now, socRead); // Neighbours in the burst come for free
+            }
+        }
+        else
+        {
+            uint16_t words[SCHEDULER_MAX_REGISTERS];
+            retVal = _gauge.readWords(commands, words, count);
+            spent = busTime(separateBytes, 2 * (uint32_t)count);
+            if (retVal == OK)
+            {
+                for (size_t i = 0; i < count; i++)
+                    storeWord(commands[i], words[i]);
+                for (size_t i = 0; i < count; i++)
+                    markRead(commands[i], now, socPlanned);
+            }
+        }
+
+        _windowMicros += spent;
+        _stats.busMicros += spent;
+        _stats.transactions++;
+        _stats.polls++;
+
+        if (retVal == OK)
+        {
+            bool moving = (_values.flags & (FLAG_DSG | FLAG_CHG)) != 0;
+            int16_t current = _values.effectiveCurrent;
+            _active = moving || current >= _config.activeCurrent || current <= -_config.activeCurrent;
+        }
+    }
+
+    uint32_t next = now + interval(FIELD_FLAGS);
+    for (size_t f = 0; f < FIELD_COUNT; f++)
+    {
+        uint32_t fieldInterval = (f == FIELD_CAPACITY) ? _config.relaxInterval[f] : interval((BQ27621Field)f);
+        uint32_t fieldDue = _lastRead[f] + fieldInterval;
+        if ((int32_t)(fieldDue - next) < 0)
+            next = fieldDue;
+    }
+    *nextPoll = next;
+    return retVal;
+}
+
+/**
+ * @brief Returns bus usage since begin()
+ *
+ * @param now Current time in microseconds
+ * @return BQ27621SchedulerStats
+ */
+BQ27621SchedulerStats BQ27621Scheduler::stats(uint32_t now) const
+{
+    BQ27621SchedulerStats stats = _stats;
+    stats.elapsedMicros = (uint32_t)(now - _start);
+    stats.occupancy = (stats.elapsedMicros > 0) ? (double)stats.busMicros / stats.elapsedMicros : 0;
+    return stats;
+}
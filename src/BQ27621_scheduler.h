@@ -0,0 +1,103 @@
+/**
+ * @file BQ27621_scheduler.h
+ * @author your name (you@domain.com)
+ * @brief Adaptive per-field polling scheduler for the BQ27621
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_SCHEDULER_H
+#define BQ27621_SCHEDULER_H
+
+#include "BQ27621.h"
+
+/**
+ * @brief Telemetry fields the scheduler keeps fresh, in priority order (first is read first under a tight budget)
+ *
+ */
+enum BQ27621Field : uint8_t
+{
+    FIELD_FLAGS,
+    FIELD_CURRENT,
+    FIELD_VOLTAGE,
+    FIELD_SOC,
+    FIELD_POWER,
+    FIELD_TEMPERATURE,
+    FIELD_CAPACITY, // RemainingCapacity() and FullChargeCapacity()
+    FIELD_COUNT
+};
+
+/**
+ * @brief Poll intervals (microseconds) and bus budget
+ *
+ */
+struct BQ27621SchedulerConfig
+{
+    uint32_t activeInterval[FIELD_COUNT]; // While [DSG]/[CHG] is set or |current| >= activeCurrent
+    uint32_t relaxInterval[FIELD_COUNT];  // Otherwise
+    int16_t activeCurrent;                // mA
+    uint32_t coalesceMicros;              // Fields due within this window are read together with the ones due now
+    uint32_t busClockHz;                  // Used to convert bytes into bus time
+    uint32_t budgetPeriod;                // Length of one budget window
+    uint32_t budgetMicros;                // Bus time allowed per window, 0 for unlimited
+};
+
+/**
+ * @brief Bus usage since begin()
+ *
+ */
+struct BQ27621SchedulerStats
+{
+    uint32_t polls;        // poll() calls that touched the bus
+    uint32_t transactions;
+    uint32_t deferred;     // Fields postponed because the window budget was spent
+    uint64_t busMicros;    // Estimated bus time
+    uint64_t elapsedMicros;
+    double occupancy;      // busMicros / elapsedMicros
+};
+
+/**
+ * @brief Reads each field only when it is due. Intervals follow the charge state, FIELD_CAPACITY is refreshed when
+ * StateOfCharge() has moved by the gauge's SOCI delta (or after its relax interval) and always together with
+ * StateOfCharge(), and due fields are fetched with whichever of one burst or one combined transfer moves fewer bytes.
+ */
+class BQ27621Scheduler
+{
+private:
+    BQ27621 &_gauge;
+    BQ27621SchedulerConfig _config;
+    BQ27621SchedulerStats _stats;
+    BQ27621Snapshot _values;
+    uint32_t _lastRead[FIELD_COUNT];
+    bool _valid[FIELD_COUNT];
+    uint16_t _capacitySoc; // StateOfCharge() when FIELD_CAPACITY was last read
+    uint8_t _sociDelta;
+    bool _active;
+    uint32_t _start;
+    uint32_t _windowStart;
+    uint32_t _windowMicros;
+
+    uint32_t interval(BQ27621Field field) const;
+    bool due(BQ27621Field field, uint32_t now) const;
+    uint32_t busTime(uint32_t bytes, uint32_t messages) const;
+    void storeWord(uint8_t command, uint16_t word);
+    void markRead(uint8_t command, uint32_t now, bool socRead);
+
+public:
+    BQ27621Scheduler(BQ27621 &gauge);
+
+    static BQ27621SchedulerConfig defaultConfig(void);
+    void setConfig(const BQ27621SchedulerConfig &config) { _config = config; }
+
+    BQ27621_error_code begin(uint32_t now);
+    BQ27621_error_code poll(uint32_t now, uint32_t *nextPoll);
+
+    const BQ27621Snapshot &values(void) const { return _values; }
+    bool isActive(void) const { return _active; }
+    BQ27621SchedulerStats stats(uint32_t now) const;
+};
+
+#endif /*BQ27621_SCHEDULER_H*/
@@ -0,0 +1,239 @@
+/**
+ * @file BQ27621_shared.cpp
+ * @author your name (you@domain.com)
+ * @brief Thread-safe front end for one BQ27621 shared by several threads
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_shared.h"
+
+BQ27621Shared::BQ27621Shared(BQ27621 &gauge) : _gauge(gauge), _stats(), _coalescing(true)
+{
+    for (uint8_t i = 0; i < SLOT_COUNT; i++)
+    {
+        _flights[i].active = false;
+        _flights[i].generation = 0;
+        _flights[i].result = OK;
+    }
+}
+
+/**
+ * @brief Performs the bus read behind a slot. Called with _busLock held.
+ *
+ * @param slot Slot to read
+ * @param value Receives the value
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::read(uint8_t slot, Result *value)
+{
+    if (slot == SLOT_VOLTAGE)
+        return _gauge.getVoltage(&value->word);
+    if (slot == SLOT_CURRENT)
+        return _gauge.getCurrent((int16_t *)&value->word);
+    if (slot == SLOT_POWER)
+        return _gauge.getPower((int16_t *)&value->word);
+    if (slot < SLOT_TEMPERATURE)
+        return _gauge.getSOC((SocMeasure)(slot - SLOT_SOC), &value->word);
+    if (slot < SLOT_CAPACITY)
+        return _gauge.getTemperature((TempMeasure)(slot - SLOT_TEMPERATURE), &value->word);
+    if (slot < SLOT_DEVICE_TYPE)
+        return _gauge.getCapacity((CapacityMeasure)(slot - SLOT_CAPACITY), &value->word);
+    if (slot == SLOT_DEVICE_TYPE)
+        return _gauge.getDeviceType(&value->word);
+    return _gauge.readSnapshot(&value->snapshot);
+}
+
+/**
+ * @brief Single flight: joins the read of this slot that is in flight, or becomes its leader and reads the bus.
+ * Waiters only need their flight's generation to move; if a newer read completed meanwhile its result is fresher and
+ * is returned instead.
+ *
+ * @param slot Slot to read
+ * @param value Receives the value
+ * @return BQ27621_error_code Result of the read that produced value
+ */
+BQ27621_error_code BQ27621Shared::coalesce(uint8_t slot, Result *value)
+{
+    Flight &flight = _flights[slot];
+    std::unique_lock<std::mutex> lock(_flightLock);
+    _stats.calls++;
+    if (_coalescing && flight.active)
+    {
+        uint32_t generation = flight.generation;
+        _stats.coalesced++;
+        flight.done.wait(lock, [&flight, generation] { return flight.generation != generation; });
+        *value = flight.value;
+        return flight.result;
+    }
+
+    bool leader = _coalescing;
+    if (leader)
+        flight.active = true;
+    _stats.reads++;
+    lock.unlock();
+
+    BQ27621_error_code retVal;
+    {
+        std::lock_guard<std::mutex> bus(_busLock);
+        retVal = read(slot, value);
+    }
+    if (!leader)
+        return retVal;
+
+    lock.lock();
+    flight.value = *value;
+    flight.result = retVal;
+    flight.generation++;
+    flight.active = false;
+    lock.unlock();
+    flight.done.notify_all();
+    return retVal;
+}
+
+/**
+ * @brief Reads and returns the battery voltage, coalesced with concurrent callers
+ *
+ * @param voltage
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::getVoltage(uint16_t *voltage)
+{
+    Result value;
+    BQ27621_error_code retVal = coalesce(SLOT_VOLTAGE, &value);
+    *voltage = value.word;
+    return retVal;
+}
+
+/**
+ * @brief Reads and returns the effective current, coalesced with concurrent callers
+ *
+ * @param current
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::getCurrent(int16_t *current)
+{
+    Result value;
+    BQ27621_error_code retVal = coalesce(SLOT_CURRENT, &value);
+    *current = (int16_t)value.word;
+    return retVal;
+}
+
+/**
+ * @brief Reads and returns the average power, coalesced with concurrent callers
+ *
+ * @param power
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::getPower(int16_t *power)
+{
+    Result value;
+    BQ27621_error_code retVal = coalesce(SLOT_POWER, &value);
+    *power = (int16_t)value.word;
+    return retVal;
+}
+
+/**
+ * @brief Reads and returns the specified state of charge, coalesced with concurrent callers
+ *
+ * @param type
+ * @param soc
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::getSOC(SocMeasure type, uint16_t *soc)
+{
+    Result value;
+    BQ27621_error_code retVal = coalesce(SLOT_SOC + ((type == UNFILTERED) ? 1 : 0), &value);
+    *soc = value.word;
+    return retVal;
+}
+
+/**
+ * @brief Reads and returns the specified temperature, coalesced with concurrent callers
+ *
+ * @param type
+ * @param temperature
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::getTemperature(TempMeasure type, uint16_t *temperature)
+{
+    Result value;
+    BQ27621_error_code retVal = coalesce(SLOT_TEMPERATURE + ((type == T_MEASURE_BATTERY) ? 0 : 1), &value);
+    *temperature = value.word;
+    return retVal;
+}
+
+/**
+ * @brief Reads and returns the specified capacity, coalesced with concurrent callers
+ *
+ * @param type
+ * @param capacity
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::getCapacity(CapacityMeasure type, uint16_t *capacity)
+{
+    Result value;
+    BQ27621_error_code retVal = coalesce(SLOT_CAPACITY + ((type <= C_MEASURE_DESIGN) ? type : C_MEASURE_REMAIN), &value);
+    *capacity = value.word;
+    return retVal;
+}
+
+/**
+ * @brief Reads and returns the device type, coalesced with concurrent callers
+ *
+ * @param deviceType
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::getDeviceType(uint16_t *deviceType)
+{
+    Result value;
+    BQ27621_error_code retVal = coalesce(SLOT_DEVICE_TYPE, &value);
+    *deviceType = value.word;
+    return retVal;
+}
+
+/**
+ * @brief Reads the default snapshot range in one burst, coalesced with concurrent callers
+ *
+ * @param snapshot
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Shared::readSnapshot(BQ27621Snapshot *snapshot)
+{
+    Result value;
+    BQ27621_error_code retVal = coalesce(SLOT_SNAPSHOT, &value);
+    *snapshot = value.snapshot;
+    return retVal;
+}
+
+/**
+ * @brief Enables or disables coalescing. Disabled, every call reads the bus and calls are only serialized.
+ *
+ * @param coalescing
+ */
+void BQ27621Shared::setCoalescing(bool coalescing)
+{
+    std::lock_guard<std::mutex> lock(_flightLock);
+    _coalescing = coalescing;
+}
+
+BQ27621SharedStats BQ27621Shared::stats(void)
+{
+    std::lock_guard<std::mutex> lock(_flightLock);
+    return _stats;
+}
+
+void BQ27621Shared::resetStats(void)
+{
+    std::lock_guard<std::mutex> lock(_flightLock);
+    _stats = BQ27621SharedStats();
+}
+
+BQ27621Shared::Exclusive::Exclusive(BQ27621Shared &shared) : _shared(shared), _lock(shared._busLock)
+{
+    std::lock_guard<std::mutex> lock(_shared._flightLock);
+    _shared._stats.exclusive++;
+}
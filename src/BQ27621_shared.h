@@ -0,0 +1,118 @@
+/**
+ * @file BQ27621_shared.h
+ * @author your name (you@domain.com)
+ * @brief Thread-safe front end for one BQ27621 shared by several threads
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_SHARED_H
+#define BQ27621_SHARED_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include "BQ27621.h"
+
+/**
+ * @brief Counters since construction or resetStats()
+ *
+ */
+struct BQ27621SharedStats
+{
+    uint64_t calls;     // Coalescable reads requested
+    uint64_t reads;     // Reads that went to the bus (one per flight)
+    uint64_t coalesced; // Calls that took the result of a read already in flight
+    uint64_t exclusive; // Exclusive sections entered
+};
+
+/**
+ * @brief Serializes every bus sequence of one gauge and coalesces identical reads: a caller asking for a value that is
+ * already being read waits for that read and returns its result instead of issuing its own (single flight). The result
+ * handed to a waiter was therefore sampled at most one transaction before its call.
+ *
+ * Multi-step sequences (configuration, sealing, ConfigSession, asynchronous operations) go through an Exclusive
+ * section, which holds the bus for its whole lifetime. Once the gauge is shared it must not be used directly.
+ */
+class BQ27621Shared
+{
+private:
+    enum Slot : uint8_t
+    {
+        SLOT_VOLTAGE,
+        SLOT_CURRENT,
+        SLOT_POWER,
+        SLOT_SOC,                             // Indexed by SocMeasure
+        SLOT_TEMPERATURE = SLOT_SOC + 2,      // Indexed by TempMeasure
+        SLOT_CAPACITY = SLOT_TEMPERATURE + 2, // Indexed by CapacityMeasure
+        SLOT_DEVICE_TYPE = SLOT_CAPACITY + C_MEASURE_DESIGN + 1,
+        SLOT_SNAPSHOT,
+        SLOT_COUNT
+    };
+
+    struct Result
+    {
+        uint16_t word;
+        BQ27621Snapshot snapshot;
+    };
+
+    struct Flight
+    {
+        bool active;         // A leader is reading this slot
+        uint32_t generation; // Incremented when a read completes
+        BQ27621_error_code result;
+        Result value;
+        std::condition_variable done;
+    };
+
+    BQ27621 &_gauge;
+    std::mutex _busLock;    // Held for every bus sequence
+    std::mutex _flightLock; // Protects _flights, _stats and _coalescing
+    Flight _flights[SLOT_COUNT];
+    BQ27621SharedStats _stats;
+    bool _coalescing;
+
+    BQ27621_error_code read(uint8_t slot, Result *value);
+    BQ27621_error_code coalesce(uint8_t slot, Result *value);
+
+public:
+    BQ27621Shared(BQ27621 &gauge);
+
+    BQ27621_error_code getVoltage(uint16_t *voltage);
+    BQ27621_error_code getCurrent(int16_t *current);
+    BQ27621_error_code getPower(int16_t *power);
+    BQ27621_error_code getSOC(SocMeasure type, uint16_t *soc);
+    BQ27621_error_code getTemperature(TempMeasure type, uint16_t *temperature);
+    BQ27621_error_code getCapacity(CapacityMeasure type, uint16_t *capacity);
+    BQ27621_error_code getDeviceType(uint16_t *deviceType);
+    BQ27621_error_code readSnapshot(BQ27621Snapshot *snapshot);
+
+    void setCoalescing(bool coalescing);
+    BQ27621SharedStats stats(void);
+    void resetStats(void);
+
+    class Exclusive;
+};
+
+/**
+ * @brief Holds the bus of a BQ27621Shared for its lifetime and gives direct access to the driver in the meantime
+ *
+ */
+class BQ27621Shared::Exclusive
+{
+private:
+    BQ27621Shared &_shared;
+    std::lock_guard<std::mutex> _lock;
+
+public:
+    Exclusive(BQ27621Shared &shared);
+    Exclusive(const Exclusive &) = delete;
+    Exclusive &operator=(const Exclusive &) = delete;
+
+    BQ27621 &gauge(void) { return _shared._gauge; }
+};
+
+#endif /*BQ27621_SHARED_H*/
@@ -0,0 +1,255 @@
+/**
+ * @file BQ27621_shm.h
+ * @author your name (you@domain.com)
+ * @brief Shared-memory telemetry segment layout and header-only reader
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_SHM_H
+#define BQ27621_SHM_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "BQ27621_defs.h"
+
+#define BQ27621_SHM_MAGIC "BQ27621M"
+#define BQ27621_SHM_VERSION 1
+#define BQ27621_SHM_ALIGN 64 // Slots and entries start on their own cache line
+
+#ifndef BQ27621_SHM_MAX_RETRIES
+#define BQ27621_SHM_MAX_RETRIES 10000 // Copies a reader attempts before it takes the publisher for dead
+#endif
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "Shared segment needs address-free 32-bit atomics");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Shared segment needs plain 32-bit atomics");
+
+/**
+ * @brief One published reading
+ *
+ */
+struct BQ27621ShmSample
+{
+    uint64_t timestampNanos; // CLOCK_MONOTONIC, comparable between processes of one host
+    uint16_t gauge;          // Slot index
+    uint8_t result;          // BQ27621_error_code of the read; snapshot is stale unless OK
+    uint8_t reserved;
+    BQ27621Snapshot snapshot;
+};
+
+/**
+ * @brief Latest reading of one gauge behind a seqlock: sequence is odd while the publisher writes, even otherwise,
+ * and 0 until the first reading
+ *
+ */
+struct alignas(BQ27621_SHM_ALIGN) BQ27621ShmSlot
+{
+    std::atomic<uint32_t> sequence;
+    BQ27621ShmSample sample;
+};
+
+/**
+ * @brief History ring entry: sequence holds index + 1 of the entry, 0 while it is being rewritten
+ *
+ */
+struct alignas(BQ27621_SHM_ALIGN) BQ27621ShmEntry
+{
+    std::atomic<uint32_t> sequence;
+    BQ27621ShmSample sample;
+};
+
+/**
+ * @brief Start of the segment, followed by gauges slots and historySize entries
+ *
+ */
+struct alignas(BQ27621_SHM_ALIGN) BQ27621ShmHeader
+{
+    char magic[8];
+    uint16_t version;
+    uint16_t gauges;
+    uint32_t historySize; // Entries, a power of two
+    uint64_t size;        // Bytes of the segment
+    std::atomic<uint32_t> ready;       // 1 once the layout is initialized
+    std::atomic<uint32_t> historyHead; // Entries published so far
+};
+
+/**
+ * @brief Bytes of a segment for the given layout
+ *
+ */
+static inline size_t bq27621ShmSize(uint16_t gauges, uint32_t historySize)
+{
+    return sizeof(BQ27621ShmHeader) + (size_t)gauges * sizeof(BQ27621ShmSlot) + (size_t)historySize * sizeof(BQ27621ShmEntry);
+}
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Maps a telemetry segment read-only. After open() every read is plain loads on the mapping: no syscalls and
+ * no locks, and a reader can never hold up the publisher or other readers.
+ */
+class BQ27621ShmReader
+{
+private:
+    const uint8_t *_map;
+    size_t _size;
+    const BQ27621ShmHeader *_header;
+
+    const BQ27621ShmSlot *slots(void) const { return (const BQ27621ShmSlot *)(_map + sizeof(BQ27621ShmHeader)); }
+    const BQ27621ShmEntry *entries(void) const { return (const BQ27621ShmEntry *)(slots() + _header->gauges); }
+
+public:
+    BQ27621ShmReader() : _map(NULL), _size(0), _header(NULL) {}
+    ~BQ27621ShmReader() { close(); }
+    BQ27621ShmReader(const BQ27621ShmReader &) = delete;
+    BQ27621ShmReader &operator=(const BQ27621ShmReader &) = delete;
+
+    /**
+     * @brief Maps the segment created by BQ27621ShmPublisher and checks its header
+     *
+     * @param name POSIX shared memory name, e.g. "/bq27621"
+     * @return BQ27621_error_code BUS_ERROR if the segment is missing, not ready or of another version
+     */
+    BQ27621_error_code open(const char *name)
+    {
+        close();
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0)
+            return BUS_ERROR;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BQ27621ShmHeader))
+        {
+            ::close(fd);
+            return BUS_ERROR;
+        }
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // The mapping keeps the segment referenced
+        if (map == MAP_FAILED)
+            return BUS_ERROR;
+
+        _map = (const uint8_t *)map;
+        _size = (size_t)st.st_size;
+        _header = (const BQ27621ShmHeader *)_map;
+        if (_header->ready.load(std::memory_order_acquire) != 1 || memcmp(_header->magic, BQ27621_SHM_MAGIC, 8) != 0 ||
+            _header->version != BQ27621_SHM_VERSION || _header->size > _size ||
+            bq27621ShmSize(_header->gauges, _header->historySize) != _header->size)
+        {
+            close();
+            return BUS_ERROR;
+        }
+        return OK;
+    }
+
+    void close(void)
+    {
+        if (_map != NULL)
+            munmap((void *)_map, _size);
+        _map = NULL;
+        _size = 0;
+        _header = NULL;
+    }
+
+    bool isOpen(void) const { return _map != NULL; }
+    uint16_t gauges(void) const { return _header->gauges; }
+    uint32_t historySize(void) const { return _header->historySize; }
+
+    /**
+     * @brief Sequence of a gauge slot, to check cheaply whether it changed since the last latest()
+     *
+     */
+    uint32_t sequence(uint16_t gauge) const { return slots()[gauge].sequence.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Copies the newest reading of a gauge, retrying while the publisher rewrites it
+     *
+     * @param gauge Slot index
+     * @param sample Receives the reading
+     * @param sequence Receives the slot sequence the copy belongs to, may be NULL
+     * @return false if the gauge was never published or does not exist, or if no consistent copy was made in
+     * BQ27621_SHM_MAX_RETRIES attempts (an odd sequence() then points to a publisher that died mid-write)
+     */
+    bool latest(uint16_t gauge, BQ27621ShmSample *sample, uint32_t *sequence = NULL) const
+    {
+        if (gauge >= _header->gauges)
+            return false;
+        const BQ27621ShmSlot &slot = slots()[gauge];
+        for (uint32_t attempt = 0; attempt < BQ27621_SHM_MAX_RETRIES; attempt++)
+        {
+            uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before == 0)
+                return false;
+            if (before & 1)
+                continue;
+            *sample = slot.sample;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == before)
+            {
+                if (sequence != NULL)
+                    *sequence = before;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t historyHead(void) const { return _header->historyHead.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Reads the history entry at *cursor and advances it. A cursor that fell behind the ring moves to the
+     * oldest entry still held and the skipped entries are added to *lost.
+     *
+     * @param cursor Reader's cursor, start at 0 or at historyHead()
+     * @param sample Receives the entry
+     * @param lost Incremented by the entries overwritten before they were read, may be NULL
+     * @return false once the reader is caught up, or if the entry stayed unreadable for BQ27621_SHM_MAX_RETRIES
+     * attempts, which leaves *cursor behind historyHead()
+     */
+    bool readHistory(uint32_t *cursor, BQ27621ShmSample *sample, uint32_t *lost) const
+    {
+        uint32_t mask = _header->historySize - 1;
+        for (uint32_t attempt = 0; attempt < BQ27621_SHM_MAX_RETRIES; attempt++)
+        {
+            uint32_t head = historyHead();
+            if (*cursor == head)
+                return false;
+
+            // Keep one entry of slack: the one after the newest may already be under rewrite
+            if (head - *cursor > mask)
+            {
+                uint32_t oldest = head - mask;
+                if (lost != NULL)
+                    *lost += oldest - *cursor;
+                *cursor = oldest;
+            }
+
+            const BQ27621ShmEntry &entry = entries()[*cursor & mask];
+            uint32_t sequence = entry.sequence.load(std::memory_order_acquire);
+            if (sequence == *cursor + 1)
+            {
+                *sample = entry.sample;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (entry.sequence.load(std::memory_order_relaxed) == sequence)
+                {
+                    (*cursor)++;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+};
+
+#endif /*__linux__*/
+
+#endif /*BQ27621_SHM_H*/
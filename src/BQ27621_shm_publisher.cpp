@@ -0,0 +1,166 @@
+/**
+ * @file BQ27621_shm_publisher.cpp
+ * @author your name (you@domain.com)
+ * @brief Publishes BQ27621 readings into a shared-memory telemetry segment
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_shm_publisher.h"
+
+#if defined(__linux__)
+
+#include <chrono>
+#include <new>
+
+BQ27621ShmPublisher::BQ27621ShmPublisher() : _map(NULL), _size(0), _header(NULL)
+{
+    _name[0] = '\0';
+}
+
+BQ27621ShmPublisher::~BQ27621ShmPublisher()
+{
+    close();
+}
+
+/**
+ * @brief Creates (or replaces) the segment and lays it out. Readers accept it once ready is set, after every slot and
+ * entry has been initialized.
+ *
+ * @param name POSIX shared memory name, e.g. "/bq27621"
+ * @param gauges Number of gauge slots
+ * @param historySize History entries, a power of two
+ * @return BQ27621_error_code BUS_ERROR if the layout is invalid or the segment cannot be created
+ */
+BQ27621_error_code BQ27621ShmPublisher::create(const char *name, uint16_t gauges, uint32_t historySize)
+{
+    close();
+    if (historySize < 2 || (historySize & (historySize - 1)) != 0 || strlen(name) >= sizeof(_name))
+        return BUS_ERROR;
+
+    shm_unlink(name); // Readers of a previous run keep their mapping, new readers see this segment
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        return BUS_ERROR;
+
+    size_t size = bq27621ShmSize(gauges, historySize);
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        ::close(fd);
+        shm_unlink(name);
+        return BUS_ERROR;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return BUS_ERROR;
+    }
+
+    _map = (uint8_t *)map;
+    _size = size;
+    strcpy(_name, name);
+
+    // ftruncate() zero-fills: every sequence starts at 0, meaning never published
+    _header = new (_map) BQ27621ShmHeader();
+    memcpy(_header->magic, BQ27621_SHM_MAGIC, 8);
+    _header->version = BQ27621_SHM_VERSION;
+    _header->gauges = gauges;
+    _header->historySize = historySize;
+    _header->size = size;
+    _header->historyHead.store(0, std::memory_order_relaxed);
+    for (uint16_t i = 0; i < gauges; i++)
+        new (&slots()[i]) BQ27621ShmSlot();
+    for (uint32_t i = 0; i < historySize; i++)
+        new (&entries()[i]) BQ27621ShmEntry();
+    _header->ready.store(1, std::memory_order_release);
+    return OK;
+}
+
+/**
+ * @brief Unmaps the segment
+ *
+ * @param unlink Also remove the name, so no new reader can open it (mapped readers keep their view)
+ */
+void BQ27621ShmPublisher::close(bool unlink)
+{
+    if (_map == NULL)
+        return;
+    munmap(_map, _size);
+    if (unlink)
+        shm_unlink(_name);
+    _map = NULL;
+    _size = 0;
+    _header = NULL;
+    _name[0] = '\0';
+}
+
+/**
+ * @brief Writes one reading into the gauge's slot and appends it to the history
+ *
+ * @param gauge Slot index
+ * @param result Result of the read
+ * @param snapshot Reading
+ * @param timestampNanos CLOCK_MONOTONIC time of the read
+ */
+void BQ27621ShmPublisher::publish(uint16_t gauge, BQ27621_error_code result, const BQ27621Snapshot &snapshot, uint64_t timestampNanos)
+{
+    if (_map == NULL || gauge >= _header->gauges)
+        return;
+
+    BQ27621ShmSample sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.timestampNanos = timestampNanos;
+    sample.gauge = gauge;
+    sample.result = (uint8_t)result;
+    sample.snapshot = snapshot;
+
+    BQ27621ShmSlot &slot = slots()[gauge];
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.sample = sample;
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(_historyLock);
+    uint32_t index = _header->historyHead.load(std::memory_order_relaxed);
+    BQ27621ShmEntry &entry = entries()[index & (_header->historySize - 1)];
+    entry.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.sample = sample;
+    entry.sequence.store(index + 1, std::memory_order_release);
+    _header->historyHead.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Reads a snapshot from the driver and publishes it, also when the read failed so readers see the error
+ *
+ * @param gauge Slot index
+ * @param driver Gauge to read
+ * @return BQ27621_error_code Result of the read
+ */
+BQ27621_error_code BQ27621ShmPublisher::sample(uint16_t gauge, BQ27621 &driver)
+{
+    uint64_t timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    BQ27621Snapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    BQ27621_error_code retVal = driver.readSnapshot(&snapshot);
+    publish(gauge, retVal, snapshot, timestamp);
+    return retVal;
+}
+
+/**
+ * @brief GaugeFleet callback publishing every sample under its fleet gauge index:
+ * fleet.setCallback(BQ27621ShmPublisher::fleetCallback, &publisher)
+ *
+ */
+void BQ27621ShmPublisher::fleetCallback(const BQ27621FleetSample &sample, void *context)
+{
+    static_cast<BQ27621ShmPublisher *>(context)->publish((uint16_t)sample.gauge, sample.result, sample.snapshot, sample.timestampNanos);
+}
+
+#endif /*__linux__*/
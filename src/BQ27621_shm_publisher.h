@@ -0,0 +1,57 @@
+/**
+ * @file BQ27621_shm_publisher.h
+ * @author your name (you@domain.com)
+ * @brief Publishes BQ27621 readings into a shared-memory telemetry segment
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_SHM_PUBLISHER_H
+#define BQ27621_SHM_PUBLISHER_H
+
+#include <mutex>
+#include "BQ27621.h"
+#include "BQ27621_fleet.h"
+#include "BQ27621_shm.h"
+
+#if defined(__linux__)
+
+/**
+ * @brief Owner side of a telemetry segment: one seqlocked slot per gauge plus a history ring of every reading. Run it
+ * in the process that owns the bus; other processes read through BQ27621ShmReader. Each gauge slot must have a single
+ * writer at a time; history appends from several threads are serialized here, never on the reader side.
+ */
+class BQ27621ShmPublisher
+{
+private:
+    uint8_t *_map;
+    size_t _size;
+    BQ27621ShmHeader *_header;
+    char _name[64];
+    std::mutex _historyLock;
+
+    BQ27621ShmSlot *slots(void) { return (BQ27621ShmSlot *)(_map + sizeof(BQ27621ShmHeader)); }
+    BQ27621ShmEntry *entries(void) { return (BQ27621ShmEntry *)(slots() + _header->gauges); }
+
+public:
+    BQ27621ShmPublisher();
+    ~BQ27621ShmPublisher();
+    BQ27621ShmPublisher(const BQ27621ShmPublisher &) = delete;
+    BQ27621ShmPublisher &operator=(const BQ27621ShmPublisher &) = delete;
+
+    BQ27621_error_code create(const char *name, uint16_t gauges, uint32_t historySize);
+    void close(bool unlink = true);
+    bool isOpen(void) const { return _map != NULL; }
+
+    void publish(uint16_t gauge, BQ27621_error_code result, const BQ27621Snapshot &snapshot, uint64_t timestampNanos);
+    BQ27621_error_code sample(uint16_t gauge, BQ27621 &driver);
+
+    static void fleetCallback(const BQ27621FleetSample &sample, void *context);
+};
+
+#endif /*__linux__*/
+
+#endif /*BQ27621_SHM_PUBLISHER_H*/
@@ -0,0 +1,233 @@
+/**
+ * @file BQ27621_subscribe.cpp
+ * @author your name (you@domain.com)
+ * @brief Deadband-filtered change subscriptions over BQ27621 telemetry
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_subscribe.h"
+#include <string.h>
+
+/**
+ * @brief Register behind each topic
+ *
+ */
+static const uint8_t topicRegisters[TOPIC_COUNT] = {
+    COMMAND_VOLTAGE,
+    COMMAND_EFFECTIVE_CURRENT,
+    COMMAND_STATE_OF_CHARGE,
+    COMMAND_TEMPERATURE,
+    COMMAND_FLAGS,
+};
+
+BQ27621Subscriptions::BQ27621Subscriptions(BQ27621 &gauge) : _gauge(gauge)
+{
+    memset(_consumers, 0, sizeof(_consumers));
+    memset(_subscriptions, 0, sizeof(_subscriptions));
+    memset(_wanted, 0, sizeof(_wanted));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+/**
+ * @brief Registers a consumer
+ *
+ * @param callback Receives the consumer's changes, must not be NULL
+ * @param context Opaque pointer passed back to callback
+ * @param consumer Receives the consumer handle
+ * @return false if BQ27621_MAX_CONSUMERS are registered
+ */
+bool BQ27621Subscriptions::addConsumer(BQ27621ChangeCallback callback, void *context, uint8_t *consumer)
+{
+    if (callback == NULL)
+        return false;
+    for (uint8_t i = 0; i < BQ27621_MAX_CONSUMERS; i++)
+    {
+        if (_consumers[i].callback == NULL)
+        {
+            _consumers[i].callback = callback;
+            _consumers[i].context = context;
+            *consumer = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Drops a consumer and all its subscriptions
+ *
+ * @param consumer Handle from addConsumer()
+ */
+void BQ27621Subscriptions::removeConsumer(uint8_t consumer)
+{
+    if (consumer >= BQ27621_MAX_CONSUMERS)
+        return;
+    for (uint8_t i = 0; i < BQ27621_MAX_SUBSCRIPTIONS; i++)
+    {
+        if (_subscriptions[i].used && _subscriptions[i].consumer == consumer)
+            unsubscribe(i);
+    }
+    _consumers[consumer].callback = NULL;
+    _consumers[consumer].context = NULL;
+}
+
+/**
+ * @brief Subscribes a consumer to a value topic. The next poll() notifies the current value as initial.
+ *
+ * @param consumer Handle from addConsumer()
+ * @param topic TOPIC_VOLTAGE, TOPIC_CURRENT, TOPIC_SOC or TOPIC_TEMPERATURE
+ * @param deadband How amount is interpreted
+ * @param amount Smallest change notified, 0 notifies every change
+ * @param subscription Receives the subscription handle
+ * @return false if the consumer or topic is invalid or BQ27621_MAX_SUBSCRIPTIONS are in use
+ */
+bool BQ27621Subscriptions::subscribe(uint8_t consumer, BQ27621Topic topic, BQ27621Deadband deadband, uint16_t amount, uint8_t *subscription)
+{
+    if (consumer >= BQ27621_MAX_CONSUMERS || _consumers[consumer].callback == NULL || topic >= TOPIC_COUNT)
+        return false;
+    if (topic == TOPIC_FLAGS && amount == 0)
+        return false;
+
+    for (uint8_t i = 0; i < BQ27621_MAX_SUBSCRIPTIONS; i++)
+    {
+        Subscription &entry = _subscriptions[i];
+        if (entry.used)
+            continue;
+        entry.used = true;
+        entry.primed = false;
+        entry.consumer = consumer;
+        entry.topic = topic;
+        entry.deadband = deadband;
+        entry.amount = amount;
+        entry.reference = 0;
+        _wanted[topic]++;
+        *subscription = i;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Subscribes a consumer to one or more Flags() bits. A change is notified whenever any bit of mask toggles;
+ * value and previous hold the masked Flags() word.
+ *
+ * @param consumer Handle from addConsumer()
+ * @param mask FlagBits to watch, not 0
+ * @param subscription Receives the subscription handle
+ * @return false if the consumer is invalid or BQ27621_MAX_SUBSCRIPTIONS are in use
+ */
+bool BQ27621Subscriptions::subscribeFlags(uint8_t consumer, uint16_t mask, uint8_t *subscription)
+{
+    return subscribe(consumer, TOPIC_FLAGS, DEADBAND_ABSOLUTE, mask, subscription);
+}
+
+/**
+ * @brief Ends a subscription. Once a topic has no subscription left poll() stops reading its register.
+ *
+ * @param subscription Handle from subscribe()
+ */
+void BQ27621Subscriptions::unsubscribe(uint8_t subscription)
+{
+    if (subscription >= BQ27621_MAX_SUBSCRIPTIONS || !_subscriptions[subscription].used)
+        return;
+    _wanted[_subscriptions[subscription].topic]--;
+    _subscriptions[subscription].used = false;
+}
+
+bool BQ27621Subscriptions::qualifies(const Subscription &subscription, int32_t value) const
+{
+    if (subscription.topic == TOPIC_FLAGS)
+        return value != subscription.reference;
+
+    int32_t delta = value - subscription.reference;
+    uint32_t change = (uint32_t)((delta < 0) ? -delta : delta);
+    if (change == 0)
+        return false;
+    if (subscription.deadband == DEADBAND_ABSOLUTE)
+        return change >= subscription.amount;
+
+    uint32_t reference = (uint32_t)((subscription.reference < 0) ? -subscription.reference : subscription.reference);
+    return (uint64_t)change * 100 >= (uint64_t)subscription.amount * reference;
+}
+
+/**
+ * @brief Reads the registers of the subscribed topics in one combined transfer, then calls each consumer once with the
+ * changes that left their deadband. Subscriptions whose change was notified take the new value as reference.
+ *
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Subscriptions::poll(void)
+{
+    _stats.polls++;
+
+    uint8_t commands[TOPIC_COUNT];
+    uint8_t topics[TOPIC_COUNT];
+    size_t count = 0;
+    for (uint8_t topic = 0; topic < TOPIC_COUNT; topic++)
+    {
+        if (_wanted[topic] == 0)
+            continue;
+        commands[count] = topicRegisters[topic];
+        topics[count] = topic;
+        count++;
+    }
+    if (count == 0)
+        return OK;
+
+    uint16_t words[TOPIC_COUNT];
+    _stats.transactions++;
+    BQ27621_error_code retVal = _gauge.readWords(commands, words, count);
+    if (retVal != OK)
+        return retVal;
+    _stats.registersRead += count;
+
+    int32_t values[TOPIC_COUNT] = {};
+    for (size_t i = 0; i < count; i++)
+        values[topics[i]] = (topics[i] == TOPIC_CURRENT) ? (int32_t)(int16_t)words[i] : (int32_t)words[i];
+
+    BQ27621Change changes[BQ27621_MAX_SUBSCRIPTIONS];
+    for (uint8_t consumer = 0; consumer < BQ27621_MAX_CONSUMERS; consumer++)
+    {
+        if (_consumers[consumer].callback == NULL)
+            continue;
+
+        size_t changed = 0;
+        for (uint8_t i = 0; i < BQ27621_MAX_SUBSCRIPTIONS; i++)
+        {
+            Subscription &entry = _subscriptions[i];
+            if (!entry.used || entry.consumer != consumer)
+                continue;
+
+            int32_t value = values[entry.topic];
+            if (entry.topic == TOPIC_FLAGS)
+                value &= entry.amount;
+            if (entry.primed && !qualifies(entry, value))
+            {
+                _stats.suppressed++;
+                continue;
+            }
+
+            BQ27621Change &change = changes[changed++];
+            change.subscription = i;
+            change.topic = entry.topic;
+            change.mask = (entry.topic == TOPIC_FLAGS) ? entry.amount : 0;
+            change.initial = !entry.primed;
+            change.previous = entry.primed ? entry.reference : value;
+            change.value = value;
+            entry.reference = value;
+            entry.primed = true;
+        }
+
+        if (changed != 0)
+        {
+            _stats.changes += changed;
+            _stats.notifications++;
+            _consumers[consumer].callback(changes, changed, _consumers[consumer].context);
+        }
+    }
+    return OK;
+}
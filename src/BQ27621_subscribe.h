@@ -0,0 +1,129 @@
+/**
+ * @file BQ27621_subscribe.h
+ * @author your name (you@domain.com)
+ * @brief Deadband-filtered change subscriptions over BQ27621 telemetry
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_SUBSCRIBE_H
+#define BQ27621_SUBSCRIBE_H
+
+#include "BQ27621.h"
+
+#ifndef BQ27621_MAX_CONSUMERS
+#define BQ27621_MAX_CONSUMERS 8
+#endif
+
+#ifndef BQ27621_MAX_SUBSCRIPTIONS
+#define BQ27621_MAX_SUBSCRIPTIONS 32
+#endif
+
+/**
+ * @brief Values a consumer can subscribe to
+ *
+ */
+enum BQ27621Topic : uint8_t
+{
+    TOPIC_VOLTAGE,     // Voltage(), mV
+    TOPIC_CURRENT,     // EffectiveCurrent(), mA
+    TOPIC_SOC,         // StateOfCharge(), %
+    TOPIC_TEMPERATURE, // Temperature(), 0.1 K
+    TOPIC_FLAGS,       // One or more FlagBits, notified when any of them toggles
+    TOPIC_COUNT
+};
+
+enum BQ27621Deadband : uint8_t
+{
+    DEADBAND_ABSOLUTE, // Notify when |value - reference| >= amount, in the topic's unit
+    DEADBAND_PERCENT   // Notify when |value - reference| >= amount % of |reference|
+};
+
+/**
+ * @brief One qualifying change. previous is the value last notified to this subscription.
+ *
+ */
+struct BQ27621Change
+{
+    uint8_t subscription; // Handle returned by subscribe()
+    BQ27621Topic topic;
+    uint16_t mask;        // FlagBits of a TOPIC_FLAGS subscription, 0 otherwise
+    bool initial;         // First value after subscribing, previous equals value
+    int32_t previous;
+    int32_t value;
+};
+
+/**
+ * @brief Receives every change of one poll for one consumer at once. changes is only valid during the call.
+ *
+ */
+typedef void (*BQ27621ChangeCallback)(const BQ27621Change *changes, size_t count, void *context);
+
+/**
+ * @brief Counters since construction
+ *
+ */
+struct BQ27621SubscriptionStats
+{
+    uint32_t polls;
+    uint32_t transactions;   // poll() calls that touched the bus, failed ones included
+    uint32_t registersRead;  // Registers of successful reads
+    uint32_t changes;        // Changes delivered
+    uint32_t notifications;  // Callback invocations
+    uint32_t suppressed;     // Readings that stayed inside a subscription's deadband
+};
+
+/**
+ * @brief Consumers register the topics they care about, each with its own deadband, and are called back with a batch
+ * of qualifying changes per poll. Each subscription keeps its own reference (the value it was last notified), so slow
+ * drifts are reported once they add up to the deadband. poll() reads only the registers of topics with at least one
+ * subscription, all in one combined transfer, and does not touch the bus when nothing is subscribed. Consumers and
+ * subscriptions live in fixed tables; neither registration nor dispatch allocates.
+ */
+class BQ27621Subscriptions
+{
+private:
+    struct Consumer
+    {
+        BQ27621ChangeCallback callback; // NULL if the slot is free
+        void *context;
+    };
+
+    struct Subscription
+    {
+        bool used;
+        bool primed; // A reference value has been notified
+        uint8_t consumer;
+        BQ27621Topic topic;
+        BQ27621Deadband deadband;
+        uint16_t amount; // Deadband amount, or FlagBits mask for TOPIC_FLAGS
+        int32_t reference;
+    };
+
+    BQ27621 &_gauge;
+    Consumer _consumers[BQ27621_MAX_CONSUMERS];
+    Subscription _subscriptions[BQ27621_MAX_SUBSCRIPTIONS];
+    uint8_t _wanted[TOPIC_COUNT]; // Subscriptions per topic
+    BQ27621SubscriptionStats _stats;
+
+    bool qualifies(const Subscription &subscription, int32_t value) const;
+
+public:
+    BQ27621Subscriptions(BQ27621 &gauge);
+
+    bool addConsumer(BQ27621ChangeCallback callback, void *context, uint8_t *consumer);
+    void removeConsumer(uint8_t consumer);
+    bool subscribe(uint8_t consumer, BQ27621Topic topic, BQ27621Deadband deadband, uint16_t amount, uint8_t *subscription);
+    bool subscribeFlags(uint8_t consumer, uint16_t mask, uint8_t *subscription);
+    void unsubscribe(uint8_t subscription);
+
+    bool wants(BQ27621Topic topic) const { return _wanted[topic] != 0; }
+    BQ27621_error_code poll(void);
+
+    const BQ27621SubscriptionStats &stats(void) const { return _stats; }
+};
+
+#endif /*BQ27621_SUBSCRIBE_H*/
@@ -0,0 +1,354 @@
+/**
+ * @file BQ27621_trace.cpp
+ * @author your name (you@domain.com)
+ * @brief Binary I2C trace capture and replay for the BQ27621 driver
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <string.h>
+#include "BQ27621_trace.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static void putWord(uint8_t *data, uint16_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+static void putLong(uint8_t *data, uint32_t value)
+{
+    putWord(data, (uint16_t)value);
+    putWord(&data[2], (uint16_t)(value >> 16));
+}
+
+static uint16_t getWord(const uint8_t *data)
+{
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint32_t getLong(const uint8_t *data)
+{
+    return getWord(data) | ((uint32_t)getWord(&data[2]) << 16);
+}
+
+TraceCaptureI2C::TraceCaptureI2C(I2C_device &bus) : _bus(bus), _file(NULL), _pending(NULL), _pendingCount(0), _pendingMicros(0), _records(0)
+{
+}
+
+TraceCaptureI2C::~TraceCaptureI2C()
+{
+    close();
+}
+
+/**
+ * @brief Creates the trace file and writes its header
+ *
+ * @param path
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code TraceCaptureI2C::open(const char *path)
+{
+    close();
+    _file = fopen(path, "wb");
+    if (_file == NULL)
+        return BUS_ERROR;
+
+    uint8_t header[BQ27621_TRACE_HEADER_SIZE];
+    memcpy(header, BQ27621_TRACE_MAGIC, 8);
+    putWord(&header[8], BQ27621_TRACE_VERSION);
+    putWord(&header[10], 0);
+    _records = 0;
+    return (fwrite(header, sizeof(header), 1, _file) == 1) ? OK : BUS_ERROR;
+}
+
+/**
+ * @brief Flushes and closes the trace file
+ *
+ */
+void TraceCaptureI2C::close(void)
+{
+    if (_file != NULL)
+        fclose(_file);
+    _file = NULL;
+}
+
+void TraceCaptureI2C::record(uint32_t micros, const I2C_message *messages, size_t count, BQ27621_error_code result)
+{
+    if (_file == NULL)
+        return;
+
+    uint8_t header[BQ27621_TRACE_RECORD_SIZE];
+    putLong(header, micros);
+    header[4] = (uint8_t)result;
+    putWord(&header[5], (uint16_t)count);
+    fwrite(header, sizeof(header), 1, _file);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t message[BQ27621_TRACE_MESSAGE_SIZE] = {messages[i].address, messages[i].flags};
+        putWord(&message[2], messages[i].len);
+        fwrite(message, sizeof(message), 1, _file);
+        fwrite(messages[i].data, 1, messages[i].len, _file);
+    }
+    _records++;
+}
+
+/**
+ * @brief Forwards a transfer and records it. A transfer the format cannot hold is failed before it reaches the bus,
+ * so the trace never misses a transfer the device saw.
+ *
+ * @param messages Pointer to message array
+ * @param count Number of messages
+ * @return BQ27621_error_code BUS_ERROR if count exceeds BQ27621_TRACE_MAX_MESSAGES while capturing
+ */
+BQ27621_error_code TraceCaptureI2C::transfer(I2C_message *messages, size_t count)
+{
+    if (_file != NULL && count > BQ27621_TRACE_MAX_MESSAGES)
+        return BUS_ERROR;
+    uint32_t micros = _bus.micros();
+    BQ27621_error_code result = _bus.transfer(messages, count);
+    record(micros, messages, count, result);
+    return result;
+}
+
+BQ27621_error_code TraceCaptureI2C::startTransfer(I2C_message *messages, size_t count)
+{
+    if (_file != NULL && count > BQ27621_TRACE_MAX_MESSAGES)
+        return BUS_ERROR;
+    _pendingMicros = _bus.micros();
+    BQ27621_error_code result = _bus.startTransfer(messages, count);
+    if (result == OK)
+    {
+        _pending = messages;
+        _pendingCount = count;
+    }
+    return result;
+}
+
+/**
+ * @brief Polls the real bus; the transfer is recorded once it completes, when the read data is known
+ *
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code TraceCaptureI2C::pollTransfer(void)
+{
+    BQ27621_error_code result = _bus.pollTransfer();
+    if (result != PENDING && _pending != NULL)
+    {
+        record(_pendingMicros, _pending, _pendingCount, result);
+        _pending = NULL;
+    }
+    return result;
+}
+
+#if defined(__linux__)
+
+BQ27621TraceReader::BQ27621TraceReader() : _map(NULL), _size(0), _pos(0)
+{
+}
+
+BQ27621TraceReader::~BQ27621TraceReader()
+{
+    close();
+}
+
+/**
+ * @brief Maps a trace file read-only and checks its header
+ *
+ * @param path
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621TraceReader::open(const char *path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return BUS_ERROR;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BQ27621_TRACE_HEADER_SIZE)
+    {
+        ::close(fd);
+        return BUS_ERROR;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping keeps the file referenced
+    if (map == MAP_FAILED)
+        return BUS_ERROR;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    _map = (const uint8_t *)map;
+    _size = (size_t)st.st_size;
+    if (memcmp(_map, BQ27621_TRACE_MAGIC, 8) != 0 || getWord(&_map[8]) != BQ27621_TRACE_VERSION)
+    {
+        close();
+        return BUS_ERROR;
+    }
+    rewind();
+    return OK;
+}
+
+/**
+ * @brief Unmaps the trace
+ *
+ */
+void BQ27621TraceReader::close(void)
+{
+    if (_map != NULL)
+        munmap((void *)_map, _size);
+    _map = NULL;
+    _size = 0;
+    _pos = 0;
+}
+
+/**
+ * @brief Decodes the record at the current position without consuming it
+ *
+ * @param record
+ * @return false at the end of the trace or on a truncated record
+ */
+bool BQ27621TraceReader::peek(BQ27621TraceRecord *record)
+{
+    if (_map == NULL || _size - _pos < BQ27621_TRACE_RECORD_SIZE)
+        return false;
+
+    const uint8_t *data = &_map[_pos];
+    record->micros = getLong(data);
+    record->result = (BQ27621_error_code)data[4];
+    record->count = getWord(&data[5]);
+    record->messages = &data[BQ27621_TRACE_RECORD_SIZE];
+    return true;
+}
+
+/**
+ * @brief Decodes the record at the current position and moves past it
+ *
+ * @param record
+ * @return false at the end of the trace or on a truncated record
+ */
+bool BQ27621TraceReader::next(BQ27621TraceRecord *record)
+{
+    if (!peek(record))
+        return false;
+
+    size_t pos = _pos + BQ27621_TRACE_RECORD_SIZE;
+    for (uint16_t i = 0; i < record->count; i++)
+    {
+        if (_size - pos < BQ27621_TRACE_MESSAGE_SIZE)
+            return false;
+        pos += BQ27621_TRACE_MESSAGE_SIZE + getWord(&_map[pos + 2]);
+        if (pos > _size)
+            return false;
+    }
+    _pos = pos;
+    return true;
+}
+
+/**
+ * @brief Decodes the message at cursor
+ *
+ * @param cursor Start of a message, record.messages for the first one
+ * @param message
+ * @return Start of the following message
+ */
+const uint8_t *BQ27621TraceReader::message(const uint8_t *cursor, BQ27621TraceMessage *message)
+{
+    message->address = cursor[0];
+    message->flags = cursor[1];
+    message->len = getWord(&cursor[2]);
+    message->data = &cursor[BQ27621_TRACE_MESSAGE_SIZE];
+    return message->data + message->len;
+}
+
+TraceReplayI2C::TraceReplayI2C() : _clock(0), _transfers(0), _mismatches(0)
+{
+}
+
+/**
+ * @brief Maps a trace for replay; the clock starts at the first record's timestamp
+ *
+ * @param path
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code TraceReplayI2C::open(const char *path)
+{
+    BQ27621_error_code retVal = _reader.open(path);
+    if (retVal != OK)
+        return retVal;
+
+    BQ27621TraceRecord record;
+    _clock = _reader.peek(&record) ? record.micros : 0;
+    _transfers = 0;
+    _mismatches = 0;
+    return OK;
+}
+
+/**
+ * @brief True once every record was replayed
+ *
+ */
+bool TraceReplayI2C::finished(void)
+{
+    BQ27621TraceRecord record;
+    return !_reader.peek(&record);
+}
+
+/**
+ * @brief Matches the transfer against the next record. On a match read buffers get the recorded bytes and the
+ * recorded result is returned; a transfer that differs from the trace (or runs past its end) fails with
+ * BUS_ERROR and leaves the trace where it is.
+ *
+ * @param messages Pointer to message array
+ * @param count Number of messages
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code TraceReplayI2C::transfer(I2C_message *messages, size_t count)
+{
+    BQ27621TraceRecord record;
+    size_t pos = _reader.position();
+    if (!_reader.next(&record) || record.count != count)
+    {
+        _mismatches++;
+        return BUS_ERROR;
+    }
+
+    const uint8_t *cursor = record.messages;
+    for (size_t i = 0; i < count; i++)
+    {
+        BQ27621TraceMessage message;
+        cursor = BQ27621TraceReader::message(cursor, &message);
+        bool match = message.address == messages[i].address && message.flags == messages[i].flags && message.len == messages[i].len;
+        if (match && !(message.flags & I2C_MSG_READ))
+            match = memcmp(message.data, messages[i].data, message.len) == 0;
+        if (!match)
+        {
+            _reader.seek(pos);
+            _mismatches++;
+            return BUS_ERROR;
+        }
+    }
+
+    cursor = record.messages;
+    for (size_t i = 0; i < count; i++)
+    {
+        BQ27621TraceMessage message;
+        cursor = BQ27621TraceReader::message(cursor, &message);
+        if (message.flags & I2C_MSG_READ)
+            memcpy(messages[i].data, message.data, message.len);
+    }
+    if ((int32_t)(record.micros - _clock) > 0)
+        _clock = record.micros;
+    _transfers++;
+    return record.result;
+}
+
+#endif /*__linux__*/
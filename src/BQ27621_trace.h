@@ -0,0 +1,148 @@
+/**
+ * @file BQ27621_trace.h
+ * @author your name (you@domain.com)
+ * @brief Binary I2C trace capture and replay for the BQ27621 driver
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_TRACE_H
+#define BQ27621_TRACE_H
+
+#include <stdio.h>
+#include "BQ27621_i2c.h"
+
+/*
+ * Trace file layout, all fields little-endian:
+ *   header:  "BQ27621T" version:u16 reserved:u16
+ *   record:  micros:u32 result:u8 count:u16 message[count]
+ *   message: address:u8 flags:u8 len:u16 data[len]   (bytes written, or bytes read back)
+ */
+#define BQ27621_TRACE_MAGIC "BQ27621T"
+#define BQ27621_TRACE_VERSION 2
+#define BQ27621_TRACE_HEADER_SIZE 12
+#define BQ27621_TRACE_RECORD_SIZE 7
+#define BQ27621_TRACE_MAX_MESSAGES 0xFFFF // Transfers with more messages are failed, not recorded
+#define BQ27621_TRACE_MESSAGE_SIZE 4
+
+/**
+ * @brief One message of a record; data points into the trace
+ *
+ */
+struct BQ27621TraceMessage
+{
+    uint8_t address;
+    uint8_t flags;
+    uint16_t len;
+    const uint8_t *data;
+};
+
+/**
+ * @brief One combined transfer; messages points at the first encoded message inside the trace
+ *
+ */
+struct BQ27621TraceRecord
+{
+    uint32_t micros;
+    BQ27621_error_code result;
+    uint16_t count;
+    const uint8_t *messages;
+};
+
+/**
+ * @brief Records every combined transfer issued through it to a trace file, then forwards it to the real bus
+ *
+ */
+class TraceCaptureI2C : public I2C_device
+{
+private:
+    I2C_device &_bus;
+    FILE *_file;
+    I2C_message *_pending;
+    size_t _pendingCount;
+    uint32_t _pendingMicros;
+    uint32_t _records;
+
+    void record(uint32_t micros, const I2C_message *messages, size_t count, BQ27621_error_code result);
+
+public:
+    TraceCaptureI2C(I2C_device &bus);
+    ~TraceCaptureI2C();
+
+    BQ27621_error_code open(const char *path);
+    void close(void);
+    bool isOpen(void) const { return _file != NULL; }
+    uint32_t records(void) const { return _records; }
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override;
+    BQ27621_error_code startTransfer(I2C_message *messages, size_t count) override;
+    BQ27621_error_code pollTransfer(void) override;
+    BQ27621_error_code selectPath(const BQ27621BusPath &path) override { return _bus.selectPath(path); }
+    uint32_t micros(void) override { return _bus.micros(); }
+    void delayMicros(uint32_t us) override { _bus.delayMicros(us); }
+};
+
+#if defined(__linux__)
+
+/**
+ * @brief Memory-maps a trace and walks it record by record without copying
+ *
+ */
+class BQ27621TraceReader
+{
+private:
+    const uint8_t *_map;
+    size_t _size;
+    size_t _pos;
+
+public:
+    BQ27621TraceReader();
+    ~BQ27621TraceReader();
+
+    BQ27621_error_code open(const char *path);
+    void close(void);
+    bool isOpen(void) const { return _map != NULL; }
+
+    bool next(BQ27621TraceRecord *record);
+    bool peek(BQ27621TraceRecord *record);
+    void rewind(void) { _pos = BQ27621_TRACE_HEADER_SIZE; }
+    size_t position(void) const { return _pos; }
+    void seek(size_t position) { _pos = position; } // Only to a value returned by position()
+    size_t size(void) const { return _size; }
+
+    static const uint8_t *message(const uint8_t *cursor, BQ27621TraceMessage *message);
+};
+
+/**
+ * @brief Answers the driver's transfers from a trace instead of a bus. Written bytes are checked against the
+ * recorded ones, read buffers are filled with the recorded bytes, and time only moves through delayMicros() and
+ * the recorded timestamps, so the unmodified driver runs as fast as the CPU allows.
+ */
+class TraceReplayI2C : public I2C_device
+{
+private:
+    BQ27621TraceReader _reader;
+    uint32_t _clock;
+    uint32_t _transfers;
+    uint32_t _mismatches;
+
+public:
+    TraceReplayI2C();
+
+    BQ27621_error_code open(const char *path);
+    void close(void) { _reader.close(); }
+    bool finished(void);
+    uint32_t transfers(void) const { return _transfers; }
+    uint32_t mismatches(void) const { return _mismatches; }
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override;
+    uint32_t micros(void) override { return _clock; }
+    void delayMicros(uint32_t us) override { _clock += us; }
+};
+
+#endif /*__linux__*/
+
+#endif /*BQ27621_TRACE_H*/
@@ -0,0 +1,162 @@
+/**
+ * @file BQ27621_api_bench.cpp
+ * @brief Per-call cost of the public BQ27621 API against the simulated gauge: transactions, bus bytes, modelled bus
+ * time, simulated elapsed time and host CPU time. Prints JSON to stdout, or to the file given as first argument.
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <vector>
+#include "BQ27621.h"
+#include "BQ27621_sim.h"
+
+#define BUS_CLOCK_HZ 400000
+
+struct BenchCase
+{
+    const char *name;
+    unsigned iterations;
+    std::function<BQ27621_error_code(unsigned)> call;
+};
+
+struct BenchResult
+{
+    const char *name;
+    unsigned iterations;
+    unsigned errors;
+    double transactions;
+    double bytes;
+    double busMicros;
+    double elapsedMicros; // Simulated, includes the gauge's own latencies (CONFIG UPDATE, reset)
+    double cpuNanos;
+    uint32_t p99Micros;  // Operation latency tail, only with BQ27621_INSTRUMENTATION
+    uint32_t p999Micros;
+};
+
+int main(int argc, char **argv)
+{
+    BQ27621Sim sim(BUS_CLOCK_HZ);
+    BQ27621 gauge(sim);
+    if (gauge.init() != OK)
+    {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+
+    uint16_t word;
+    int16_t value;
+    bool flag;
+    uint8_t byte;
+    GpoutFunction function;
+    BQ27621FlagSet flags;
+    BQ27621StatusSet status;
+    BQ27621Snapshot snapshot;
+    const uint8_t commands[3] = {COMMAND_VOLTAGE, COMMAND_EFFECTIVE_CURRENT, COMMAND_STATE_OF_CHARGE};
+    uint16_t words[3];
+    BQ27621ImageBlock image[4] = {};
+    image[0].classId = ID_STATE;
+    image[1].classId = ID_STATE;
+    image[1].block = 1;
+    image[2].classId = ID_DISCHARGE;
+    image[3].classId = ID_REGISTERS;
+    if (gauge.readImage(image, 4) != OK)
+    {
+        fprintf(stderr, "readImage failed\n");
+        return 1;
+    }
+
+    std::vector<BenchCase> cases = {
+        {"getVoltage", 1000, [&](unsigned) { return gauge.getVoltage(&word); }},
+        {"getCurrent", 1000, [&](unsigned) { return gauge.getCurrent(&value); }},
+        {"getPower", 1000, [&](unsigned) { return gauge.getPower(&value); }},
+        {"getCapacity", 1000, [&](unsigned i) { return gauge.getCapacity((CapacityMeasure)(i % (C_MEASURE_DESIGN + 1)), &word); }},
+        {"getSOC", 1000, [&](unsigned i) { return gauge.getSOC((SocMeasure)(i & 1), &word); }},
+        {"getTemperature", 1000, [&](unsigned i) { return gauge.getTemperature((TempMeasure)(i & 1), &word); }},
+        {"getFlags", 1000, [&](unsigned) { return gauge.getFlags(&flags); }},
+        {"getStatus", 1000, [&](unsigned) { return gauge.getStatus(&flags, &status); }},
+        {"getSoc1Flag", 1000, [&](unsigned) { return gauge.getSoc1Flag(&flag); }},
+        {"getSociDelta", 1000, [&](unsigned) { return gauge.getSociDelta(&byte); }},
+        {"getDeviceType", 1000, [&](unsigned) { return gauge.getDeviceType(&word); }},
+        {"readSnapshot", 1000, [&](unsigned) { return gauge.readSnapshot(&snapshot); }},
+        {"readWords", 1000, [&](unsigned) { return gauge.readWords(commands, words, 3); }},
+        {"getGpoutPolarity", 1000, [&](unsigned) { return gauge.getGpoutPolarity(&flag); }},
+        {"getGpoutFunction", 1000, [&](unsigned) { return gauge.getGpoutFunction(&function); }},
+        {"flashImage (unchanged)", 20, [&](unsigned) { return gauge.flashImage(image, 4, true, NULL); }},
+        {"flashImage (one block)", 20, [&](unsigned i) {
+             image[0].data[STATE_DESIGN_CAPACITY + 1] = (uint8_t)(0xE8 + (i & 1));
+             return gauge.flashImage(image, 4, true, NULL);
+         }},
+        {"setGpoutPolarity", 20, [&](unsigned i) { return gauge.setGpoutPolarity(i & 1); }},
+        {"setGpoutFunction", 20, [&](unsigned i) { return gauge.setGpoutFunction((i & 1) ? GPOUT_F_BAT_LOW : GPOUT_F_SOC_INT); }},
+        {"setSOC1Thresholds", 20, [&](unsigned i) { return gauge.setSOC1Thresholds((uint8_t)(10 + (i & 1)), 15); }},
+        {"setSOCFThresholds", 20, [&](unsigned i) { return gauge.setSOCFThresholds((uint8_t)(2 + (i & 1)), 5); }},
+        {"setSociDelta", 20, [&](unsigned i) { return gauge.setSociDelta((uint8_t)(1 + (i & 1))); }},
+        {"setCapacity", 20, [&](unsigned i) { return gauge.setCapacity((uint16_t)(1000 + (i & 1))); }},
+        {"setDesignenergy", 20, [&](unsigned i) { return gauge.setDesignenergy((uint16_t)(3700 + (i & 1))); }},
+        {"setTerminateVoltage", 20, [&](unsigned i) { return gauge.setTerminateVoltage((uint16_t)(3000 + (i & 1))); }},
+        {"ConfigSession", 20, [&](unsigned i) {
+             BQ27621::ConfigSession session(gauge);
+             session.setCapacity((uint16_t)(1000 + (i & 1)));
+             session.setDesignenergy((uint16_t)(3700 + (i & 1)));
+             session.setTerminateVoltage((uint16_t)(3000 + (i & 1)));
+             return session.commit();
+         }},
+    };
+
+    std::vector<BenchResult> results;
+    unsigned failures = 0;
+    for (const BenchCase &benchCase : cases)
+    {
+        BenchResult result = {benchCase.name, benchCase.iterations, 0, 0, 0, 0, 0, 0, 0, 0};
+#if BQ27621_INSTRUMENTATION
+        gauge.instrumentation().reset();
+#endif
+        sim.resetStats();
+        uint32_t simStart = sim.micros();
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < benchCase.iterations; i++)
+        {
+            if (benchCase.call(i) != OK)
+                result.errors++;
+        }
+        double cpuNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        BQ27621SimStats stats = sim.stats();
+        result.transactions = (double)stats.transactions / benchCase.iterations;
+        result.bytes = (double)stats.bytes / benchCase.iterations;
+        result.busMicros = stats.busNanos / 1000.0 / benchCase.iterations;
+        result.elapsedMicros = (double)(uint32_t)(sim.micros() - simStart) / benchCase.iterations;
+        result.cpuNanos = cpuNanos / benchCase.iterations;
+#if BQ27621_INSTRUMENTATION
+        result.p99Micros = gauge.instrumentation().operationLatency(0.99f);
+        result.p999Micros = gauge.instrumentation().operationLatency(0.999f);
+#endif
+        failures += result.errors;
+        results.push_back(result);
+    }
+
+    FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(out, "{\n  \"bus_clock_hz\": %u,\n  \"results\": [\n", BUS_CLOCK_HZ);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        fprintf(out,
+                "    {\"api\": \"%s\", \"iterations\": %u, \"errors\": %u, \"transactions\": %.2f, \"bytes\": %.2f, "
+                "\"bus_us\": %.2f, \"elapsed_us\": %.2f, \"cpu_ns\": %.1f",
+                r.name, r.iterations, r.errors, r.transactions, r.bytes, r.busMicros, r.elapsedMicros, r.cpuNanos);
+#if BQ27621_INSTRUMENTATION
+        fprintf(out, ", \"p99_us\": %u, \"p999_us\": %u", r.p99Micros, r.p999Micros);
+#endif
+        fprintf(out, "}%s\n", (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    return failures == 0 ? 0 : 1;
+}
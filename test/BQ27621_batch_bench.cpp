@@ -0,0 +1,61 @@
+/**
+ * @file BQ27621_batch_bench.cpp
+ * @brief Throughput of BQ27621BatchDecoder per kernel, in samples (all fields of one snapshot) per second.
+ * Fails if a kernel's output differs from the scalar one.
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "BQ27621_batch.h"
+
+#define SAMPLES (1 << 20)
+#define ROUNDS 10
+
+int main()
+{
+    static const char *const names[] = {"scalar", "sse2", "avx2"};
+    std::vector<uint8_t> raw(BATCH_FIELD_COUNT * SAMPLES * 2);
+    uint32_t seed = 1;
+    for (uint8_t &byte : raw)
+    {
+        seed = seed * 1103515245 + 12345;
+        byte = (uint8_t)(seed >> 16);
+    }
+
+    std::vector<float> reference;
+    int failures = 0;
+    for (bool bigEndian : {false, true})
+    {
+        for (int k = BATCH_KERNEL_SCALAR; k <= BATCH_KERNEL_AVX2; k++)
+        {
+            if (!BQ27621BatchDecoder::kernelSupported((BQ27621BatchKernel)k))
+                continue;
+            BQ27621BatchDecoder decoder((BQ27621BatchKernel)k);
+            std::vector<float> out(BATCH_FIELD_COUNT * SAMPLES);
+            BQ27621RawBatch in;
+            BQ27621DecodedBatch decoded;
+            in.bigEndian = bigEndian;
+            for (size_t f = 0; f < BATCH_FIELD_COUNT; f++)
+            {
+                in.field[f] = &raw[f * SAMPLES * 2];
+                decoded.field[f] = &out[f * SAMPLES];
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (int round = 0; round < ROUNDS; round++)
+                decoder.decode(in, decoded, SAMPLES - 3); // Leaves a tail for the narrower kernels
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (k == BATCH_KERNEL_SCALAR)
+                reference = out;
+            bool same = memcmp(reference.data(), out.data(), out.size() * sizeof(float)) == 0;
+            failures += same ? 0 : 1;
+            printf("%-6s %-10s %8.1f Msamples/s %8.1f Mwords/s %s\n", names[k], bigEndian ? "big-endian" : "wire", (double)(SAMPLES - 3) * ROUNDS / seconds / 1e6,
+                   (double)(SAMPLES - 3) * ROUNDS * BATCH_FIELD_COUNT / seconds / 1e6, same ? "" : "MISMATCH");
+        }
+    }
+    return failures;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file BQ27621_config_test.cpp
+ * @brief Data memory write through step() with one transfer failing at every point of the sequence: the gauge must end
+ * up out of CONFIG UPDATE and sealed again, and a failed write must not leave a block in the cache that makes the
+ * retried write look like a no-op.
+ *
+ */
+
+#include <cstdio>
+#include "BQ27621.h"
+#include "BQ27621_sim.h"
+
+#define CAPACITY 1234
+
+struct WriteResult
+{
+    BQ27621_error_code result;
+    uint32_t transactions;
+};
+
+/**
+ * @brief Writes Design Capacity, failing the transfer numbered failAt (none if beyond the sequence)
+ *
+ */
+static WriteResult writeCapacity(BQ27621Sim &sim, BQ27621 &gauge, uint32_t failAt, BQ27621_error_code error)
+{
+    const uint8_t data[2] = {(uint8_t)(CAPACITY >> 8), (uint8_t)(CAPACITY & 0xFF)};
+    BQ27621Operation op;
+    WriteResult result = {OK, 0};
+    uint32_t start = sim.stats().transactions;
+    bool injected = false;
+
+    gauge.startWriteExtendedData(&op, ID_STATE, STATE_DESIGN_CAPACITY, data, sizeof(data));
+    for (;;)
+    {
+        // Transfers run inside step(), so arming here hits the next one
+        if (!injected && sim.stats().transactions - start == failAt)
+        {
+            sim.injectErrors(1, error);
+            injected = true;
+        }
+        result.result = gauge.step(&op);
+        if (result.result != PENDING)
+            break;
+        if (op.waitMicros != 0)
+            sim.delayMicros(op.waitMicros);
+    }
+    result.transactions = sim.stats().transactions - start;
+    return result;
+}
+
+int main(void)
+{
+    BQ27621RetryPolicy policy = BQ27621::defaultRetryPolicy();
+    policy.maxAttempts = 1; // The injected error must reach the state machine
+    policy.operationBudget = 0;
+
+    uint32_t sequence;
+    {
+        BQ27621Sim sim;
+        BQ27621 gauge(sim);
+        gauge.setRetryPolicy(policy);
+        WriteResult clean = writeCapacity(sim, gauge, UINT32_MAX, OK);
+        if (clean.result != OK || sim.dataMemoryWord(ID_STATE, STATE_DESIGN_CAPACITY) != CAPACITY)
+        {
+            fprintf(stderr, "clean write failed\n");
+            return 1;
+        }
+        sequence = clean.transactions;
+    }
+
+    const BQ27621_error_code errors[] = {NACK_RECEIVED, BUS_BUSY};
+    unsigned failures = 0;
+    unsigned failedWrites = 0;
+    for (size_t e = 0; e < sizeof(errors) / sizeof(errors[0]); e++)
+    {
+        for (uint32_t failAt = 0; failAt < sequence; failAt++)
+        {
+            BQ27621Sim sim;
+            BQ27621 gauge(sim);
+            gauge.setRetryPolicy(policy);
+            WriteResult write = writeCapacity(sim, gauge, failAt, errors[e]);
+
+            // Let a CONFIG UPDATE entry or exit still under way settle before looking at the mode
+            sim.delayMicros(2 * sim.timing().resetMicros + sim.timing().cfgUpdateMicros);
+            bool stuck = sim.inConfigUpdate();
+            bool unsealed = (sim.controlStatus() & STATUS_SS) == 0;
+
+            // The retried write must reach data memory, not stop at a stale cached block
+            WriteResult retry = writeCapacity(sim, gauge, UINT32_MAX, OK);
+            bool written = retry.result == OK && sim.dataMemoryWord(ID_STATE, STATE_DESIGN_CAPACITY) == CAPACITY;
+
+            if (write.result != OK)
+                failedWrites++;
+            if (stuck || unsealed || !written)
+            {
+                fprintf(stderr, "error %d at transfer %u: result %d, config update %d, unsealed %d, retried write %d\n",
+                        errors[e], failAt, write.result, stuck, unsealed, written);
+                failures++;
+            }
+        }
+    }
+    if (failedWrites == 0)
+        failures++;
+
+    printf("{\n  \"sequence_transfers\": %u, \"failed_writes\": %u, \"failures\": %u\n}\n", sequence, failedWrites, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file BQ27621_estimator_test.cpp
+ * @brief BQ27621Estimator fed with known snapshots: time-to-empty, time-to-full, throughput and cycles match hand
+ * computed values, a repeated timestamp leaves the averages finite even without smoothing, and a FullChargeCapacity()
+ * far above DesignCapacity() saturates stateOfHealth instead of wrapping.
+ *
+ */
+
+#include <cstdio>
+#include <string.h>
+#include "BQ27621_estimator.h"
+
+#define DESIGN_CAPACITY 2000
+#define MINUTE 60000000UL
+
+static BQ27621Snapshot sample(int16_t current, int16_t power, uint16_t remaining, uint16_t full)
+{
+    BQ27621Snapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.effectiveCurrent = current;
+    snapshot.averagePower = power;
+    snapshot.remainingCapacity = remaining;
+    snapshot.fullChargeCapacity = full;
+    return snapshot;
+}
+
+int main(void)
+{
+    unsigned failures = 0;
+
+    // 500 mA and 1850 mW out for one hour: 1000 mAh left lasts 120 min, 500 mAh is a quarter cycle
+    BQ27621Estimator discharge(DESIGN_CAPACITY);
+    for (uint32_t minute = 0; minute <= 60; minute++)
+        discharge.update(sample(-500, -1850, 1000, 1900), minute * MINUTE);
+    BQ27621Estimate empty = discharge.estimate();
+    if (empty.timeToEmpty != 120 || empty.timeToFull != BQ27621_TIME_UNAVAILABLE || empty.averageCurrent != -500)
+        failures++;
+    if (empty.energyOut != 1850 || empty.energyIn != 0 || empty.chargeOut != 500 || empty.cycles != 25)
+        failures++;
+    if (empty.stateOfHealth != 95)
+        failures++;
+
+    // 1000 mA in: 900 mAh missing fills in 54 min
+    BQ27621Estimator charge(DESIGN_CAPACITY);
+    for (uint32_t minute = 0; minute <= 10; minute++)
+        charge.update(sample(1000, 3900, 1000, 1900), minute * MINUTE);
+    BQ27621Estimate full = charge.estimate();
+    if (full.timeToFull != 54 || full.timeToEmpty != BQ27621_TIME_UNAVAILABLE || full.energyIn != 650)
+        failures++;
+
+    // Resting: no time estimate either way
+    BQ27621Estimator rest(DESIGN_CAPACITY);
+    rest.update(sample(-5, 0, 1000, 1900), 0);
+    rest.update(sample(3, 0, 1000, 1900), MINUTE);
+    BQ27621Estimate idle = rest.estimate();
+    if (idle.timeToEmpty != BQ27621_TIME_UNAVAILABLE || idle.timeToFull != BQ27621_TIME_UNAVAILABLE)
+        failures++;
+
+    // No smoothing and two samples at the same time: 0 / 0 must not turn the averages into NaN
+    BQ27621Estimator unsmoothed(DESIGN_CAPACITY, 0);
+    unsmoothed.update(sample(-500, -1850, 1000, 1900), MINUTE);
+    unsmoothed.update(sample(-500, -1850, 1000, 1900), MINUTE);
+    unsmoothed.update(sample(-400, -1480, 1000, 1900), 2 * MINUTE);
+    BQ27621Estimate same = unsmoothed.estimate();
+    if (same.averageCurrent != -400 || same.averagePower != -1480 || same.timeToEmpty != 150)
+        failures++;
+
+    // FullChargeCapacity() of three times DesignCapacity() (e.g. a wrong DesignCapacity()) saturates
+    BQ27621Estimator oversized(DESIGN_CAPACITY);
+    oversized.update(sample(0, 0, 3000, 3 * DESIGN_CAPACITY), 0);
+    if (oversized.estimate().stateOfHealth != 255)
+        failures++;
+
+    // Unknown DesignCapacity(): no health or cycle figure
+    BQ27621Estimator unknown;
+    unknown.update(sample(-500, -1850, 1000, 1900), 0);
+    if (unknown.estimate().stateOfHealth != 0 || unknown.estimate().cycles != 0)
+        failures++;
+
+    printf("{\n  \"tte_min\": %u, \"ttf_min\": %u, \"soh\": %u, \"soh_oversized\": %u, \"failures\": %u\n}\n",
+           empty.timeToEmpty, full.timeToFull, empty.stateOfHealth, oversized.estimate().stateOfHealth, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file BQ27621_events_test.cpp
+ * @brief BQ27621EventMonitor driven by BQ27621SimGpout: no bus traffic before begin() or while the pack is idle, one
+ * EVENT_SOC_DELTA per 1 % step, and exactly one set and one clear of [SOC1] and [SOCF] over a discharge to empty and
+ * a charge back above the clear thresholds.
+ *
+ */
+
+#include <cstdio>
+#include "BQ27621_events.h"
+#include "BQ27621_sim.h"
+
+#define START_SOC 13
+#define POLL_MICROS 10000000
+
+struct EventLog
+{
+    unsigned counts[EVENT_SOCF_CLEAR + 1];
+    unsigned badDeltas;    // EVENT_SOC_DELTA not exactly one step from the previous one
+    unsigned badPrevious;  // previousStateOfCharge not the SOC of the previous snapshot
+    uint16_t lastDeltaSoc;
+    uint16_t lastSoc;
+};
+
+static void onEvent(const BQ27621Event &event, void *context)
+{
+    EventLog *log = static_cast<EventLog *>(context);
+    log->counts[event.type]++;
+    uint16_t soc = event.snapshot->stateOfCharge;
+    if (event.previousStateOfCharge != log->lastSoc)
+        log->badPrevious++;
+    if (event.type == EVENT_SOC_DELTA)
+    {
+        uint16_t step = (soc > log->lastDeltaSoc) ? soc - log->lastDeltaSoc : log->lastDeltaSoc - soc;
+        if (step != 1)
+            log->badDeltas++;
+        log->lastDeltaSoc = soc;
+    }
+}
+
+/**
+ * @brief Runs the pack at current for seconds of simulated time, polling GPOUT like a host loop
+ *
+ */
+static BQ27621_error_code run(BQ27621Sim &sim, BQ27621EventMonitor &monitor, EventLog &log, int16_t current, uint32_t seconds)
+{
+    sim.setBattery(3700, current, 2982);
+    uint64_t end = sim.nowNanos() + (uint64_t)seconds * 1000000000ULL;
+    while (sim.nowNanos() < end)
+    {
+        log.lastSoc = monitor.snapshot().stateOfCharge;
+        BQ27621_error_code retVal = monitor.poll(POLL_MICROS);
+        if (retVal != OK)
+            return retVal;
+    }
+    return OK;
+}
+
+int main(void)
+{
+    BQ27621Sim sim;
+    BQ27621 gauge(sim);
+    BQ27621SimGpout line(sim);
+    BQ27621EventMonitor monitor(gauge, line);
+    EventLog log = {};
+    monitor.setCallback(onEvent, &log);
+    sim.setStateOfCharge(START_SOC);
+    sim.setBattery(3700, 0, 2982);
+    unsigned failures = 0;
+
+    // Before begin() an edge must not touch the bus
+    uint32_t before = sim.stats().transactions;
+    if (monitor.handleEdge() != BUS_ERROR || sim.stats().transactions != before)
+        failures++;
+
+    if (gauge.init() != OK || monitor.begin(GPOUT_F_SOC_INT) != OK)
+    {
+        fprintf(stderr, "begin failed\n");
+        return 1;
+    }
+    log.lastDeltaSoc = monitor.snapshot().stateOfCharge;
+
+    // Idle pack: no edges, no reads
+    before = sim.stats().transactions;
+    if (run(sim, monitor, log, 0, 600) != OK || sim.stats().transactions != before || monitor.edges() != 0)
+        failures++;
+
+    // 1 A discharge, well past empty
+    if (run(sim, monitor, log, -1000, 60 * (START_SOC + 2)) != OK)
+        failures++;
+    uint16_t empty = monitor.snapshot().stateOfCharge;
+    unsigned dischargeDeltas = log.counts[EVENT_SOC_DELTA];
+    if (empty != 0 || dischargeDeltas != START_SOC)
+        failures++;
+    if (log.counts[EVENT_SOC1_SET] != 1 || log.counts[EVENT_SOCF_SET] != 1 || log.counts[EVENT_SOC1_CLEAR] != 0 ||
+        log.counts[EVENT_SOCF_CLEAR] != 0)
+        failures++;
+
+    // 2 A charge, back above the [SOC1] clear threshold
+    if (run(sim, monitor, log, 2000, 300) != OK)
+        failures++;
+    uint16_t charged = monitor.snapshot().stateOfCharge;
+    if (log.counts[EVENT_SOC_DELTA] - dischargeDeltas != charged || charged < 12)
+        failures++;
+    if (log.counts[EVENT_SOC1_CLEAR] != 1 || log.counts[EVENT_SOCF_CLEAR] != 1 || log.counts[EVENT_SOC1_SET] != 1 ||
+        log.counts[EVENT_SOCF_SET] != 1)
+        failures++;
+    if (log.badDeltas != 0 || log.badPrevious != 0)
+        failures++;
+
+    // Each edge costs one read, plus the reference read of begin()
+    if (monitor.reads() != monitor.edges() + 1)
+        failures++;
+
+    printf("{\n  \"edges\": %u, \"reads\": %u, \"soc_delta\": %u, \"soc1_set\": %u, \"soc1_clear\": %u, \"socf_set\": %u, "
+           "\"socf_clear\": %u, \"charged_soc\": %u, \"failures\": %u\n}\n",
+           monitor.edges(), monitor.reads(), log.counts[EVENT_SOC_DELTA], log.counts[EVENT_SOC1_SET],
+           log.counts[EVENT_SOC1_CLEAR], log.counts[EVENT_SOCF_SET], log.counts[EVENT_SOCF_CLEAR], charged, failures);
+    return failures == 0 ? 0 : 1;
+}
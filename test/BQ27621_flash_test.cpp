@@ -0,0 +1,143 @@
+/**
+ * @file BQ27621_flash_test.cpp
+ * @brief flashImage() against the simulated gauge: an unchanged image costs reads only and never enters CONFIG UPDATE,
+ * only blocks whose masked bytes differ are written, with checksums the gauge accepts, the report counts what was
+ * read, written and selected, and a block the gauge did not take is reported as a verify failure.
+ *
+ */
+
+#include <cstdio>
+#include "BQ27621.h"
+#include "BQ27621_sim.h"
+
+#define BLOCKS 4
+
+/**
+ * @brief Passes transfers to the simulated gauge, counts SET_CFGUPDATE and can drop the checksum write of every block
+ * write, so the gauge never commits it
+ *
+ */
+class FlashWatch : public I2C_device
+{
+private:
+    BQ27621Sim &_sim;
+
+public:
+    unsigned cfgUpdates;
+    bool dropCommits;
+
+    FlashWatch(BQ27621Sim &sim) : _sim(sim), cfgUpdates(0), dropCommits(false) {}
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const I2C_message &message = messages[i];
+            if ((message.flags & I2C_MSG_READ) || message.len < 2)
+                continue;
+            if (message.len >= 3 && message.data[0] == COMMAND_CONTROL &&
+                (message.data[1] | (message.data[2] << 8)) == SET_CFGUPDATE)
+                cfgUpdates++;
+            if (dropCommits && message.data[0] == EXTENDED_BLOCK_DATA_CHECKSUM && i + 1 == count)
+                count--;
+        }
+        return _sim.transfer(messages, count);
+    }
+    uint32_t micros(void) override { return _sim.micros(); }
+    void delayMicros(uint32_t us) override { _sim.delayMicros(us); }
+};
+
+/**
+ * @brief True if the gauge is sealed and out of CONFIG UPDATE
+ *
+ */
+static bool settled(const BQ27621Sim &sim)
+{
+    return !sim.inConfigUpdate() && (sim.controlStatus() & STATUS_SS) != 0;
+}
+
+/**
+ * @brief True if the report holds exactly the given counts
+ *
+ */
+static bool reportIs(const BQ27621FlashReport &report, uint32_t changed, uint16_t bytesChanged, uint8_t blocksRead,
+                     uint8_t blocksWritten, uint8_t classSwitches, uint8_t verifyFailures)
+{
+    return report.changed == changed && report.bytesChanged == bytesChanged && report.blocksRead == blocksRead &&
+           report.blocksWritten == blocksWritten && report.classSwitches == classSwitches &&
+           report.verifyFailures == verifyFailures;
+}
+
+int main(void)
+{
+    unsigned failures = 0;
+    BQ27621Sim sim;
+    FlashWatch watch(sim);
+    BQ27621 gauge(watch);
+    BQ27621FlashReport report;
+
+    // Visited as DISCHARGE, REGISTERS, STATE 0, STATE 1: three class selections per pass
+    BQ27621ImageBlock image[BLOCKS] = {};
+    image[0].classId = ID_STATE;
+    image[1].classId = ID_STATE;
+    image[1].block = 1;
+    image[2].classId = ID_DISCHARGE;
+    image[3].classId = ID_REGISTERS;
+    if (gauge.readImage(image, BLOCKS) != OK)
+    {
+        fprintf(stderr, "readImage failed\n");
+        return 1;
+    }
+
+    // Unchanged image: reads only, CONFIG UPDATE never entered
+    BQ27621SimStats before = sim.stats();
+    if (gauge.flashImage(image, BLOCKS, true, &report) != OK || !reportIs(report, 0, 0, BLOCKS, 0, 3, 0))
+        failures++;
+    if (watch.cfgUpdates != 0 || sim.stats().blockCommits != before.blockCommits || !settled(sim))
+        failures++;
+
+    // Two bytes of STATE block 1 and one masked byte of DISCHARGE, chosen so the updated checksums wrap. The unmasked
+    // byte of DISCHARGE is not part of the image and must stay as it is.
+    image[1].data[3] = (uint8_t)(sim.dataMemory(ID_STATE, BQ27621_BLOCK_SIZE + 3) + 0x80);
+    image[1].data[4] = (uint8_t)(sim.dataMemory(ID_STATE, BQ27621_BLOCK_SIZE + 4) + 0xFF);
+    image[2].mask = 1UL << 5;
+    image[2].data[5] = (uint8_t)~sim.dataMemory(ID_DISCHARGE, 5);
+    image[2].data[6] = (uint8_t)~sim.dataMemory(ID_DISCHARGE, 6);
+    uint8_t unmasked = sim.dataMemory(ID_DISCHARGE, 6);
+    before = sim.stats();
+    // Reads select DISCHARGE, REGISTERS and STATE, the write after entering CONFIG UPDATE selects DISCHARGE again and
+    // verification selects DISCHARGE and STATE
+    if (gauge.flashImage(image, BLOCKS, true, &report) != OK || !reportIs(report, 0x6, 3, BLOCKS, 2, 6, 0))
+        failures++;
+    if (watch.cfgUpdates != 1 || sim.stats().blockCommits != before.blockCommits + 2 ||
+        sim.stats().checksumFailures != before.checksumFailures || !settled(sim))
+        failures++;
+    if (sim.dataMemory(ID_STATE, BQ27621_BLOCK_SIZE + 3) != image[1].data[3] ||
+        sim.dataMemory(ID_STATE, BQ27621_BLOCK_SIZE + 4) != image[1].data[4] ||
+        sim.dataMemory(ID_DISCHARGE, 5) != image[2].data[5] || sim.dataMemory(ID_DISCHARGE, 6) != unmasked)
+        failures++;
+
+    // The gauge's own block checksums are still consistent: every block reads back through readImageBlock()
+    BQ27621ImageBlock readBack[BLOCKS] = {};
+    for (size_t i = 0; i < BLOCKS; i++)
+    {
+        readBack[i].classId = image[i].classId;
+        readBack[i].block = image[i].block;
+    }
+    if (gauge.readImage(readBack, BLOCKS) != OK)
+        failures++;
+
+    // A block write the gauge never commits is caught by verification and reported, and the gauge is left settled
+    watch.dropCommits = true;
+    image[0].data[STATE_DESIGN_CAPACITY + 1]++;
+    before = sim.stats();
+    if (gauge.flashImage(image, BLOCKS, true, &report) != BUS_ERROR || !reportIs(report, 0x1, 1, BLOCKS, 1, 4, 1))
+        failures++;
+    if (sim.stats().blockCommits != before.blockCommits || !settled(sim))
+        failures++;
+    watch.dropCommits = false;
+
+    printf("{\n  \"cfg_updates\": %u, \"class_switches\": %u, \"verify_failures\": %u, \"failures\": %u\n}\n",
+           watch.cfgUpdates, report.classSwitches, report.verifyFailures, failures);
+    return failures == 0 ? 0 : 1;
+}
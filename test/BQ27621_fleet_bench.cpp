@@ -0,0 +1,131 @@
+/**
+ * @file BQ27621_fleet_bench.cpp
+ * @brief GaugeFleet sampling simulated gauges on four independent buses and on two mux channels of a fifth physical
+ * bus. Transfers sleep for their modelled bus time, so a bus is as busy as it would be on the wire. Checks the
+ * achieved samples/s against the target, the per-gauge start jitter the fleet reports, and that no two transfers
+ * ever overlap on one physical bus. Prints JSON to stdout, or to the file given as first argument.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "BQ27621_fleet.h"
+#include "BQ27621_sim.h"
+
+#define RATE_HZ 50
+#define RUN_MILLIS 2000
+#define INDEPENDENT_BUSES 4
+#define GAUGES_PER_BUS 4
+#define MUX_CHANNELS 2
+#define GAUGES_PER_CHANNEL 3
+#define MIN_RATE_RATIO 0.95  // Achieved over target samples/s
+#define MAX_JITTER_MICROS 2000 // Bound of the mean start lateness of every gauge
+
+/**
+ * @brief Physical bus: a simulated gauge whose transfers block for their modelled bus time, and a detector for
+ * transfers issued while another one is still on the wire
+ *
+ */
+class PacedBus : public I2C_device
+{
+private:
+    BQ27621Sim _sim;
+    std::atomic<int> _active;
+    std::atomic<unsigned> _overlaps;
+
+public:
+    PacedBus() : _active(0), _overlaps(0) {}
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override
+    {
+        if (_active.fetch_add(1) != 0)
+            _overlaps++;
+        uint64_t before = _sim.nowNanos();
+        auto start = std::chrono::steady_clock::now();
+        BQ27621_error_code retVal = _sim.transfer(messages, count);
+        std::this_thread::sleep_until(start + std::chrono::nanoseconds(_sim.nowNanos() - before));
+        _active--;
+        return retVal;
+    }
+    uint32_t micros(void) override { return _sim.micros(); }
+    void delayMicros(uint32_t us) override { _sim.delayMicros(us); }
+
+    unsigned overlaps(void) const { return _overlaps; }
+};
+
+int main(int argc, char **argv)
+{
+    std::vector<std::unique_ptr<PacedBus>> buses;
+    GaugeFleet fleet;
+    for (int b = 0; b < INDEPENDENT_BUSES; b++)
+    {
+        buses.emplace_back(new PacedBus());
+        size_t bus = fleet.addBus(*buses.back());
+        for (int g = 0; g < GAUGES_PER_BUS; g++)
+            fleet.addGauge(bus);
+    }
+    buses.emplace_back(new PacedBus());
+    for (int c = 0; c < MUX_CHANNELS; c++)
+    {
+        size_t bus = fleet.addBus(*buses.back(), 0);
+        for (int g = 0; g < GAUGES_PER_CHANNEL; g++)
+            fleet.addGauge(bus);
+    }
+
+    if (!fleet.start(RATE_HZ))
+    {
+        fprintf(stderr, "start failed\n");
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(RUN_MILLIS));
+    fleet.stop();
+
+    BQ27621FleetStats stats = fleet.stats();
+    double target = (double)fleet.gaugeCount() * RATE_HZ;
+    double worstMean = 0;
+    double worstMax = 0;
+    uint64_t fewest = UINT64_MAX;
+    for (size_t i = 0; i < fleet.gaugeCount(); i++)
+    {
+        BQ27621GaugeStats gauge = fleet.gaugeStats(i);
+        if (gauge.jitterMeanMicros > worstMean)
+            worstMean = gauge.jitterMeanMicros;
+        if (gauge.jitterMaxMicros > worstMax)
+            worstMax = gauge.jitterMaxMicros;
+        if (gauge.samples < fewest)
+            fewest = gauge.samples;
+    }
+    unsigned overlaps = 0;
+    for (size_t b = 0; b < buses.size(); b++)
+        overlaps += buses[b]->overlaps();
+
+    unsigned failures = 0;
+    if (stats.errors != 0 || overlaps != 0)
+        failures++;
+    if (stats.samplesPerSecond < MIN_RATE_RATIO * target)
+        failures++;
+    if (worstMean > MAX_JITTER_MICROS || fewest == 0)
+        failures++;
+
+    FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(out,
+            "{\n  \"gauges\": %u, \"physical_buses\": %u, \"rate_hz\": %d, \"failures\": %u,\n"
+            "  \"samples\": %llu, \"errors\": %llu, \"overlaps\": %u,\n"
+            "  \"samples_per_second\": %.1f, \"target_per_second\": %.1f,\n"
+            "  \"jitter_mean_us_worst\": %.1f, \"jitter_max_us_worst\": %.1f, \"fewest_samples\": %llu\n}\n",
+            (unsigned)fleet.gaugeCount(), (unsigned)buses.size(), RATE_HZ, failures, (unsigned long long)stats.samples,
+            (unsigned long long)stats.errors, overlaps, stats.samplesPerSecond, target, worstMean, worstMax,
+            (unsigned long long)fewest);
+    if (out != stdout)
+        fclose(out);
+    return failures == 0 ? 0 : 1;
+}
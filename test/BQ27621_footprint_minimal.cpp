@@ -0,0 +1,29 @@
+/**
+ * @file BQ27621_footprint_minimal.cpp
+ * @brief Smallest application of the driver (one getter over a stub bus), linked with section garbage collection
+ * so the size report shows what an MCU image pays for the driver when unused getters are stripped.
+ *
+ */
+
+#include "BQ27621.h"
+
+class StubBus : public I2C_device
+{
+public:
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override
+    {
+        (void)messages;
+        (void)count;
+        return BUS_ERROR;
+    }
+    uint32_t micros(void) override { return 0; }
+    void delayMicros(uint32_t us) override { (void)us; }
+};
+
+int main()
+{
+    StubBus bus;
+    BQ27621 gauge(bus);
+    uint16_t voltage;
+    return gauge.getVoltage(&voltage);
+}
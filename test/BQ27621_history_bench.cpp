@@ -0,0 +1,116 @@
+/**
+ * @file BQ27621_history_bench.cpp
+ * @brief Bytes per sample and append latency of BQ27621History against storing the raw structs. Fails if a sample
+ * decoded from the delta/varint chunks, or a snapshot read back from the seqlock ring, differs from what was stored.
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <string.h>
+#include <vector>
+#include "BQ27621_history.h"
+#include "BQ27621_sim.h"
+
+#define SAMPLES 100000
+#define PERIOD_MS 1000
+
+static double nanosPerItem(std::chrono::steady_clock::time_point start, size_t items)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / items;
+}
+
+static bool sameSample(const BQ27621HistorySample &a, const BQ27621HistorySample &b)
+{
+    return a.timestamp == b.timestamp && a.voltage == b.voltage && a.current == b.current &&
+           a.stateOfCharge == b.stateOfCharge && a.temperature == b.temperature;
+}
+
+int main()
+{
+    // Discharge at a slowly varying load, one snapshot per second
+    BQ27621Sim sim;
+    BQ27621 gauge(sim);
+    gauge.init();
+    std::vector<BQ27621TimedSnapshot> snapshots(SAMPLES);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < SAMPLES; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int16_t current = (int16_t)(-300 - ((seed >> 16) % 8));
+        sim.setBattery((uint16_t)(4150 - i * 700 / SAMPLES), current, (uint16_t)(2981 + (i / 3600)));
+        sim.setStateOfCharge((uint8_t)(100 - i * 100 / SAMPLES));
+        snapshots[i].timestamp = (uint32_t)(i * PERIOD_MS);
+        gauge.readSnapshot(&snapshots[i].snapshot, BQ27621_SNAPSHOT_FIRST, BQ27621_SNAPSHOT_LAST);
+    }
+
+    std::vector<BQ27621TimedSnapshot> rawSnapshots(SAMPLES);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < SAMPLES; i++)
+        rawSnapshots[i] = snapshots[i];
+    double rawSnapshotNanos = nanosPerItem(start, SAMPLES);
+
+    std::vector<BQ27621HistorySample> rawSamples(SAMPLES);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < SAMPLES; i++)
+        rawSamples[i] = BQ27621History::fromSnapshot(snapshots[i]);
+    double rawSampleNanos = nanosPerItem(start, SAMPLES);
+
+    std::vector<uint8_t> storage(SAMPLES * sizeof(BQ27621HistorySample));
+    BQ27621History history(storage.data(), storage.size());
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < SAMPLES; i++)
+        history.append(BQ27621History::fromSnapshot(snapshots[i]));
+    double historyNanos = nanosPerItem(start, SAMPLES);
+
+    static BQ27621SnapshotRing ring;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < SAMPLES; i++)
+        ring.publish(snapshots[i]);
+    double ringNanos = nanosPerItem(start, SAMPLES);
+
+    start = std::chrono::steady_clock::now();
+    BQ27621HistorySample found;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < SAMPLES; i += 97)
+    {
+        if (!history.find((uint32_t)(i * PERIOD_MS + PERIOD_MS / 2), &found) || !sameSample(found, rawSamples[i]))
+            mismatches++;
+    }
+    double findNanos = nanosPerItem(start, (SAMPLES + 96) / 97);
+
+    // Every field of every sample must survive the delta/varint encoding
+    std::vector<BQ27621HistorySample> decoded(SAMPLES);
+    size_t kept = history.copy(0, decoded.data(), SAMPLES);
+    size_t decodeMismatches = (kept == history.samples()) ? 0 : 1;
+    for (size_t i = 0; i < kept; i++)
+    {
+        if (!sameSample(decoded[i], rawSamples[SAMPLES - kept + i]))
+            decodeMismatches++;
+    }
+
+    // The entries still in the ring and the latest one read back unchanged through the sequence checks
+    size_t ringMismatches = 0;
+    uint32_t lost = 0;
+    uint32_t cursor = ring.head() - (BQ27621_RING_SIZE - 1);
+    size_t index = SAMPLES - (BQ27621_RING_SIZE - 1);
+    BQ27621TimedSnapshot entry;
+    while (ring.read(&cursor, &entry, &lost))
+    {
+        if (index >= SAMPLES || memcmp(&entry, &snapshots[index++], sizeof(entry)) != 0)
+            ringMismatches++;
+    }
+    if (index != SAMPLES || lost != 0)
+        ringMismatches++;
+    if (!ring.latest(&entry) || memcmp(&entry, &snapshots[SAMPLES - 1], sizeof(entry)) != 0)
+        ringMismatches++;
+
+    printf("%-24s %14s %14s\n", "store", "bytes/sample", "append ns");
+    printf("%-24s %14.2f %14.1f\n", "BQ27621TimedSnapshot", (double)sizeof(BQ27621TimedSnapshot), rawSnapshotNanos);
+    printf("%-24s %14.2f %14.1f\n", "BQ27621HistorySample", (double)sizeof(BQ27621HistorySample), rawSampleNanos);
+    printf("%-24s %14.2f %14.1f\n", "BQ27621History", (double)history.bytesUsed() / history.samples(), historyNanos);
+    printf("%-24s %14s %14.1f\n", "BQ27621SnapshotRing", "-", ringNanos);
+    printf("find: %.1f ns, %u samples kept, %zu mismatches\n", findNanos, (unsigned)history.samples(), mismatches);
+    printf("decode: %zu mismatches, ring: %zu mismatches\n", decodeMismatches, ringMismatches);
+    return (mismatches == 0 && decodeMismatches == 0 && ringMismatches == 0) ? 0 : 1;
+}
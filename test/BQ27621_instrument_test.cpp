@@ -0,0 +1,102 @@
+/**
+ * @file BQ27621_instrument_test.cpp
+ * @brief Per-command instrumentation after a known call sequence: exact transfer, byte and error counts per key, the
+ * latency of a combined transfer split across its keys instead of charged to each, and the CSV export, whole lines
+ * only when the buffer is short.
+ *
+ */
+
+#include <cstdio>
+#include <string.h>
+#include "BQ27621.h"
+#include "BQ27621_sim.h"
+
+#define READS 3
+
+/**
+ * @brief Stats of one key, NULL if it was never recorded
+ *
+ */
+static const BQ27621CommandStats *find(const BQ27621CommandStats *stats, size_t count, uint16_t id)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (stats[i].kind == INSTRUMENT_COMMAND && stats[i].id == id)
+            return &stats[i];
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    unsigned failures = 0;
+    BQ27621Sim sim;
+    BQ27621 gauge(sim);
+    BQ27621RetryPolicy policy = BQ27621::defaultRetryPolicy();
+    policy.maxAttempts = 1; // The injected NACK must be recorded, not retried away
+    gauge.setRetryPolicy(policy);
+    BQ27621Instrumentation &instrumentation = gauge.instrumentation();
+    instrumentation.reset();
+
+    // READS successful reads of Voltage() and one NACKed: 1 + 1 bytes written, 1 + 2 read per transfer
+    uint16_t voltage;
+    for (unsigned i = 0; i < READS; i++)
+    {
+        if (gauge.getVoltage(&voltage) != OK)
+            failures++;
+    }
+    sim.injectErrors(1, NACK_RECEIVED);
+    if (gauge.getVoltage(&voltage) != NACK_RECEIVED)
+        failures++;
+
+    // Voltage() and Temperature() in one combined transfer: each key counted once, with half the latency
+    const uint8_t registers[2] = {COMMAND_VOLTAGE, COMMAND_TEMPERATURE};
+    uint16_t words[2];
+    uint32_t start = sim.micros();
+    if (gauge.readWords(registers, words, 2) != OK)
+        failures++;
+    uint32_t combinedMicros = sim.micros() - start;
+
+    BQ27621CommandStats stats[BQ27621_INSTRUMENT_SLOTS];
+    size_t count = instrumentation.snapshot(stats, BQ27621_INSTRUMENT_SLOTS);
+    const BQ27621CommandStats *v = find(stats, count, COMMAND_VOLTAGE);
+    const BQ27621CommandStats *t = find(stats, count, COMMAND_TEMPERATURE);
+    if (count != 2 || v == NULL || t == NULL)
+    {
+        fprintf(stderr, "expected two keys, got %u\n", (unsigned)count);
+        return 1;
+    }
+    if (v->count != READS + 2 || v->bytes != 5 * (READS + 2) || v->errors[OK] != READS + 1 || v->errors[NACK_RECEIVED] != 1)
+        failures++;
+    if (t->count != 1 || t->bytes != 5 || t->errors[OK] != 1)
+        failures++;
+
+    // Temperature() was only ever read in the combined transfer, so its maximum is its share of it
+    uint32_t half = combinedMicros / 2;
+    if (combinedMicros == 0 || t->maxMicros != combinedMicros - half)
+        failures++;
+
+    // One line per key, in first-seen order
+    char expected[2][64];
+    snprintf(expected[0], sizeof(expected[0]), "command,0x%04X,%u,%u,1,%u,", COMMAND_VOLTAGE, READS + 2, 5 * (READS + 2),
+             (unsigned)v->maxMicros);
+    snprintf(expected[1], sizeof(expected[1]), "command,0x%04X,1,5,0,%u,", COMMAND_TEMPERATURE, (unsigned)t->maxMicros);
+    char csv[512];
+    size_t length = instrumentation.exportCsv(csv, sizeof(csv));
+    const char *second = strchr(csv, '\n');
+    if (length != strlen(csv) || second == NULL || strncmp(csv, expected[0], strlen(expected[0])) != 0 ||
+        strncmp(second + 1, expected[1], strlen(expected[1])) != 0 || strchr(second + 1, '\n') != &csv[length - 1])
+        failures++;
+
+    // A buffer one byte short of both lines holds the first line only, terminated
+    size_t firstLine = (size_t)(second - csv) + 1;
+    char shortCsv[512];
+    if (instrumentation.exportCsv(shortCsv, length) != firstLine || strlen(shortCsv) != firstLine ||
+        strncmp(shortCsv, csv, firstLine) != 0)
+        failures++;
+
+    printf("{\n  \"keys\": %u, \"voltage_transfers\": %u, \"combined_us\": %u, \"temperature_max_us\": %u, "
+           "\"failures\": %u\n}\n",
+           (unsigned)count, v->count, combinedMicros, t->maxMicros, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file BQ27621_mux_bench.cpp
+ * @brief Ten simulated gauges at 0x55 behind three TCA9548 muxes (one nested), read by three consumers that each
+ * queue one read per gauge every round. Compares mux control writes and bus time per round in submission order
+ * against BQ27621MuxScheduler's channel grouping, and fails on a collision or a reading from the wrong gauge. Prints
+ * JSON to stdout, or to the file given as first argument.
+ *
+ */
+
+#include <cstdio>
+#include "BQ27621_mux.h"
+#include "BQ27621_sim.h"
+
+#define ROUNDS 100
+#define GAUGES 10
+#define CONSUMERS 3
+
+struct GaugeContext
+{
+    uint16_t voltage; // Set on the simulated gauge, tells the gauges apart
+    unsigned mismatches;
+};
+
+static BQ27621_error_code readVoltage(BQ27621 &gauge, void *context)
+{
+    GaugeContext *expected = static_cast<GaugeContext *>(context);
+    uint16_t voltage;
+    BQ27621_error_code retVal = gauge.getVoltage(&voltage);
+    if (retVal == OK && voltage != expected->voltage)
+        expected->mismatches++;
+    return retVal;
+}
+
+static BQ27621_error_code readCurrent(BQ27621 &gauge, void *context)
+{
+    (void)context;
+    int16_t current;
+    return gauge.getCurrent(&current);
+}
+
+static BQ27621_error_code readSoc(BQ27621 &gauge, void *context)
+{
+    (void)context;
+    uint16_t soc;
+    return gauge.getSOC(FILTERED, &soc);
+}
+
+static const BQ27621MuxTask consumers[CONSUMERS] = {readVoltage, readCurrent, readSoc};
+
+int main(int argc, char **argv)
+{
+    // 0x70: gauges on channels 0..5, mux 0x74 on channel 7 with gauges on 0..1; 0x71: gauges on channels 0..1
+    const BQ27621BusPath host = BQ27621BusPath();
+    const BQ27621BusPath nested = bq27621BusPath(0x70, 7);
+    BQ27621BusPath paths[GAUGES];
+    for (uint8_t i = 0; i < 6; i++)
+        paths[i] = bq27621BusPath(0x70, i);
+    paths[6] = bq27621BusPath(nested, 0x74, 0);
+    paths[7] = bq27621BusPath(nested, 0x74, 1);
+    paths[8] = bq27621BusPath(0x71, 0);
+    paths[9] = bq27621BusPath(0x71, 1);
+
+    BQ27621SimMuxBus wire;
+    BQ27621MuxI2C bus(wire);
+    bool ok = wire.addMux(host, 0x70) && wire.addMux(host, 0x71) && wire.addMux(nested, 0x74) &&
+              bus.addMux(host, 0x70) && bus.addMux(host, 0x71) && bus.addMux(nested, 0x74);
+
+    static BQ27621Sim sims[GAUGES];
+    BQ27621 *gauges[GAUGES];
+    GaugeContext contexts[GAUGES];
+    unsigned errors = 0;
+    for (size_t i = 0; i < GAUGES; i++)
+    {
+        contexts[i].voltage = (uint16_t)(3600 + 10 * i);
+        contexts[i].mismatches = 0;
+        sims[i].setBattery(contexts[i].voltage, -100, 2982);
+        ok = ok && wire.attach(paths[i], sims[i]);
+        gauges[i] = new BQ27621(bus, paths[i]);
+        if (gauges[i]->init() != OK)
+            errors++;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "topology setup failed\n");
+        return 1;
+    }
+
+    // Reference: every consumer reads every gauge in turn, as they would without the scheduler
+    bus.resetStats();
+    wire.resetStats();
+    for (unsigned round = 0; round < ROUNDS; round++)
+    {
+        for (size_t c = 0; c < CONSUMERS; c++)
+        {
+            for (size_t i = 0; i < GAUGES; i++)
+            {
+                if (consumers[c](*gauges[i], &contexts[i]) != OK)
+                    errors++;
+            }
+        }
+    }
+    uint32_t directSwitches = bus.switches();
+    uint64_t directNanos = wire.stats().busNanos;
+    uint32_t directCollisions = wire.stats().collisions;
+
+    BQ27621MuxScheduler scheduler(bus);
+    BQ27621MuxRoundStats round;
+    uint64_t switches = 0;
+    uint64_t unsorted = 0;
+    uint32_t minSaved = UINT32_MAX;
+    bus.resetStats();
+    wire.resetStats();
+    for (unsigned r = 0; r < ROUNDS; r++)
+    {
+        for (size_t c = 0; c < CONSUMERS; c++)
+        {
+            for (size_t i = 0; i < GAUGES; i++)
+                ok = ok && scheduler.enqueue(*gauges[i], consumers[c], &contexts[i]);
+        }
+        if (scheduler.round(&round) != OK)
+            errors += round.errors;
+        switches += round.switches;
+        unsorted += round.switchesUnsorted;
+        if (round.saved < minSaved)
+            minSaved = round.saved;
+    }
+    uint64_t groupedNanos = wire.stats().busNanos;
+    uint32_t collisions = directCollisions + wire.stats().collisions;
+
+    unsigned mismatches = 0;
+    for (size_t i = 0; i < GAUGES; i++)
+    {
+        mismatches += contexts[i].mismatches;
+        delete gauges[i];
+    }
+    if (!ok || collisions != 0 || mismatches != 0 || switches >= unsorted)
+        errors++;
+
+    FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(out,
+            "{\n  \"gauges\": %d, \"consumers\": %d, \"rounds\": %d, \"errors\": %u, \"collisions\": %u, \"mismatches\": %u,\n"
+            "  \"direct\": {\"switches_per_round\": %.1f, \"bus_us_per_round\": %.1f},\n"
+            "  \"grouped\": {\"switches_per_round\": %.1f, \"predicted_unsorted_per_round\": %.1f, \"saved_per_round\": %.1f, "
+            "\"min_saved\": %u, \"bus_us_per_round\": %.1f},\n"
+            "  \"saved_total\": %llu\n}\n",
+            GAUGES, CONSUMERS, ROUNDS, errors, collisions, mismatches, (double)directSwitches / ROUNDS,
+            directNanos / 1000.0 / ROUNDS, (double)switches / ROUNDS, (double)unsorted / ROUNDS,
+            (double)(unsorted - switches) / ROUNDS, minSaved, groupedNanos / 1000.0 / ROUNDS,
+            (unsigned long long)scheduler.totalSaved());
+    if (out != stdout)
+        fclose(out);
+    return errors == 0 ? 0 : 1;
+}
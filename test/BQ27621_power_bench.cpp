@@ -0,0 +1,186 @@
+/**
+ * @file BQ27621_power_bench.cpp
+ * @brief Gauge supply current against sample latency under BQ27621PowerManager, for sampling intervals from 100 ms to
+ * 15 min against the simulated gauge: state chosen between samples, estimated average current and wake-up latency.
+ * Prints JSON to stdout, or to the file given as first argument, and fails if a sample cannot be read or if a shutdown()
+ * failing at any of its transfers leaves the gauge unsealed.
+ *
+ */
+
+#include <cstdio>
+#include <vector>
+#include "BQ27621_power.h"
+#include "BQ27621_sim.h"
+
+#define SAMPLES 20
+#define POLL_MICROS 1000 // Status poll period while a wake-up settles
+
+static const char *const stateNames[POWER_STATE_COUNT] = {"active", "low_power", "hibernate", "shutdown"};
+
+struct RunResult
+{
+    uint32_t interval;
+    BQ27621PowerState idleState;
+    unsigned errors;
+    double averageMicroAmps;
+    double meanWakeMicros;
+    uint32_t maxWakeMicros;
+    uint32_t reinitializations;
+};
+
+static BQ27621_error_code assertWakePin(void *context)
+{
+    static_cast<BQ27621Sim *>(context)->wake();
+    return OK;
+}
+
+/**
+ * @brief Passes transfers to the simulated gauge and fails the one numbered failAt before it reaches the gauge
+ *
+ */
+class FailAt : public I2C_device
+{
+private:
+    BQ27621Sim &_sim;
+
+public:
+    uint32_t transfers;
+    uint32_t failAt;
+
+    FailAt(BQ27621Sim &sim) : _sim(sim), transfers(0), failAt(UINT32_MAX) {}
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override
+    {
+        if (transfers++ == failAt)
+            return NACK_RECEIVED;
+        return _sim.transfer(messages, count);
+    }
+    uint32_t micros(void) override { return _sim.micros(); }
+    void delayMicros(uint32_t us) override { _sim.delayMicros(us); }
+};
+
+/**
+ * @brief shutdown() of a sealed gauge with each of its transfers failing in turn: the error must be reported, and a
+ * gauge that did not shut down must be sealed again. Returns the number of failure points that broke either rule.
+ *
+ */
+static unsigned shutdownFailures(void)
+{
+    BQ27621RetryPolicy policy = BQ27621::defaultRetryPolicy();
+    policy.maxAttempts = 1; // The injected error must reach shutdown()
+
+    uint32_t sequence;
+    {
+        BQ27621Sim sim;
+        FailAt bus(sim);
+        BQ27621 gauge(bus);
+        gauge.setRetryPolicy(policy);
+        if (gauge.shutdown() != OK || !sim.isShutdown())
+            return 1;
+        sequence = bus.transfers;
+    }
+
+    unsigned failures = 0;
+    for (uint32_t failAt = 0; failAt < sequence; failAt++)
+    {
+        BQ27621Sim sim;
+        FailAt bus(sim);
+        BQ27621 gauge(bus);
+        gauge.setRetryPolicy(policy);
+        bus.failAt = failAt;
+        if (gauge.shutdown() != NACK_RECEIVED || sim.isShutdown() || (sim.controlStatus() & STATUS_SS) == 0)
+        {
+            fprintf(stderr, "shutdown failing at transfer %u left the gauge unsealed or unreported\n", failAt);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static RunResult run(uint32_t interval)
+{
+    BQ27621Sim sim;
+    BQ27621 gauge(sim);
+    BQ27621PowerManager power(gauge);
+    RunResult result = {interval, POWER_ACTIVE, 0, 0, 0, 0, 0};
+    power.setWakeCallback(assertWakePin, &sim);
+    if (gauge.init() != OK || power.begin(sim.micros()) != OK || power.plan(interval, sim.micros()) != OK)
+    {
+        result.errors++;
+        return result;
+    }
+
+    for (unsigned i = 0; i < SAMPLES; i++)
+    {
+        uint32_t slot = sim.micros();
+        BQ27621_error_code retVal = power.wake(sim.micros());
+        while (retVal == PENDING)
+        {
+            sim.delayMicros(POLL_MICROS);
+            retVal = power.poll(sim.micros());
+        }
+        if (power.configLost())
+        {
+            // The host would provision the gauge again here
+            power.clearConfigLost();
+        }
+
+        BQ27621Snapshot snapshot;
+        if (retVal != OK || gauge.readSnapshot(&snapshot) != OK)
+            result.errors++;
+
+        uint32_t used = sim.micros() - slot;
+        uint32_t gap = (used < interval) ? interval - used : 0;
+        if (power.idle(gap, sim.micros()) != OK)
+            result.errors++;
+        result.idleState = power.state();
+        sim.delayMicros(gap);
+    }
+
+    BQ27621PowerStats stats = power.stats(sim.micros());
+    result.averageMicroAmps = stats.averageMicroAmps;
+    for (size_t state = POWER_HIBERNATE; state < POWER_STATE_COUNT; state++)
+    {
+        if (stats.wakeups[state] != 0)
+            result.meanWakeMicros = (double)stats.totalWakeMicros[state] / stats.wakeups[state];
+        if (stats.maxWakeMicros[state] > result.maxWakeMicros)
+            result.maxWakeMicros = stats.maxWakeMicros[state];
+    }
+    result.reinitializations = stats.reinitializations;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t intervals[] = {100000, 1000000, 30000000, 120000000, 900000000};
+    std::vector<RunResult> results;
+    unsigned failures = 0;
+    for (uint32_t interval : intervals)
+    {
+        RunResult result = run(interval);
+        failures += result.errors;
+        results.push_back(result);
+    }
+    failures += shutdownFailures();
+
+    FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(out, "{\n  \"samples\": %u,\n  \"results\": [\n", SAMPLES);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const RunResult &r = results[i];
+        fprintf(out,
+                "    {\"interval_us\": %u, \"idle_state\": \"%s\", \"errors\": %u, \"average_ua\": %.2f, "
+                "\"mean_wake_us\": %.0f, \"max_wake_us\": %u, \"reinitializations\": %u}%s\n",
+                r.interval, stateNames[r.idleState], r.errors, r.averageMicroAmps, r.meanWakeMicros, r.maxWakeMicros,
+                r.reinitializations, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    return failures == 0 ? 0 : 1;
+}
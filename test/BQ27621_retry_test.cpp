@@ -0,0 +1,192 @@
+/**
+ * @file BQ27621_retry_test.cpp
+ * @brief Retry policy against injected NACKs and BUS_BUSY: reads and blocking writes recover and are counted as
+ * recovered, SOFT_RESET and EXIT_* are never repeated blindly, and operationBudget stops both the step() path and the
+ * blocking path with TIMEOUT_ERROR.
+ *
+ */
+
+#include <cstdio>
+#include "BQ27621.h"
+#include "BQ27621_sim.h"
+
+#define BUDGET_MICROS 10000
+
+/**
+ * @brief Passes transfers to the simulated gauge, records when a SOFT_RESET or EXIT_* subcommand is sent and can fail
+ * the next one before it reaches the gauge
+ *
+ */
+class ExitWatch : public I2C_device
+{
+private:
+    BQ27621Sim &_sim;
+
+public:
+    unsigned exits;
+    uint32_t lastExitMicros;
+    uint32_t shortestGap; // Microseconds between two exit subcommands, UINT32_MAX while fewer than two were sent
+    bool failNext;
+
+    ExitWatch(BQ27621Sim &sim) : _sim(sim), exits(0), lastExitMicros(0), shortestGap(UINT32_MAX), failNext(false) {}
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const I2C_message &message = messages[i];
+            if ((message.flags & I2C_MSG_READ) || message.len < 3 || message.data[0] != COMMAND_CONTROL)
+                continue;
+            uint16_t function = (uint16_t)(message.data[1] | (message.data[2] << 8));
+            if (function != SOFT_RESET && function != EXIT_CFGUPDATE && function != EXIT_RESIM)
+                continue;
+            uint32_t now = _sim.micros();
+            if (exits != 0 && now - lastExitMicros < shortestGap)
+                shortestGap = now - lastExitMicros;
+            exits++;
+            lastExitMicros = now;
+            if (failNext)
+            {
+                failNext = false;
+                return NACK_RECEIVED;
+            }
+        }
+        return _sim.transfer(messages, count);
+    }
+    uint32_t micros(void) override { return _sim.micros(); }
+    void delayMicros(uint32_t us) override { _sim.delayMicros(us); }
+};
+
+/**
+ * @brief True if call succeeded and the retry counters moved by exactly one recovered transfer after two retries
+ *
+ */
+static bool recovered(BQ27621 &gauge, const BQ27621RetryStats &before, BQ27621_error_code result)
+{
+    const BQ27621RetryStats &after = gauge.retryStats();
+    return result == OK && after.recovered == before.recovered + 1 && after.retries == before.retries + 2 &&
+           after.exhausted == before.exhausted && after.timeouts == before.timeouts;
+}
+
+int main(void)
+{
+    unsigned failures = 0;
+    const BQ27621_error_code errors[] = {NACK_RECEIVED, BUS_BUSY};
+
+    // Two failures in a row, fewer than maxAttempts: step() reads, blocking writes and blocking reads all recover
+    for (size_t e = 0; e < sizeof(errors) / sizeof(errors[0]); e++)
+    {
+        BQ27621Sim sim;
+        BQ27621 gauge(sim);
+        sim.setBattery(3712, -250, 2982);
+        if (gauge.init() != OK)
+            failures++;
+
+        BQ27621RetryStats before = gauge.retryStats();
+        uint16_t voltage = 0;
+        sim.injectErrors(2, errors[e]);
+        if (!recovered(gauge, before, gauge.getVoltage(&voltage)) || voltage != 3712)
+            failures++;
+
+        before = gauge.retryStats();
+        uint32_t commands = sim.stats().controlCommands;
+        sim.injectErrors(2, errors[e]);
+        if (!recovered(gauge, before, gauge.setHibernate(true)) || sim.stats().controlCommands != commands + 1)
+            failures++;
+
+        const uint8_t registers[2] = {COMMAND_VOLTAGE, COMMAND_TEMPERATURE};
+        uint16_t words[2] = {0, 0};
+        before = gauge.retryStats();
+        sim.injectErrors(2, errors[e]);
+        if (!recovered(gauge, before, gauge.readWords(registers, words, 2)) || words[0] != 3712 || words[1] != 2982)
+            failures++;
+    }
+
+    // The gauge NACKs its address while it resets: polling for the exit recovers through retries
+    {
+        BQ27621Sim sim;
+        BQ27621SimTiming timing = sim.timing();
+        timing.nackMicros = 3000;
+        sim.setTiming(timing);
+        BQ27621 gauge(sim);
+        uint32_t recoveredBefore = gauge.retryStats().recovered;
+        if (gauge.enterConfig(true) != OK || gauge.exitConfig() != OK || sim.inConfigUpdate())
+            failures++;
+        if (gauge.retryStats().recovered == recoveredBefore)
+            failures++;
+    }
+
+    // A failed exit subcommand is reported, never resent by the retry loop: the cleanup sends SOFT_RESET only after the
+    // gauge stayed in CONFIG UPDATE for the whole exit timeout, then reseals
+    const ConfigExitMode modes[] = {CONFIG_EXIT_SOFT_RESET, CONFIG_EXIT_CFGUPDATE, CONFIG_EXIT_RESIM};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        BQ27621Sim sim;
+        ExitWatch watch(sim);
+        BQ27621 gauge(watch);
+        if (gauge.enterConfig(true) != OK)
+            failures++;
+        BQ27621RetryStats before = gauge.retryStats();
+        watch.failNext = true;
+        if (gauge.exitConfig(modes[m]) != NACK_RECEIVED || watch.exits != 2 ||
+            watch.shortestGap < BQ27621_CONFIG_TIMEOUT_US)
+            failures++;
+        if (gauge.retryStats().retries != before.retries || gauge.retryStats().exhausted != before.exhausted + 1)
+            failures++;
+        if (sim.inConfigUpdate() || (sim.controlStatus() & STATUS_SS) == 0)
+            failures++;
+    }
+
+    // A data memory write through step() whose SOFT_RESET fails: the cleanup sends it again only after the gauge
+    // stayed in CONFIG UPDATE for the whole exit timeout, so the first one cannot have run
+    {
+        BQ27621Sim sim;
+        ExitWatch watch(sim);
+        BQ27621 gauge(watch);
+        const uint8_t data[2] = {0x04, 0xD2};
+        BQ27621Operation op;
+        BQ27621_error_code result;
+        watch.failNext = true;
+        gauge.startWriteExtendedData(&op, ID_STATE, STATE_DESIGN_CAPACITY, data, sizeof(data));
+        while ((result = gauge.step(&op)) == PENDING)
+        {
+            if (op.waitMicros != 0)
+                sim.delayMicros(op.waitMicros);
+        }
+        sim.delayMicros(sim.timing().resetMicros);
+        if (result != NACK_RECEIVED || watch.exits != 2 || watch.shortestGap < BQ27621_CONFIG_TIMEOUT_US)
+            failures++;
+        if (sim.inConfigUpdate() || (sim.controlStatus() & STATUS_SS) == 0)
+            failures++;
+    }
+
+    // Errors that outlast operationBudget end in TIMEOUT_ERROR, through step() and through the blocking path
+    {
+        BQ27621Sim sim;
+        BQ27621 gauge(sim);
+        BQ27621RetryPolicy policy = BQ27621::defaultRetryPolicy();
+        policy.maxAttempts = 50;
+        policy.operationBudget = BUDGET_MICROS;
+        gauge.setRetryPolicy(policy);
+
+        uint16_t voltage;
+        uint32_t timeouts = gauge.retryStats().timeouts;
+        uint32_t start = sim.micros();
+        sim.injectErrors(1000, NACK_RECEIVED);
+        if (gauge.getVoltage(&voltage) != TIMEOUT_ERROR || gauge.retryStats().timeouts != timeouts + 1)
+            failures++;
+        if (sim.micros() - start > BUDGET_MICROS + policy.maxBackoffMicros)
+            failures++;
+
+        start = sim.micros();
+        sim.injectErrors(1000, BUS_BUSY);
+        if (gauge.setHibernate(true) != TIMEOUT_ERROR || gauge.retryStats().timeouts != timeouts + 2)
+            failures++;
+        if (sim.micros() - start > BUDGET_MICROS)
+            failures++;
+        sim.injectErrors(0, OK);
+    }
+
+    printf("{\n  \"failures\": %u\n}\n", failures);
+    return failures == 0 ? 0 : 1;
+}
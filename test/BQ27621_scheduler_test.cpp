@@ -0,0 +1,151 @@
+/**
+ * @file BQ27621_scheduler_test.cpp
+ * @brief BQ27621Scheduler against the simulated gauge: due fields are fetched with whichever of one burst or one
+ * combined transfer moves fewer bytes, FIELD_CAPACITY is read together with StateOfCharge(), odd burst bounds are
+ * rejected, and the bus time measured on the wire never exceeds budgetMicros in any budget window.
+ *
+ */
+
+#include <cstdio>
+#include "BQ27621_scheduler.h"
+#include "BQ27621_sim.h"
+
+#define SECOND 1000000
+#define NEVER (1000 * SECOND)
+#define POLL_MICROS 100000
+#define WINDOWS 20
+
+/**
+ * @brief Every field every interval, or only the fields in due every interval and the rest practically never
+ *
+ */
+static BQ27621SchedulerConfig configFor(uint32_t interval, const bool *due)
+{
+    BQ27621SchedulerConfig config = BQ27621Scheduler::defaultConfig();
+    for (size_t f = 0; f < FIELD_COUNT; f++)
+    {
+        config.activeInterval[f] = (due == NULL || due[f]) ? interval : NEVER;
+        config.relaxInterval[f] = config.activeInterval[f];
+    }
+    config.coalesceMicros = 0;
+    return config;
+}
+
+/**
+ * @brief Bus time of the traffic between two stats snapshots, with the same model as the scheduler's estimate
+ *
+ */
+static uint64_t wireMicros(const BQ27621SimStats &from, const BQ27621SimStats &to, uint32_t clockHz)
+{
+    uint64_t transactions = to.transactions - from.transactions;
+    uint64_t messages = to.messages - from.messages;
+    uint64_t bits = 9ULL * (to.bytes - from.bytes) + 2 * transactions + (messages - transactions);
+    return bits * 1000000ULL / clockHz;
+}
+
+/**
+ * @brief Polls once, a second after begin() and after SOC moved from 50 % to 40 %, with only the fields in due
+ * scheduled. Returns the traffic of that poll.
+ *
+ */
+static BQ27621SimStats pollOnce(const bool *due, BQ27621Snapshot *values, unsigned *failures)
+{
+    BQ27621Sim sim;
+    sim.setStateOfCharge(50);
+    BQ27621 gauge(sim);
+    BQ27621Scheduler scheduler(gauge);
+    scheduler.setConfig(configFor(SECOND, due));
+    uint32_t nextPoll;
+    if (gauge.init() != OK || scheduler.begin(sim.micros()) != OK)
+        (*failures)++;
+
+    sim.setStateOfCharge(40);
+    sim.delayMicros(SECOND);
+    BQ27621SimStats before = sim.stats();
+    if (scheduler.poll(sim.micros(), &nextPoll) != OK)
+        (*failures)++;
+    BQ27621SimStats after = sim.stats();
+    after.transactions -= before.transactions;
+    after.messages -= before.messages;
+    after.bytes -= before.bytes;
+    *values = scheduler.values();
+    return after;
+}
+
+int main(void)
+{
+    unsigned failures = 0;
+    BQ27621Snapshot values;
+
+    // Flags() and Voltage() are neighbours: one 4-byte burst (7 bytes) beats two separate reads (10 bytes)
+    const bool neighbours[FIELD_COUNT] = {true, false, true, false, false, false, false};
+    BQ27621SimStats burst = pollOnce(neighbours, &values, &failures);
+    if (burst.transactions != 1 || burst.messages != 2 || burst.bytes != 7)
+        failures++;
+
+    // Flags() and StateOfCharge() are 22 bytes apart: two separate reads (10 bytes) beat a 24-byte burst (27 bytes)
+    const bool apart[FIELD_COUNT] = {true, false, false, true, false, false, false};
+    BQ27621SimStats words = pollOnce(apart, &values, &failures);
+    if (words.transactions != 1 || words.messages != 4 || words.bytes != 10)
+        failures++;
+
+    // FIELD_CAPACITY due on its own brings StateOfCharge() along, so it is tagged with the SOC it was read at
+    const bool capacity[FIELD_COUNT] = {false, false, false, false, false, false, true};
+    BQ27621SimStats tagged = pollOnce(capacity, &values, &failures);
+    if (tagged.transactions != 1 || tagged.messages != 6 || tagged.bytes != 15 || values.stateOfCharge != 40)
+        failures++;
+
+    // A burst bound on an odd code would decode no register: rejected before touching the bus
+    {
+        BQ27621Sim sim;
+        BQ27621 gauge(sim);
+        BQ27621Snapshot snapshot;
+        uint32_t transactions = sim.stats().transactions;
+        if (gauge.readSnapshot(&snapshot, (Commands)(COMMAND_VOLTAGE + 1), COMMAND_FLAGS) != BUS_ERROR ||
+            gauge.readSnapshot(&snapshot, COMMAND_VOLTAGE, (Commands)(COMMAND_FLAGS + 1)) != BUS_ERROR ||
+            sim.stats().transactions != transactions)
+            failures++;
+    }
+
+    // Tight budget: every field due every poll, room for about four separate reads per window
+    BQ27621Sim sim;
+    BQ27621 gauge(sim);
+    BQ27621Scheduler scheduler(gauge);
+    BQ27621SchedulerConfig config = configFor(POLL_MICROS, NULL);
+    config.budgetPeriod = SECOND;
+    config.budgetMicros = 2000;
+    scheduler.setConfig(config);
+    uint32_t nextPoll;
+    if (gauge.init() != OK || scheduler.begin(sim.micros()) != OK)
+        failures++;
+
+    uint32_t start = sim.micros() + SECOND; // The first reads of begin() are not held to the budget
+    sim.delayMicros(start - sim.micros());
+    uint64_t worstWindow = 0;
+    unsigned idleWindows = 0;
+    for (unsigned w = 0; w < WINDOWS; w++)
+    {
+        BQ27621SimStats before = sim.stats();
+        for (uint32_t t = 0; t < SECOND; t += POLL_MICROS)
+        {
+            uint32_t now = start + w * SECOND + t;
+            sim.delayMicros(now - sim.micros());
+            if (scheduler.poll(now, &nextPoll) != OK)
+                failures++;
+        }
+        uint64_t spent = wireMicros(before, sim.stats(), config.busClockHz);
+        if (spent > worstWindow)
+            worstWindow = spent;
+        if (spent == 0)
+            idleWindows++;
+    }
+    BQ27621SchedulerStats stats = scheduler.stats(sim.micros());
+    if (worstWindow > config.budgetMicros || idleWindows != 0 || stats.deferred == 0)
+        failures++;
+
+    printf("{\n  \"burst_bytes\": %u, \"words_bytes\": %u, \"capacity_bytes\": %u, \"budget_us\": %u, "
+           "\"worst_window_us\": %llu, \"deferred\": %u, \"failures\": %u\n}\n",
+           burst.bytes, words.bytes, tagged.bytes, config.budgetMicros, (unsigned long long)worstWindow, stats.deferred,
+           failures);
+    return failures == 0 ? 0 : 1;
+}
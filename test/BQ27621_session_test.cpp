@@ -0,0 +1,106 @@
+/**
+ * @file BQ27621_session_test.cpp
+ * @brief ConfigSession on the blocking path with one transfer failing at every point of the sequence: the first error
+ * is returned, the gauge ends up out of CONFIG UPDATE and sealed again, and a retried session reaches data memory.
+ *
+ */
+
+#include <cstdio>
+#include "BQ27621.h"
+#include "BQ27621_sim.h"
+
+#define CAPACITY 1234
+
+/**
+ * @brief Passes transfers to the simulated gauge and fails the one numbered failAt before it reaches the gauge
+ *
+ */
+class FailAt : public I2C_device
+{
+private:
+    BQ27621Sim &_sim;
+
+public:
+    uint32_t transfers;
+    uint32_t failAt;
+    BQ27621_error_code error;
+
+    FailAt(BQ27621Sim &sim) : _sim(sim), transfers(0), failAt(UINT32_MAX), error(OK) {}
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override
+    {
+        if (transfers++ == failAt)
+            return error;
+        return _sim.transfer(messages, count);
+    }
+    uint32_t micros(void) override { return _sim.micros(); }
+    void delayMicros(uint32_t us) override { _sim.delayMicros(us); }
+};
+
+/**
+ * @brief Sets Design Capacity in a session and commits it with SOFT_RESET
+ *
+ */
+static BQ27621_error_code setCapacity(BQ27621 &gauge)
+{
+    BQ27621::ConfigSession session(gauge);
+    session.setCapacity(CAPACITY);
+    return session.commit();
+}
+
+int main(void)
+{
+    BQ27621RetryPolicy policy = BQ27621::defaultRetryPolicy();
+    policy.maxAttempts = 1; // The injected error must reach the session
+    policy.operationBudget = 0;
+
+    uint32_t sequence;
+    {
+        BQ27621Sim sim;
+        FailAt bus(sim);
+        BQ27621 gauge(bus);
+        gauge.setRetryPolicy(policy);
+        if (setCapacity(gauge) != OK || sim.dataMemoryWord(ID_STATE, STATE_DESIGN_CAPACITY) != CAPACITY ||
+            (sim.controlStatus() & STATUS_SS) == 0)
+        {
+            fprintf(stderr, "clean session failed\n");
+            return 1;
+        }
+        sequence = bus.transfers;
+    }
+
+    const BQ27621_error_code errors[] = {NACK_RECEIVED, BUS_BUSY};
+    unsigned failures = 0;
+    for (size_t e = 0; e < sizeof(errors) / sizeof(errors[0]); e++)
+    {
+        for (uint32_t failAt = 0; failAt < sequence; failAt++)
+        {
+            BQ27621Sim sim;
+            FailAt bus(sim);
+            BQ27621 gauge(bus);
+            gauge.setRetryPolicy(policy);
+            bus.failAt = failAt;
+            bus.error = errors[e];
+            BQ27621_error_code result = setCapacity(gauge);
+
+            // Let a CONFIG UPDATE entry or exit still under way settle before looking at the mode
+            sim.delayMicros(2 * sim.timing().resetMicros + sim.timing().cfgUpdateMicros);
+            bool stuck = sim.inConfigUpdate();
+            // Only a failure of the final SEALED itself may leave the gauge unsealed, and it is reported
+            bool unsealed = (sim.controlStatus() & STATUS_SS) == 0 && failAt != sequence - 1;
+
+            BQ27621_error_code retry = setCapacity(gauge);
+            bool written = retry == OK && sim.dataMemoryWord(ID_STATE, STATE_DESIGN_CAPACITY) == CAPACITY;
+
+            if (result != errors[e] || stuck || unsealed || !written)
+            {
+                fprintf(stderr, "error %d at transfer %u: result %d, config update %d, unsealed %d, retried session %d\n",
+                        errors[e], failAt, result, stuck, unsealed, written);
+                failures++;
+            }
+        }
+    }
+
+    printf("{\n  \"sequence_transfers\": %u, \"failures\": %u\n}\n", sequence, failures);
+    return failures == 0 ? 0 : 1;
+}
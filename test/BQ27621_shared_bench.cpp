@@ -0,0 +1,165 @@
+/**
+ * @file BQ27621_shared_bench.cpp
+ * @brief Contention on one gauge shared by 1 to 64 reader threads calling getSOC(): bus transactions and caller
+ * latency with reads only serialized and with single-flight coalescing. The simulated bus is paced to wall-clock time
+ * so that a transaction occupies the bus as long as it would on the wire. Prints JSON to stdout, or to the file given
+ * as first argument, and fails if any read returns an error or a wrong value.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "BQ27621_shared.h"
+#include "BQ27621_sim.h"
+
+#define BUS_CLOCK_HZ 400000
+#define TOTAL_CALLS 2048    // Calls per run, split between the reader threads
+#define MIN_THREAD_CALLS 16 // Lower bound of calls per thread
+#define MAX_THREADS 64
+
+/**
+ * @brief Simulated gauge whose transfers block for their modelled bus time, sleeping like a blocking adapter would
+ *
+ */
+class PacedSim : public I2C_device
+{
+private:
+    BQ27621Sim &_sim;
+
+public:
+    PacedSim(BQ27621Sim &sim) : _sim(sim) {}
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override
+    {
+        uint64_t before = _sim.nowNanos();
+        auto start = std::chrono::steady_clock::now();
+        BQ27621_error_code retVal = _sim.transfer(messages, count);
+        auto end = start + std::chrono::nanoseconds(_sim.nowNanos() - before);
+        std::this_thread::sleep_until(end);
+        return retVal;
+    }
+    uint32_t micros(void) override { return _sim.micros(); }
+    void delayMicros(uint32_t us) override { _sim.delayMicros(us); }
+};
+
+struct RunResult
+{
+    unsigned threads;
+    bool coalescing;
+    unsigned calls;
+    unsigned errors;
+    uint32_t transactions;
+    double transactionsPerCall;
+    double p50Micros;
+    double p99Micros;
+    double callsPerSecond;
+};
+
+static double percentile(std::vector<double> &sorted, double quantile)
+{
+    size_t index = (size_t)(quantile * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+static RunResult run(BQ27621Sim &sim, BQ27621Shared &shared, unsigned threads, bool coalescing, uint16_t expected)
+{
+    unsigned perThread = std::max(TOTAL_CALLS / threads, (unsigned)MIN_THREAD_CALLS);
+    std::vector<std::vector<double>> latencies(threads);
+    std::vector<unsigned> errors(threads, 0);
+    std::vector<std::thread> workers;
+
+    shared.setCoalescing(coalescing);
+    sim.resetStats();
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]() {
+            latencies[t].reserve(perThread);
+            for (unsigned i = 0; i < perThread; i++)
+            {
+                uint16_t soc = 0;
+                auto callStart = std::chrono::steady_clock::now();
+                BQ27621_error_code retVal = shared.getSOC(FILTERED, &soc);
+                latencies[t].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - callStart).count());
+                if (retVal != OK || soc != expected)
+                    errors[t]++;
+            }
+        });
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    RunResult result = {threads, coalescing, perThread * threads, 0, sim.stats().transactions, 0, 0, 0, 0};
+    for (unsigned t = 0; t < threads; t++)
+    {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+        result.errors += errors[t];
+    }
+    std::sort(all.begin(), all.end());
+    result.transactionsPerCall = (double)result.transactions / result.calls;
+    result.p50Micros = percentile(all, 0.50);
+    result.p99Micros = percentile(all, 0.99);
+    result.callsPerSecond = result.calls / seconds;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    BQ27621Sim sim(BUS_CLOCK_HZ);
+    PacedSim bus(sim);
+    BQ27621 gauge(bus);
+    if (gauge.init() != OK)
+    {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    sim.setStateOfCharge(73);
+    uint16_t expected;
+    if (gauge.getSOC(FILTERED, &expected) != OK)
+    {
+        fprintf(stderr, "getSOC failed\n");
+        return 1;
+    }
+
+    BQ27621Shared shared(gauge);
+    std::vector<RunResult> results;
+    unsigned failures = 0;
+    for (unsigned threads = 1; threads <= MAX_THREADS; threads *= 2)
+    {
+        for (int coalescing = 0; coalescing < 2; coalescing++)
+        {
+            RunResult result = run(sim, shared, threads, coalescing != 0, expected);
+            failures += result.errors;
+            // A flight can only absorb callers, never add bus traffic
+            if (result.transactions > result.calls)
+                failures++;
+            results.push_back(result);
+        }
+    }
+
+    FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(out, "{\n  \"bus_clock_hz\": %u,\n  \"results\": [\n", BUS_CLOCK_HZ);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const RunResult &r = results[i];
+        fprintf(out,
+                "    {\"threads\": %u, \"mode\": \"%s\", \"calls\": %u, \"errors\": %u, \"transactions\": %u, "
+                "\"transactions_per_call\": %.3f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"calls_per_s\": %.0f}%s\n",
+                r.threads, r.coalescing ? "coalesced" : "serialized", r.calls, r.errors, r.transactions,
+                r.transactionsPerCall, r.p50Micros, r.p99Micros, r.callsPerSecond, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/**
+ * @file BQ27621_shm_bench.cpp
+ * @brief Shared-memory telemetry with several reader processes: the parent publishes readings of four gauges as fast
+ * as it can while forked readers poll every slot and follow the history ring. Every published sample has all its
+ * bytes set to one value, so a torn copy is detected. A publisher that died mid-write must make readers give up
+ * rather than spin. Reports publish and read cost, reads and torn or lost entries as JSON to stdout, or to the file
+ * given as first argument.
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <sys/wait.h>
+#include "BQ27621_shm_publisher.h"
+#include "BQ27621_sim.h"
+
+#define SEGMENT_NAME "/bq27621_shm_bench"
+#define GAUGES 4
+#define HISTORY_SIZE 1024
+#define READERS 4
+#define RUN_MILLIS 500
+
+struct ReaderResult
+{
+    uint64_t latestReads;
+    uint64_t historyReads;
+    uint64_t torn;
+    uint32_t lost;
+    double latestNanos; // Per latest() call
+};
+
+static bool consistent(const BQ27621ShmSample &sample)
+{
+    const uint8_t *bytes = (const uint8_t *)&sample.snapshot;
+    uint8_t expected = (uint8_t)sample.timestampNanos;
+    for (size_t i = 0; i < sizeof(sample.snapshot); i++)
+    {
+        if (bytes[i] != expected)
+            return false;
+    }
+    return true;
+}
+
+static ReaderResult readerProcess(void)
+{
+    ReaderResult result = {0, 0, 0, 0, 0};
+    BQ27621ShmReader reader;
+    if (reader.open(SEGMENT_NAME) != OK)
+    {
+        result.torn = 1; // Counted as a failure
+        return result;
+    }
+
+    uint32_t cursor = reader.historyHead();
+    BQ27621ShmSample sample;
+    double latestNanos = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(RUN_MILLIS);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (uint16_t gauge = 0; gauge < GAUGES; gauge++)
+        {
+            if (reader.latest(gauge, &sample))
+            {
+                result.latestReads++;
+                if (!consistent(sample) || sample.gauge != gauge)
+                    result.torn++;
+            }
+        }
+        latestNanos += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        while (reader.readHistory(&cursor, &sample, &result.lost))
+        {
+            result.historyReads++;
+            if (!consistent(sample))
+                result.torn++;
+        }
+    }
+    result.latestNanos = result.latestReads ? latestNanos / result.latestReads : 0;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    BQ27621ShmPublisher publisher;
+    if (publisher.create(SEGMENT_NAME, GAUGES, HISTORY_SIZE) != OK)
+    {
+        fprintf(stderr, "cannot create %s\n", SEGMENT_NAME);
+        return 1;
+    }
+
+    // Driver path: a real reading must come out unchanged on the reader side
+    unsigned failures = 0;
+    {
+        BQ27621Sim sim;
+        BQ27621 gauge(sim);
+        sim.setBattery(3712, -420, 2990);
+        BQ27621ShmReader reader;
+        BQ27621ShmSample sample;
+        if (gauge.init() != OK || publisher.sample(0, gauge) != OK || reader.open(SEGMENT_NAME) != OK ||
+            !reader.latest(0, &sample) || sample.result != OK || sample.snapshot.voltage != 3712 ||
+            sample.snapshot.effectiveCurrent != -420)
+            failures++;
+    }
+
+    // Readers start on synthetic samples only
+    uint64_t published = 0;
+    BQ27621Snapshot snapshot;
+    for (; published < GAUGES; published++)
+    {
+        memset(&snapshot, (uint8_t)published, sizeof(snapshot));
+        publisher.publish((uint16_t)published, OK, snapshot, published);
+    }
+
+    int pipes[READERS][2];
+    pid_t children[READERS];
+    for (int i = 0; i < READERS; i++)
+    {
+        if (pipe(pipes[i]) != 0)
+            return 1;
+        children[i] = fork();
+        if (children[i] == 0)
+        {
+            ::close(pipes[i][0]);
+            ReaderResult result = readerProcess();
+            ssize_t written = write(pipes[i][1], &result, sizeof(result));
+            _exit(written == (ssize_t)sizeof(result) ? 0 : 1);
+        }
+        ::close(pipes[i][1]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::milliseconds(RUN_MILLIS + 50);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        for (int batch = 0; batch < 256; batch++, published++)
+        {
+            memset(&snapshot, (uint8_t)published, sizeof(snapshot));
+            publisher.publish((uint16_t)(published % GAUGES), OK, snapshot, published);
+        }
+    }
+    double publishNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / published;
+
+    ReaderResult total = {0, 0, 0, 0, 0};
+    for (int i = 0; i < READERS; i++)
+    {
+        ReaderResult result;
+        int status;
+        if (read(pipes[i][0], &result, sizeof(result)) != (ssize_t)sizeof(result) || waitpid(children[i], &status, 0) != children[i] ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            failures++;
+            continue;
+        }
+        ::close(pipes[i][0]);
+        total.latestReads += result.latestReads;
+        total.historyReads += result.historyReads;
+        total.torn += result.torn;
+        total.lost += result.lost;
+        total.latestNanos += result.latestNanos / READERS;
+    }
+
+    // Leave slot 0 and the newest history entry as a publisher that died while writing them would
+    bool deadDetected = false;
+    int fd = shm_open(SEGMENT_NAME, O_RDWR, 0);
+    size_t size = bq27621ShmSize(GAUGES, HISTORY_SIZE);
+    void *map = (fd < 0) ? MAP_FAILED : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        ::close(fd);
+    if (map != MAP_FAILED)
+    {
+        BQ27621ShmHeader *header = (BQ27621ShmHeader *)map;
+        BQ27621ShmSlot *slots = (BQ27621ShmSlot *)((uint8_t *)map + sizeof(BQ27621ShmHeader));
+        BQ27621ShmEntry *entries = (BQ27621ShmEntry *)(slots + GAUGES);
+        uint32_t head = header->historyHead.load();
+        slots[0].sequence.fetch_or(1);
+        entries[(head - 1) & (HISTORY_SIZE - 1)].sequence.store(0);
+
+        BQ27621ShmReader reader;
+        BQ27621ShmSample sample;
+        uint32_t cursor = head - 1;
+        deadDetected = reader.open(SEGMENT_NAME) == OK && !reader.latest(0, &sample) && (reader.sequence(0) & 1) &&
+                       reader.latest(1, &sample) && !reader.readHistory(&cursor, &sample, NULL) && cursor == head - 1;
+        munmap(map, size);
+    }
+    if (!deadDetected)
+        failures++;
+
+    publisher.close();
+    failures += (unsigned)total.torn;
+
+    FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(out,
+            "{\n  \"readers\": %d, \"gauges\": %d, \"history_size\": %d, \"failures\": %u,\n"
+            "  \"published\": %llu, \"publish_ns\": %.1f,\n"
+            "  \"latest_reads\": %llu, \"latest_ns\": %.1f, \"history_reads\": %llu, \"history_lost\": %u, \"torn\": %llu\n}\n",
+            READERS, GAUGES, HISTORY_SIZE, failures, (unsigned long long)published, publishNanos,
+            (unsigned long long)total.latestReads, total.latestNanos, (unsigned long long)total.historyReads, total.lost,
+            (unsigned long long)total.torn);
+    if (out != stdout)
+        fclose(out);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,762 @@
+/**
+ * @file BQ27621_sim.cpp
+ * @author your name (you@domain.com)
+ * @brief Simulated BQ27621 that plugs in behind the driver as its I2C_device
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "BQ27621_sim.h"
+#include <string.h>
+
+BQ27621Sim::BQ27621Sim(uint32_t clockHz) : _nowNanos(0)
+{
+    _timing.clockHz = clockHz;
+    _timing.stretchNanos = 0;
+    _timing.cfgUpdateMicros = 1000000;
+    _timing.resetMicros = 1000000;
+    _timing.nackMicros = 0;
+    _timing.wakeMicros = 20000;
+    _nackUntilNanos = 0;
+    _injectCount = 0;
+    _injectError = OK;
+    resetStats();
+    powerOnReset();
+}
+
+/**
+ * @brief Makes the next count transfers fail with error after their first address byte
+ *
+ * @param count Number of transfers
+ * @param error NACK_RECEIVED, BUS_BUSY, ...
+ */
+void BQ27621Sim::injectErrors(uint32_t count, BQ27621_error_code error)
+{
+    _injectCount = count;
+    _injectError = error;
+}
+
+/**
+ * @brief Clears the bus activity counters
+ *
+ */
+void BQ27621Sim::resetStats(void)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+/**
+ * @brief Power cycles the gauge: data memory back to defaults, SEALED, [ITPOR] set
+ *
+ */
+void BQ27621Sim::powerOnReset(void)
+{
+    memset(_regs, 0, sizeof(_regs));
+    _pointer = 0;
+    _controlStatus = STATUS_SS | STATUS_INITCOMP;
+    _controlResult = 0;
+    _lastSubCommand = 0;
+    _unsealKeyPending = false;
+    _itpor = true;
+    _batDet = true;
+    _cfgUpdate = false;
+    _shutdown = false;
+    _cfgUpdateAtNanos = 0;
+    _normalAtNanos = 0;
+    _awakeAtNanos = 0;
+    _gpoutPulses = 0;
+    _gpoutEdges = 0;
+    _blockControl = false;
+    _blockClass = 0;
+    _blockIndex = 0;
+    memset(_blockBuffer, 0, sizeof(_blockBuffer));
+    loadDefaults();
+
+    _voltage = 3800;
+    _current = 0;
+    _temperature = 2982;
+    _remainingMicroAh = (uint32_t)fullChargeCapacity() * 1000 / 2;
+    _sociReference = stateOfCharge();
+    _lastFlags = flags();
+}
+
+/**
+ * @brief Leaves SHUTDOWN as if the GPOUT/BIN wake-up had been asserted. The gauge restarts like after a power-on
+ * reset: SEALED, data memory back to defaults, [ITPOR] set and [INITCOMP] clear for resetMicros.
+ *
+ */
+void BQ27621Sim::wake(void)
+{
+    if (!_shutdown)
+        return;
+    _shutdown = false;
+    loadDefaults();
+    _itpor = true;
+    _cfgUpdate = false;
+    _controlStatus = STATUS_SS;
+    _awakeAtNanos = 0;
+    _normalAtNanos = _nowNanos + (uint64_t)_timing.resetMicros * 1000 + 1;
+}
+
+void BQ27621Sim::loadDefaults(void)
+{
+    memset(_dataMemory, 0, sizeof(_dataMemory));
+
+    uint8_t *state = _dataMemory[ID_STATE];
+    const uint16_t stateWords[][2] = {
+        {STATE_QMAX_CELL_0, 0x4000},
+        {STATE_DESIGN_CAPACITY, 1000},
+        {STATE_DESIGN_ENERGY, 3800},
+        {STATE_DEFAULT_DESIGN_CAP, 1000},
+        {STATE_TERMINATE_VOLTAGE, 3200},
+        {STATE_TAPER_RATE, 100},
+        {STATE_TAPER_VOLTAGE, 4100},
+        {STATE_SLEEP_CURRENT, 10},
+        {STATE_CHARGE_TERMINATION_VOLTAGE, 4200},
+        {STATE_CHEM_ID, 0x1202},
+    };
+    for (size_t i = 0; i < sizeof(stateWords) / sizeof(stateWords[0]); i++)
+    {
+        state[stateWords[i][0]] = (uint8_t)(stateWords[i][1] >> 8); // Data memory is big-endian
+        state[stateWords[i][0] + 1] = (uint8_t)(stateWords[i][1] & 0xFF);
+    }
+    state[STATE_LOAD_SELECT_MODE] = 0x81;
+    state[STATE_SOCI_DELTA] = 1;
+
+    uint8_t *discharge = _dataMemory[ID_DISCHARGE];
+    discharge[DISCHARGE_SOC1_SET_THRESHOLD] = 10;
+    discharge[DISCHARGE_SOC1_CLEAR_THRESHOLD] = 15;
+    discharge[DISCHARGE_SOCF_SET_THRESHOLD] = 2;
+    discharge[DISCHARGE_SOCF_CLEAR_THRESHOLD] = 5;
+
+    uint8_t *registers = _dataMemory[ID_REGISTERS];
+    registers[REGISTERS_OP_CONFIG] = 0x25;
+    registers[REGISTERS_OP_CONFIG + 1] = 0xF8;
+}
+
+uint16_t BQ27621Sim::dataMemoryWord(uint8_t classId, uint8_t offset) const
+{
+    return (uint16_t)((_dataMemory[classId][offset] << 8) | _dataMemory[classId][offset + 1]);
+}
+
+/**
+ * @brief Sets the measured battery quantities reported by the standard commands
+ *
+ * @param voltage mV
+ * @param current mA, positive while charging
+ * @param temperature 0.1 K
+ */
+void BQ27621Sim::setBattery(uint16_t voltage, int16_t current, uint16_t temperature)
+{
+    _voltage = voltage;
+    _current = current;
+    _temperature = temperature;
+}
+
+/**
+ * @brief Forces the remaining capacity to soc percent of full charge capacity
+ *
+ * @param soc Percent
+ */
+void BQ27621Sim::setStateOfCharge(uint8_t soc)
+{
+    _remainingMicroAh = (uint32_t)fullChargeCapacity() * 10 * soc;
+}
+
+uint16_t BQ27621Sim::fullChargeCapacity(void) const
+{
+    return dataMemoryWord(ID_STATE, STATE_DESIGN_CAPACITY);
+}
+
+uint16_t BQ27621Sim::stateOfCharge(void) const
+{
+    uint16_t fcc = fullChargeCapacity();
+    if (fcc == 0)
+        return 0;
+    uint32_t soc = (_remainingMicroAh / 1000 * 100 + fcc / 2) / fcc;
+    return (soc > 100) ? 100 : (uint16_t)soc;
+}
+
+uint16_t BQ27621Sim::flags(void) const
+{
+    uint16_t flags = 0;
+    uint16_t soc = stateOfCharge();
+    const uint8_t *discharge = _dataMemory[ID_DISCHARGE];
+
+    if (_itpor)
+        flags |= FLAG_ITPOR;
+    if (_cfgUpdate)
+        flags |= FLAG_CFGUPMODE;
+    if (_batDet)
+        flags |= FLAG_BAT_DET;
+    if (soc <= discharge[DISCHARGE_SOC1_SET_THRESHOLD])
+        flags |= FLAG_SOC1;
+    if (soc <= discharge[DISCHARGE_SOCF_SET_THRESHOLD])
+        flags |= FLAG_SOCF;
+    if (soc >= 100)
+        flags |= FLAG_FC;
+    if (_current > 0)
+        flags |= FLAG_CHG;
+    if (_current < 0)
+        flags |= FLAG_DSG;
+    return flags;
+}
+
+/**
+ * @brief Moves simulated time forward, integrating current into remaining capacity and
+ * completing pending mode transitions
+ *
+ * @param nanos Elapsed time
+ */
+void BQ27621Sim::advance(uint64_t nanos)
+{
+    _nowNanos += nanos;
+
+    int64_t deltaMicroAh = (int64_t)_current * (int64_t)nanos / 3600000000LL; // mA * ns -> uAh
+    int64_t remaining = (int64_t)_remainingMicroAh + deltaMicroAh;
+    int64_t full = (int64_t)fullChargeCapacity() * 1000;
+    _remainingMicroAh = (uint32_t)(remaining < 0 ? 0 : (remaining > full ? full : remaining));
+
+    updateGpout();
+
+    if (_cfgUpdateAtNanos != 0 && _nowNanos >= _cfgUpdateAtNanos)
+    {
+        _cfgUpdateAtNanos = 0;
+        _cfgUpdate = true;
+    }
+    if (_awakeAtNanos != 0 && _nowNanos >= _awakeAtNanos)
+    {
+        _awakeAtNanos = 0;
+        _controlStatus &= ~STATUS_SLEEP;
+    }
+    if (_normalAtNanos != 0 && _nowNanos >= _normalAtNanos)
+    {
+        _normalAtNanos = 0;
+        _cfgUpdate = false;
+        _itpor = false;
+        _controlStatus |= STATUS_INITCOMP;
+    }
+}
+
+/**
+ * @brief Raises GPOUT edges: in SOC_INT mode a pulse per SOCI delta step and per [SOC1]/[SOCF] change,
+ * in BAT_LOW mode an edge per [SOC1] change
+ *
+ */
+void BQ27621Sim::updateGpout(void)
+{
+    uint16_t soc = stateOfCharge();
+    uint16_t current = flags();
+    uint16_t changed = current ^ _lastFlags;
+    _lastFlags = current;
+
+    if (dataMemoryWord(ID_REGISTERS, REGISTERS_OP_CONFIG) & OPCONFIG_BATLOWEN)
+    {
+        if (changed & FLAG_SOC1)
+            _gpoutEdges++;
+        return;
+    }
+
+    uint8_t delta = _dataMemory[ID_STATE][STATE_SOCI_DELTA];
+    uint16_t distance = (soc > _sociReference) ? soc - _sociReference : _sociReference - soc;
+    if ((delta != 0 && distance >= delta) || (changed & (FLAG_SOC1 | FLAG_SOCF)))
+    {
+        _sociReference = soc;
+        _gpoutEdges++;
+    }
+}
+
+uint32_t BQ27621Sim::micros(void)
+{
+    return (uint32_t)(_nowNanos / 1000);
+}
+
+void BQ27621Sim::delayMicros(uint32_t us)
+{
+    advance((uint64_t)us * 1000);
+}
+
+void BQ27621Sim::setWord(uint8_t reg, uint16_t value)
+{
+    _regs[reg] = (uint8_t)(value & 0xFF);
+    _regs[reg + 1] = (uint8_t)(value >> 8);
+}
+
+void BQ27621Sim::loadBlock(void)
+{
+    size_t base = (size_t)_blockIndex * BQ27621_SIM_BLOCK_SIZE;
+    if (base + BQ27621_SIM_BLOCK_SIZE > BQ27621_SIM_CLASS_SIZE)
+        memset(_blockBuffer, 0, sizeof(_blockBuffer));
+    else
+        memcpy(_blockBuffer, &_dataMemory[_blockClass][base], sizeof(_blockBuffer));
+}
+
+uint8_t BQ27621Sim::blockChecksum(void) const
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < sizeof(_blockBuffer); i++)
+        sum += _blockBuffer[i];
+    return (uint8_t)(0xFF - sum);
+}
+
+void BQ27621Sim::commitBlock(uint8_t checksum)
+{
+    size_t base = (size_t)_blockIndex * BQ27621_SIM_BLOCK_SIZE;
+    if (checksum != blockChecksum() || !_cfgUpdate || (_controlStatus & STATUS_SS) ||
+        base + BQ27621_SIM_BLOCK_SIZE > BQ27621_SIM_CLASS_SIZE)
+    {
+        _stats.checksumFailures++;
+        return;
+    }
+    memcpy(&_dataMemory[_blockClass][base], _blockBuffer, sizeof(_blockBuffer));
+    _stats.blockCommits++;
+}
+
+void BQ27621Sim::executeSubCommand(uint16_t subCommand)
+{
+    _stats.controlCommands++;
+
+    if (subCommand == BQ27621_UNSEAL_KEY)
+    {
+        if (_unsealKeyPending)
+            _controlStatus &= ~STATUS_SS;
+        _unsealKeyPending = !_unsealKeyPending;
+        return;
+    }
+    _unsealKeyPending = false;
+
+    switch (subCommand)
+    {
+    case CONTROL_STATUS:
+        _controlResult = _controlStatus;
+        break;
+    case DEVICE_TYPE:
+        _controlResult = BQ27621_DEVICE_TYPE;
+        break;
+    case FW_VERSION:
+        _controlResult = 0x0109;
+        break;
+    case PREV_MACWRITE:
+        _controlResult = _lastSubCommand;
+        break;
+    case CHEM_ID:
+        _controlResult = dataMemoryWord(ID_STATE, STATE_CHEM_ID);
+        break;
+    case BAT_INSERT:
+        _batDet = true;
+        break;
+    case BAT_REMOVE:
+        _batDet = false;
+        break;
+    case TOGGLE_POWERMIN:
+        _controlStatus |= STATUS_POWERMIN;
+        break;
+    case SET_HIBERNATE:
+        _controlStatus |= STATUS_SLEEP;
+        _awakeAtNanos = 0;
+        break;
+    case CLEAR_HIBERNATE:
+        if (_controlStatus & STATUS_SLEEP)
+            _awakeAtNanos = _nowNanos + (uint64_t)_timing.wakeMicros * 1000 + 1;
+        break;
+    case SET_CFGUPDATE:
+        if (!(_controlStatus & STATUS_SS) && !_cfgUpdate)
+            _cfgUpdateAtNanos = _nowNanos + (uint64_t)_timing.cfgUpdateMicros * 1000 + 1;
+        break;
+    case SHUTDOWN_ENABLE:
+        if (!(_controlStatus & STATUS_SS))
+            _controlStatus |= STATUS_SHUTDOWNEN;
+        break;
+    case SHUTDOWN:
+        if (_controlStatus & STATUS_SHUTDOWNEN)
+            _shutdown = true;
+        break;
+    case SEALED:
+        _controlStatus |= STATUS_SS;
+        break;
+    case TOGGLE_GPOUT:
+        _gpoutPulses++;
+        _gpoutEdges++;
+        break;
+    case RESET:
+        if (!(_controlStatus & STATUS_SS))
+        {
+            loadDefaults();
+            _itpor = true;
+            _cfgUpdate = false;
+            _controlStatus &= ~STATUS_INITCOMP;
+            _normalAtNanos = _nowNanos + (uint64_t)_timing.resetMicros * 1000 + 1;
+            _nackUntilNanos = _nowNanos + (uint64_t)_timing.nackMicros * 1000;
+        }
+        break;
+    case SOFT_RESET:
+    case EXIT_CFGUPDATE:
+    case EXIT_RESIM:
+        if (_cfgUpdate)
+        {
+            _normalAtNanos = _nowNanos + (uint64_t)_timing.resetMicros * 1000 + 1;
+            _nackUntilNanos = _nowNanos + (uint64_t)_timing.nackMicros * 1000;
+        }
+        break;
+    default:
+        break;
+    }
+    _lastSubCommand = subCommand;
+}
+
+void BQ27621Sim::writeRegister(uint8_t reg, uint8_t value)
+{
+    if (reg >= EXTENDED_BLOCK_DATA && reg < EXTENDED_BLOCK_DATA_CHECKSUM)
+    {
+        if (_blockControl)
+            _blockBuffer[reg - EXTENDED_BLOCK_DATA] = value;
+        return;
+    }
+
+    switch (reg)
+    {
+    case COMMAND_CONTROL:
+        _regs[COMMAND_CONTROL] = value;
+        break;
+    case COMMAND_CONTROL + 1:
+        _regs[COMMAND_CONTROL + 1] = value;
+        executeSubCommand((uint16_t)(_regs[COMMAND_CONTROL] | (value << 8)));
+        break;
+    case EXTENDED_DATA_CLASS:
+        _blockClass = value;
+        _blockIndex = 0;
+        loadBlock();
+        break;
+    case EXTENDED_DATA_BLOCK:
+        _blockIndex = value;
+        loadBlock();
+        break;
+    case EXTENDED_BLOCK_DATA_CHECKSUM:
+        if (_blockControl)
+            commitBlock(value);
+        break;
+    case EXTENDED_BLOCK_DATA_CONTROL:
+        _blockControl = (value == 0x00) && !(_controlStatus & STATUS_SS);
+        break;
+    default: // Read-only standard commands
+        break;
+    }
+}
+
+uint8_t BQ27621Sim::readRegister(uint8_t reg)
+{
+    if (reg >= EXTENDED_BLOCK_DATA && reg < EXTENDED_BLOCK_DATA_CHECKSUM)
+        return _blockControl ? _blockBuffer[reg - EXTENDED_BLOCK_DATA] : 0;
+
+    switch (reg)
+    {
+    case COMMAND_CONTROL:
+        return (uint8_t)(_controlResult & 0xFF);
+    case COMMAND_CONTROL + 1:
+        return (uint8_t)(_controlResult >> 8);
+    case EXTENDED_DATA_CLASS:
+        return _blockClass;
+    case EXTENDED_DATA_BLOCK:
+        return _blockIndex;
+    case EXTENDED_BLOCK_DATA_CHECKSUM:
+        return blockChecksum();
+    case EXTENDED_BLOCK_DATA_CONTROL:
+        return _blockControl ? 0x00 : 0x01;
+    default:
+        break;
+    }
+    if (reg >= sizeof(_regs))
+        return 0;
+
+    // Refresh the word containing reg from the battery model on its low byte
+    if ((reg & 1) == 0)
+    {
+        uint16_t fcc = fullChargeCapacity();
+        uint16_t rm = (uint16_t)(_remainingMicroAh / 1000);
+        switch (reg)
+        {
+        case COMMAND_TEMPERATURE:
+            setWord(reg, _temperature);
+            break;
+        case COMMAND_VOLTAGE:
+            setWord(reg, _voltage);
+            break;
+        case COMMAND_FLAGS:
+            setWord(reg, flags());
+            break;
+        case COMMAND_NOMINAL_AVAILABLE_CAPACITY:
+        case COMMAND_REMAINING_CAPACITY:
+        case COMMAND_REMAINING_CAPACITY_UNFILTERED:
+        case COMMAND_REMAINING_CAPACITY_FILTERED:
+            setWord(reg, rm);
+            break;
+        case COMMAND_FULL_AVAILABLE_CAPACITY:
+        case COMMAND_FULL_CHARGE_CAPACITY:
+        case COMMAND_FULL_CHARGE_CAPACITY_UNFILTERED:
+        case COMMAND_FULL_CHARGE_CAPACITY_FILTERED:
+            setWord(reg, fcc);
+            break;
+        case COMMAND_EFFECTIVE_CURRENT:
+            setWord(reg, (uint16_t)_current);
+            break;
+        case COMMAND_AVERAGE_POWER:
+            setWord(reg, (uint16_t)(int16_t)((int32_t)_current * _voltage / 1000));
+            break;
+        case COMMAND_STATE_OF_CHARGE:
+        case COMMAND_STATE_OF_CHARGE_UNFILTERED:
+            setWord(reg, stateOfCharge());
+            break;
+        case COMMAND_INTERNAL_TEMPERATURE:
+            setWord(reg, _temperature);
+            break;
+        case COMMAND_OPERATION_CONFIGURATION:
+            setWord(reg, dataMemoryWord(ID_REGISTERS, REGISTERS_OP_CONFIG));
+            break;
+        case EXTENDED_DESIGN_CAPACITY:
+            setWord(reg, fcc);
+            break;
+        default:
+            break;
+        }
+    }
+    return _regs[reg];
+}
+
+/**
+ * @brief Executes a combined transfer against the register model and charges the modelled bus time:
+ * start, per message (repeated start,) address byte and data bytes at 9 clocks each, plus the
+ * configured clock stretch, then stop.
+ *
+ * @param messages Pointer to message array
+ * @param count Number of messages
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621Sim::transfer(I2C_message *messages, size_t count)
+{
+    uint64_t bits = 2; // Start and stop
+    uint64_t stretch = 0;
+    BQ27621_error_code retVal = OK;
+
+    _stats.transactions++;
+    for (size_t i = 0; i < count; i++)
+    {
+        I2C_message &message = messages[i];
+        _stats.messages++;
+        _stats.bytes += 1;
+        bits += 9 + ((i > 0) ? 1 : 0);
+
+        if (_injectCount != 0)
+        {
+            _injectCount--;
+            retVal = _injectError;
+            if (retVal == NACK_RECEIVED)
+                _stats.nacks++;
+            break;
+        }
+        if (message.address != BQ27621_I2C_ADDRESS || _shutdown || _nowNanos < _nackUntilNanos)
+        {
+            _stats.nacks++;
+            retVal = NACK_RECEIVED;
+            break;
+        }
+
+        stretch += _timing.stretchNanos;
+        _stats.bytes += message.len;
+        bits += 9ULL * message.len;
+
+        if (message.flags & I2C_MSG_READ)
+        {
+            for (uint16_t j = 0; j < message.len; j++)
+                message.data[j] = readRegister(_pointer++);
+        }
+        else if (message.len > 0)
+        {
+            _pointer = message.data[0];
+            for (uint16_t j = 1; j < message.len; j++)
+                writeRegister(_pointer++, message.data[j]);
+        }
+    }
+
+    uint64_t nanos = bits * 1000000000ULL / _timing.clockHz + stretch;
+    _stats.busNanos += nanos;
+    advance(nanos);
+    return retVal;
+}
+
+/**
+ * @brief Consumes one latched edge, advancing simulated time in 10 ms steps up to timeoutMicros while none is pending
+ *
+ * @param timeoutMicros Maximum simulated wait
+ * @param edge Pointer to bool set to true if an edge occurred
+ * @return BQ27621_error_code
+ */
+BQ27621_error_code BQ27621SimGpout::waitEdge(uint32_t timeoutMicros, bool *edge)
+{
+    uint32_t waited = 0;
+    while (_sim.gpoutEdges() == _seen && waited < timeoutMicros)
+    {
+        uint32_t chunk = (timeoutMicros - waited > 10000) ? 10000 : timeoutMicros - waited;
+        _sim.delayMicros(chunk);
+        waited += chunk;
+    }
+
+    *edge = (_sim.gpoutEdges() != _seen);
+    if (*edge)
+        _seen++;
+    return OK;
+}
+
+BQ27621SimMuxBus::BQ27621SimMuxBus(uint32_t clockHz) : _clockHz(clockHz), _nowNanos(0), _muxCount(0), _gaugeCount(0)
+{
+    resetStats();
+}
+
+void BQ27621SimMuxBus::resetStats(void)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+/**
+ * @brief Adds a mux with all channels off, as after power-up
+ *
+ * @param upstream Path to the segment it sits on
+ * @param address 7-bit address
+ * @return false if the table is full
+ */
+bool BQ27621SimMuxBus::addMux(const BQ27621BusPath &upstream, uint8_t address)
+{
+    if (_muxCount == BQ27621_SIM_MAX_MUXES)
+        return false;
+    Mux &mux = _muxes[_muxCount++];
+    mux.upstream = upstream;
+    mux.address = address;
+    mux.control = 0;
+    return true;
+}
+
+/**
+ * @brief Puts a simulated gauge at the end of path
+ *
+ * @return false if the table is full
+ */
+bool BQ27621SimMuxBus::attach(const BQ27621BusPath &path, BQ27621Sim &sim)
+{
+    if (_gaugeCount == BQ27621_SIM_MAX_MUX_GAUGES)
+        return false;
+    _gauges[_gaugeCount].path = path;
+    _gauges[_gaugeCount].sim = &sim;
+    _gaugeCount++;
+    return true;
+}
+
+/**
+ * @brief Whether the first depth hops of path are all routed
+ *
+ */
+bool BQ27621SimMuxBus::visible(const BQ27621BusPath &path, uint8_t depth) const
+{
+    for (uint8_t hop = 0; hop < depth; hop++)
+    {
+        bool routed = false;
+        for (size_t i = 0; i < _muxCount && !routed; i++)
+        {
+            const Mux &mux = _muxes[i];
+            if (mux.address != path.hop[hop].muxAddress || mux.upstream.depth != hop)
+                continue;
+            bool same = true;
+            for (uint8_t j = 0; j < hop; j++)
+                same = same && mux.upstream.hop[j].muxAddress == path.hop[j].muxAddress && mux.upstream.hop[j].channel == path.hop[j].channel;
+            routed = same && (mux.control & (1u << path.hop[hop].channel)) != 0;
+        }
+        if (!routed)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Control register access: a write of one byte sets the enabled channels, a read returns them
+ *
+ */
+BQ27621_error_code BQ27621SimMuxBus::transferMux(Mux &mux, I2C_message *messages, size_t count)
+{
+    uint64_t bits = 2;
+    for (size_t i = 0; i < count; i++)
+    {
+        bits += 10 + 9ULL * messages[i].len;
+        if (messages[i].len == 0)
+            continue;
+        if (messages[i].flags & I2C_MSG_READ)
+        {
+            for (uint16_t j = 0; j < messages[i].len; j++)
+                messages[i].data[j] = mux.control;
+        }
+        else
+        {
+            mux.control = messages[i].data[messages[i].len - 1];
+            _stats.muxWrites++;
+        }
+    }
+    uint64_t nanos = bits * 1000000000ULL / _clockHz;
+    _stats.busNanos += nanos;
+    _nowNanos += nanos;
+    return OK;
+}
+
+/**
+ * @brief Routes a transfer by the address of its first message to the single visible device with that address
+ *
+ */
+BQ27621_error_code BQ27621SimMuxBus::transfer(I2C_message *messages, size_t count)
+{
+    _stats.transactions++;
+    if (count == 0)
+        return OK;
+    uint8_t address = messages[0].address;
+
+    Mux *mux = NULL;
+    BQ27621Sim *sim = NULL;
+    unsigned answering = 0;
+    for (size_t i = 0; i < _muxCount; i++)
+    {
+        if (_muxes[i].address == address && visible(_muxes[i].upstream, _muxes[i].upstream.depth))
+        {
+            mux = &_muxes[i];
+            answering++;
+        }
+    }
+    for (size_t i = 0; i < _gaugeCount; i++)
+    {
+        if (address == BQ27621_I2C_ADDRESS && visible(_gauges[i].path, _gauges[i].path.depth))
+        {
+            sim = _gauges[i].sim;
+            answering++;
+        }
+    }
+
+    if (answering > 1)
+    {
+        _stats.collisions++;
+        return BUS_ERROR;
+    }
+    if (mux != NULL)
+        return transferMux(*mux, messages, count);
+    if (sim == NULL)
+    {
+        uint64_t nanos = 11ULL * 1000000000ULL / _clockHz; // Start, address byte, stop
+        _stats.busNanos += nanos;
+        _nowNanos += nanos;
+        return NACK_RECEIVED;
+    }
+
+    if (sim->nowNanos() < _nowNanos)
+        sim->delayMicros((uint32_t)((_nowNanos - sim->nowNanos() + 999) / 1000));
+    uint64_t start = sim->nowNanos();
+    BQ27621_error_code retVal = sim->transfer(messages, count);
+    _stats.busNanos += sim->nowNanos() - start;
+    _nowNanos = sim->nowNanos();
+    return retVal;
+}
@@ -0,0 +1,216 @@
+/**
+ * @file BQ27621_sim.h
+ * @author your name (you@domain.com)
+ * @brief Simulated BQ27621 that plugs in behind the driver as its I2C_device
+ * @version 0.1
+ * @date 2024-04-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BQ27621_SIM_H
+#define BQ27621_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../src/BQ27621_i2c.h"
+#include "../src/BQ27621_gpout.h"
+
+#define BQ27621_SIM_CLASS_SIZE 64 // Bytes of data memory modelled per class (two blocks)
+#define BQ27621_SIM_BLOCK_SIZE 32
+
+/**
+ * @brief Bus and device timing of the model. Time only advances through bus traffic and delayMicros(),
+ * so results are deterministic and independent of the host.
+ */
+struct BQ27621SimTiming
+{
+    uint32_t clockHz;         // SCL frequency: 100000, 400000 or 1000000
+    uint32_t stretchNanos;    // Clock-stretch latency added per message (slave processing)
+    uint32_t cfgUpdateMicros; // Delay from SET_CFGUPDATE until [CFGUPMODE] is set
+    uint32_t resetMicros;     // Delay from SOFT_RESET/EXIT_*/RESET until the gauge is back in NORMAL mode
+    uint32_t nackMicros;      // After SOFT_RESET/EXIT_*/RESET the gauge NACKs its address for this long
+    uint32_t wakeMicros;      // Delay from CLEAR_HIBERNATE until [SLEEP] clears
+};
+
+/**
+ * @brief Bus activity counters
+ *
+ */
+struct BQ27621SimStats
+{
+    uint32_t transactions;      // transfer() calls (start ... stop)
+    uint32_t messages;          // Segments including repeated starts
+    uint32_t bytes;             // Address and data bytes on the wire
+    uint32_t nacks;             // Transfers rejected by the device
+    uint32_t controlCommands;   // Control() subcommands executed
+    uint32_t blockCommits;      // Data memory blocks written through a valid checksum
+    uint32_t checksumFailures;  // Checksum writes that did not match the block buffer
+    uint64_t busNanos;          // Modelled time the bus was occupied
+};
+
+class BQ27621Sim : public I2C_device
+{
+private:
+    BQ27621SimTiming _timing;
+    BQ27621SimStats _stats;
+    uint64_t _nowNanos;
+
+    uint8_t _regs[0x40];
+    uint8_t _pointer;
+
+    uint16_t _controlStatus;
+    uint16_t _controlResult;
+    uint16_t _lastSubCommand;
+    bool _unsealKeyPending;
+    bool _itpor;
+    bool _batDet;
+    bool _cfgUpdate;
+    bool _shutdown;
+    uint64_t _cfgUpdateAtNanos; // Pending CONFIG UPDATE entry, 0 if none
+    uint64_t _normalAtNanos;    // Pending return to NORMAL mode, 0 if none
+    uint64_t _nackUntilNanos;   // Address NACKed until then
+    uint64_t _awakeAtNanos;     // Pending exit from SLEEP/HIBERNATE, 0 if none
+    uint32_t _injectCount;      // Transfers still to fail with _injectError
+    BQ27621_error_code _injectError;
+    uint32_t _gpoutPulses;
+    uint32_t _gpoutEdges;   // Active GPOUT edges (SOC_INT pulses or BAT_LOW level changes)
+    uint16_t _sociReference; // StateOfCharge() at the last SOC_INT delta pulse
+    uint16_t _lastFlags;
+
+    uint8_t _dataMemory[256][BQ27621_SIM_CLASS_SIZE];
+    bool _blockControl;
+    uint8_t _blockClass;
+    uint8_t _blockIndex;
+    uint8_t _blockBuffer[BQ27621_SIM_BLOCK_SIZE];
+
+    uint16_t _voltage;
+    int16_t _current;
+    uint16_t _temperature;
+    uint32_t _remainingMicroAh; // Remaining capacity in uAh
+
+    void advance(uint64_t nanos);
+    void loadDefaults(void);
+    void loadBlock(void);
+    void commitBlock(uint8_t checksum);
+    uint8_t blockChecksum(void) const;
+    void executeSubCommand(uint16_t subCommand);
+    void writeRegister(uint8_t reg, uint8_t value);
+    uint8_t readRegister(uint8_t reg);
+    uint16_t flags(void) const;
+    uint16_t fullChargeCapacity(void) const;
+    uint16_t stateOfCharge(void) const;
+    void setWord(uint8_t reg, uint16_t value);
+    void updateGpout(void);
+
+public:
+    BQ27621Sim(uint32_t clockHz = 400000);
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override;
+    uint32_t micros(void) override;
+    void delayMicros(uint32_t us) override;
+
+    void setTiming(const BQ27621SimTiming &timing) { _timing = timing; }
+    const BQ27621SimTiming &timing(void) const { return _timing; }
+    const BQ27621SimStats &stats(void) const { return _stats; }
+    void resetStats(void);
+    uint64_t nowNanos(void) const { return _nowNanos; }
+    void injectErrors(uint32_t count, BQ27621_error_code error);
+
+    void powerOnReset(void);
+    void wake(void);
+    void setBattery(uint16_t voltage, int16_t current, uint16_t temperature);
+    void setStateOfCharge(uint8_t soc);
+    uint32_t gpoutPulses(void) const { return _gpoutPulses; }
+    uint32_t gpoutEdges(void) const { return _gpoutEdges; }
+
+    uint16_t controlStatus(void) const { return _controlStatus; }
+    bool inConfigUpdate(void) const { return _cfgUpdate; }
+    bool isShutdown(void) const { return _shutdown; }
+    uint8_t dataMemory(uint8_t classId, uint8_t offset) const { return _dataMemory[classId][offset]; }
+    uint16_t dataMemoryWord(uint8_t classId, uint8_t offset) const;
+};
+
+#ifndef BQ27621_SIM_MAX_MUXES
+#define BQ27621_SIM_MAX_MUXES 8
+#endif
+
+#ifndef BQ27621_SIM_MAX_MUX_GAUGES
+#define BQ27621_SIM_MAX_MUX_GAUGES 32
+#endif
+
+/**
+ * @brief Bus activity behind simulated muxes
+ *
+ */
+struct BQ27621SimMuxStats
+{
+    uint32_t transactions; // Transfers on the host bus, mux writes included
+    uint32_t muxWrites;    // Control register writes
+    uint32_t collisions;   // Transfers answered by more than one device at once
+    uint64_t busNanos;     // Modelled time the host bus was occupied
+};
+
+/**
+ * @brief Host bus with TCA9548 muxes and simulated gauges hanging off their channels. A device answers only while
+ * every mux on its path has its channel enabled; a transfer reaching two devices of one address fails as a collision.
+ * Each gauge keeps its own clock and is brought up to the bus time before it is addressed.
+ */
+class BQ27621SimMuxBus : public I2C_device
+{
+private:
+    struct Mux
+    {
+        BQ27621BusPath upstream;
+        uint8_t address;
+        uint8_t control;
+    };
+    struct Gauge
+    {
+        BQ27621BusPath path;
+        BQ27621Sim *sim;
+    };
+
+    uint32_t _clockHz;
+    uint64_t _nowNanos;
+    BQ27621SimMuxStats _stats;
+    Mux _muxes[BQ27621_SIM_MAX_MUXES];
+    size_t _muxCount;
+    Gauge _gauges[BQ27621_SIM_MAX_MUX_GAUGES];
+    size_t _gaugeCount;
+
+    bool visible(const BQ27621BusPath &path, uint8_t depth) const;
+    BQ27621_error_code transferMux(Mux &mux, I2C_message *messages, size_t count);
+
+public:
+    BQ27621SimMuxBus(uint32_t clockHz = 400000);
+
+    BQ27621_error_code transfer(I2C_message *messages, size_t count) override;
+    uint32_t micros(void) override { return (uint32_t)(_nowNanos / 1000); }
+    void delayMicros(uint32_t us) override { _nowNanos += (uint64_t)us * 1000; }
+
+    bool addMux(const BQ27621BusPath &upstream, uint8_t address);
+    bool attach(const BQ27621BusPath &path, BQ27621Sim &sim);
+    uint8_t control(size_t mux) const { return _muxes[mux].control; }
+    const BQ27621SimMuxStats &stats(void) const { return _stats; }
+    void resetStats(void);
+};
+
+/**
+ * @brief GPOUT_line wired to a simulated gauge. Waiting advances the simulation clock.
+ *
+ */
+class BQ27621SimGpout : public GPOUT_line
+{
+private:
+    BQ27621Sim &_sim;
+    uint32_t _seen;
+
+public:
+    BQ27621SimGpout(BQ27621Sim &sim) : _sim(sim), _seen(sim.gpoutEdges()) {}
+
+    BQ27621_error_code waitEdge(uint32_t timeoutMicros, bool *edge) override;
+};
+
+#endif /*BQ27621_SIM_H*/
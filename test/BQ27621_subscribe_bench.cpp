@@ -0,0 +1,198 @@
+/**
+ * @file BQ27621_subscribe_bench.cpp
+ * @brief Deadband subscriptions over one simulated hour of discharge with measurement noise: changes delivered and
+ * bus bytes against reading every field on every poll, and heap allocations while polling (must be zero). Also checks
+ * the deadband edge, that unsubscribing drops a register from the read and that a failed poll is counted. Prints
+ * JSON to stdout, or to the file given as first argument.
+ *
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "BQ27621_subscribe.h"
+#include "BQ27621_sim.h"
+
+#define POLLS 3600
+#define POLL_MICROS 1000000
+
+static std::atomic<unsigned> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *pointer = malloc(size ? size : 1);
+    if (pointer == NULL)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+struct ConsumerLog
+{
+    unsigned batches;
+    unsigned changes;
+    unsigned initial;
+    int32_t lastSoc;
+};
+
+static void onChanges(const BQ27621Change *changes, size_t count, void *context)
+{
+    ConsumerLog *log = static_cast<ConsumerLog *>(context);
+    log->batches++;
+    for (size_t i = 0; i < count; i++)
+    {
+        log->changes++;
+        if (changes[i].initial)
+            log->initial++;
+        if (changes[i].topic == TOPIC_SOC)
+            log->lastSoc = changes[i].value;
+    }
+}
+
+/**
+ * @brief A 50 mA current deadband: 49 mA from the reference is suppressed, 50 mA notified. Unsubscribing the current
+ * leaves only Voltage() in the read, and a poll whose read fails still counts as a transaction.
+ *
+ * @return Number of failed checks
+ */
+static unsigned deadbandErrors(void)
+{
+    unsigned errors = 0;
+    BQ27621Sim sim;
+    BQ27621 gauge(sim);
+    BQ27621RetryPolicy policy = BQ27621::defaultRetryPolicy();
+    policy.maxAttempts = 1;
+    gauge.setRetryPolicy(policy);
+    BQ27621Subscriptions subscriptions(gauge);
+    ConsumerLog log = {0, 0, 0, -1};
+    uint8_t consumer, current, voltage;
+    if (!subscriptions.addConsumer(onChanges, &log, &consumer) ||
+        !subscriptions.subscribe(consumer, TOPIC_CURRENT, DEADBAND_ABSOLUTE, 50, &current) ||
+        !subscriptions.subscribe(consumer, TOPIC_VOLTAGE, DEADBAND_ABSOLUTE, 1000, &voltage))
+        return 1;
+
+    sim.setBattery(3800, -1000, 2982);
+    if (subscriptions.poll() != OK || log.changes != 2 || log.initial != 2)
+        errors++;
+
+    uint32_t suppressed = subscriptions.stats().suppressed;
+    sim.setBattery(3800, -1049, 2982);
+    if (subscriptions.poll() != OK || log.changes != 2 || subscriptions.stats().suppressed != suppressed + 2)
+        errors++;
+    sim.setBattery(3800, -1050, 2982);
+    if (subscriptions.poll() != OK || log.changes != 3 || log.batches != 2)
+        errors++;
+
+    subscriptions.unsubscribe(current);
+    uint32_t registersRead = subscriptions.stats().registersRead;
+    sim.resetStats();
+    sim.setBattery(3800, -2000, 2982);
+    if (subscriptions.poll() != OK || log.changes != 3 || subscriptions.stats().registersRead != registersRead + 1)
+        errors++;
+    if (sim.stats().transactions != 1 || sim.stats().messages != 2)
+        errors++;
+
+    uint32_t transactions = subscriptions.stats().transactions;
+    sim.injectErrors(1, NACK_RECEIVED);
+    if (subscriptions.poll() != NACK_RECEIVED || subscriptions.stats().transactions != transactions + 1 ||
+        subscriptions.stats().registersRead != registersRead + 1)
+        errors++;
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    BQ27621Sim sim;
+    BQ27621 gauge(sim);
+    if (gauge.init() != OK)
+    {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    sim.setStateOfCharge(90);
+
+    // A display wants SOC steps and 1 % voltage moves, a protection task wants 50 mA and any [DSG]/[SOCF] toggle
+    BQ27621Subscriptions subscriptions(gauge);
+    ConsumerLog display = {0, 0, 0, -1};
+    ConsumerLog protection = {0, 0, 0, -1};
+    uint8_t displayId, protectionId, handle;
+    bool ok = subscriptions.addConsumer(onChanges, &display, &displayId) &&
+              subscriptions.addConsumer(onChanges, &protection, &protectionId) &&
+              subscriptions.subscribe(displayId, TOPIC_SOC, DEADBAND_ABSOLUTE, 1, &handle) &&
+              subscriptions.subscribe(displayId, TOPIC_VOLTAGE, DEADBAND_PERCENT, 1, &handle) &&
+              subscriptions.subscribe(protectionId, TOPIC_CURRENT, DEADBAND_ABSOLUTE, 50, &handle) &&
+              subscriptions.subscribeFlags(protectionId, FLAG_DSG | FLAG_SOCF, &handle);
+    if (!ok)
+    {
+        fprintf(stderr, "subscribe failed\n");
+        return 1;
+    }
+
+    unsigned errors = 0;
+    uint32_t allReadBytes = 0;
+    sim.resetStats();
+    unsigned before = allocations;
+    srand(1);
+    for (unsigned i = 0; i < POLLS; i++)
+    {
+        uint16_t voltage = (uint16_t)(3900 - i / 4 + rand() % 7 - 3);
+        int16_t current = (int16_t)(-1500 + rand() % 41 - 20);
+        sim.setBattery(voltage, current, 2982);
+        if (subscriptions.poll() != OK)
+            errors++;
+        sim.delayMicros(POLL_MICROS);
+    }
+    unsigned pollAllocations = allocations - before;
+    uint32_t subscribedBytes = sim.stats().bytes;
+
+    // Reference: every topic read on every poll, as a consumer without subscriptions would
+    const uint8_t commands[TOPIC_COUNT] = {COMMAND_VOLTAGE, COMMAND_EFFECTIVE_CURRENT, COMMAND_STATE_OF_CHARGE,
+                                           COMMAND_TEMPERATURE, COMMAND_FLAGS};
+    uint16_t words[TOPIC_COUNT];
+    sim.resetStats();
+    for (unsigned i = 0; i < POLLS; i++)
+    {
+        if (gauge.readWords(commands, words, TOPIC_COUNT) != OK)
+            errors++;
+    }
+    allReadBytes = sim.stats().bytes;
+
+    uint16_t soc;
+    if (gauge.getSOC(FILTERED, &soc) != OK || display.lastSoc != soc)
+        errors++;
+    if (display.initial != 2 || protection.initial != 2)
+        errors++;
+    if (pollAllocations != 0)
+        errors++;
+    errors += deadbandErrors();
+
+    const BQ27621SubscriptionStats &stats = subscriptions.stats();
+    FILE *out = (argc > 1) ? fopen(argv[1], "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(out,
+            "{\n  \"polls\": %u, \"errors\": %u, \"allocations\": %u,\n"
+            "  \"readings\": %u, \"changes\": %u, \"suppressed\": %u, \"notifications\": %u,\n"
+            "  \"display\": {\"batches\": %u, \"changes\": %u}, \"protection\": {\"batches\": %u, \"changes\": %u},\n"
+            "  \"bus_bytes\": %u, \"bus_bytes_all_fields\": %u\n}\n",
+            POLLS, errors, pollAllocations, stats.changes + stats.suppressed, stats.changes, stats.suppressed,
+            stats.notifications, display.batches, display.changes, protection.batches, protection.changes,
+            subscribedBytes, allReadBytes);
+    if (out != stdout)
+        fclose(out);
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file BQ27621_trace_test.cpp
+ * @brief Captures a driver session against the simulated gauge, then replays the trace through the unmodified driver:
+ * every call must return the same result and values, the whole trace must be consumed without a mismatch, and a
+ * transfer of more than 255 messages must survive the round trip.
+ *
+ */
+
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "BQ27621.h"
+#include "BQ27621_sim.h"
+#include "BQ27621_trace.h"
+
+#define LONG_TRANSFER 300 // Messages, more than an 8-bit count holds
+
+struct Session
+{
+    BQ27621_error_code results[7];
+    uint16_t voltage;
+    uint16_t soc;
+    uint16_t words[3];
+    BQ27621Snapshot snapshot;
+    uint8_t longData[LONG_TRANSFER];
+    BQ27621_error_code longResult;
+};
+
+/**
+ * @brief The same calls against any bus: reads, a data memory write through CONFIG UPDATE, and one very long transfer
+ *
+ */
+static void runSession(I2C_device &bus, Session *session)
+{
+    memset(session, 0, sizeof(*session));
+    BQ27621 gauge(bus);
+    const uint8_t commands[3] = {COMMAND_VOLTAGE, COMMAND_FLAGS, COMMAND_STATE_OF_CHARGE};
+    session->results[0] = gauge.init();
+    session->results[1] = gauge.getVoltage(&session->voltage);
+    session->results[2] = gauge.readSnapshot(&session->snapshot);
+    session->results[3] = gauge.setCapacity(1500);
+    session->results[4] = gauge.getSOC(FILTERED, &session->soc);
+    session->results[5] = gauge.readWords(commands, session->words, 3);
+    session->results[6] = gauge.getVoltage(&session->voltage);
+
+    static I2C_message messages[LONG_TRANSFER];
+    static uint8_t command[LONG_TRANSFER];
+    for (size_t i = 0; i < LONG_TRANSFER; i += 2)
+    {
+        command[i] = (uint8_t)(COMMAND_VOLTAGE + (i / 2) % 16 * 2);
+        messages[i] = {BQ27621_I2C_ADDRESS, I2C_MSG_WRITE, 1, &command[i]};
+        messages[i + 1] = {BQ27621_I2C_ADDRESS, I2C_MSG_READ, 1, &session->longData[i + 1]};
+    }
+    session->longResult = bus.transfer(messages, LONG_TRANSFER);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/bq27621_trace_testXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    Session captured;
+    uint32_t records;
+    {
+        BQ27621Sim sim;
+        sim.setBattery(3712, -250, 2982);
+        TraceCaptureI2C capture(sim);
+        if (capture.open(path) != OK)
+        {
+            fprintf(stderr, "cannot create %s\n", path);
+            return 1;
+        }
+        runSession(capture, &captured);
+        records = capture.records();
+        capture.close();
+    }
+
+    Session replayed;
+    TraceReplayI2C replay;
+    unsigned failures = 0;
+    if (replay.open(path) != OK)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        failures++;
+    }
+    else
+    {
+        runSession(replay, &replayed);
+        if (!replay.finished() || replay.mismatches() != 0 || replay.transfers() != records)
+            failures++;
+        if (memcmp(&captured, &replayed, sizeof(captured)) != 0)
+            failures++;
+    }
+    for (size_t i = 0; i < sizeof(captured.results) / sizeof(captured.results[0]); i++)
+    {
+        if (captured.results[i] != OK)
+            failures++;
+    }
+    if (captured.longResult != OK || captured.voltage != 3712)
+        failures++;
+    replay.close();
+    unlink(path);
+
+    printf("{\n  \"records\": %u, \"replayed\": %u, \"mismatches\": %u, \"failures\": %u\n}\n", records,
+           replay.transfers(), replay.mismatches(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -1,4 +1,5 @@
 from os import chdir,system,mkdir,path
+from sys import argv
 from shutil import rmtree
 import platform
 from multiprocessing import cpu_count
@@ -26,7 +27,12 @@ def main():
         raise SystemExit(-1)
     system(cmake_command)
     chdir(build_dir)
-    system(make_command)
+    if system(make_command) != 0:
+        raise SystemExit(-1)
+    if '--bench' in argv:
+        # Per-call API cost as JSON, compare against the previous release's bench.json
+        system(path.join('.', 'bq27621_api_bench') + ' bench.json')
+        print(f'Benchmark results written to {path.abspath("bench.json")}')
 
 if __name__ == '__main__':
     main()
\ No newline at end of file